@@ -0,0 +1,311 @@
+/*
+ * relaxisloader
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * relaxisloader is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * relaxisloader is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "relaxisloader.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "rlxfile.h"
+#include "trace.h"
+
+/*
+ * One query joins the chosen parameter with the Temperature, Area and Thickness metadata of every fitted
+ * spectrum in the file, ordered by project. Each point is converted to x = 1/(k_B*(T-T0)) and y = ln(sigma)
+ * in flat arrays, so the weighted linear regression of every project is a few sums over a contiguous range.
+ * For VTF laws with an unknown T0 the regression is repeated in a golden section search for the T0 with the
+ * smallest residual.
+ */
+
+#define RLX_BOLTZMANN_EV 8.617333262e-5
+#define RLX_CELSIUS_TO_KELVIN 273.15
+#define RLX_T0_SEARCH_ITERATIONS 60
+
+struct rlx_temperature_points
+{
+	size_t length;
+	int *project_id;
+	double *temperature;
+	double *log_sigma;
+	double *weight;
+	double *x;
+};
+
+struct rlx_regression
+{
+	double slope;
+	double slope_error;
+	double intercept;
+	double intercept_error;
+	double ssr;
+};
+
+void rlx_activation_free(struct rlx_activation* activation)
+{
+	free(activation);
+}
+
+void rlx_activation_free_array(struct rlx_activation** activations)
+{
+	struct rlx_activation** first = activations;
+	while(*activations) {
+		rlx_activation_free(*activations);
+		++activations;
+	}
+	free(first);
+}
+
+static void rlx_temperature_points_free(struct rlx_temperature_points *points)
+{
+	free(points->project_id);
+	free(points->temperature);
+	free(points->log_sigma);
+	free(points->weight);
+	free(points->x);
+}
+
+static int rlx_temperature_points_reserve(struct rlx_temperature_points *points, size_t size)
+{
+	int *project_id = realloc(points->project_id, sizeof(*project_id)*size);
+	if(project_id)
+		points->project_id = project_id;
+	double *temperature = realloc(points->temperature, sizeof(*temperature)*size);
+	if(temperature)
+		points->temperature = temperature;
+	double *log_sigma = realloc(points->log_sigma, sizeof(*log_sigma)*size);
+	if(log_sigma)
+		points->log_sigma = log_sigma;
+	double *weight = realloc(points->weight, sizeof(*weight)*size);
+	if(weight)
+		points->weight = weight;
+	double *x = realloc(points->x, sizeof(*x)*size);
+	if(x)
+		points->x = x;
+	return project_id && temperature && log_sigma && weight && x ? RLX_ERR_SUCESS : RLX_ERR_OOM;
+}
+
+static int rlx_load_temperature_points(struct rlxfile *file, const char *parameter, struct rlx_temperature_points *points)
+{
+	const char *req =
+		"SELECT Files.project_id,Parameter.value,Parameter.error,Temperature.value,Area.value,Thickness.value FROM Files "
+		"JOIN Fitparameters AS Parameter ON Parameter.file_id=Files.ID AND Parameter.name=? "
+		"JOIN FileInformation AS Temperature ON Temperature.file_id=Files.ID AND Temperature.name='Temperature' "
+		"LEFT JOIN FileInformation AS Area ON Area.file_id=Files.ID AND Area.name='Area' "
+		"LEFT JOIN FileInformation AS Thickness ON Thickness.file_id=Files.ID AND Thickness.name='Thickness' "
+		"WHERE Files.fitted=1 ORDER BY Files.project_id";
+	sqlite3_stmt *ppStmt;
+	int ret = sqlite3_prepare_v2(file->db, req, -1, &ppStmt, NULL);
+	if(ret != SQLITE_OK)
+		return ret;
+	sqlite3_bind_text(ppStmt, 1, parameter, -1, SQLITE_STATIC);
+
+	size_t size = 0;
+	while((ret = sqlite3_step(ppStmt)) == SQLITE_ROW) {
+		double r = sqlite3_column_double(ppStmt, 1);
+		double rErr = sqlite3_column_double(ppStmt, 2);
+		double temperature = sqlite3_column_double(ppStmt, 3) + RLX_CELSIUS_TO_KELVIN;
+		double area = sqlite3_column_type(ppStmt, 4) == SQLITE_NULL ? 1 : sqlite3_column_double(ppStmt, 4);
+		double thickness = sqlite3_column_type(ppStmt, 5) == SQLITE_NULL ? 1 : sqlite3_column_double(ppStmt, 5);
+		if(!(r > 0) || !(temperature > 0) || !(area > 0) || !(thickness > 0))
+			continue;
+
+		if(points->length == size) {
+			size = size ? size*2 : 256;
+			if(rlx_temperature_points_reserve(points, size) != RLX_ERR_SUCESS) {
+				ret = RLX_ERR_OOM;
+				break;
+			}
+		}
+		size_t i = points->length++;
+		points->project_id[i] = sqlite3_column_int(ppStmt, 0);
+		points->temperature[i] = temperature;
+		points->log_sigma[i] = log(thickness/(r*area));
+		// the relative error of R is the absolute error of ln(sigma)
+		double logErr = rErr/r;
+		points->weight[i] = logErr > 0 && isfinite(logErr) ? 1/(logErr*logErr) : 1;
+	}
+	sqlite3_finalize(ppStmt);
+	return ret == SQLITE_DONE ? SQLITE_OK : ret;
+}
+
+/* Weighted least squares of y over x, the errors are scaled by the residual variance */
+static void rlx_linear_regression(const double *x, const double *y, const double *w, size_t n, struct rlx_regression *out)
+{
+	double sw = 0, sx = 0, sy = 0;
+	for(size_t i = 0; i < n; ++i) {
+		sw += w[i];
+		sx += w[i]*x[i];
+		sy += w[i]*y[i];
+	}
+	const double mx = sx/sw;
+	const double my = sy/sw;
+
+	double sxx = 0, sxy = 0;
+	for(size_t i = 0; i < n; ++i) {
+		sxx += w[i]*(x[i] - mx)*(x[i] - mx);
+		sxy += w[i]*(x[i] - mx)*(y[i] - my);
+	}
+	out->slope = sxy/sxx;
+	out->intercept = my - out->slope*mx;
+
+	double ssr = 0;
+	for(size_t i = 0; i < n; ++i) {
+		double r = y[i] - out->intercept - out->slope*x[i];
+		ssr += w[i]*r*r;
+	}
+	out->ssr = ssr;
+	const double variance = n > 2 ? ssr/(n - 2) : NAN;
+	out->slope_error = sqrt(variance/sxx);
+	out->intercept_error = sqrt(variance*(1/sw + mx*mx/sxx));
+}
+
+static void rlx_regression_at_t0(struct rlx_temperature_points *points, size_t start, size_t n, double t0, struct rlx_regression *out)
+{
+	for(size_t i = start; i < start + n; ++i)
+		points->x[i] = 1/(RLX_BOLTZMANN_EV*(points->temperature[i] - t0));
+	rlx_linear_regression(points->x + start, points->log_sigma + start, points->weight + start, n, out);
+}
+
+static void rlx_fit_temperature_law(struct rlx_temperature_points *points, size_t start, size_t n,
+                                    enum rlx_temperature_law law, double t0, struct rlx_activation *result)
+{
+	double tMin = INFINITY;
+	for(size_t i = start; i < start + n; ++i)
+		tMin = fmin(tMin, points->temperature[i]);
+
+	const size_t required = law == RLX_LAW_VTF && isnan(t0) ? 4 : 3;
+	if(n < required || (law == RLX_LAW_VTF && !isnan(t0) && t0 >= tMin)) {
+		result->error = RLX_ERR_NO_SPECTRA;
+		return;
+	}
+
+	if(law == RLX_LAW_ARRHENIUS) {
+		t0 = 0;
+	}
+	else if(isnan(t0)) {
+		const double ratio = (sqrt(5) - 1)/2;
+		double a = 0;
+		double b = tMin - 1;
+		struct rlx_regression fc, fd;
+		double c = b - ratio*(b - a);
+		double d = a + ratio*(b - a);
+		rlx_regression_at_t0(points, start, n, c, &fc);
+		rlx_regression_at_t0(points, start, n, d, &fd);
+		for(int i = 0; i < RLX_T0_SEARCH_ITERATIONS && b - a > 1e-6; ++i) {
+			if(fc.ssr < fd.ssr) {
+				b = d;
+				d = c;
+				fd = fc;
+				c = b - ratio*(b - a);
+				rlx_regression_at_t0(points, start, n, c, &fc);
+			}
+			else {
+				a = c;
+				c = d;
+				fc = fd;
+				d = a + ratio*(b - a);
+				rlx_regression_at_t0(points, start, n, d, &fd);
+			}
+		}
+		t0 = (a + b)/2;
+	}
+
+	struct rlx_regression regression;
+	rlx_regression_at_t0(points, start, n, t0, &regression);
+	result->t0 = t0;
+	result->activation_energy = -regression.slope;
+	result->activation_energy_error = regression.slope_error;
+	result->log_prefactor = regression.intercept;
+	result->log_prefactor_error = regression.intercept_error;
+}
+
+static struct rlx_activation** rlx_get_activation_energies_untraced(struct rlxfile* file, const char* parameter,
+                                                                    enum rlx_temperature_law law, double t0, size_t* length)
+{
+	if(length)
+		*length = 0;
+
+	struct rlx_temperature_points points = {0};
+	int ret = rlx_load_temperature_points(file, parameter, &points);
+	if(ret != SQLITE_OK) {
+		rlx_temperature_points_free(&points);
+		file->error = ret;
+		return NULL;
+	}
+
+	size_t projects = 0;
+	for(size_t i = 0; i < points.length; ++i) {
+		if(i == 0 || points.project_id[i] != points.project_id[i-1])
+			++projects;
+	}
+
+	struct rlx_activation **results = calloc(projects+1, sizeof(*results));
+	if(!results) {
+		rlx_temperature_points_free(&points);
+		file->error = RLX_ERR_OOM;
+		return NULL;
+	}
+
+	size_t start = 0;
+	for(size_t project = 0; project < projects; ++project) {
+		size_t end = start;
+		while(end < points.length && points.project_id[end] == points.project_id[start])
+			++end;
+
+		struct rlx_activation *result = calloc(1, sizeof(*result));
+		if(!result) {
+			rlx_activation_free_array(results);
+			rlx_temperature_points_free(&points);
+			file->error = RLX_ERR_OOM;
+			return NULL;
+		}
+		result->project_id = points.project_id[start];
+		result->points = end - start;
+		result->activation_energy = NAN;
+		result->activation_energy_error = NAN;
+		result->log_prefactor = NAN;
+		result->log_prefactor_error = NAN;
+		result->t0 = NAN;
+		rlx_fit_temperature_law(&points, start, end - start, law, t0, result);
+		results[project] = result;
+		start = end;
+	}
+
+	rlx_temperature_points_free(&points);
+	if(length)
+		*length = projects;
+	return results;
+}
+
+struct rlx_activation** rlx_get_activation_energies(struct rlxfile* file, const char* parameter,
+                                                    enum rlx_temperature_law law, double t0, size_t* length)
+{
+	uint64_t trace = rlx_trace_begin();
+	struct rlx_activation **results = rlx_get_activation_energies_untraced(file, parameter, law, t0, length);
+	size_t payloadSize = sizeof(t0) + strlen(parameter);
+	unsigned char *payload = trace ? malloc(payloadSize) : NULL;
+	if(payload) {
+		memcpy(payload, &t0, sizeof(t0));
+		memcpy(payload + sizeof(t0), parameter, payloadSize - sizeof(t0));
+	}
+	rlx_trace_end(trace, RLX_CALL_GET_ACTIVATION_ENERGIES, file->trace_handle, -1, law,
+	              results ? RLX_ERR_SUCESS : file->error, payload, payload ? payloadSize : 0);
+	free(payload);
+	return results;
+}
@@ -0,0 +1,367 @@
+/*
+ * relaxisloader
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * relaxisloader is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * relaxisloader is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "relaxisloader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <sqlite3.h>
+
+#include "utils.h"
+#include "rlxfile.h"
+#include "trace.h"
+
+/*
+ * RelaxIS writes the files, so changes can not be captured as they are made, and the sqlite session extension is
+ * not available in common sqlite builds. Instead the state of the file at the last changeset is kept in a state
+ * database next to the source:
+ *
+ * - The per spectrum tables Datapoints, FileInformation and Fitparameters are large, here only the largest rowid is
+ *   kept as a watermark. Rows above it are new, which costs a seek instead of a scan.
+ * - All other tables, most importantly Files and Projects, have one row per spectrum or less. For these a hash of
+ *   every row is kept, so that new, modified and deleted rows are found by comparing hashes.
+ *
+ * Whenever a row of Files is new or modified, all rows of the per spectrum tables of that spectrum are included
+ * and replace those of the mirror. This covers refits, which rewrite Fitparameters, as well as rowids of deleted
+ * spectra being reused by new ones. Rows of the per spectrum tables that change without their Files row
+ * changing are not detected unless they are new, RelaxIS does not do this.
+ *
+ * A changeset is a sqlite database holding the rows to insert or replace in tables of the same name and schema
+ * as the source, the deleted rows in rlx_deleted and the generations it applies to in rlx_changeset.
+ * The mirror records the generation it is at in rlx_replication.
+ */
+
+static const char *spectrum_tables[] = {"FileInformation", "Datapoints", "Fitparameters", NULL};
+
+static void rlx_row_hash(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for(int i = 0; i < argc; ++i) {
+		int type = sqlite3_value_type(argv[i]);
+		const unsigned char *data = NULL;
+		size_t length = 0;
+		int64_t integer;
+		double real;
+		switch(type) {
+			case SQLITE_INTEGER:
+				integer = sqlite3_value_int64(argv[i]);
+				data = (const unsigned char*)&integer;
+				length = sizeof(integer);
+				break;
+			case SQLITE_FLOAT:
+				real = sqlite3_value_double(argv[i]);
+				data = (const unsigned char*)&real;
+				length = sizeof(real);
+				break;
+			case SQLITE_TEXT:
+			case SQLITE_BLOB:
+				data = type == SQLITE_TEXT ? sqlite3_value_text(argv[i]) : sqlite3_value_blob(argv[i]);
+				length = sqlite3_value_bytes(argv[i]);
+				break;
+			default:
+				break;
+		}
+		hash = (hash ^ (type + length)) * 1099511628211ULL;
+		for(size_t j = 0; j < length; ++j)
+			hash = (hash ^ data[j]) * 1099511628211ULL;
+	}
+	sqlite3_result_int64(context, (sqlite3_int64)hash);
+}
+
+static bool rlx_is_spectrum_table(const char *table)
+{
+	for(size_t i = 0; spectrum_tables[i]; ++i) {
+		if(strcmp(table, spectrum_tables[i]) == 0)
+			return true;
+	}
+	return false;
+}
+
+static int rlx_changeset_exec(sqlite3 *db, const char *sql)
+{
+	return sqlite3_exec(db, sql, NULL, NULL, NULL);
+}
+
+static int rlx_changeset_execf(sqlite3 *db, const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	char *sql = sqlite3_vmprintf(fmt, args);
+	va_end(args);
+	if(!sql)
+		return SQLITE_NOMEM;
+	int ret = rlx_changeset_exec(db, sql);
+	sqlite3_free(sql);
+	return ret;
+}
+
+static int rlx_changeset_int(sqlite3 *db, const char *sql, int64_t *value)
+{
+	sqlite3_stmt *ppStmt;
+	int ret = sqlite3_prepare_v2(db, sql, -1, &ppStmt, NULL);
+	if(ret != SQLITE_OK)
+		return ret;
+	ret = sqlite3_step(ppStmt);
+	if(ret == SQLITE_ROW)
+		*value = sqlite3_column_int64(ppStmt, 0);
+	sqlite3_finalize(ppStmt);
+	return ret == SQLITE_ROW || ret == SQLITE_DONE ? SQLITE_OK : ret;
+}
+
+/* Opens path for writing and checks that it is empty */
+static int rlx_changeset_open_empty(const char *path, sqlite3 **db)
+{
+	int ret = sqlite3_open_v2(path, db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_URI, NULL);
+	int64_t pages = 0;
+	if(ret == SQLITE_OK)
+		ret = rlx_changeset_int(*db, "PRAGMA main.page_count", &pages);
+	if(ret == SQLITE_OK && pages > 0)
+		ret = RLX_ERR_EXISTS;
+	if(ret != SQLITE_OK) {
+		sqlite3_close(*db);
+		*db = NULL;
+	}
+	return ret;
+}
+
+/* Comma separated and quoted columns of a table in schema */
+static char *rlx_changeset_columns(sqlite3 *db, const char *schema, const char *table)
+{
+	sqlite3_stmt *ppStmt;
+	char *sql = sqlite3_mprintf("SELECT name FROM pragma_table_info(%Q, %Q) ORDER BY cid", table, schema);
+	int ret = sql ? sqlite3_prepare_v2(db, sql, -1, &ppStmt, NULL) : SQLITE_NOMEM;
+	sqlite3_free(sql);
+	if(ret != SQLITE_OK)
+		return NULL;
+
+	char *columns = sqlite3_mprintf("");
+	while(columns && (ret = sqlite3_step(ppStmt)) == SQLITE_ROW) {
+		char *next = sqlite3_mprintf("%s%s\"%w\"", columns, columns[0] ? "," : "", (const char*)sqlite3_column_text(ppStmt, 0));
+		sqlite3_free(columns);
+		columns = next;
+	}
+	sqlite3_finalize(ppStmt);
+	if(columns && ret != SQLITE_DONE) {
+		sqlite3_free(columns);
+		return NULL;
+	}
+	return columns;
+}
+
+/* Adds the rows of a hashed table that changed since the state to the changeset and brings the state up to date */
+static int rlx_changeset_hashed_table(sqlite3 *db, const char *table)
+{
+	char *columns = rlx_changeset_columns(db, "src", table);
+	if(!columns)
+		return SQLITE_NOMEM;
+
+	int ret = rlx_changeset_execf(db,
+		"DELETE FROM temp.rlx_now;"
+		"INSERT INTO temp.rlx_now SELECT rowid,rlx_row_hash(%s) FROM src.\"%w\";"
+		"INSERT INTO main.\"%w\" SELECT * FROM src.\"%w\" WHERE rowid IN "
+			"(SELECT n.id FROM temp.rlx_now n LEFT JOIN state.rlx_rows s ON s.tbl=%Q AND s.id=n.id "
+			"WHERE s.hash IS NULL OR s.hash!=n.hash);"
+		"INSERT INTO main.rlx_deleted SELECT %Q,id FROM state.rlx_rows WHERE tbl=%Q AND id NOT IN (SELECT id FROM temp.rlx_now);"
+		"DELETE FROM state.rlx_rows WHERE tbl=%Q AND id NOT IN (SELECT id FROM temp.rlx_now);"
+		"INSERT OR REPLACE INTO state.rlx_rows SELECT %Q,n.id,n.hash FROM temp.rlx_now n "
+			"LEFT JOIN state.rlx_rows s ON s.tbl=%Q AND s.id=n.id WHERE s.hash IS NULL OR s.hash!=n.hash",
+		columns, table, table, table, table, table, table, table, table, table);
+	sqlite3_free(columns);
+	return ret;
+}
+
+/* Adds the rows of a per spectrum table above the watermark or of changed spectra and moves the watermark */
+static int rlx_changeset_spectrum_table(sqlite3 *db, const char *table)
+{
+	return rlx_changeset_execf(db,
+		"INSERT INTO main.\"%w\" SELECT * FROM src.\"%w\" WHERE "
+			"rowid>(SELECT IFNULL(MAX(value),0) FROM state.rlx_watermarks WHERE name=%Q) OR "
+			"file_id IN (SELECT ID FROM main.Files);"
+		"INSERT OR REPLACE INTO state.rlx_watermarks SELECT %Q,IFNULL(MAX(rowid),0) FROM src.\"%w\"",
+		table, table, table, table, table);
+}
+
+static int rlx_changeset_tables(sqlite3 *db)
+{
+	int ret = rlx_changeset_exec(db,
+		"CREATE TABLE main.rlx_changeset(name TEXT PRIMARY KEY, value INTEGER);"
+		"CREATE TABLE main.rlx_deleted(tbl TEXT NOT NULL, id INTEGER NOT NULL);"
+		"CREATE TEMP TABLE rlx_now(id INTEGER PRIMARY KEY, hash INTEGER NOT NULL);"
+		"CREATE TABLE IF NOT EXISTS state.rlx_watermarks(name TEXT PRIMARY KEY, value INTEGER);"
+		"CREATE TABLE IF NOT EXISTS state.rlx_rows(tbl TEXT NOT NULL, id INTEGER NOT NULL, hash INTEGER NOT NULL, "
+			"PRIMARY KEY(tbl,id)) WITHOUT ROWID;"
+		"INSERT INTO main.rlx_changeset SELECT 'base',IFNULL(MAX(value),0) FROM state.rlx_watermarks WHERE name='rlx_generation';"
+		"INSERT INTO main.rlx_changeset SELECT 'generation',value+1 FROM main.rlx_changeset WHERE name='base';"
+		"INSERT OR REPLACE INTO state.rlx_watermarks SELECT 'rlx_generation',value FROM main.rlx_changeset WHERE name='generation'");
+	if(ret != SQLITE_OK)
+		return ret;
+
+	sqlite3_stmt *ppStmt;
+	ret = sqlite3_prepare_v2(db, "SELECT name,sql FROM src.sqlite_master WHERE type='table' AND sql NOT NULL "
+	                         "AND name NOT LIKE 'sqlite_%' ORDER BY name!='Files'", -1, &ppStmt, NULL);
+	if(ret != SQLITE_OK)
+		return ret;
+
+	/* Files comes first, as the per spectrum tables depend on which spectra changed */
+	int step = SQLITE_DONE;
+	while(ret == SQLITE_OK && (step = sqlite3_step(ppStmt)) == SQLITE_ROW) {
+		const char *table = (const char*)sqlite3_column_text(ppStmt, 0);
+		ret = rlx_changeset_exec(db, (const char*)sqlite3_column_text(ppStmt, 1));
+		if(ret != SQLITE_OK)
+			break;
+		if(rlx_is_spectrum_table(table))
+			ret = rlx_changeset_spectrum_table(db, table);
+		else
+			ret = rlx_changeset_hashed_table(db, table);
+	}
+	sqlite3_finalize(ppStmt);
+	if(ret == SQLITE_OK && step != SQLITE_DONE)
+		ret = step;
+	if(ret != SQLITE_OK)
+		return ret;
+
+	ret = sqlite3_prepare_v2(db, "SELECT sql FROM src.sqlite_master WHERE type='index' AND sql NOT NULL", -1, &ppStmt, NULL);
+	while(ret == SQLITE_OK && (step = sqlite3_step(ppStmt)) == SQLITE_ROW)
+		ret = rlx_changeset_exec(db, (const char*)sqlite3_column_text(ppStmt, 0));
+	sqlite3_finalize(ppStmt);
+	return ret == SQLITE_OK && step != SQLITE_DONE ? step : ret;
+}
+
+static int rlx_changeset_create_untraced(struct rlxfile* file, const char* state_path, const char* changeset_path)
+{
+	sqlite3 *db;
+	int ret = rlx_changeset_open_empty(changeset_path, &db);
+	if(ret != SQLITE_OK) {
+		file->error = ret;
+		return ret;
+	}
+
+	ret = sqlite3_create_function(db, "rlx_row_hash", -1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL, rlx_row_hash, NULL, NULL);
+	char *uri = rlx_uri_readonly(sqlite3_db_filename(file->db, "main"), file->vfs);
+	if(ret == SQLITE_OK)
+		ret = uri ? rlx_changeset_execf(db, "ATTACH %Q AS src; ATTACH %Q AS state", uri, state_path) : SQLITE_NOMEM;
+	free(uri);
+
+	if(ret == SQLITE_OK)
+		ret = rlx_changeset_exec(db, "BEGIN");
+	if(ret == SQLITE_OK)
+		ret = rlx_changeset_tables(db);
+	if(ret == SQLITE_OK)
+		ret = rlx_changeset_exec(db, "COMMIT");
+	if(ret != SQLITE_OK)
+		rlx_changeset_exec(db, "ROLLBACK");
+	sqlite3_close(db);
+
+	if(ret != SQLITE_OK) {
+		remove(changeset_path);
+		file->error = ret;
+	}
+	return ret;
+}
+
+int rlx_changeset_create(struct rlxfile* file, const char* state_path, const char* changeset_path)
+{
+	uint64_t trace = rlx_trace_begin();
+	int ret = rlx_changeset_create_untraced(file, state_path, changeset_path);
+	rlx_trace_end(trace, RLX_CALL_CHANGESET_CREATE, file->trace_handle, -1, 0, ret, changeset_path, strlen(changeset_path));
+	return ret;
+}
+
+static int rlx_changeset_apply_tables(sqlite3 *db)
+{
+	int64_t generation = 0;
+	int64_t base = -1;
+	int64_t target = -1;
+	int ret = rlx_changeset_exec(db, "CREATE TABLE IF NOT EXISTS main.rlx_replication(name TEXT PRIMARY KEY, value INTEGER)");
+	if(ret == SQLITE_OK)
+		ret = rlx_changeset_int(db, "SELECT value FROM main.rlx_replication WHERE name='generation'", &generation);
+	if(ret == SQLITE_OK)
+		ret = rlx_changeset_int(db, "SELECT value FROM cs.rlx_changeset WHERE name='base'", &base);
+	if(ret == SQLITE_OK)
+		ret = rlx_changeset_int(db, "SELECT value FROM cs.rlx_changeset WHERE name='generation'", &target);
+	/* the changeset was applied before, eg. by a run that failed before removing it */
+	if(ret == SQLITE_OK && base != generation && target == generation)
+		return SQLITE_OK;
+	if(ret == SQLITE_OK && base != generation)
+		return RLX_ERR_CHANGESET;
+
+	/* tables and indexes the mirror lacks, eg. because this is the first changeset */
+	sqlite3_stmt *ppStmt;
+	if(ret == SQLITE_OK)
+		ret = sqlite3_prepare_v2(db, "SELECT sql FROM cs.sqlite_master WHERE sql NOT NULL AND name NOT LIKE 'rlx_%' "
+		                         "AND name NOT IN (SELECT name FROM main.sqlite_master) ORDER BY type='index'", -1, &ppStmt, NULL);
+	if(ret != SQLITE_OK)
+		return ret;
+	int step = SQLITE_DONE;
+	while(ret == SQLITE_OK && (step = sqlite3_step(ppStmt)) == SQLITE_ROW)
+		ret = rlx_changeset_exec(db, (const char*)sqlite3_column_text(ppStmt, 0));
+	sqlite3_finalize(ppStmt);
+	if(ret == SQLITE_OK && step != SQLITE_DONE)
+		ret = step;
+
+	/* spectra that were deleted or changed lose all their rows in the per spectrum tables */
+	for(size_t i = 0; ret == SQLITE_OK && spectrum_tables[i]; ++i) {
+		ret = rlx_changeset_execf(db,
+			"DELETE FROM main.\"%w\" WHERE file_id IN (SELECT id FROM cs.rlx_deleted WHERE tbl='Files') "
+			"OR file_id IN (SELECT ID FROM cs.Files)", spectrum_tables[i]);
+	}
+
+	if(ret == SQLITE_OK)
+		ret = sqlite3_prepare_v2(db, "SELECT name FROM cs.sqlite_master WHERE type='table' AND name NOT LIKE 'rlx_%' "
+		                         "AND name NOT LIKE 'sqlite_%'", -1, &ppStmt, NULL);
+	if(ret != SQLITE_OK)
+		return ret;
+	while(ret == SQLITE_OK && (step = sqlite3_step(ppStmt)) == SQLITE_ROW) {
+		const char *table = (const char*)sqlite3_column_text(ppStmt, 0);
+		ret = rlx_changeset_execf(db,
+			"DELETE FROM main.\"%w\" WHERE rowid IN (SELECT id FROM cs.rlx_deleted WHERE tbl=%Q);"
+			"INSERT OR REPLACE INTO main.\"%w\" SELECT * FROM cs.\"%w\"",
+			table, table, table, table);
+	}
+	sqlite3_finalize(ppStmt);
+	if(ret == SQLITE_OK && step != SQLITE_DONE)
+		ret = step;
+
+	if(ret == SQLITE_OK)
+		ret = rlx_changeset_exec(db, "INSERT OR REPLACE INTO main.rlx_replication "
+		                         "SELECT 'generation',value FROM cs.rlx_changeset WHERE name='generation'");
+	return ret;
+}
+
+int rlx_changeset_apply(const char* mirror_path, const char* changeset_path)
+{
+	sqlite3 *db;
+	int ret = sqlite3_open_v2(mirror_path, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_URI, NULL);
+	char *uri = rlx_uri_readonly(changeset_path, NULL);
+	if(ret == SQLITE_OK)
+		ret = uri ? rlx_changeset_execf(db, "ATTACH %Q AS cs", uri) : SQLITE_NOMEM;
+	free(uri);
+
+	if(ret == SQLITE_OK)
+		ret = rlx_changeset_exec(db, "BEGIN IMMEDIATE");
+	if(ret == SQLITE_OK)
+		ret = rlx_changeset_apply_tables(db);
+	if(ret == SQLITE_OK)
+		ret = rlx_changeset_exec(db, "COMMIT");
+	if(ret != SQLITE_OK)
+		rlx_changeset_exec(db, "ROLLBACK");
+	sqlite3_close(db);
+	return ret;
+}
@@ -0,0 +1,485 @@
+/*
+ * relaxisloader
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * relaxisloader is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * relaxisloader is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "relaxisloader.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#include "circuit.h"
+
+/*
+ * RelaxIS circuit strings consist of elements joined in series by '-',
+ * elements or sub circuits in parentheses directly following each other are in parallel,
+ * ie. "R-(R)(P)-P" is a resistor in series with a resistor parallel to a cpe in series with a cpe.
+ */
+
+struct rlx_circuit_parser
+{
+	const char *str;
+	struct rlx_circuit *circuit;
+	size_t nodes_size;
+	const char *error;
+};
+
+static int rlx_element_param_count(enum rlx_circuit_node_type type)
+{
+	return type == RLX_NODE_CPE ? 2 : 1;
+}
+
+static char rlx_parser_peek(struct rlx_circuit_parser *parser)
+{
+	while(isspace((unsigned char)*parser->str))
+		++parser->str;
+	return *parser->str;
+}
+
+static int rlx_parser_add_node(struct rlx_circuit_parser *parser, enum rlx_circuit_node_type type, int param)
+{
+	struct rlx_circuit *circuit = parser->circuit;
+	if(circuit->node_count == parser->nodes_size) {
+		size_t size = parser->nodes_size ? parser->nodes_size*2 : 8;
+		struct rlx_circuit_node *nodes = realloc(circuit->nodes, sizeof(*nodes)*size);
+		if(!nodes) {
+			parser->error = "Out of memory";
+			return -1;
+		}
+		circuit->nodes = nodes;
+		parser->nodes_size = size;
+	}
+	circuit->nodes[circuit->node_count].type = type;
+	circuit->nodes[circuit->node_count].param = param;
+	circuit->nodes[circuit->node_count].parent = -1;
+	return circuit->node_count++;
+}
+
+static int rlx_parser_add_parent(struct rlx_circuit_parser *parser, enum rlx_circuit_node_type type,
+                                 const int *children, size_t count)
+{
+	if(count == 1)
+		return children[0];
+	int parent = rlx_parser_add_node(parser, type, -1);
+	if(parent < 0)
+		return -1;
+	for(size_t i = 0; i < count; ++i)
+		parser->circuit->nodes[children[i]].parent = parent;
+	return parent;
+}
+
+static int rlx_parse_series(struct rlx_circuit_parser *parser);
+
+static int rlx_parse_element(struct rlx_circuit_parser *parser)
+{
+	enum rlx_circuit_node_type type;
+	switch(rlx_parser_peek(parser)) {
+		case 'R':
+			type = RLX_NODE_RESISTOR;
+			break;
+		case 'C':
+			type = RLX_NODE_CAPACITOR;
+			break;
+		case 'L':
+			type = RLX_NODE_INDUCTOR;
+			break;
+		case 'P':
+			type = RLX_NODE_CPE;
+			break;
+		case 'W':
+			type = RLX_NODE_WARBURG;
+			break;
+		default:
+			parser->error = *parser->str ? "Unsupported circuit element" : "Unexpected end of circuit";
+			return -1;
+	}
+	++parser->str;
+
+	int node = rlx_parser_add_node(parser, type, parser->circuit->param_count);
+	if(node >= 0)
+		parser->circuit->param_count += rlx_element_param_count(type);
+	return node;
+}
+
+static int rlx_parse_term(struct rlx_circuit_parser *parser)
+{
+	if(rlx_parser_peek(parser) != '(')
+		return rlx_parse_element(parser);
+
+	int *children = NULL;
+	size_t count = 0;
+	int ret = -1;
+	while(rlx_parser_peek(parser) == '(') {
+		++parser->str;
+		int child = rlx_parse_series(parser);
+		if(child < 0)
+			goto out;
+		if(rlx_parser_peek(parser) != ')') {
+			parser->error = "Unbalanced parentheses in circuit";
+			goto out;
+		}
+		++parser->str;
+
+		int *newChildren = realloc(children, sizeof(*children)*(count+1));
+		if(!newChildren) {
+			parser->error = "Out of memory";
+			goto out;
+		}
+		children = newChildren;
+		children[count++] = child;
+	}
+	ret = rlx_parser_add_parent(parser, RLX_NODE_PARALLEL, children, count);
+
+out:
+	free(children);
+	return ret;
+}
+
+static int rlx_parse_series(struct rlx_circuit_parser *parser)
+{
+	int *children = NULL;
+	size_t count = 0;
+	int ret = -1;
+	while(true) {
+		int child = rlx_parse_term(parser);
+		if(child < 0)
+			goto out;
+
+		int *newChildren = realloc(children, sizeof(*children)*(count+1));
+		if(!newChildren) {
+			parser->error = "Out of memory";
+			goto out;
+		}
+		children = newChildren;
+		children[count++] = child;
+
+		if(rlx_parser_peek(parser) != '-')
+			break;
+		++parser->str;
+	}
+	ret = rlx_parser_add_parent(parser, RLX_NODE_SERIES, children, count);
+
+out:
+	free(children);
+	return ret;
+}
+
+struct rlx_circuit* rlx_circuit_compile(const char* str, const char** error)
+{
+	struct rlx_circuit *circuit = calloc(1, sizeof(*circuit));
+	if(!circuit) {
+		if(error)
+			*error = "Out of memory";
+		return NULL;
+	}
+
+	struct rlx_circuit_parser parser = {.str = str, .circuit = circuit};
+	int root = rlx_parse_series(&parser);
+	if(root >= 0 && rlx_parser_peek(&parser) != '\0') {
+		parser.error = *parser.str == ')' ? "Unbalanced parentheses in circuit" : "Unexpected character in circuit";
+		root = -1;
+	}
+
+	if(root < 0) {
+		if(error)
+			*error = parser.error;
+		rlx_circuit_free(circuit);
+		return NULL;
+	}
+
+	if(error)
+		*error = NULL;
+	return circuit;
+}
+
+void rlx_circuit_free(struct rlx_circuit* circuit)
+{
+	if(!circuit)
+		return;
+	free(circuit->nodes);
+	free(circuit);
+}
+
+size_t rlx_circuit_get_parameter_count(const struct rlx_circuit* circuit)
+{
+	return circuit->param_count;
+}
+
+size_t rlx_circuit_workspace_size(const struct rlx_circuit* circuit)
+{
+	return circuit->node_count*3;
+}
+
+size_t rlx_circuit_rc_elements(const struct rlx_circuit* circuit, struct rlx_rc_element* elements)
+{
+	const struct rlx_circuit_node *nodes = circuit->nodes;
+	size_t count = 0;
+	for(size_t i = 0; i < circuit->node_count; ++i) {
+		if(nodes[i].type != RLX_NODE_PARALLEL)
+			continue;
+
+		int resistor = -1;
+		int capacitor = -1;
+		size_t children = 0;
+		for(size_t j = 0; j < i; ++j) {
+			if(nodes[j].parent != (int)i)
+				continue;
+			++children;
+			if(nodes[j].type == RLX_NODE_RESISTOR)
+				resistor = j;
+			else if(nodes[j].type == RLX_NODE_CPE || nodes[j].type == RLX_NODE_CAPACITOR)
+				capacitor = j;
+		}
+		if(children != 2 || resistor < 0 || capacitor < 0)
+			continue;
+
+		if(elements) {
+			elements[count].resistance = nodes[resistor].param;
+			elements[count].capacitance = nodes[capacitor].param;
+			elements[count].cpe = nodes[capacitor].type == RLX_NODE_CPE;
+		}
+		++count;
+	}
+	return count;
+}
+
+/*
+ * The impedance is evaluated in a single pass over the nodes in postfix order, every node adds its impedance
+ * (series) or admittance (parallel) to the accumulator of its parent. The jacobian is then obtained in reverse
+ * order by propagating the sensitivity of the total impedance to the impedance of every node down the tree.
+ */
+double complex rlx_circuit_impedance(const struct rlx_circuit* circuit, const double* params, double omega,
+                                     double complex* jacobian, double complex* work)
+{
+	const struct rlx_circuit_node *nodes = circuit->nodes;
+	const size_t count = circuit->node_count;
+	double complex *z = work;
+	double complex *acc = work + count;
+	double complex *sens = work + 2*count;
+
+	for(size_t i = 0; i < count; ++i)
+		acc[i] = 0;
+
+	for(size_t i = 0; i < count; ++i) {
+		const double *p = params + (nodes[i].param >= 0 ? nodes[i].param : 0);
+		switch(nodes[i].type) {
+			case RLX_NODE_RESISTOR:
+				z[i] = p[0];
+				break;
+			case RLX_NODE_CAPACITOR:
+				z[i] = 1.0/(I*omega*p[0]);
+				break;
+			case RLX_NODE_INDUCTOR:
+				z[i] = I*omega*p[0];
+				break;
+			case RLX_NODE_CPE:
+				z[i] = 1.0/(p[0]*pow(omega, p[1])*(cos(M_PI/2*p[1]) + I*sin(M_PI/2*p[1])));
+				break;
+			case RLX_NODE_WARBURG:
+				z[i] = p[0]*(1.0 - I)/sqrt(omega);
+				break;
+			case RLX_NODE_SERIES:
+				z[i] = acc[i];
+				break;
+			case RLX_NODE_PARALLEL:
+				z[i] = 1.0/acc[i];
+				break;
+		}
+
+		int parent = nodes[i].parent;
+		if(parent >= 0)
+			acc[parent] += nodes[parent].type == RLX_NODE_SERIES ? z[i] : 1.0/z[i];
+	}
+
+	if(!jacobian)
+		return z[count-1];
+
+	const double complex logjw = log(omega) + I*M_PI/2;
+	for(size_t i = count; i-- > 0;) {
+		int parent = nodes[i].parent;
+		if(parent < 0)
+			sens[i] = 1;
+		else if(nodes[parent].type == RLX_NODE_SERIES)
+			sens[i] = sens[parent];
+		else if(z[i] == 0)
+			sens[i] = sens[parent]; // a shorted branch, like a resistance at its lower limit of 0, carries all current
+		else
+			sens[i] = sens[parent]*(z[parent]/z[i])*(z[parent]/z[i]);
+
+		if(nodes[i].param < 0)
+			continue;
+
+		const double *p = params + nodes[i].param;
+		double complex *j = jacobian + nodes[i].param;
+		switch(nodes[i].type) {
+			case RLX_NODE_RESISTOR:
+				j[0] = sens[i];
+				break;
+			case RLX_NODE_CAPACITOR:
+				j[0] = -sens[i]*z[i]/p[0];
+				break;
+			case RLX_NODE_INDUCTOR:
+				j[0] = sens[i]*I*omega;
+				break;
+			case RLX_NODE_CPE:
+				j[0] = -sens[i]*z[i]/p[0];
+				j[1] = -sens[i]*z[i]*logjw;
+				break;
+			case RLX_NODE_WARBURG:
+				j[0] = sens[i]*(1.0 - I)/sqrt(omega);
+				break;
+			default:
+				break;
+		}
+	}
+	return z[count-1];
+}
+
+/*
+ * Without a jacobian the nodes are instead visited once per block of frequencies, with real and imaginary parts
+ * in separate arrays. Everything that only depends on the parameters, like the phase of a cpe, is computed once
+ * per node and the loops over the block contain no branches or calls to the complex division of libgcc, so that
+ * the compiler can vectorize them.
+ */
+#define RLX_EVAL_BLOCK 64
+
+struct rlx_eval_block
+{
+	double re[RLX_EVAL_BLOCK];
+	double im[RLX_EVAL_BLOCK];
+};
+
+/*
+ * Reciprocal that, like the impedance of a shorted branch, takes 0 to infinity and infinity back to 0.
+ * The value is scaled by its 1-norm first so that the squared magnitude can neither under- nor overflow.
+ */
+static inline void rlx_eval_reciprocal(double re, double im, double *outRe, double *outIm)
+{
+	double s = fabs(re) + fabs(im);
+	bool zero = s == 0;
+	bool inf = isinf(s);
+	double r = re/s;
+	double i = im/s;
+	double d = (r*r + i*i)*s;
+	*outRe = zero ? INFINITY : inf ? 0 : r/d;
+	*outIm = zero || inf ? 0 : -i/d;
+}
+
+static void rlx_eval_block(const struct rlx_circuit* circuit, const double* params, const double* omega, size_t n,
+                           double* re, double* im, struct rlx_eval_block* z, struct rlx_eval_block* acc)
+{
+	const struct rlx_circuit_node *nodes = circuit->nodes;
+	const size_t count = circuit->node_count;
+
+	for(size_t i = 0; i < count; ++i) {
+		for(size_t k = 0; k < n; ++k) {
+			acc[i].re[k] = 0;
+			acc[i].im[k] = 0;
+		}
+	}
+
+	for(size_t i = 0; i < count; ++i) {
+		const double *p = params + (nodes[i].param >= 0 ? nodes[i].param : 0);
+		double *zr = z[i].re;
+		double *zi = z[i].im;
+		switch(nodes[i].type) {
+			case RLX_NODE_RESISTOR:
+				for(size_t k = 0; k < n; ++k) {
+					zr[k] = p[0];
+					zi[k] = 0;
+				}
+				break;
+			case RLX_NODE_CAPACITOR:
+				for(size_t k = 0; k < n; ++k) {
+					zr[k] = 0;
+					zi[k] = -1.0/(omega[k]*p[0]);
+				}
+				break;
+			case RLX_NODE_INDUCTOR:
+				for(size_t k = 0; k < n; ++k) {
+					zr[k] = 0;
+					zi[k] = omega[k]*p[0];
+				}
+				break;
+			case RLX_NODE_CPE: {
+				double c = cos(M_PI/2*p[1])/p[0];
+				double s = -sin(M_PI/2*p[1])/p[0];
+				for(size_t k = 0; k < n; ++k) {
+					double m = pow(omega[k], -p[1]);
+					zr[k] = m*c;
+					zi[k] = m*s;
+				}
+				break;
+			}
+			case RLX_NODE_WARBURG:
+				for(size_t k = 0; k < n; ++k) {
+					zr[k] = p[0]/sqrt(omega[k]);
+					zi[k] = -zr[k];
+				}
+				break;
+			case RLX_NODE_SERIES:
+				for(size_t k = 0; k < n; ++k) {
+					zr[k] = acc[i].re[k];
+					zi[k] = acc[i].im[k];
+				}
+				break;
+			case RLX_NODE_PARALLEL:
+				for(size_t k = 0; k < n; ++k)
+					rlx_eval_reciprocal(acc[i].re[k], acc[i].im[k], &zr[k], &zi[k]);
+				break;
+		}
+
+		int parent = nodes[i].parent;
+		if(parent < 0)
+			continue;
+		double *ar = acc[parent].re;
+		double *ai = acc[parent].im;
+		if(nodes[parent].type == RLX_NODE_SERIES) {
+			for(size_t k = 0; k < n; ++k) {
+				ar[k] += zr[k];
+				ai[k] += zi[k];
+			}
+		} else {
+			for(size_t k = 0; k < n; ++k) {
+				double yr, yi;
+				rlx_eval_reciprocal(zr[k], zi[k], &yr, &yi);
+				ar[k] += yr;
+				ai[k] += yi;
+			}
+		}
+	}
+
+	memcpy(re, z[count-1].re, sizeof(*re)*n);
+	memcpy(im, z[count-1].im, sizeof(*im)*n);
+}
+
+int rlx_circuit_evaluate(const struct rlx_circuit* circuit, const double* params, const double* omega, size_t count,
+                         double* re, double* im)
+{
+	struct rlx_eval_block *work = malloc(sizeof(*work)*circuit->node_count*2);
+	if(!work)
+		return RLX_ERR_OOM;
+
+	for(size_t i = 0; i < count; i += RLX_EVAL_BLOCK) {
+		size_t n = count - i < RLX_EVAL_BLOCK ? count - i : RLX_EVAL_BLOCK;
+		rlx_eval_block(circuit, params, omega + i, n, re + i, im + i, work, work + circuit->node_count);
+	}
+
+	free(work);
+	return RLX_ERR_SUCESS;
+}
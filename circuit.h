@@ -0,0 +1,69 @@
+/*
+ * relaxisloader
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * relaxisloader is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * relaxisloader is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <complex.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+enum rlx_circuit_node_type
+{
+	RLX_NODE_RESISTOR,
+	RLX_NODE_CAPACITOR,
+	RLX_NODE_INDUCTOR,
+	RLX_NODE_CPE,
+	RLX_NODE_WARBURG,
+	RLX_NODE_SERIES,
+	RLX_NODE_PARALLEL,
+};
+
+struct rlx_circuit_node
+{
+	enum rlx_circuit_node_type type;
+	int param; // index of the first parameter of an element, -1 for series and parallel nodes
+	int parent; // index of the parent node, -1 for the root
+};
+
+/* Nodes are stored in postfix order, children before their parents, the root is the last node */
+struct rlx_circuit
+{
+	struct rlx_circuit_node *nodes;
+	size_t node_count;
+	size_t param_count;
+};
+
+/* amount of double complex values the work argument of rlx_circuit_impedance must hold */
+size_t rlx_circuit_workspace_size(const struct rlx_circuit* circuit);
+
+/*
+ * Evaluates the impedance of the circuit at omega, if jacobian is not NULL the derivatives of the
+ * impedance with respect to every parameter are stored there.
+ */
+double complex rlx_circuit_impedance(const struct rlx_circuit* circuit, const double* params, double omega,
+                                     double complex* jacobian, double complex* work);
+
+/* A resistor in parallel to a cpe or capacitor, ie. "(R)(P)", described by the indices of their first parameters */
+struct rlx_rc_element
+{
+	int resistance;
+	int capacitance;
+	bool cpe;
+};
+
+/* Finds all rc elements in order of appearance, elements may be NULL to only count them */
+size_t rlx_circuit_rc_elements(const struct rlx_circuit* circuit, struct rlx_rc_element* elements);
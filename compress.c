@@ -0,0 +1,365 @@
+/*
+ * relaxisloader
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * relaxisloader is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * relaxisloader is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "relaxisloader.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+/*
+ * Compressed spectra are split into blocks of RLX_CBLOCK_SIZE datapoints that can be decoded
+ * independently of each other. Every block starts with a small header:
+ *
+ * u8 column[3], u8 shift[3], 2 bytes padding, u64 omega0, u64 re0, u64 im0
+ *
+ * followed by the residuals of the remaining datapoints of the block, column by column (omega, re, im).
+ * The low nibble of column gives the byte width every residual of the column is stored little endian in,
+ * the high nibble the encoding used. shift gives the amount of trailing zero bytes removed from every residual.
+ *
+ * Two encodings are available and the smaller one is chosen per block and column:
+ * RLX_CENC_XOR stores the xor of the bit pattern of a value with the previous value (Gorilla style).
+ * RLX_CENC_DELTA_DELTA stores the zigzag encoded second difference of the IEEE 754 bit patterns. As the
+ * bit pattern of a double is approximately linear in log2 of its value, this is a cheap, lossless,
+ * delta-of-log encoding that is very effective on the logarithmic sweeps RelaxIS stores.
+ */
+
+#define RLX_CBLOCK_SIZE 256
+#define RLX_CBLOCK_HEADER_SIZE 32
+#define RLX_CPADDING 8
+
+enum {
+	RLX_CENC_XOR = 0,
+	RLX_CENC_DELTA_DELTA = 1,
+};
+
+/* Decoding works on the bit patterns of the callers double buffers in place */
+typedef uint64_t __attribute__((may_alias)) rlx_bits_t;
+
+struct rlx_compressed_spectra
+{
+	int id;
+	size_t length;
+	size_t block_count;
+	uint32_t *block_offsets;
+	uint8_t *data;
+	size_t data_size;
+};
+
+static inline uint64_t double_to_bits(double value)
+{
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+static inline uint64_t zigzag_encode(int64_t value)
+{
+	return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t zigzag_decode(uint64_t value)
+{
+	return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static inline uint64_t load_le64(const uint8_t *ptr)
+{
+	uint64_t value;
+	memcpy(&value, ptr, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	value = __builtin_bswap64(value);
+#endif
+	return value;
+}
+
+static inline void store_le64(uint8_t *ptr, uint64_t value)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	value = __builtin_bswap64(value);
+#endif
+	memcpy(ptr, &value, sizeof(value));
+}
+
+static void residual_width(const uint64_t *residuals, size_t count, unsigned int *width, unsigned int *shift)
+{
+	uint64_t any = 0;
+	for(size_t i = 0; i < count; ++i)
+		any |= residuals[i];
+
+	if(any == 0) {
+		*width = 0;
+		*shift = 0;
+		return;
+	}
+
+	*shift = __builtin_ctzll(any)/8;
+	*width = (64 - __builtin_clzll(any) + 7)/8 - *shift;
+}
+
+static uint8_t* pack_residuals(uint8_t *out, const uint64_t *residuals, size_t count, unsigned int width, unsigned int shift)
+{
+	for(size_t i = 0; i < count; ++i) {
+		uint64_t value = residuals[i] >> shift*8;
+		for(unsigned int j = 0; j < width; ++j) {
+			*out++ = value & 0xff;
+			value >>= 8;
+		}
+	}
+	return out;
+}
+
+/* Relies on RLX_CPADDING bytes being readable past the end of the data buffer */
+static void unpack_residuals(const uint8_t *in, rlx_bits_t *residuals, size_t count, unsigned int width, unsigned int shift)
+{
+	if(width == 0) {
+		memset(residuals, 0, count*sizeof(*residuals));
+	}
+	else if(width == 8) {
+		for(size_t i = 0; i < count; ++i)
+			residuals[i] = load_le64(in + i*8);
+	}
+	else {
+		const uint64_t mask = (UINT64_C(1) << width*8) - 1;
+		for(size_t i = 0; i < count; ++i)
+			residuals[i] = (load_le64(in + i*width) & mask) << shift*8;
+	}
+}
+
+static void prefix_xor(rlx_bits_t *values, size_t count, uint64_t carry)
+{
+	size_t i = 0;
+#ifdef __AVX2__
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i carryv = _mm256_set1_epi64x(carry);
+	for(; i + 4 <= count; i += 4) {
+		__m256i x = _mm256_loadu_si256((const __m256i*)(values + i));
+		__m256i shifted = _mm256_blend_epi32(_mm256_permute4x64_epi64(x, _MM_SHUFFLE(2, 1, 0, 0)), zero, 0x03);
+		x = _mm256_xor_si256(x, shifted);
+		shifted = _mm256_blend_epi32(_mm256_permute4x64_epi64(x, _MM_SHUFFLE(1, 0, 0, 0)), zero, 0x0F);
+		x = _mm256_xor_si256(x, shifted);
+		x = _mm256_xor_si256(x, carryv);
+		_mm256_storeu_si256((__m256i*)(values + i), x);
+		carryv = _mm256_permute4x64_epi64(x, _MM_SHUFFLE(3, 3, 3, 3));
+	}
+	if(i > 0)
+		carry = values[i-1];
+#endif
+	for(; i < count; ++i) {
+		carry ^= values[i];
+		values[i] = carry;
+	}
+}
+
+static void prefix_delta_delta(rlx_bits_t *values, size_t count, uint64_t first)
+{
+	uint64_t value = first;
+	uint64_t delta = 0;
+	for(size_t i = 0; i < count; ++i) {
+		delta += (uint64_t)zigzag_decode(values[i]);
+		value += delta;
+		values[i] = value;
+	}
+}
+
+static uint8_t* encode_column(uint8_t *out, uint8_t *header, const uint64_t *bits, size_t count, uint64_t *scratch)
+{
+	uint64_t *xor_residuals = scratch;
+	uint64_t *dd_residuals = scratch + RLX_CBLOCK_SIZE;
+
+	uint64_t delta = 0;
+	for(size_t i = 1; i < count; ++i) {
+		uint64_t current_delta = bits[i] - bits[i-1];
+		dd_residuals[i-1] = zigzag_encode((int64_t)(current_delta - delta));
+		delta = current_delta;
+		xor_residuals[i-1] = bits[i] ^ bits[i-1];
+	}
+
+	unsigned int xor_width, xor_shift, dd_width, dd_shift;
+	residual_width(xor_residuals, count-1, &xor_width, &xor_shift);
+	residual_width(dd_residuals, count-1, &dd_width, &dd_shift);
+
+	if(dd_width < xor_width) {
+		header[0] = dd_width | RLX_CENC_DELTA_DELTA << 4;
+		header[3] = dd_shift;
+		return pack_residuals(out, dd_residuals, count-1, dd_width, dd_shift);
+	}
+	header[0] = xor_width | RLX_CENC_XOR << 4;
+	header[3] = xor_shift;
+	return pack_residuals(out, xor_residuals, count-1, xor_width, xor_shift);
+}
+
+static uint8_t* encode_block(uint8_t *out, const struct rlx_datapoint *datapoints, size_t count, uint64_t *scratch)
+{
+	uint64_t *bits = scratch + 2*RLX_CBLOCK_SIZE;
+	uint8_t *header = out;
+	memset(header, 0, RLX_CBLOCK_HEADER_SIZE);
+	store_le64(header + 8, double_to_bits(datapoints[0].omega));
+	store_le64(header + 16, double_to_bits(datapoints[0].re));
+	store_le64(header + 24, double_to_bits(datapoints[0].im));
+	out += RLX_CBLOCK_HEADER_SIZE;
+
+	for(size_t i = 0; i < count; ++i)
+		bits[i] = double_to_bits(datapoints[i].omega);
+	out = encode_column(out, header, bits, count, scratch);
+	for(size_t i = 0; i < count; ++i)
+		bits[i] = double_to_bits(datapoints[i].re);
+	out = encode_column(out, header + 1, bits, count, scratch);
+	for(size_t i = 0; i < count; ++i)
+		bits[i] = double_to_bits(datapoints[i].im);
+	out = encode_column(out, header + 2, bits, count, scratch);
+	return out;
+}
+
+static const uint8_t* decode_column(const uint8_t *in, const uint8_t *header, uint64_t first, double *out, size_t count)
+{
+	const unsigned int width = header[0] & 0x0f;
+	const unsigned int encoding = header[0] >> 4;
+	if(out) {
+		rlx_bits_t *bits = (rlx_bits_t*)out;
+		bits[0] = first;
+		unpack_residuals(in, bits + 1, count - 1, width, header[3]);
+		if(encoding == RLX_CENC_DELTA_DELTA)
+			prefix_delta_delta(bits + 1, count - 1, first);
+		else
+			prefix_xor(bits + 1, count - 1, first);
+	}
+	return in + width*(count-1);
+}
+
+static void decode_block(const uint8_t *in, size_t count, double *re, double *im, double *omega)
+{
+	const uint8_t *data = in + RLX_CBLOCK_HEADER_SIZE;
+	data = decode_column(data, in, load_le64(in + 8), omega, count);
+	data = decode_column(data, in + 1, load_le64(in + 16), re, count);
+	decode_column(data, in + 2, load_le64(in + 24), im, count);
+}
+
+struct rlx_compressed_spectra* rlx_spectra_compress(const struct rlx_spectra* spectra)
+{
+	if(!spectra)
+		return NULL;
+
+	struct rlx_compressed_spectra *out = calloc(1, sizeof(*out));
+	if(!out)
+		return NULL;
+
+	out->id = spectra->id;
+	out->length = spectra->length;
+	out->block_count = (spectra->length + RLX_CBLOCK_SIZE - 1)/RLX_CBLOCK_SIZE;
+
+	// worst case size, shrunk after encoding
+	size_t max_size = out->block_count*RLX_CBLOCK_HEADER_SIZE + spectra->length*3*sizeof(uint64_t) + RLX_CPADDING;
+	out->data = malloc(max_size);
+	out->block_offsets = malloc(sizeof(*out->block_offsets)*(out->block_count+1));
+	uint64_t *scratch = malloc(sizeof(*scratch)*RLX_CBLOCK_SIZE*3);
+	if(!out->data || !out->block_offsets || !scratch || max_size > UINT32_MAX) {
+		free(scratch);
+		rlx_compressed_spectra_free(out);
+		return NULL;
+	}
+
+	uint8_t *ptr = out->data;
+	for(size_t i = 0; i < out->block_count; ++i) {
+		size_t start = i*RLX_CBLOCK_SIZE;
+		size_t count = spectra->length - start < RLX_CBLOCK_SIZE ? spectra->length - start : RLX_CBLOCK_SIZE;
+		out->block_offsets[i] = ptr - out->data;
+		ptr = encode_block(ptr, spectra->datapoints + start, count, scratch);
+	}
+	out->block_offsets[out->block_count] = ptr - out->data;
+	free(scratch);
+
+	out->data_size = ptr - out->data;
+	memset(ptr, 0, RLX_CPADDING);
+	uint8_t *shrunk = realloc(out->data, out->data_size + RLX_CPADDING);
+	if(shrunk)
+		out->data = shrunk;
+
+	return out;
+}
+
+void rlx_compressed_spectra_free(struct rlx_compressed_spectra* cspectra)
+{
+	if(!cspectra)
+		return;
+	free(cspectra->block_offsets);
+	free(cspectra->data);
+	free(cspectra);
+}
+
+int rlx_compressed_spectra_get_id(const struct rlx_compressed_spectra* cspectra)
+{
+	return cspectra->id;
+}
+
+size_t rlx_compressed_spectra_get_length(const struct rlx_compressed_spectra* cspectra)
+{
+	return cspectra->length;
+}
+
+size_t rlx_compressed_spectra_get_size(const struct rlx_compressed_spectra* cspectra)
+{
+	return sizeof(*cspectra) + cspectra->data_size + RLX_CPADDING +
+		sizeof(*cspectra->block_offsets)*(cspectra->block_count+1);
+}
+
+double rlx_compressed_spectra_get_ratio(const struct rlx_compressed_spectra* cspectra)
+{
+	size_t uncompressed = sizeof(struct rlx_datapoint)*cspectra->length;
+	return (double)uncompressed/rlx_compressed_spectra_get_size(cspectra);
+}
+
+int rlx_compressed_spectra_decompress(const struct rlx_compressed_spectra* cspectra, size_t start, size_t count,
+                                      double *re, double *im, double *omega)
+{
+	if(start + count > cspectra->length || start + count < start)
+		return RLX_ERR_NO_ENT;
+
+	double tmp[3][RLX_CBLOCK_SIZE];
+	size_t block = start/RLX_CBLOCK_SIZE;
+	size_t written = 0;
+	while(written < count) {
+		size_t block_start = block*RLX_CBLOCK_SIZE;
+		size_t block_length = cspectra->length - block_start < RLX_CBLOCK_SIZE ? cspectra->length - block_start : RLX_CBLOCK_SIZE;
+		size_t skip = start + written - block_start;
+		size_t take = block_length - skip < count - written ? block_length - skip : count - written;
+		const uint8_t *data = cspectra->data + cspectra->block_offsets[block];
+
+		if(skip == 0 && take == block_length) {
+			decode_block(data, block_length, re ? re + written : NULL, im ? im + written : NULL, omega ? omega + written : NULL);
+		}
+		else {
+			decode_block(data, block_length, re ? tmp[0] : NULL, im ? tmp[1] : NULL, omega ? tmp[2] : NULL);
+			if(re)
+				memcpy(re + written, tmp[0] + skip, take*sizeof(double));
+			if(im)
+				memcpy(im + written, tmp[1] + skip, take*sizeof(double));
+			if(omega)
+				memcpy(omega + written, tmp[2] + skip, take*sizeof(double));
+		}
+
+		written += take;
+		++block;
+	}
+
+	return RLX_ERR_SUCESS;
+}
@@ -0,0 +1,540 @@
+/*
+ * relaxisloader
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * relaxisloader is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * relaxisloader is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "relaxisloader.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+#include "utils.h"
+#include "rlxfile.h"
+#include "trace.h"
+#include "perf.h"
+
+/*
+ * A directory is immutable once built. The file holds one reference to the current directory,
+ * every rlx_directory_acquire adds another one. Readers announce themselves in directory_readers
+ * while they load the pointer and take their reference, rlx_directory_refresh swaps in a new
+ * directory and then waits for this grace period to pass before dropping the files reference
+ * to the old one. Thus readers never block and lookups never lock.
+ *
+ * Directories are built on a private read only connection, so that the transaction that gives the build a
+ * consistent snapshot never interferes with the calls made on the connection of the file at the same time.
+ */
+
+struct rlx_directory
+{
+	atomic_int refcount;
+
+	struct rlx_project *projects;
+	size_t project_count;
+	size_t *project_start;
+	size_t *project_length;
+
+	size_t length;
+	int *id;
+	int *project_id;
+	bool *fitted;
+	double *freq_lower_limit;
+	double *freq_upper_limit;
+	time_t *date_added;
+	time_t *date_fitted;
+	const char **circuit;
+	size_t *by_id;
+
+	struct rlx_strpool *strings;
+};
+
+static void rlx_directory_free(struct rlx_directory* dir)
+{
+	free(dir->projects);
+	free(dir->project_start);
+	free(dir->project_length);
+	free(dir->id);
+	free(dir->project_id);
+	free(dir->fitted);
+	free(dir->freq_lower_limit);
+	free(dir->freq_upper_limit);
+	free(dir->date_added);
+	free(dir->date_fitted);
+	free(dir->circuit);
+	free(dir->by_id);
+	rlx_strpool_free(dir->strings);
+	free(dir);
+}
+
+static int rlx_query_int64(sqlite3 *db, const char *req, int64_t *value)
+{
+	sqlite3_stmt *ppStmt;
+	int ret = sqlite3_prepare_v2(db, req, -1, &ppStmt, NULL);
+	if(ret != SQLITE_OK)
+		return ret;
+	ret = sqlite3_step(ppStmt);
+	if(ret == SQLITE_ROW)
+		*value = sqlite3_column_int64(ppStmt, 0);
+	sqlite3_finalize(ppStmt);
+	return ret == SQLITE_ROW ? SQLITE_OK : ret;
+}
+
+static time_t rlx_column_time(sqlite3_stmt *ppStmt, int col)
+{
+	const char *str = (const char*)sqlite3_column_text(ppStmt, col);
+	return str ? rlx_str_to_time(str) : 0;
+}
+
+struct rlx_id_row
+{
+	int id;
+	size_t row;
+};
+
+static int rlx_id_row_cmp(const void *a, const void *b)
+{
+	int ida = ((const struct rlx_id_row*)a)->id;
+	int idb = ((const struct rlx_id_row*)b)->id;
+	return (ida > idb) - (ida < idb);
+}
+
+static int rlx_directory_load_projects(struct rlx_directory* dir, sqlite3 *db)
+{
+	sqlite3_stmt *ppStmt;
+	int ret = sqlite3_prepare_v2(db, "SELECT ID,name,date FROM Projects ORDER BY ID", -1, &ppStmt, NULL);
+	if(ret != SQLITE_OK)
+		return ret;
+
+	size_t i = 0;
+	while((ret = sqlite3_step(ppStmt)) == SQLITE_ROW && i < dir->project_count) {
+		const char *name = (const char*)sqlite3_column_text(ppStmt, 1);
+		dir->projects[i].id = sqlite3_column_int(ppStmt, 0);
+		dir->projects[i].name = (char*)rlx_strpool_intern(dir->strings, name ? name : "");
+		dir->projects[i].date = rlx_column_time(ppStmt, 2);
+		++i;
+	}
+	sqlite3_finalize(ppStmt);
+	dir->project_count = i;
+	return ret == SQLITE_ROW || ret == SQLITE_DONE ? SQLITE_OK : ret;
+}
+
+static int rlx_directory_load_spectra(struct rlx_directory* dir, sqlite3 *db)
+{
+	sqlite3_stmt *ppStmt;
+	const char *req = "SELECT ID,project_id,groupname,fitted,lowfreqlimit,highfreqlimit,dateadded,datefitted "
+		"FROM Files ORDER BY project_id,ID";
+	int ret = sqlite3_prepare_v2(db, req, -1, &ppStmt, NULL);
+	if(ret != SQLITE_OK)
+		return ret;
+
+	size_t i = 0;
+	while((ret = sqlite3_step(ppStmt)) == SQLITE_ROW && i < dir->length) {
+		const char *circuit = (const char*)sqlite3_column_text(ppStmt, 2);
+		dir->id[i] = sqlite3_column_int(ppStmt, 0);
+		dir->project_id[i] = sqlite3_column_int(ppStmt, 1);
+		dir->circuit[i] = rlx_strpool_intern(dir->strings, circuit ? circuit : "");
+		dir->fitted[i] = sqlite3_column_int(ppStmt, 3) == 1;
+		dir->freq_lower_limit[i] = rlx_column_number(ppStmt, 4);
+		dir->freq_upper_limit[i] = rlx_column_number(ppStmt, 5);
+		dir->date_added[i] = rlx_column_time(ppStmt, 6);
+		dir->date_fitted[i] = rlx_column_time(ppStmt, 7);
+		if(!dir->circuit[i]) {
+			ret = RLX_ERR_OOM;
+			break;
+		}
+		++i;
+	}
+	sqlite3_finalize(ppStmt);
+	dir->length = i;
+	return ret == SQLITE_ROW || ret == SQLITE_DONE ? SQLITE_OK : ret;
+}
+
+static int rlx_directory_open_db(struct rlxfile* file, sqlite3 **db)
+{
+	*db = NULL;
+	char *uri = rlx_uri_readonly(sqlite3_db_filename(file->db, "main"), file->vfs);
+	if(!uri)
+		return RLX_ERR_OOM;
+	int ret = sqlite3_open_v2(uri, db, SQLITE_OPEN_READONLY | SQLITE_OPEN_URI, NULL);
+	free(uri);
+	if(ret == SQLITE_OK)
+		ret = sqlite3_exec(*db, "BEGIN", NULL, NULL, NULL);
+	if(ret != SQLITE_OK) {
+		sqlite3_close(*db);
+		*db = NULL;
+	}
+	return ret;
+}
+
+static struct rlx_directory* rlx_directory_build(struct rlxfile* file)
+{
+	struct rlx_directory *dir = calloc(1, sizeof(*dir));
+	if(!dir) {
+		file->error = RLX_ERR_OOM;
+		return NULL;
+	}
+	atomic_init(&dir->refcount, 1);
+
+	sqlite3 *db;
+	int ret = rlx_directory_open_db(file, &db);
+	if(ret != SQLITE_OK) {
+		file->error = ret;
+		free(dir);
+		return NULL;
+	}
+
+	int64_t project_count = 0;
+	int64_t length = 0;
+	ret = rlx_query_int64(db, "SELECT COUNT(*) FROM Projects", &project_count);
+	if(ret == SQLITE_OK)
+		ret = rlx_query_int64(db, "SELECT COUNT(*) FROM Files", &length);
+	if(ret != SQLITE_OK)
+		goto error;
+
+	dir->project_count = project_count;
+	dir->length = length;
+	dir->strings = rlx_strpool_create();
+	dir->projects = calloc(project_count+1, sizeof(*dir->projects));
+	dir->project_start = calloc(project_count+1, sizeof(*dir->project_start));
+	dir->project_length = calloc(project_count+1, sizeof(*dir->project_length));
+	dir->id = malloc(sizeof(*dir->id)*(length+1));
+	dir->project_id = malloc(sizeof(*dir->project_id)*(length+1));
+	dir->fitted = malloc(sizeof(*dir->fitted)*(length+1));
+	dir->freq_lower_limit = malloc(sizeof(*dir->freq_lower_limit)*(length+1));
+	dir->freq_upper_limit = malloc(sizeof(*dir->freq_upper_limit)*(length+1));
+	dir->date_added = malloc(sizeof(*dir->date_added)*(length+1));
+	dir->date_fitted = malloc(sizeof(*dir->date_fitted)*(length+1));
+	dir->circuit = malloc(sizeof(*dir->circuit)*(length+1));
+	dir->by_id = malloc(sizeof(*dir->by_id)*(length+1));
+	if(!dir->strings || !dir->projects || !dir->project_start || !dir->project_length || !dir->id ||
+		!dir->project_id || !dir->fitted || !dir->freq_lower_limit || !dir->freq_upper_limit ||
+		!dir->date_added || !dir->date_fitted || !dir->circuit || !dir->by_id) {
+		ret = RLX_ERR_OOM;
+		goto error;
+	}
+
+	ret = rlx_directory_load_projects(dir, db);
+	if(ret == SQLITE_OK)
+		ret = rlx_directory_load_spectra(dir, db);
+	if(ret != SQLITE_OK)
+		goto error;
+	sqlite3_close(db);
+
+	// spectra are sorted by project so every project covers a contiguous range
+	size_t row = 0;
+	for(size_t i = 0; i < dir->project_count; ++i) {
+		while(row < dir->length && dir->project_id[row] < dir->projects[i].id)
+			++row;
+		dir->project_start[i] = row;
+		while(row < dir->length && dir->project_id[row] == dir->projects[i].id)
+			++row;
+		dir->project_length[i] = row - dir->project_start[i];
+	}
+
+	struct rlx_id_row *rows = malloc(sizeof(*rows)*(dir->length+1));
+	if(!rows) {
+		file->error = RLX_ERR_OOM;
+		rlx_directory_free(dir);
+		return NULL;
+	}
+	for(size_t i = 0; i < dir->length; ++i) {
+		rows[i].id = dir->id[i];
+		rows[i].row = i;
+	}
+	qsort(rows, dir->length, sizeof(*rows), rlx_id_row_cmp);
+	for(size_t i = 0; i < dir->length; ++i)
+		dir->by_id[i] = rows[i].row;
+	free(rows);
+
+	return dir;
+
+error:
+	sqlite3_close(db);
+	file->error = ret;
+	rlx_directory_free(dir);
+	return NULL;
+}
+
+static void rlx_directory_swap(struct rlxfile* file, struct rlx_directory* dir)
+{
+	struct rlx_directory *old = atomic_exchange(&file->directory, dir);
+	while(atomic_load(&file->directory_readers) > 0)
+		sched_yield();
+	rlx_directory_release(old);
+}
+
+static int rlx_directory_refresh_untraced(struct rlxfile* file)
+{
+	int64_t version;
+	pthread_mutex_lock(&file->directory_lock);
+	int ret = rlx_query_int64(file->db, "PRAGMA data_version", &version);
+	if(ret != SQLITE_OK) {
+		pthread_mutex_unlock(&file->directory_lock);
+		file->error = ret;
+		return ret;
+	}
+
+	if(atomic_load(&file->directory) && version == file->directory_version) {
+		pthread_mutex_unlock(&file->directory_lock);
+		return RLX_ERR_SUCESS;
+	}
+
+	struct rlx_directory *dir = rlx_directory_build(file);
+	if(!dir) {
+		pthread_mutex_unlock(&file->directory_lock);
+		return file->error;
+	}
+	file->directory_version = version;
+	rlx_directory_swap(file, dir);
+	pthread_mutex_unlock(&file->directory_lock);
+	return RLX_ERR_SUCESS;
+}
+
+int rlx_directory_refresh(struct rlxfile* file)
+{
+	uint64_t trace = rlx_trace_begin();
+	int ret = rlx_directory_refresh_untraced(file);
+	rlx_trace_end(trace, RLX_CALL_DIRECTORY_REFRESH, file->trace_handle, -1, 0, ret, NULL, 0);
+	return ret;
+}
+
+static struct rlx_directory* rlx_directory_acquire_untraced(struct rlxfile* file)
+{
+	while(true) {
+		atomic_fetch_add(&file->directory_readers, 1);
+		struct rlx_directory *dir = atomic_load(&file->directory);
+		if(dir)
+			atomic_fetch_add(&dir->refcount, 1);
+		atomic_fetch_sub(&file->directory_readers, 1);
+
+		if(dir)
+			return dir;
+		if(rlx_directory_refresh_untraced(file) != RLX_ERR_SUCESS)
+			return NULL;
+	}
+}
+
+struct rlx_directory* rlx_directory_acquire(struct rlxfile* file)
+{
+	uint64_t trace = rlx_trace_begin();
+	struct rlx_directory *dir = rlx_directory_acquire_untraced(file);
+	rlx_trace_end(trace, RLX_CALL_DIRECTORY_ACQUIRE, file->trace_handle, -1, 0, dir ? RLX_ERR_SUCESS : file->error, NULL, 0);
+	return dir;
+}
+
+void rlx_directory_release(struct rlx_directory* dir)
+{
+	if(dir && atomic_fetch_sub(&dir->refcount, 1) == 1)
+		rlx_directory_free(dir);
+}
+
+void rlx_directory_file_close(struct rlxfile* file)
+{
+	rlx_directory_release(atomic_exchange(&file->directory, NULL));
+}
+
+const struct rlx_project* rlx_directory_get_projects(const struct rlx_directory* dir, size_t* length)
+{
+	if(length)
+		*length = dir->project_count;
+	return dir->projects;
+}
+
+static void rlx_directory_fill_headers(const struct rlx_directory* dir, size_t start, size_t length, struct rlx_spectra_headers* headers)
+{
+	headers->length = length;
+	headers->id = dir->id + start;
+	headers->project_id = dir->project_id + start;
+	headers->fitted = dir->fitted + start;
+	headers->freq_lower_limit = dir->freq_lower_limit + start;
+	headers->freq_upper_limit = dir->freq_upper_limit + start;
+	headers->date_added = dir->date_added + start;
+	headers->date_fitted = dir->date_fitted + start;
+	headers->circuit = dir->circuit + start;
+}
+
+static long rlx_directory_find_project(const struct rlx_directory* dir, int project_id)
+{
+	size_t low = 0;
+	size_t high = dir->project_count;
+	while(low < high) {
+		size_t mid = low + (high - low)/2;
+		if(dir->projects[mid].id < project_id)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	if(low < dir->project_count && dir->projects[low].id == project_id)
+		return low;
+	return -1;
+}
+
+int rlx_directory_get_headers(const struct rlx_directory* dir, int project_id, struct rlx_spectra_headers* headers)
+{
+	long project = rlx_directory_find_project(dir, project_id);
+	if(project < 0)
+		return RLX_ERR_NO_ENT;
+
+	rlx_directory_fill_headers(dir, dir->project_start[project], dir->project_length[project], headers);
+	return RLX_ERR_SUCESS;
+}
+
+int rlx_directory_find_spectra(const struct rlx_directory* dir, int id, struct rlx_spectra_headers* headers, size_t* index)
+{
+	size_t low = 0;
+	size_t high = dir->length;
+	while(low < high) {
+		size_t mid = low + (high - low)/2;
+		if(dir->id[dir->by_id[mid]] < id)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	if(low >= dir->length || dir->id[dir->by_id[low]] != id)
+		return RLX_ERR_NON_EXIST_SPECTRA;
+
+	size_t row = dir->by_id[low];
+	long project = rlx_directory_find_project(dir, dir->project_id[row]);
+	if(project < 0)
+		return RLX_ERR_NON_EXIST_SPECTRA;
+
+	rlx_directory_fill_headers(dir, dir->project_start[project], dir->project_length[project], headers);
+	if(index)
+		*index = row - dir->project_start[project];
+	return RLX_ERR_SUCESS;
+}
+
+struct rlx_spectra_headers_owned
+{
+	struct rlx_spectra_headers headers;
+	int *id;
+	int *project_id;
+	bool *fitted;
+	double *freq_lower_limit;
+	double *freq_upper_limit;
+	time_t *date_added;
+	time_t *date_fitted;
+	const char **circuit;
+	struct rlx_strpool *strings;
+};
+
+void rlx_spectra_headers_free(struct rlx_spectra_headers* headers)
+{
+	if(!headers)
+		return;
+	struct rlx_spectra_headers_owned *owned = (struct rlx_spectra_headers_owned*)headers;
+	free(owned->id);
+	free(owned->project_id);
+	free(owned->fitted);
+	free(owned->freq_lower_limit);
+	free(owned->freq_upper_limit);
+	free(owned->date_added);
+	free(owned->date_fitted);
+	free(owned->circuit);
+	rlx_strpool_free(owned->strings);
+	free(owned);
+}
+
+static int rlx_load_project_headers(struct rlx_spectra_headers_owned* owned, sqlite3 *db, int project_id, size_t length)
+{
+	sqlite3_stmt *ppStmt;
+	const char *req = "SELECT ID,project_id,groupname,fitted,lowfreqlimit,highfreqlimit,dateadded,datefitted "
+		"FROM Files WHERE project_id=? ORDER BY ID";
+	int ret = sqlite3_prepare_v2(db, req, -1, &ppStmt, NULL);
+	if(ret != SQLITE_OK)
+		return ret;
+	sqlite3_bind_int(ppStmt, 1, project_id);
+
+	size_t i = 0;
+	while((ret = sqlite3_step(ppStmt)) == SQLITE_ROW && i < length) {
+		const char *circuit = (const char*)sqlite3_column_text(ppStmt, 2);
+		owned->id[i] = sqlite3_column_int(ppStmt, 0);
+		owned->project_id[i] = sqlite3_column_int(ppStmt, 1);
+		owned->circuit[i] = rlx_strpool_intern(owned->strings, circuit ? circuit : "");
+		owned->fitted[i] = sqlite3_column_int(ppStmt, 3) == 1;
+		owned->freq_lower_limit[i] = rlx_column_number(ppStmt, 4);
+		owned->freq_upper_limit[i] = rlx_column_number(ppStmt, 5);
+		owned->date_added[i] = rlx_column_time(ppStmt, 6);
+		owned->date_fitted[i] = rlx_column_time(ppStmt, 7);
+		if(!owned->circuit[i]) {
+			ret = RLX_ERR_OOM;
+			break;
+		}
+		++i;
+	}
+	sqlite3_finalize(ppStmt);
+	owned->headers.length = i;
+	return ret == SQLITE_ROW || ret == SQLITE_DONE ? SQLITE_OK : ret;
+}
+
+struct rlx_spectra_headers* rlx_get_spectra_headers_untraced(struct rlxfile* file, const struct rlx_project* project)
+{
+	struct rlx_spectra_headers_owned *owned = calloc(1, sizeof(*owned));
+	if(!owned) {
+		file->error = RLX_ERR_OOM;
+		return NULL;
+	}
+
+	// no transaction, like the other loaders, rlx_load_project_headers stops at length should rows be added meanwhile
+	int64_t length = 0;
+	char *req = rlx_alloc_printf("SELECT COUNT(*) FROM Files WHERE project_id=%d", project->id);
+	int ret = req ? rlx_query_int64(file->db, req, &length) : RLX_ERR_OOM;
+	free(req);
+	if(ret == SQLITE_OK) {
+		owned->strings = rlx_strpool_create();
+		owned->id = malloc(sizeof(*owned->id)*(length+1));
+		owned->project_id = malloc(sizeof(*owned->project_id)*(length+1));
+		owned->fitted = malloc(sizeof(*owned->fitted)*(length+1));
+		owned->freq_lower_limit = malloc(sizeof(*owned->freq_lower_limit)*(length+1));
+		owned->freq_upper_limit = malloc(sizeof(*owned->freq_upper_limit)*(length+1));
+		owned->date_added = malloc(sizeof(*owned->date_added)*(length+1));
+		owned->date_fitted = malloc(sizeof(*owned->date_fitted)*(length+1));
+		owned->circuit = malloc(sizeof(*owned->circuit)*(length+1));
+		if(!owned->strings || !owned->id || !owned->project_id || !owned->fitted || !owned->freq_lower_limit ||
+			!owned->freq_upper_limit || !owned->date_added || !owned->date_fitted || !owned->circuit)
+			ret = RLX_ERR_OOM;
+	}
+	if(ret == SQLITE_OK)
+		ret = rlx_load_project_headers(owned, file->db, project->id, length);
+
+	if(ret != SQLITE_OK) {
+		file->error = ret;
+		rlx_spectra_headers_free(&owned->headers);
+		return NULL;
+	}
+
+	owned->headers.id = owned->id;
+	owned->headers.project_id = owned->project_id;
+	owned->headers.fitted = owned->fitted;
+	owned->headers.freq_lower_limit = owned->freq_lower_limit;
+	owned->headers.freq_upper_limit = owned->freq_upper_limit;
+	owned->headers.date_added = owned->date_added;
+	owned->headers.date_fitted = owned->date_fitted;
+	owned->headers.circuit = owned->circuit;
+	return &owned->headers;
+}
+
+struct rlx_spectra_headers* rlx_get_spectra_headers(struct rlxfile* file, const struct rlx_project* project)
+{
+	uint64_t trace = rlx_trace_begin();
+	struct rlx_perf_sample perf;
+	rlx_perf_begin(file->perf, &perf);
+	struct rlx_spectra_headers *headers = rlx_get_spectra_headers_untraced(file, project);
+	rlx_perf_end(file->perf, RLX_PERF_GET_SPECTRA_HEADERS, &perf);
+	rlx_trace_end(trace, RLX_CALL_GET_SPECTRA_HEADERS, file->trace_handle, project->id, 0,
+	              headers ? RLX_ERR_SUCESS : file->error, NULL, 0);
+	return headers;
+}
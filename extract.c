@@ -0,0 +1,248 @@
+/*
+ * relaxisloader
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * relaxisloader is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * relaxisloader is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "relaxisloader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+
+#include "utils.h"
+#include "rlxfile.h"
+#include "trace.h"
+
+/*
+ * The output is written by its own connection, as the connection of the file is read only, with the file
+ * attached as src. The selected ids are resolved into two temp tables, one holding the projects and whether they
+ * are selected entirely, one holding the spectra. Every table is then copied with one INSERT ... SELECT filtered
+ * against these, keeping all ids as they are so the references between the tables stay valid.
+ * Indexes, views and triggers are only created once all rows are in place.
+ */
+
+struct rlx_extract_table
+{
+	const char *name;
+	const char *filter;
+};
+
+static const struct rlx_extract_table extract_tables[] = {
+	{"Projects", "ID IN (SELECT id FROM temp.rlx_extract_projects)"},
+	{"Files", "ID IN (SELECT id FROM temp.rlx_extract_spectra)"},
+	{"FileInformation", "file_id IN (SELECT id FROM temp.rlx_extract_spectra)"},
+	{"Datapoints", "file_id IN (SELECT id FROM temp.rlx_extract_spectra)"},
+	{"Fitparameters", "file_id IN (SELECT id FROM temp.rlx_extract_spectra)"},
+	{"StoredResults", "project_id IN (SELECT id FROM temp.rlx_extract_projects WHERE whole)"},
+	{"Properties", "1"},
+	{NULL, NULL}
+};
+
+static int rlx_extract_exec(sqlite3 *db, const char *sql)
+{
+	return sqlite3_exec(db, sql, NULL, NULL, NULL);
+}
+
+static int rlx_extract_insert_ids(sqlite3 *db, const char *sql, const int *ids, size_t count)
+{
+	sqlite3_stmt *ppStmt;
+	int ret = sqlite3_prepare_v2(db, sql, -1, &ppStmt, NULL);
+	for(size_t i = 0; i < count && ret == SQLITE_OK; ++i) {
+		sqlite3_bind_int(ppStmt, 1, ids[i]);
+		ret = sqlite3_step(ppStmt);
+		ret = ret == SQLITE_DONE ? sqlite3_reset(ppStmt) : ret;
+	}
+	sqlite3_finalize(ppStmt);
+	return ret;
+}
+
+static int rlx_extract_count(sqlite3 *db, const char *sql, int64_t *count)
+{
+	sqlite3_stmt *ppStmt;
+	int ret = sqlite3_prepare_v2(db, sql, -1, &ppStmt, NULL);
+	if(ret != SQLITE_OK)
+		return ret;
+	ret = sqlite3_step(ppStmt);
+	if(ret == SQLITE_ROW)
+		*count = sqlite3_column_int64(ppStmt, 0);
+	sqlite3_finalize(ppStmt);
+	return ret == SQLITE_ROW ? SQLITE_OK : ret;
+}
+
+/* Resolves the selection into temp.rlx_extract_projects and temp.rlx_extract_spectra */
+static int rlx_extract_select(sqlite3 *db, const struct rlx_selection *selection)
+{
+	int ret = rlx_extract_exec(db,
+		"CREATE TEMP TABLE rlx_extract_projects(id INTEGER PRIMARY KEY, whole INTEGER NOT NULL);"
+		"CREATE TEMP TABLE rlx_extract_spectra(id INTEGER PRIMARY KEY)");
+	if(ret == SQLITE_OK)
+		ret = rlx_extract_insert_ids(db, "INSERT OR IGNORE INTO temp.rlx_extract_projects VALUES(?,1)",
+		                             selection->projects, selection->project_count);
+	if(ret == SQLITE_OK)
+		ret = rlx_extract_insert_ids(db, "INSERT OR IGNORE INTO temp.rlx_extract_spectra VALUES(?)",
+		                             selection->spectra, selection->spectra_count);
+	if(ret != SQLITE_OK)
+		return ret;
+
+	int64_t missing = 0;
+	ret = rlx_extract_count(db, "SELECT COUNT(*) FROM temp.rlx_extract_projects WHERE id NOT IN (SELECT ID FROM src.Projects)", &missing);
+	if(ret == SQLITE_OK && missing > 0)
+		return RLX_ERR_NO_ENT;
+	if(ret == SQLITE_OK)
+		ret = rlx_extract_count(db, "SELECT COUNT(*) FROM temp.rlx_extract_spectra WHERE id NOT IN (SELECT ID FROM src.Files)", &missing);
+	if(ret == SQLITE_OK && missing > 0)
+		return RLX_ERR_NON_EXIST_SPECTRA;
+
+	if(ret == SQLITE_OK)
+		ret = rlx_extract_exec(db,
+			"INSERT OR IGNORE INTO temp.rlx_extract_spectra "
+			"SELECT ID FROM src.Files WHERE project_id IN (SELECT id FROM temp.rlx_extract_projects);"
+			"INSERT OR IGNORE INTO temp.rlx_extract_projects "
+			"SELECT DISTINCT project_id,0 FROM src.Files WHERE ID IN (SELECT id FROM temp.rlx_extract_spectra)");
+	return ret;
+}
+
+static int rlx_extract_schema(sqlite3 *db, const char *type)
+{
+	sqlite3_stmt *ppStmt;
+	int ret = sqlite3_prepare_v2(db, "SELECT sql FROM src.sqlite_master WHERE type=? AND sql NOT NULL AND name NOT LIKE 'sqlite_%'",
+	                             -1, &ppStmt, NULL);
+	if(ret != SQLITE_OK)
+		return ret;
+	sqlite3_bind_text(ppStmt, 1, type, -1, SQLITE_STATIC);
+	int step = SQLITE_DONE;
+	while(ret == SQLITE_OK && (step = sqlite3_step(ppStmt)) == SQLITE_ROW)
+		ret = rlx_extract_exec(db, (const char*)sqlite3_column_text(ppStmt, 0));
+	sqlite3_finalize(ppStmt);
+	return ret == SQLITE_OK && step != SQLITE_DONE ? step : ret;
+}
+
+static int rlx_extract_rows(sqlite3 *db)
+{
+	int ret = SQLITE_OK;
+	for(size_t i = 0; ret == SQLITE_OK && extract_tables[i].name; ++i) {
+		char *sql = sqlite3_mprintf("SELECT 1 FROM src.sqlite_master WHERE type='table' AND name=%Q", extract_tables[i].name);
+		int64_t exists = 0;
+		ret = sql ? rlx_extract_count(db, sql, &exists) : SQLITE_NOMEM;
+		sqlite3_free(sql);
+		if(ret == SQLITE_DONE) {
+			ret = SQLITE_OK;
+			continue;
+		}
+		if(ret != SQLITE_OK)
+			break;
+
+		sql = sqlite3_mprintf("INSERT INTO main.\"%w\" SELECT * FROM src.\"%w\" WHERE %s",
+		                      extract_tables[i].name, extract_tables[i].name, extract_tables[i].filter);
+		ret = sql ? rlx_extract_exec(db, sql) : SQLITE_NOMEM;
+		sqlite3_free(sql);
+	}
+	return ret;
+}
+
+static int rlx_extract_pragma(sqlite3 *db, const char *pragma)
+{
+	char *sql = sqlite3_mprintf("PRAGMA src.%s", pragma);
+	sqlite3_stmt *ppStmt;
+	int ret = sqlite3_prepare_v2(db, sql, -1, &ppStmt, NULL);
+	sqlite3_free(sql);
+	if(ret != SQLITE_OK)
+		return ret;
+	if(sqlite3_step(ppStmt) == SQLITE_ROW) {
+		sql = sqlite3_mprintf("PRAGMA main.%s=%lld", pragma, sqlite3_column_int64(ppStmt, 0));
+		ret = rlx_extract_exec(db, sql);
+		sqlite3_free(sql);
+	}
+	sqlite3_finalize(ppStmt);
+	return ret;
+}
+
+static int rlx_extract_untraced(struct rlxfile* file, const struct rlx_selection* selection, const char* out_path)
+{
+	sqlite3 *db;
+	int ret = sqlite3_open_v2(out_path, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_URI, NULL);
+	if(ret != SQLITE_OK) {
+		sqlite3_close(db);
+		file->error = ret;
+		return ret;
+	}
+
+	int64_t pages = 0;
+	ret = rlx_extract_count(db, "PRAGMA main.page_count", &pages);
+	if(ret != SQLITE_OK || pages > 0) {
+		sqlite3_close(db);
+		file->error = ret == SQLITE_OK ? RLX_ERR_EXISTS : ret;
+		return file->error;
+	}
+
+	char *uri = rlx_uri_readonly(sqlite3_db_filename(file->db, "main"), file->vfs);
+	char *sql = uri ? sqlite3_mprintf("ATTACH %Q AS src", uri) : NULL;
+	ret = sql ? rlx_extract_exec(db, sql) : SQLITE_NOMEM;
+	sqlite3_free(sql);
+	free(uri);
+
+	if(ret == SQLITE_OK)
+		ret = rlx_extract_pragma(db, "page_size");
+	if(ret == SQLITE_OK)
+		ret = rlx_extract_exec(db, "BEGIN");
+	if(ret == SQLITE_OK)
+		ret = rlx_extract_pragma(db, "user_version");
+	if(ret == SQLITE_OK)
+		ret = rlx_extract_pragma(db, "application_id");
+	if(ret == SQLITE_OK)
+		ret = rlx_extract_select(db, selection);
+	if(ret == SQLITE_OK)
+		ret = rlx_extract_schema(db, "table");
+	if(ret == SQLITE_OK)
+		ret = rlx_extract_rows(db);
+	if(ret == SQLITE_OK)
+		ret = rlx_extract_schema(db, "index");
+	if(ret == SQLITE_OK)
+		ret = rlx_extract_schema(db, "view");
+	if(ret == SQLITE_OK)
+		ret = rlx_extract_schema(db, "trigger");
+	if(ret == SQLITE_OK)
+		ret = rlx_extract_exec(db, "COMMIT");
+	if(ret != SQLITE_OK)
+		rlx_extract_exec(db, "ROLLBACK");
+	sqlite3_close(db);
+
+	/* the file was created empty by us above, so nothing of value is lost */
+	if(ret != SQLITE_OK) {
+		remove(out_path);
+		file->error = ret;
+	}
+	return ret;
+}
+
+int rlx_extract(struct rlxfile* file, const struct rlx_selection* selection, const char* out_path)
+{
+	uint64_t trace = rlx_trace_begin();
+	int ret = rlx_extract_untraced(file, selection, out_path);
+	size_t payloadSize = sizeof(int)*(selection->project_count + selection->spectra_count);
+	int *payload = trace && payloadSize > 0 ? malloc(payloadSize) : NULL;
+	if(payload) {
+		if(selection->project_count > 0)
+			memcpy(payload, selection->projects, sizeof(int)*selection->project_count);
+		if(selection->spectra_count > 0)
+			memcpy(payload + selection->project_count, selection->spectra, sizeof(int)*selection->spectra_count);
+	}
+	rlx_trace_end(trace, RLX_CALL_EXTRACT, file->trace_handle, -1, selection->project_count, ret,
+	              payload, payload ? payloadSize : 0);
+	free(payload);
+	return ret;
+}
@@ -0,0 +1,223 @@
+/*
+ * relaxisloader
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * relaxisloader is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * relaxisloader is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "relaxisloader.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "utils.h"
+#include "rlxfile.h"
+#include "trace.h"
+
+#define RLX_WARBURG_POINTS 5
+
+const char* rlx_feature_get_name(enum rlx_feature feature)
+{
+	switch(feature)
+	{
+		case RLX_FEATURE_HF_INTERCEPT:
+			return "HighFrequencyIntercept";
+		case RLX_FEATURE_LF_INTERCEPT:
+			return "LowFrequencyIntercept";
+		case RLX_FEATURE_APEX_FREQUENCY:
+			return "ApexFrequency";
+		case RLX_FEATURE_APEX_MAGNITUDE:
+			return "ApexMagnitude";
+		case RLX_FEATURE_PHASE_MIN:
+			return "PhaseMinimum";
+		case RLX_FEATURE_PHASE_MIN_FREQUENCY:
+			return "PhaseMinimumFrequency";
+		case RLX_FEATURE_WARBURG_SLOPE:
+			return "WarburgSlope";
+		case RLX_FEATURE_COUNT:
+		default:
+			return "Unkown";
+	}
+}
+
+/*
+ * All features are gathered in one pass over the datapoints in order of ascending frequency.
+ * The high frequency intercept is the zero crossing of the imaginary part with the highest frequency,
+ * the low frequency intercept the real part at the local minimum of -im with the lowest frequency,
+ * ie. where a diffusion tail starts. If no such point exists the outermost datapoint is used for either.
+ * The apex is the largest local maximum of -im, or the global maximum if -im has no local maximum.
+ */
+void rlx_spectra_features(const struct rlx_spectra* spectra, double* features)
+{
+	for(size_t i = 0; i < RLX_FEATURE_COUNT; ++i)
+		features[i] = NAN;
+
+	const size_t n = spectra->length;
+	if(n == 0 || !spectra->datapoints)
+		return;
+
+	const struct rlx_datapoint *dp = spectra->datapoints;
+	const bool descending = dp[0].omega > dp[n-1].omega;
+	const ptrdiff_t step = descending ? -1 : 1;
+	const struct rlx_datapoint *point = descending ? dp + n - 1 : dp;
+
+	double apexMag = -INFINITY;
+	double apexOmega = NAN;
+	double maxMag = -INFINITY;
+	double maxOmega = NAN;
+	double phaseMin = INFINITY;
+	double phaseOmega = NAN;
+	double hfIntercept = NAN;
+	double lfIntercept = NAN;
+	double sx = 0, sy = 0, sxx = 0, sxy = 0;
+	const size_t warburgPoints = n < RLX_WARBURG_POINTS ? n : RLX_WARBURG_POINTS;
+
+	for(size_t i = 0; i < n; ++i, point += step) {
+		const double re = point->re;
+		const double negIm = -point->im;
+
+		if(negIm > maxMag) {
+			maxMag = negIm;
+			maxOmega = point->omega;
+		}
+
+		const double phase = atan2(point->im, re);
+		if(phase < phaseMin) {
+			phaseMin = phase;
+			phaseOmega = point->omega;
+		}
+
+		if(i < warburgPoints) {
+			sx += re;
+			sy += negIm;
+			sxx += re*re;
+			sxy += re*negIm;
+		}
+
+		if(i > 0) {
+			const struct rlx_datapoint *prev = point - step;
+			if((prev->im < 0) != (point->im < 0) && prev->im != point->im)
+				hfIntercept = prev->re + (re - prev->re)*prev->im/(prev->im - point->im);
+
+			if(i + 1 < n) {
+				const struct rlx_datapoint *next = point + step;
+				if(isnan(lfIntercept) && negIm <= -prev->im && negIm < -next->im)
+					lfIntercept = re;
+				if(negIm > apexMag && negIm >= -prev->im && negIm > -next->im) {
+					apexMag = negIm;
+					apexOmega = point->omega;
+				}
+			}
+		}
+	}
+
+	const struct rlx_datapoint *lowest = descending ? dp + n - 1 : dp;
+	const struct rlx_datapoint *highest = descending ? dp : dp + n - 1;
+	features[RLX_FEATURE_HF_INTERCEPT] = isnan(hfIntercept) ? highest->re : hfIntercept;
+	features[RLX_FEATURE_LF_INTERCEPT] = isnan(lfIntercept) ? lowest->re : lfIntercept;
+	features[RLX_FEATURE_APEX_FREQUENCY] = (isnan(apexOmega) ? maxOmega : apexOmega)/(2*M_PI);
+	features[RLX_FEATURE_APEX_MAGNITUDE] = isnan(apexOmega) ? maxMag : apexMag;
+	features[RLX_FEATURE_PHASE_MIN] = phaseMin*180/M_PI;
+	features[RLX_FEATURE_PHASE_MIN_FREQUENCY] = phaseOmega/(2*M_PI);
+
+	const double denom = warburgPoints*sxx - sx*sx;
+	if(warburgPoints > 1 && denom != 0)
+		features[RLX_FEATURE_WARBURG_SLOPE] = (warburgPoints*sxy - sx*sy)/denom;
+}
+
+struct rlx_feature_job
+{
+	struct rlx_spectra **spectra;
+	double *rows;
+};
+
+static void rlx_feature_worker(size_t index, int thread, void *userdata)
+{
+	(void)thread;
+	struct rlx_feature_job *job = userdata;
+	rlx_spectra_features(job->spectra[index], job->rows + index*RLX_FEATURE_COUNT);
+}
+
+static double* rlx_get_project_features_untraced(struct rlxfile* file, const struct rlx_project* project, int threads, int** ids, size_t* length)
+{
+	if(length)
+		*length = 0;
+	if(ids)
+		*ids = NULL;
+
+	// the spectra are loaded chunk by chunk within the memory budget, only the features of every spectrum are kept
+	double *rows = NULL;
+	int *outIds = NULL;
+	size_t count = 0;
+	int cursor = 0;
+	bool loaded = false;
+	int ret;
+	while(true) {
+		size_t chunkLength;
+		struct rlx_spectra **spectra = rlx_get_spectra_chunk_untraced(file, project, &cursor, &chunkLength);
+		if(!spectra) {
+			ret = loaded || file->error != RLX_ERR_SUCESS ? file->error : RLX_ERR_NO_ENT;
+			break;
+		}
+		loaded = true;
+
+		double *newRows = realloc(rows, sizeof(*rows)*RLX_FEATURE_COUNT*(count+chunkLength+1));
+		if(newRows)
+			rows = newRows;
+		int *newIds = realloc(outIds, sizeof(*outIds)*(count+chunkLength+1));
+		if(newIds)
+			outIds = newIds;
+		struct rlx_feature_job job = {.spectra = spectra, .rows = rows + count*RLX_FEATURE_COUNT};
+		if(!newRows || !newIds || rlx_parallel_for(chunkLength, threads, rlx_feature_worker, &job) != 0) {
+			rlx_spectra_free_array(spectra);
+			ret = RLX_ERR_OOM;
+			break;
+		}
+		for(size_t i = 0; i < chunkLength; ++i)
+			outIds[count+i] = spectra[i]->id;
+		count += chunkLength;
+		rlx_spectra_free_array(spectra);
+	}
+
+	double *matrix = ret == RLX_ERR_SUCESS ? malloc(sizeof(*matrix)*RLX_FEATURE_COUNT*(count+1)) : NULL;
+	if(!matrix) {
+		free(rows);
+		free(outIds);
+		file->error = ret == RLX_ERR_SUCESS ? RLX_ERR_OOM : ret;
+		return NULL;
+	}
+	for(size_t j = 0; j < count; ++j) {
+		for(size_t i = 0; i < RLX_FEATURE_COUNT; ++i)
+			matrix[i*count + j] = rows[j*RLX_FEATURE_COUNT + i];
+	}
+	free(rows);
+
+	if(ids)
+		*ids = outIds;
+	else
+		free(outIds);
+	if(length)
+		*length = count;
+	return matrix;
+}
+
+double* rlx_get_project_features(struct rlxfile* file, const struct rlx_project* project, int threads, int** ids, size_t* length)
+{
+	uint64_t trace = rlx_trace_begin();
+	double *matrix = rlx_get_project_features_untraced(file, project, threads, ids, length);
+	rlx_trace_end(trace, RLX_CALL_GET_PROJECT_FEATURES, file->trace_handle, project->id, threads,
+	              matrix ? RLX_ERR_SUCESS : file->error, NULL, 0);
+	return matrix;
+}
@@ -0,0 +1,595 @@
+/*
+ * relaxisloader
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * relaxisloader is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * relaxisloader is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "relaxisloader.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "utils.h"
+#include "circuit.h"
+#include "fit.h"
+#include "rlxfile.h"
+#include "trace.h"
+
+void rlx_fit_options_default(struct rlx_fit_options* options)
+{
+	options->weighting = RLX_FIT_WEIGHT_PROPORTIONAL;
+	options->max_iterations = 200;
+	options->tolerance = 1e-8;
+	options->freq_lower_limit = 0;
+	options->freq_upper_limit = 0;
+}
+
+static bool rlx_fit_ws_reserve(void **ptr, size_t *size, size_t required)
+{
+	if(*size >= required)
+		return true;
+	void *newPtr = realloc(*ptr, required);
+	if(!newPtr)
+		return false;
+	*ptr = newPtr;
+	*size = required;
+	return true;
+}
+
+#define RLX_WS_RESERVE(ws, member, count) rlx_fit_ws_reserve((void**)&(ws)->member, &(ws)->member##_size, sizeof(*(ws)->member)*(count))
+
+bool rlx_fit_workspace_reserve(struct rlx_fit_workspace* ws, size_t points, size_t params, size_t work)
+{
+	return RLX_WS_RESERVE(ws, omega, points) && RLX_WS_RESERVE(ws, re, points) &&
+		RLX_WS_RESERVE(ws, im, points) && RLX_WS_RESERVE(ws, weight, points) &&
+		RLX_WS_RESERVE(ws, res, points*2) && RLX_WS_RESERVE(ws, jac, points*2*params) &&
+		RLX_WS_RESERVE(ws, jtj, params*params) && RLX_WS_RESERVE(ws, a, params*params) &&
+		RLX_WS_RESERVE(ws, jtr, params) && RLX_WS_RESERVE(ws, delta, params) &&
+		RLX_WS_RESERVE(ws, trial, params) && RLX_WS_RESERVE(ws, scale, params) &&
+		RLX_WS_RESERVE(ws, active, params) && RLX_WS_RESERVE(ws, dz, params) && RLX_WS_RESERVE(ws, work, work);
+}
+
+void rlx_fit_workspace_free(struct rlx_fit_workspace* ws)
+{
+	free(ws->omega);
+	free(ws->re);
+	free(ws->im);
+	free(ws->weight);
+	free(ws->res);
+	free(ws->jac);
+	free(ws->jtj);
+	free(ws->a);
+	free(ws->jtr);
+	free(ws->delta);
+	free(ws->trial);
+	free(ws->scale);
+	free(ws->active);
+	free(ws->dz);
+	free(ws->work);
+	memset(ws, 0, sizeof(*ws));
+}
+
+size_t rlx_fit_select_points(const struct rlx_spectra* spectra, const struct rlx_fit_options* options, struct rlx_fit_workspace* ws)
+{
+	double lower = options->freq_lower_limit > 0 ? options->freq_lower_limit : spectra->freq_lower_limit;
+	double upper = options->freq_upper_limit > 0 ? options->freq_upper_limit : spectra->freq_upper_limit;
+	// limits are stored as floats by RelaxIS
+	lower *= 1 - 1e-7;
+	upper *= 1 + 1e-7;
+
+	size_t count = 0;
+	for(size_t i = 0; i < spectra->length; ++i) {
+		const struct rlx_datapoint *dp = &spectra->datapoints[i];
+		double freq = dp->omega/(2*M_PI);
+		if((lower > 0 && freq < lower) || (upper > 0 && freq > upper))
+			continue;
+		ws->omega[count] = dp->omega;
+		ws->re[count] = dp->re;
+		ws->im[count] = dp->im;
+		if(options->weighting == RLX_FIT_WEIGHT_PROPORTIONAL) {
+			double mag = sqrt(dp->re*dp->re + dp->im*dp->im);
+			ws->weight[count] = mag > 0 ? 1/mag : 1;
+		}
+		else {
+			ws->weight[count] = 1;
+		}
+		++count;
+	}
+	return count;
+}
+
+double rlx_fit_residuals(const struct rlx_circuit* circuit, const double* params, struct rlx_fit_workspace* ws,
+                         size_t points, double* res, double* jac)
+{
+	const size_t n = circuit->param_count;
+	double cost = 0;
+	for(size_t k = 0; k < points; ++k) {
+		double complex z = rlx_circuit_impedance(circuit, params, ws->omega[k], jac ? ws->dz : NULL, ws->work);
+		double w = ws->weight[k];
+		res[2*k] = w*(creal(z) - ws->re[k]);
+		res[2*k+1] = w*(cimag(z) - ws->im[k]);
+		cost += res[2*k]*res[2*k] + res[2*k+1]*res[2*k+1];
+		if(jac) {
+			for(size_t p = 0; p < n; ++p) {
+				jac[2*k*n + p] = w*creal(ws->dz[p]);
+				jac[(2*k+1)*n + p] = w*cimag(ws->dz[p]);
+			}
+		}
+	}
+	return isfinite(cost) ? cost : INFINITY;
+}
+
+bool rlx_cholesky_decompose(double* a, size_t n)
+{
+	for(size_t j = 0; j < n; ++j) {
+		double sum = a[j*n+j];
+		for(size_t k = 0; k < j; ++k)
+			sum -= a[j*n+k]*a[j*n+k];
+		if(!(sum > 0))
+			return false;
+		a[j*n+j] = sqrt(sum);
+		for(size_t i = j+1; i < n; ++i) {
+			double s = a[i*n+j];
+			for(size_t k = 0; k < j; ++k)
+				s -= a[i*n+k]*a[j*n+k];
+			a[i*n+j] = s/a[j*n+j];
+		}
+	}
+	return true;
+}
+
+void rlx_cholesky_solve(const double* l, double* b, size_t n)
+{
+	for(size_t i = 0; i < n; ++i) {
+		double s = b[i];
+		for(size_t k = 0; k < i; ++k)
+			s -= l[i*n+k]*b[k];
+		b[i] = s/l[i*n+i];
+	}
+	for(size_t i = n; i-- > 0;) {
+		double s = b[i];
+		for(size_t k = i+1; k < n; ++k)
+			s -= l[k*n+i]*b[k];
+		b[i] = s/l[i*n+i];
+	}
+}
+
+static void rlx_fit_normal_equations(const double* jac, const double* res, size_t rows, size_t n, double* jtj, double* jtr)
+{
+	memset(jtj, 0, sizeof(*jtj)*n*n);
+	memset(jtr, 0, sizeof(*jtr)*n);
+	for(size_t r = 0; r < rows; ++r) {
+		const double *row = jac + r*n;
+		for(size_t i = 0; i < n; ++i) {
+			jtr[i] += row[i]*res[r];
+			for(size_t j = 0; j <= i; ++j)
+				jtj[i*n+j] += row[i]*row[j];
+		}
+	}
+	for(size_t i = 0; i < n; ++i) {
+		for(size_t j = 0; j < i; ++j)
+			jtj[j*n+i] = jtj[i*n+j];
+	}
+}
+
+/*
+ * Solves (jtj + lambda*diag(jtj))*delta = -jtr, the system is jacobi scaled first as the parameters of
+ * impedance models routinely differ by many orders of magnitude.
+ */
+static bool rlx_fit_solve_step(const double* jtj, const double* jtr, size_t n, double lambda, double* a, double* scale, double* delta)
+{
+	for(size_t i = 0; i < n; ++i)
+		scale[i] = jtj[i*n+i] > 0 ? 1/sqrt(jtj[i*n+i]) : 1;
+
+	for(size_t i = 0; i < n; ++i) {
+		for(size_t j = 0; j < n; ++j)
+			a[i*n+j] = jtj[i*n+j]*scale[i]*scale[j];
+		a[i*n+i] += lambda*(jtj[i*n+i] > 0 ? a[i*n+i] : 1);
+		delta[i] = -jtr[i]*scale[i];
+	}
+
+	if(!rlx_cholesky_decompose(a, n))
+		return false;
+	rlx_cholesky_solve(a, delta, n);
+
+	for(size_t i = 0; i < n; ++i)
+		delta[i] *= scale[i];
+	return true;
+}
+
+static double rlx_clamp(double value, double lower, double upper)
+{
+	if(value < lower)
+		return lower;
+	if(value > upper)
+		return upper;
+	return value;
+}
+
+static void rlx_fit_errors(const double* jtj, size_t n, double variance, double* a, double* scale, double* column, double* errors)
+{
+	for(size_t i = 0; i < n; ++i)
+		scale[i] = jtj[i*n+i] > 0 ? 1/sqrt(jtj[i*n+i]) : 1;
+	for(size_t i = 0; i < n; ++i) {
+		for(size_t j = 0; j < n; ++j)
+			a[i*n+j] = jtj[i*n+j]*scale[i]*scale[j];
+	}
+
+	if(!rlx_cholesky_decompose(a, n)) {
+		for(size_t i = 0; i < n; ++i)
+			errors[i] = INFINITY;
+		return;
+	}
+
+	for(size_t i = 0; i < n; ++i) {
+		memset(column, 0, sizeof(*column)*n);
+		column[i] = 1;
+		rlx_cholesky_solve(a, column, n);
+		errors[i] = sqrt(column[i]*variance)*scale[i];
+	}
+}
+
+/* drops the jacobian columns of fixed parameters in place, leaving a rows x m matrix */
+static void rlx_fit_active_columns(double* jac, size_t rows, size_t n, const size_t* active, size_t m)
+{
+	if(m == n)
+		return;
+	for(size_t r = 0; r < rows; ++r) {
+		for(size_t k = 0; k < m; ++k)
+			jac[r*m+k] = jac[r*n+active[k]];
+	}
+}
+
+int rlx_fit_lm(const struct rlx_circuit* circuit, size_t points, const double* lower, const double* upper,
+               const bool* fixed, const struct rlx_fit_options* options, struct rlx_fit_workspace* ws, double* params,
+               double* errors, double* chi2, int* iterations)
+{
+	const size_t n = circuit->param_count;
+	const size_t rows = points*2;
+
+	// only the free parameters enter the normal equations
+	size_t m = 0;
+	for(size_t i = 0; i < n; ++i) {
+		if(!fixed || !fixed[i])
+			ws->active[m++] = i;
+	}
+	if(rows <= m)
+		return RLX_ERR_NO_ENT;
+
+	for(size_t i = 0; i < n; ++i)
+		params[i] = rlx_clamp(params[i], lower[i], upper[i]);
+
+	double cost = rlx_fit_residuals(circuit, params, ws, points, ws->res, ws->jac);
+	rlx_fit_active_columns(ws->jac, rows, n, ws->active, m);
+	double lambda = 1e-3;
+	int iteration = 0;
+	bool done = false;
+
+	while(!done && iteration < options->max_iterations) {
+		++iteration;
+		rlx_fit_normal_equations(ws->jac, ws->res, rows, m, ws->jtj, ws->jtr);
+
+		bool accepted = false;
+		while(!accepted && lambda < 1e16) {
+			if(rlx_fit_solve_step(ws->jtj, ws->jtr, m, lambda, ws->a, ws->scale, ws->delta)) {
+				bool moved = false;
+				memcpy(ws->trial, params, sizeof(*params)*n);
+				for(size_t k = 0; k < m; ++k) {
+					size_t i = ws->active[k];
+					ws->trial[i] = rlx_clamp(params[i] + ws->delta[k], lower[i], upper[i]);
+					moved = moved || ws->trial[i] != params[i];
+				}
+				if(!moved) {
+					done = true;
+					break;
+				}
+
+				double trialCost = rlx_fit_residuals(circuit, ws->trial, ws, points, ws->res, NULL);
+				if(trialCost < cost) {
+					accepted = true;
+					done = cost - trialCost <= options->tolerance*cost;
+					cost = trialCost;
+					memcpy(params, ws->trial, sizeof(*params)*n);
+					lambda = lambda/10 > 1e-12 ? lambda/10 : 1e-12;
+					break;
+				}
+			}
+			lambda *= 10;
+		}
+
+		if(!accepted)
+			done = true;
+		// residuals and jacobian at the current parameters
+		cost = rlx_fit_residuals(circuit, params, ws, points, ws->res, ws->jac);
+		rlx_fit_active_columns(ws->jac, rows, n, ws->active, m);
+	}
+
+	rlx_fit_normal_equations(ws->jac, ws->res, rows, m, ws->jtj, ws->jtr);
+	double variance = cost/(rows - m);
+	rlx_fit_errors(ws->jtj, m, variance, ws->a, ws->scale, ws->delta, ws->trial);
+	for(size_t i = 0; i < n; ++i)
+		errors[i] = 0;
+	for(size_t k = 0; k < m; ++k)
+		errors[ws->active[k]] = ws->trial[k];
+
+	if(chi2)
+		*chi2 = variance;
+	if(iterations)
+		*iterations = iteration;
+	return RLX_ERR_SUCESS;
+}
+
+static int rlx_fitparam_index_cmp(const void *a, const void *b)
+{
+	const struct rlx_fitparam *pa = *(struct rlx_fitparam* const*)a;
+	const struct rlx_fitparam *pb = *(struct rlx_fitparam* const*)b;
+	return (pa->p_index > pb->p_index) - (pa->p_index < pb->p_index);
+}
+
+struct rlx_fitparam** rlx_fitparam_sorted_copy(struct rlx_fitparam** params, size_t* length)
+{
+	size_t count = 0;
+	while(params[count])
+		++count;
+
+	struct rlx_fitparam **sorted = malloc(sizeof(*sorted)*(count+1));
+	if(!sorted)
+		return NULL;
+	memcpy(sorted, params, sizeof(*sorted)*(count+1));
+	qsort(sorted, count, sizeof(*sorted), rlx_fitparam_index_cmp);
+	*length = count;
+	return sorted;
+}
+
+static struct rlx_fit_result* rlx_fit_spectra_ws(const struct rlx_spectra* spectra, struct rlx_fitparam** initial,
+                                                 const struct rlx_fit_options* options, struct rlx_fit_workspace* ws)
+{
+	struct rlx_fit_result *result = calloc(1, sizeof(*result));
+	if(!result)
+		return NULL;
+	result->spectra_id = spectra->id;
+
+	struct rlx_fit_options defaults;
+	if(!options) {
+		rlx_fit_options_default(&defaults);
+		options = &defaults;
+	}
+
+	size_t n;
+	struct rlx_fitparam **sorted = rlx_fitparam_sorted_copy(initial, &n);
+	struct rlx_circuit *circuit = rlx_circuit_compile(spectra->circuit, NULL);
+	double *values = malloc(sizeof(*values)*(n*4+1));
+	bool *fixed = malloc(sizeof(*fixed)*(n+1));
+	result->params = calloc(n+1, sizeof(*result->params));
+	if(!sorted || !values || !fixed || !result->params) {
+		result->error = RLX_ERR_OOM;
+		goto out;
+	}
+	if(!circuit || circuit->param_count != n) {
+		result->error = RLX_ERR_CIRCUIT;
+		goto out;
+	}
+
+	double *lower = values + n;
+	double *upper = values + 2*n;
+	double *errors = values + 3*n;
+	for(size_t i = 0; i < n; ++i) {
+		values[i] = sorted[i]->value;
+		lower[i] = sorted[i]->lower_limit;
+		upper[i] = sorted[i]->upper_limit;
+		fixed[i] = sorted[i]->fixed;
+	}
+
+	if(!rlx_fit_workspace_reserve(ws, spectra->length, n, rlx_circuit_workspace_size(circuit))) {
+		result->error = RLX_ERR_OOM;
+		goto out;
+	}
+
+	size_t points = rlx_fit_select_points(spectra, options, ws);
+	result->error = rlx_fit_lm(circuit, points, lower, upper, fixed, options, ws, values, errors, &result->chi2, &result->iterations);
+	if(result->error != RLX_ERR_SUCESS)
+		goto out;
+
+	for(size_t i = 0; i < n; ++i) {
+		struct rlx_fitparam *param = malloc(sizeof(*param));
+		if(!param) {
+			result->error = RLX_ERR_OOM;
+			goto out;
+		}
+		*param = *sorted[i];
+		param->spectra_id = spectra->id;
+		param->name = rlx_strdup(sorted[i]->name);
+		if(!param->name) {
+			free(param);
+			result->error = RLX_ERR_OOM;
+			goto out;
+		}
+		param->value = values[i];
+		param->error = errors[i];
+		result->params[i] = param;
+		result->param_count = i+1;
+	}
+
+out:
+	if(result->error != RLX_ERR_SUCESS) {
+		rlx_fitparam_free_array(result->params);
+		result->params = NULL;
+		result->param_count = 0;
+	}
+	free(values);
+	free(fixed);
+	free(sorted);
+	rlx_circuit_free(circuit);
+	return result;
+}
+
+struct rlx_fit_result* rlx_fit_spectra(const struct rlx_spectra* spectra, struct rlx_fitparam** initial, const struct rlx_fit_options* options)
+{
+	struct rlx_fit_workspace ws = {0};
+	struct rlx_fit_result *result = rlx_fit_spectra_ws(spectra, initial, options, &ws);
+	rlx_fit_workspace_free(&ws);
+	return result;
+}
+
+void rlx_fit_result_free(struct rlx_fit_result* result)
+{
+	if(!result)
+		return;
+	if(result->params)
+		rlx_fitparam_free_array(result->params);
+	free(result);
+}
+
+void rlx_fit_result_free_array(struct rlx_fit_result** results)
+{
+	struct rlx_fit_result** firstresult = results;
+	while(*results) {
+		rlx_fit_result_free(*results);
+		++results;
+	}
+	free(firstresult);
+}
+
+struct rlx_fit_job
+{
+	struct rlx_spectra **spectra;
+	struct rlx_fitparam ***params;
+	struct rlx_fit_result **results;
+	struct rlx_fit_workspace *workspaces;
+	const struct rlx_fit_options *options;
+};
+
+static void rlx_fit_project_worker(size_t index, int thread, void *userdata)
+{
+	struct rlx_fit_job *job = userdata;
+	job->results[index] = rlx_fit_spectra_ws(job->spectra[index], job->params[index], job->options, &job->workspaces[thread]);
+}
+
+/*
+ * Loads the parameters of a chunk of spectra and fits those that have parameters and datapoints in parallel,
+ * the results are appended to results, which is kept NULL terminated.
+ */
+static int rlx_fit_project_chunk(struct rlxfile* file, struct rlx_spectra** chunk, size_t length, struct rlx_fit_job* job,
+                                 int threads, struct rlx_fit_result*** results, size_t* resultCount)
+{
+	int *ids = malloc(sizeof(*ids)*(length+1));
+	size_t *paramCounts = calloc(length+1, sizeof(*paramCounts));
+	job->spectra = calloc(length+1, sizeof(*job->spectra));
+	job->params = NULL;
+	if(ids && paramCounts && job->spectra) {
+		for(size_t i = 0; i < length; ++i)
+			ids[i] = chunk[i]->id;
+		job->params = rlx_get_fit_parameters_many_untraced(file, ids, length, paramCounts);
+	}
+	else {
+		file->error = RLX_ERR_OOM;
+	}
+	free(ids);
+	if(!job->params) {
+		free(job->spectra);
+		free(paramCounts);
+		return file->error;
+	}
+
+	// spectra without parameters or datapoints are not fitted
+	size_t count = 0;
+	for(size_t i = 0; i < length; ++i) {
+		if(paramCounts[i] == 0 || !chunk[i]->datapoints) {
+			rlx_fitparam_free_array(job->params[i]);
+			continue;
+		}
+		job->spectra[count] = chunk[i];
+		job->params[count] = job->params[i];
+		++count;
+	}
+	job->params[count] = NULL;
+	free(paramCounts);
+
+	int ret = RLX_ERR_SUCESS;
+	struct rlx_fit_result **grown = realloc(*results, sizeof(**results)*(*resultCount + count + 1));
+	if(grown) {
+		*results = grown;
+		job->results = grown + *resultCount;
+		memset(job->results, 0, sizeof(*job->results)*(count+1));
+	}
+	if(!grown || rlx_parallel_for(count, threads, rlx_fit_project_worker, job) != 0)
+		ret = RLX_ERR_OOM;
+
+	// compact results that failed to allocate
+	for(size_t i = 0; grown && i < count; ++i) {
+		if(job->results[i])
+			(*results)[(*resultCount)++] = job->results[i];
+	}
+	(*results)[*resultCount] = NULL;
+
+	for(size_t i = 0; i < count; ++i)
+		rlx_fitparam_free_array(job->params[i]);
+	free(job->params);
+	free(job->spectra);
+	return ret;
+}
+
+static struct rlx_fit_result** rlx_fit_project_untraced(struct rlxfile* file, const struct rlx_project* project,
+                                                        const struct rlx_fit_options* options, int threads)
+{
+	threads = rlx_thread_count(threads);
+	struct rlx_fit_job job = {.options = options};
+	struct rlx_fit_result **results = calloc(1, sizeof(*results));
+	job.workspaces = calloc(threads, sizeof(*job.workspaces));
+	if(!results || !job.workspaces) {
+		free(results);
+		free(job.workspaces);
+		file->error = RLX_ERR_OOM;
+		return NULL;
+	}
+
+	// the project is loaded chunk by chunk within the memory budget, every chunk is fitted before the next is loaded
+	size_t resultCount = 0;
+	int cursor = 0;
+	bool loaded = false;
+	int ret = RLX_ERR_SUCESS;
+	while(ret == RLX_ERR_SUCESS) {
+		size_t length;
+		struct rlx_spectra **chunk = rlx_get_spectra_chunk_untraced(file, project, &cursor, &length);
+		if(!chunk) {
+			ret = loaded || file->error != RLX_ERR_SUCESS ? file->error : RLX_ERR_NO_ENT;
+			break;
+		}
+		loaded = true;
+		ret = rlx_fit_project_chunk(file, chunk, length, &job, threads, &results, &resultCount);
+		rlx_spectra_free_array(chunk);
+	}
+
+	for(int i = 0; i < threads; ++i)
+		rlx_fit_workspace_free(&job.workspaces[i]);
+	free(job.workspaces);
+	if(ret != RLX_ERR_SUCESS) {
+		rlx_fit_result_free_array(results);
+		file->error = ret;
+		return NULL;
+	}
+	return results;
+}
+
+struct rlx_fit_result** rlx_fit_project(struct rlxfile* file, const struct rlx_project* project,
+                                        const struct rlx_fit_options* options, int threads)
+{
+	uint64_t trace = rlx_trace_begin();
+	struct rlx_fit_result **results = rlx_fit_project_untraced(file, project, options, threads);
+	rlx_trace_end(trace, RLX_CALL_FIT_PROJECT, file->trace_handle, project->id, threads, results ? RLX_ERR_SUCESS : file->error,
+	              options, options ? sizeof(*options) : 0);
+	return results;
+}
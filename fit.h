@@ -0,0 +1,83 @@
+/*
+ * relaxisloader
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * relaxisloader is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * relaxisloader is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <complex.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+struct rlx_circuit;
+struct rlx_spectra;
+struct rlx_fit_options;
+struct rlx_fitparam;
+
+/* Buffers reused across fits, every thread owns one */
+struct rlx_fit_workspace
+{
+	double *omega;
+	size_t omega_size;
+	double *re;
+	size_t re_size;
+	double *im;
+	size_t im_size;
+	double *weight;
+	size_t weight_size;
+	double *res;
+	size_t res_size;
+	double *jac;
+	size_t jac_size;
+	double *jtj;
+	size_t jtj_size;
+	double *a;
+	size_t a_size;
+	double *jtr;
+	size_t jtr_size;
+	double *delta;
+	size_t delta_size;
+	double *trial;
+	size_t trial_size;
+	double *scale;
+	size_t scale_size;
+	size_t *active;
+	size_t active_size;
+	double complex *dz;
+	size_t dz_size;
+	double complex *work;
+	size_t work_size;
+};
+
+bool rlx_fit_workspace_reserve(struct rlx_fit_workspace* ws, size_t points, size_t params, size_t work);
+void rlx_fit_workspace_free(struct rlx_fit_workspace* ws);
+
+/* copies the datapoints within the frequency limits and their weights into the workspace, returns their count */
+size_t rlx_fit_select_points(const struct rlx_spectra* spectra, const struct rlx_fit_options* options, struct rlx_fit_workspace* ws);
+
+/* weighted residuals re0, im0, re1, ... and optionally the row major jacobian thereof, returns the sum of squares */
+double rlx_fit_residuals(const struct rlx_circuit* circuit, const double* params, struct rlx_fit_workspace* ws,
+                         size_t points, double* res, double* jac);
+
+bool rlx_cholesky_decompose(double* a, size_t n);
+void rlx_cholesky_solve(const double* l, double* b, size_t n);
+
+/* fits the parameters not marked in fixed, which may be NULL, the errors of fixed parameters are 0 */
+int rlx_fit_lm(const struct rlx_circuit* circuit, size_t points, const double* lower, const double* upper,
+               const bool* fixed, const struct rlx_fit_options* options, struct rlx_fit_workspace* ws, double* params, double* errors,
+               double* chi2, int* iterations);
+
+/* returns a NULL terminated copy of the pointer array sorted by p_index, the structs are not copied */
+struct rlx_fitparam** rlx_fitparam_sorted_copy(struct rlx_fitparam** params, size_t* length);
@@ -0,0 +1,323 @@
+/*
+ * relaxisloader
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * relaxisloader is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * relaxisloader is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "relaxisloader.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <sqlite3.h>
+
+#include "utils.h"
+#include "rlxfile.h"
+#include "trace.h"
+#include "perf.h"
+
+/*
+ * Every worker owns a connection, the calling thread uses the connection of the file, the others open their own
+ * read only connections to the same file, as a sqlite connection can only step one statement at a time.
+ * A worker decodes each spectrum into buffers it keeps for the whole loop, which only ever grow, so that
+ * after the first few spectra no allocations are made anymore. Strings are collected in one text buffer and
+ * the pointers into it are only set once the spectrum is complete, as the buffer may move while it grows.
+ */
+
+struct rlx_each_thread
+{
+	sqlite3 *db;
+	sqlite3_stmt *header;
+	sqlite3_stmt *datapoints;
+	sqlite3_stmt *metadata;
+	struct rlx_datapoint *points;
+	size_t points_size;
+	struct rlx_metadata *entries;
+	size_t entries_size;
+	char *text;
+	size_t text_size;
+	size_t text_length;
+};
+
+struct rlx_each_job
+{
+	struct rlxfile *file;
+	const struct rlx_project *project;
+	const int *ids;
+	int flags;
+	rlx_spectrum_fn fn;
+	void *userdata;
+	struct rlx_each_thread *threads;
+	atomic_int result;
+	atomic_bool stop;
+};
+
+static void rlx_each_fail(struct rlx_each_job *job, int error)
+{
+	int expected = RLX_ERR_SUCESS;
+	atomic_compare_exchange_strong(&job->result, &expected, error);
+	atomic_store(&job->stop, true);
+}
+
+static int rlx_each_prepare(struct rlx_each_job *job, struct rlx_each_thread *state, int thread)
+{
+	int ret = SQLITE_OK;
+	if(thread == 0) {
+		state->db = job->file->db;
+	}
+	else {
+		const char *path = sqlite3_db_filename(job->file->db, "main");
+		ret = sqlite3_open_v2(path, &state->db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, job->file->vfs);
+		if(ret != SQLITE_OK)
+			return ret;
+	}
+
+	const char *header = "SELECT groupname,fitted,lowfreqlimit,highfreqlimit,dateadded,datefitted FROM Files WHERE project_id=? AND ID=?";
+	const char *datapoints = "SELECT frequency,zreal,zimag FROM Datapoints WHERE file_id=?";
+	const char *metadata = "SELECT name,value FROM FileInformation WHERE file_id=?";
+	ret = sqlite3_prepare_v2(state->db, header, -1, &state->header, NULL);
+	if(ret == SQLITE_OK)
+		ret = sqlite3_prepare_v2(state->db, datapoints, -1, &state->datapoints, NULL);
+	if(ret == SQLITE_OK)
+		ret = sqlite3_prepare_v2(state->db, metadata, -1, &state->metadata, NULL);
+	return ret;
+}
+
+static void rlx_each_thread_free(struct rlx_each_thread *state, int thread)
+{
+	sqlite3_finalize(state->header);
+	sqlite3_finalize(state->datapoints);
+	sqlite3_finalize(state->metadata);
+	if(thread != 0 && state->db)
+		sqlite3_close(state->db);
+	free(state->points);
+	free(state->entries);
+	free(state->text);
+}
+
+/* Appends str to the text buffer and returns its offset, or -1 if out of memory */
+static ptrdiff_t rlx_each_text(struct rlx_each_thread *state, const char *str)
+{
+	if(!str)
+		str = "";
+	size_t length = strlen(str) + 1;
+	if(state->text_length + length > state->text_size) {
+		size_t size = state->text_size ? state->text_size : 256;
+		while(size < state->text_length + length)
+			size *= 2;
+		char *text = realloc(state->text, size);
+		if(!text)
+			return -1;
+		state->text = text;
+		state->text_size = size;
+	}
+	memcpy(state->text + state->text_length, str, length);
+	state->text_length += length;
+	return state->text_length - length;
+}
+
+/* Converts like the text based loaders do, so that all paths yield bit identical values */
+static double rlx_each_number(sqlite3_stmt *ppStmt, int col)
+{
+	const char *str = (const char*)sqlite3_column_text(ppStmt, col);
+	return str ? strtod(str, NULL) : NAN;
+}
+
+static time_t rlx_each_time(sqlite3_stmt *ppStmt, int col)
+{
+	const char *str = (const char*)sqlite3_column_text(ppStmt, col);
+	return str ? rlx_str_to_time(str) : 0;
+}
+
+static int rlx_each_datapoints(struct rlx_each_thread *state, int id, struct rlx_spectra *spectra)
+{
+	sqlite3_bind_int(state->datapoints, 1, id);
+	int ret;
+	while((ret = sqlite3_step(state->datapoints)) == SQLITE_ROW) {
+		if(spectra->length == state->points_size) {
+			size_t size = state->points_size ? state->points_size*2 : 128;
+			struct rlx_datapoint *points = realloc(state->points, sizeof(*points)*size);
+			if(!points) {
+				ret = RLX_ERR_OOM;
+				break;
+			}
+			state->points = points;
+			state->points_size = size;
+		}
+		struct rlx_datapoint *point = &state->points[spectra->length++];
+		point->omega = rlx_each_number(state->datapoints, 0)*2*M_PI;
+		point->re = rlx_each_number(state->datapoints, 1);
+		point->im = rlx_each_number(state->datapoints, 2);
+	}
+	sqlite3_reset(state->datapoints);
+	spectra->datapoints = spectra->length > 0 ? state->points : NULL;
+	return ret == SQLITE_DONE ? SQLITE_OK : ret;
+}
+
+static int rlx_each_metadata(struct rlx_each_thread *state, int id, struct rlx_spectra *spectra)
+{
+	sqlite3_bind_int(state->metadata, 1, id);
+	int ret;
+	while((ret = sqlite3_step(state->metadata)) == SQLITE_ROW) {
+		if(spectra->metadata_count == state->entries_size) {
+			size_t size = state->entries_size ? state->entries_size*2 : 32;
+			struct rlx_metadata *entries = realloc(state->entries, sizeof(*entries)*size);
+			if(!entries) {
+				ret = RLX_ERR_OOM;
+				break;
+			}
+			state->entries = entries;
+			state->entries_size = size;
+		}
+		struct rlx_metadata *entry = &state->entries[spectra->metadata_count];
+		ptrdiff_t key = rlx_each_text(state, (const char*)sqlite3_column_text(state->metadata, 0));
+		ptrdiff_t str = rlx_each_text(state, (const char*)sqlite3_column_text(state->metadata, 1));
+		if(key < 0 || str < 0) {
+			ret = RLX_ERR_OOM;
+			break;
+		}
+		/* offsets until the text buffer is final */
+		entry->key = (char*)key;
+		entry->str = (char*)str;
+		++spectra->metadata_count;
+	}
+	sqlite3_reset(state->metadata);
+	spectra->metadata = state->entries;
+	return ret == SQLITE_DONE ? SQLITE_OK : ret;
+}
+
+static void rlx_each_worker(size_t index, int thread, void *userdata)
+{
+	struct rlx_each_job *job = userdata;
+	if(atomic_load_explicit(&job->stop, memory_order_relaxed))
+		return;
+
+	struct rlx_each_thread *state = &job->threads[thread];
+	if(!state->header) {
+		int ret = rlx_each_prepare(job, state, thread);
+		if(ret != SQLITE_OK) {
+			rlx_each_fail(job, ret);
+			return;
+		}
+	}
+
+	int id = job->ids[index];
+	sqlite3_bind_int(state->header, 1, job->project->id);
+	sqlite3_bind_int(state->header, 2, id);
+	int ret = sqlite3_step(state->header);
+	if(ret != SQLITE_ROW) {
+		sqlite3_reset(state->header);
+		/* the spectrum was removed since the ids were read */
+		if(ret != SQLITE_DONE)
+			rlx_each_fail(job, ret);
+		return;
+	}
+
+	struct rlx_spectra spectra = {
+		.id = id,
+		.project_id = job->project->id,
+		.freq_lower_limit = rlx_each_number(state->header, 2),
+		.freq_upper_limit = rlx_each_number(state->header, 3),
+		.date_added = rlx_each_time(state->header, 4),
+		.date_fitted = rlx_each_time(state->header, 5),
+	};
+	const char *fitted = (const char*)sqlite3_column_text(state->header, 1);
+	spectra.fitted = fitted && fitted[0] == '1';
+	state->text_length = 0;
+	ptrdiff_t circuit = rlx_each_text(state, (const char*)sqlite3_column_text(state->header, 0));
+	sqlite3_reset(state->header);
+	if(circuit < 0) {
+		rlx_each_fail(job, RLX_ERR_OOM);
+		return;
+	}
+
+	struct rlx_perf_sample perf;
+	ret = SQLITE_OK;
+	if(!(job->flags & RLX_FOR_EACH_SKIP_DATAPOINTS)) {
+		rlx_perf_begin(job->file->perf, &perf);
+		ret = rlx_each_datapoints(state, id, &spectra);
+		rlx_perf_end(job->file->perf, RLX_PERF_DATAPOINTS, &perf);
+	}
+	if(ret == SQLITE_OK && !(job->flags & RLX_FOR_EACH_SKIP_METADATA)) {
+		rlx_perf_begin(job->file->perf, &perf);
+		ret = rlx_each_metadata(state, id, &spectra);
+		rlx_perf_end(job->file->perf, RLX_PERF_METADATA, &perf);
+	}
+	if(ret != SQLITE_OK) {
+		rlx_each_fail(job, ret);
+		return;
+	}
+
+	spectra.circuit = state->text + circuit;
+	for(size_t i = 0; i < spectra.metadata_count; ++i) {
+		struct rlx_metadata *entry = &spectra.metadata[i];
+		entry->key = state->text + (ptrdiff_t)entry->key;
+		entry->str = state->text + (ptrdiff_t)entry->str;
+		entry->type = sscanf(entry->str, "%lf", &entry->value) == 1 ? RLX_FIELD_TYPE_DOUBLE : RLX_FIELD_TYPE_STR;
+	}
+
+	if(!job->fn(&spectra, thread, job->userdata))
+		atomic_store(&job->stop, true);
+}
+
+static int rlx_for_each_spectrum_untraced(struct rlxfile* file, const struct rlx_project* project, int flags,
+                                          rlx_spectrum_fn fn, void* userdata, int threads)
+{
+	size_t count;
+	int *ids = rlx_get_spectra_ids_untraced(file, project, &count);
+	if(!ids)
+		return file->error;
+
+	threads = rlx_thread_count(threads);
+	struct rlx_each_job job = {
+		.file = file,
+		.project = project,
+		.ids = ids,
+		.flags = flags,
+		.fn = fn,
+		.userdata = userdata,
+		.threads = calloc(threads, sizeof(*job.threads)),
+	};
+	atomic_init(&job.result, RLX_ERR_SUCESS);
+	atomic_init(&job.stop, false);
+	if(!job.threads || rlx_parallel_for(count, threads, rlx_each_worker, &job) != 0)
+		rlx_each_fail(&job, RLX_ERR_OOM);
+
+	if(job.threads) {
+		for(int i = 0; i < threads; ++i)
+			rlx_each_thread_free(&job.threads[i], i);
+	}
+	free(job.threads);
+	free(ids);
+
+	int ret = atomic_load(&job.result);
+	if(ret != RLX_ERR_SUCESS)
+		file->error = ret;
+	return ret;
+}
+
+int rlx_for_each_spectrum(struct rlxfile* file, const struct rlx_project* project, int flags,
+                          rlx_spectrum_fn fn, void* userdata, int threads)
+{
+	uint64_t trace = rlx_trace_begin();
+	struct rlx_perf_sample perf;
+	rlx_perf_begin(file->perf, &perf);
+	int ret = rlx_for_each_spectrum_untraced(file, project, flags, fn, userdata, threads);
+	rlx_perf_end(file->perf, RLX_PERF_FOR_EACH_SPECTRUM, &perf);
+	rlx_trace_end(trace, RLX_CALL_FOR_EACH_SPECTRUM, file->trace_handle, project->id, flags, ret, NULL, 0);
+	return ret;
+}
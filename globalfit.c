@@ -0,0 +1,739 @@
+/*
+ * relaxisloader
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * relaxisloader is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * relaxisloader is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "relaxisloader.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "utils.h"
+#include "circuit.h"
+#include "fit.h"
+#include "rlxfile.h"
+#include "trace.h"
+
+/*
+ * In a global fit the residuals of a spectrum depend on its local parameters and on the global ones only,
+ * so the jacobian consists of one block A per spectrum for the local parameters and a column block B per spectrum
+ * for the global parameters:
+ *
+ *   | A1        B1 |        | U1       W1 |
+ *   |    A2     B2 |  J^TJ = |    U2    W2 |  with U = A^TA, W = A^TB, V = sum B^TB
+ *   |       A3  B3 |        | W1^T W2^T V  |
+ *
+ * The local steps are eliminated block by block, leaving the small reduced system
+ * (V - sum W^T U^-1 W) db = -gb + sum W^T U^-1 ga for the global step db, after which every local step is
+ * da = U^-1 (-ga - W db). Thus the cost of an iteration is linear in the amount of spectra and only the normal
+ * equation blocks are kept per spectrum, the jacobian of a spectrum is reduced as soon as it is computed.
+ * The blocks are computed in parallel and reduced in the order of the spectra, so results do not depend on the
+ * amount of threads.
+ */
+
+struct rlx_global_block
+{
+	const struct rlx_spectra *spectra;
+	struct rlx_fitparam **sorted;
+	double *params; // values of all parameters of the spectrum, the global ones are equal in every block
+	double *trial;
+	double *lower;
+	double *upper;
+	double *errors;
+	size_t *local; // indices of the free local parameters
+	size_t local_count;
+	double *u; // A^TA
+	double *w; // A^TB, local_count rows of global_count
+	double *v; // B^TB
+	double *ga; // A^Tr
+	double *gb; // B^Tr
+	double *scale;
+	double *factor; // cholesky factor of the scaled and damped u
+	double *y; // factor^-1 of the scaled w, global_count columns of local_count
+	double *z; // factor^-1 of the scaled ga
+	double *delta;
+	double *schur; // contribution of this block to the reduced system
+	double *schur_rhs;
+	double *storage;
+	size_t rows;
+	double cost;
+	bool factored;
+};
+
+struct rlx_global_fit
+{
+	const struct rlx_circuit *circuit;
+	const struct rlx_fit_options *options;
+	struct rlx_global_block *blocks;
+	size_t count;
+	size_t *global; // indices of the free global parameters
+	size_t global_count;
+	struct rlx_fit_workspace *workspaces;
+	bool trial;
+	bool jacobian;
+	double lambda;
+	double *global_scale;
+};
+
+static double rlx_clamp(double value, double lower, double upper)
+{
+	if(value < lower)
+		return lower;
+	if(value > upper)
+		return upper;
+	return value;
+}
+
+static void rlx_global_symmetrize(double *a, size_t n)
+{
+	for(size_t i = 0; i < n; ++i) {
+		for(size_t j = 0; j < i; ++j)
+			a[j*n+i] = a[i*n+j];
+	}
+}
+
+/* Evaluates the residuals of a block and, if requested, reduces its jacobian into the normal equation blocks */
+static void rlx_global_evaluate(size_t index, int thread, void *userdata)
+{
+	struct rlx_global_fit *fit = userdata;
+	struct rlx_global_block *b = &fit->blocks[index];
+	struct rlx_fit_workspace *ws = &fit->workspaces[thread];
+	const size_t n = fit->circuit->param_count;
+	const size_t nl = b->local_count;
+	const size_t ng = fit->global_count;
+
+	size_t points = rlx_fit_select_points(b->spectra, fit->options, ws);
+	b->rows = points*2;
+	b->cost = rlx_fit_residuals(fit->circuit, fit->trial ? b->trial : b->params, ws, points, ws->res,
+	                            fit->jacobian ? ws->jac : NULL);
+	if(!fit->jacobian)
+		return;
+
+	memset(b->u, 0, sizeof(*b->u)*nl*nl);
+	memset(b->w, 0, sizeof(*b->w)*nl*ng);
+	memset(b->v, 0, sizeof(*b->v)*ng*ng);
+	memset(b->ga, 0, sizeof(*b->ga)*nl);
+	memset(b->gb, 0, sizeof(*b->gb)*ng);
+	for(size_t r = 0; r < b->rows; ++r) {
+		const double *row = ws->jac + r*n;
+		const double res = ws->res[r];
+		for(size_t i = 0; i < nl; ++i) {
+			double a = row[b->local[i]];
+			b->ga[i] += a*res;
+			for(size_t j = 0; j <= i; ++j)
+				b->u[i*nl+j] += a*row[b->local[j]];
+			for(size_t k = 0; k < ng; ++k)
+				b->w[i*ng+k] += a*row[fit->global[k]];
+		}
+		for(size_t k = 0; k < ng; ++k) {
+			double g = row[fit->global[k]];
+			b->gb[k] += g*res;
+			for(size_t l = 0; l <= k; ++l)
+				b->v[k*ng+l] += g*row[fit->global[l]];
+		}
+	}
+	rlx_global_symmetrize(b->u, nl);
+	rlx_global_symmetrize(b->v, ng);
+}
+
+/*
+ * Factors the jacobi scaled local block damped with fit->lambda and computes the contribution of the block to the
+ * reduced system, the global columns are scaled with fit->global_scale.
+ */
+static void rlx_global_eliminate(size_t index, int thread, void *userdata)
+{
+	(void)thread;
+	struct rlx_global_fit *fit = userdata;
+	struct rlx_global_block *b = &fit->blocks[index];
+	const size_t nl = b->local_count;
+	const size_t ng = fit->global_count;
+	const double *t = fit->global_scale;
+
+	for(size_t i = 0; i < nl; ++i)
+		b->scale[i] = b->u[i*nl+i] > 0 ? 1/sqrt(b->u[i*nl+i]) : 1;
+	for(size_t i = 0; i < nl; ++i) {
+		for(size_t j = 0; j < nl; ++j)
+			b->factor[i*nl+j] = b->u[i*nl+j]*b->scale[i]*b->scale[j];
+		b->factor[i*nl+i] += fit->lambda*(b->u[i*nl+i] > 0 ? b->factor[i*nl+i] : 1);
+	}
+
+	b->factored = rlx_cholesky_decompose(b->factor, nl);
+	if(!b->factored)
+		return;
+
+	for(size_t i = 0; i < nl; ++i)
+		b->z[i] = b->ga[i]*b->scale[i];
+	rlx_cholesky_solve(b->factor, b->z, nl);
+	for(size_t k = 0; k < ng; ++k) {
+		double *column = b->y + k*nl;
+		for(size_t i = 0; i < nl; ++i)
+			column[i] = b->w[i*ng+k]*b->scale[i]*t[k];
+		rlx_cholesky_solve(b->factor, column, nl);
+	}
+
+	for(size_t k = 0; k < ng; ++k) {
+		double rhs = 0;
+		for(size_t i = 0; i < nl; ++i)
+			rhs += b->w[i*ng+k]*b->scale[i]*t[k]*b->z[i];
+		b->schur_rhs[k] = rhs;
+		for(size_t l = 0; l <= k; ++l) {
+			double sum = 0;
+			for(size_t i = 0; i < nl; ++i)
+				sum += b->w[i*ng+k]*b->scale[i]*t[k]*b->y[l*nl+i];
+			b->schur[k*ng+l] = sum;
+		}
+	}
+	rlx_global_symmetrize(b->schur, ng);
+}
+
+static double rlx_global_run(struct rlx_global_fit *fit, bool trial, bool jacobian, int threads)
+{
+	fit->trial = trial;
+	fit->jacobian = jacobian;
+	if(rlx_parallel_for(fit->count, threads, rlx_global_evaluate, fit) != 0)
+		return NAN;
+	double cost = 0;
+	for(size_t i = 0; i < fit->count; ++i)
+		cost += fit->blocks[i].cost;
+	return isfinite(cost) ? cost : INFINITY;
+}
+
+/*
+ * Sums the global normal equation blocks v and gb of all spectra into v and gb and sets the jacobi scale of the
+ * global parameters.
+ */
+static void rlx_global_reduce(struct rlx_global_fit *fit, double *v, double *gb)
+{
+	const size_t ng = fit->global_count;
+	memset(v, 0, sizeof(*v)*ng*ng);
+	memset(gb, 0, sizeof(*gb)*ng);
+	for(size_t i = 0; i < fit->count; ++i) {
+		for(size_t k = 0; k < ng*ng; ++k)
+			v[k] += fit->blocks[i].v[k];
+		for(size_t k = 0; k < ng; ++k)
+			gb[k] += fit->blocks[i].gb[k];
+	}
+	for(size_t k = 0; k < ng; ++k)
+		fit->global_scale[k] = v[k*ng+k] > 0 ? 1/sqrt(v[k*ng+k]) : 1;
+}
+
+/* Forms the reduced system into s, returns false if a block or s is not positive definite */
+static bool rlx_global_reduced_system(struct rlx_global_fit *fit, const double *v, double lambda, int threads, double *s)
+{
+	const size_t ng = fit->global_count;
+	const double *t = fit->global_scale;
+	fit->lambda = lambda;
+	if(rlx_parallel_for(fit->count, threads, rlx_global_eliminate, fit) != 0)
+		return false;
+
+	for(size_t k = 0; k < ng; ++k) {
+		for(size_t l = 0; l < ng; ++l)
+			s[k*ng+l] = v[k*ng+l]*t[k]*t[l];
+		s[k*ng+k] += lambda*(v[k*ng+k] > 0 ? s[k*ng+k] : 1);
+	}
+	for(size_t i = 0; i < fit->count; ++i) {
+		if(!fit->blocks[i].factored)
+			return false;
+		for(size_t k = 0; k < ng*ng; ++k)
+			s[k] -= fit->blocks[i].schur[k];
+	}
+	return rlx_cholesky_decompose(s, ng);
+}
+
+/* Computes the step of all blocks into their delta and the global step into db */
+static bool rlx_global_solve_step(struct rlx_global_fit *fit, const double *v, const double *gb, double lambda,
+                                  int threads, double *s, double *db)
+{
+	const size_t ng = fit->global_count;
+	if(!rlx_global_reduced_system(fit, v, lambda, threads, s))
+		return false;
+
+	for(size_t k = 0; k < ng; ++k) {
+		db[k] = -gb[k]*fit->global_scale[k];
+		for(size_t i = 0; i < fit->count; ++i)
+			db[k] += fit->blocks[i].schur_rhs[k];
+	}
+	rlx_cholesky_solve(s, db, ng);
+
+	for(size_t i = 0; i < fit->count; ++i) {
+		struct rlx_global_block *b = &fit->blocks[i];
+		const size_t nl = b->local_count;
+		for(size_t j = 0; j < nl; ++j) {
+			double step = -b->z[j];
+			for(size_t k = 0; k < ng; ++k)
+				step -= b->y[k*nl+j]*db[k];
+			b->delta[j] = step*b->scale[j];
+		}
+	}
+	for(size_t k = 0; k < ng; ++k)
+		db[k] *= fit->global_scale[k];
+	return true;
+}
+
+/* Sets the trial parameters of every block from the steps, returns false if no parameter moved */
+static bool rlx_global_apply_step(struct rlx_global_fit *fit, const double *db)
+{
+	bool moved = false;
+	for(size_t i = 0; i < fit->count; ++i) {
+		struct rlx_global_block *b = &fit->blocks[i];
+		memcpy(b->trial, b->params, sizeof(*b->params)*fit->circuit->param_count);
+		for(size_t j = 0; j < b->local_count; ++j) {
+			size_t p = b->local[j];
+			b->trial[p] = rlx_clamp(b->params[p] + b->delta[j], b->lower[p], b->upper[p]);
+			moved = moved || b->trial[p] != b->params[p];
+		}
+	}
+	const struct rlx_global_block *first = &fit->blocks[0];
+	for(size_t k = 0; k < fit->global_count; ++k) {
+		size_t p = fit->global[k];
+		double value = rlx_clamp(first->params[p] + db[k], first->lower[p], first->upper[p]);
+		moved = moved || value != first->params[p];
+		for(size_t i = 0; i < fit->count; ++i)
+			fit->blocks[i].trial[p] = value;
+	}
+	return moved;
+}
+
+/*
+ * The errors are the square roots of the diagonal of the inverse of J^TJ times the variance. For the global
+ * parameters this is the inverse of the reduced system, for the local parameters of a block
+ * U^-1 + U^-1 W S^-1 W^T U^-1, where U^-1 W is y.
+ */
+static void rlx_global_errors(struct rlx_global_fit *fit, const double *v, double variance, int threads,
+                              double *s, double *sinv)
+{
+	const size_t ng = fit->global_count;
+	if(!rlx_global_reduced_system(fit, v, 0, threads, s)) {
+		for(size_t i = 0; i < fit->count; ++i) {
+			struct rlx_global_block *b = &fit->blocks[i];
+			for(size_t j = 0; j < b->local_count; ++j)
+				b->errors[b->local[j]] = INFINITY;
+			for(size_t k = 0; k < ng; ++k)
+				b->errors[fit->global[k]] = INFINITY;
+		}
+		return;
+	}
+
+	for(size_t k = 0; k < ng; ++k) {
+		double *column = sinv + k*ng;
+		memset(column, 0, sizeof(*column)*ng);
+		column[k] = 1;
+		rlx_cholesky_solve(s, column, ng);
+	}
+
+	for(size_t i = 0; i < fit->count; ++i) {
+		struct rlx_global_block *b = &fit->blocks[i];
+		const size_t nl = b->local_count;
+		for(size_t j = 0; j < nl; ++j) {
+			memset(b->delta, 0, sizeof(*b->delta)*nl);
+			b->delta[j] = 1;
+			rlx_cholesky_solve(b->factor, b->delta, nl);
+			double diagonal = b->delta[j];
+			for(size_t k = 0; k < ng; ++k) {
+				for(size_t l = 0; l < ng; ++l)
+					diagonal += b->y[k*nl+j]*sinv[k*ng+l]*b->y[l*nl+j];
+			}
+			b->errors[b->local[j]] = sqrt(diagonal*variance)*b->scale[j];
+		}
+		for(size_t k = 0; k < ng; ++k)
+			b->errors[fit->global[k]] = sqrt(sinv[k*ng+k]*variance)*fit->global_scale[k];
+	}
+}
+
+static int rlx_global_lm(struct rlx_global_fit *fit, int threads, double *chi2, int *iterations)
+{
+	const size_t ng = fit->global_count;
+	const struct rlx_fit_options *options = fit->options;
+
+	double *storage = malloc(sizeof(*storage)*(ng*ng*3 + ng*3 + 1));
+	if(!storage)
+		return RLX_ERR_OOM;
+	double *v = storage;
+	double *s = v + ng*ng;
+	double *sinv = s + ng*ng;
+	double *gb = sinv + ng*ng;
+	double *db = gb + ng;
+	fit->global_scale = db + ng;
+
+	double cost = rlx_global_run(fit, false, true, threads);
+	size_t rows = 0;
+	size_t freeCount = ng;
+	for(size_t i = 0; i < fit->count; ++i) {
+		rows += fit->blocks[i].rows;
+		freeCount += fit->blocks[i].local_count;
+	}
+	if(isnan(cost)) {
+		free(storage);
+		return RLX_ERR_OOM;
+	}
+	if(rows <= freeCount) {
+		free(storage);
+		return RLX_ERR_NO_ENT;
+	}
+
+	double lambda = 1e-3;
+	int iteration = 0;
+	bool done = false;
+	while(!done && iteration < options->max_iterations) {
+		++iteration;
+		rlx_global_reduce(fit, v, gb);
+
+		bool accepted = false;
+		while(!accepted && lambda < 1e16) {
+			if(rlx_global_solve_step(fit, v, gb, lambda, threads, s, db)) {
+				if(!rlx_global_apply_step(fit, db)) {
+					done = true;
+					break;
+				}
+
+				double trialCost = rlx_global_run(fit, true, false, threads);
+				if(trialCost < cost) {
+					accepted = true;
+					done = cost - trialCost <= options->tolerance*cost;
+					cost = trialCost;
+					for(size_t i = 0; i < fit->count; ++i)
+						memcpy(fit->blocks[i].params, fit->blocks[i].trial, sizeof(double)*fit->circuit->param_count);
+					lambda = lambda/10 > 1e-12 ? lambda/10 : 1e-12;
+					break;
+				}
+			}
+			lambda *= 10;
+		}
+
+		if(!accepted)
+			done = true;
+		// residuals and normal equations at the current parameters
+		cost = rlx_global_run(fit, false, true, threads);
+		if(isnan(cost)) {
+			free(storage);
+			return RLX_ERR_OOM;
+		}
+	}
+
+	rlx_global_reduce(fit, v, gb);
+	double variance = cost/(rows - freeCount);
+	rlx_global_errors(fit, v, variance, threads, s, sinv);
+
+	if(chi2)
+		*chi2 = variance;
+	if(iterations)
+		*iterations = iteration;
+	free(storage);
+	return RLX_ERR_SUCESS;
+}
+
+/* Sets up the block of a spectrum, first is the block of the first spectrum or NULL for the first one itself */
+static int rlx_global_block_init(struct rlx_global_block *b, const struct rlx_global_block *first, const struct rlx_circuit *circuit,
+                                 const struct rlx_spectra *spectra, struct rlx_fitparam **initial, size_t global_count)
+{
+	const size_t n = circuit->param_count;
+	size_t length;
+	b->spectra = spectra;
+	b->sorted = rlx_fitparam_sorted_copy(initial, &length);
+	if(!b->sorted)
+		return RLX_ERR_OOM;
+	if(length != n)
+		return RLX_ERR_CIRCUIT;
+
+	const size_t ng = global_count;
+	const size_t nl = n;
+	b->storage = malloc(sizeof(*b->storage)*(n*5 + nl*nl*2 + nl*ng*2 + ng*ng*2 + nl*4 + ng*2 + 1));
+	b->local = malloc(sizeof(*b->local)*(n+1));
+	if(!b->storage || !b->local)
+		return RLX_ERR_OOM;
+
+	b->params = b->storage;
+	b->trial = b->params + n;
+	b->lower = b->trial + n;
+	b->upper = b->lower + n;
+	b->errors = b->upper + n;
+	b->u = b->errors + n;
+	b->factor = b->u + nl*nl;
+	b->w = b->factor + nl*nl;
+	b->y = b->w + nl*ng;
+	b->v = b->y + nl*ng;
+	b->schur = b->v + ng*ng;
+	b->ga = b->schur + ng*ng;
+	b->scale = b->ga + nl;
+	b->z = b->scale + nl;
+	b->delta = b->z + nl;
+	b->gb = b->delta + nl;
+	b->schur_rhs = b->gb + ng;
+
+	struct rlx_fitparam **reference = first ? first->sorted : b->sorted;
+	b->local_count = 0;
+	for(size_t i = 0; i < n; ++i) {
+		const struct rlx_fitparam *param = reference[i]->global ? reference[i] : b->sorted[i];
+		b->params[i] = param->value;
+		b->lower[i] = param->lower_limit;
+		b->upper[i] = param->upper_limit;
+		b->params[i] = rlx_clamp(b->params[i], b->lower[i], b->upper[i]);
+		b->errors[i] = 0;
+		if(!param->global && !param->fixed)
+			b->local[b->local_count++] = i;
+	}
+	return RLX_ERR_SUCESS;
+}
+
+static void rlx_global_block_free(struct rlx_global_block *b)
+{
+	free(b->sorted);
+	free(b->storage);
+	free(b->local);
+}
+
+static int rlx_global_results(struct rlx_global_fit *fit, struct rlx_fit_result **results)
+{
+	const size_t n = fit->circuit->param_count;
+	struct rlx_fitparam **reference = fit->blocks[0].sorted;
+	for(size_t i = 0; i < fit->count; ++i) {
+		struct rlx_global_block *b = &fit->blocks[i];
+		struct rlx_fit_result *result = results[i];
+		result->params = calloc(n+1, sizeof(*result->params));
+		if(!result->params)
+			return RLX_ERR_OOM;
+		for(size_t j = 0; j < n; ++j) {
+			struct rlx_fitparam *param = malloc(sizeof(*param));
+			if(!param)
+				return RLX_ERR_OOM;
+			*param = *b->sorted[j];
+			param->spectra_id = b->spectra->id;
+			param->name = rlx_strdup(b->sorted[j]->name);
+			if(!param->name) {
+				free(param);
+				return RLX_ERR_OOM;
+			}
+			param->global = reference[j]->global;
+			param->fixed = param->global ? reference[j]->fixed : param->fixed;
+			param->value = b->params[j];
+			param->error = b->errors[j];
+			result->params[j] = param;
+			result->param_count = j+1;
+		}
+	}
+	return RLX_ERR_SUCESS;
+}
+
+struct rlx_fit_result** rlx_fit_global(struct rlx_spectra** spectra, struct rlx_fitparam*** initial, size_t count,
+                                       const struct rlx_fit_options* options, int threads)
+{
+	struct rlx_fit_result **results = calloc(count+1, sizeof(*results));
+	if(!results)
+		return NULL;
+	for(size_t i = 0; i < count; ++i) {
+		results[i] = calloc(1, sizeof(**results));
+		if(!results[i]) {
+			rlx_fit_result_free_array(results);
+			return NULL;
+		}
+		results[i]->spectra_id = spectra[i]->id;
+	}
+	if(count == 0)
+		return results;
+
+	struct rlx_fit_options defaults;
+	if(!options) {
+		rlx_fit_options_default(&defaults);
+		options = &defaults;
+	}
+	threads = rlx_thread_count(threads);
+
+	int error = RLX_ERR_SUCESS;
+	double chi2 = 0;
+	int iterations = 0;
+	struct rlx_global_fit fit = {.options = options, .count = count};
+	struct rlx_circuit *circuit = spectra[0]->circuit ? rlx_circuit_compile(spectra[0]->circuit, NULL) : NULL;
+	fit.circuit = circuit;
+	fit.blocks = calloc(count, sizeof(*fit.blocks));
+	fit.workspaces = calloc(threads, sizeof(*fit.workspaces));
+	if(!fit.blocks || !fit.workspaces) {
+		error = RLX_ERR_OOM;
+		goto out;
+	}
+	if(!circuit) {
+		error = RLX_ERR_CIRCUIT;
+		goto out;
+	}
+
+	const size_t n = circuit->param_count;
+	fit.global = malloc(sizeof(*fit.global)*(n+1));
+	if(!fit.global) {
+		error = RLX_ERR_OOM;
+		goto out;
+	}
+
+	// the parameters flagged global in the first spectrum are shared by all
+	size_t length;
+	struct rlx_fitparam **sorted = rlx_fitparam_sorted_copy(initial[0], &length);
+	if(!sorted) {
+		error = RLX_ERR_OOM;
+		goto out;
+	}
+	for(size_t p = 0; p < length && length == n; ++p) {
+		if(sorted[p]->global && !sorted[p]->fixed)
+			fit.global[fit.global_count++] = p;
+	}
+	free(sorted);
+
+	size_t maxPoints = 0;
+	for(size_t i = 0; i < count && error == RLX_ERR_SUCESS; ++i) {
+		if(!spectra[i]->circuit || strcmp(spectra[i]->circuit, spectra[0]->circuit) != 0) {
+			error = RLX_ERR_CIRCUIT;
+			break;
+		}
+		error = rlx_global_block_init(&fit.blocks[i], i > 0 ? &fit.blocks[0] : NULL, circuit, spectra[i], initial[i], fit.global_count);
+		if(spectra[i]->length > maxPoints)
+			maxPoints = spectra[i]->length;
+	}
+	if(error != RLX_ERR_SUCESS)
+		goto out;
+
+	for(int i = 0; i < threads; ++i) {
+		if(!rlx_fit_workspace_reserve(&fit.workspaces[i], maxPoints, n, rlx_circuit_workspace_size(circuit))) {
+			error = RLX_ERR_OOM;
+			goto out;
+		}
+	}
+
+	error = rlx_global_lm(&fit, threads, &chi2, &iterations);
+	if(error == RLX_ERR_SUCESS)
+		error = rlx_global_results(&fit, results);
+
+out:
+	for(size_t i = 0; i < count; ++i) {
+		results[i]->error = error;
+		results[i]->chi2 = chi2;
+		results[i]->iterations = iterations;
+		if(error != RLX_ERR_SUCESS) {
+			if(results[i]->params)
+				rlx_fitparam_free_array(results[i]->params);
+			results[i]->params = NULL;
+			results[i]->param_count = 0;
+		}
+	}
+	for(size_t i = 0; fit.blocks && i < count; ++i)
+		rlx_global_block_free(&fit.blocks[i]);
+	for(int i = 0; fit.workspaces && i < threads; ++i)
+		rlx_fit_workspace_free(&fit.workspaces[i]);
+	free(fit.workspaces);
+	free(fit.blocks);
+	free(fit.global);
+	rlx_circuit_free(circuit);
+	return results;
+}
+
+static struct rlx_fit_result** rlx_fit_project_global_untraced(struct rlxfile* file, const struct rlx_project* project,
+                                                               const struct rlx_fit_options* options, int threads)
+{
+	// only the ids are grouped up front, the spectra and parameters are loaded one group at a time
+	size_t groupCount;
+	struct rlx_circuit_group **groups = rlx_get_spectra_grouped_by_circuit_untraced(file, project, false, &groupCount);
+	if(!groups)
+		return NULL;
+
+	size_t total = 0;
+	for(size_t i = 0; i < groupCount; ++i)
+		total += groups[i]->length;
+
+	struct rlx_fit_result **results = calloc(total+1, sizeof(*results));
+	size_t *paramCounts = calloc(total+1, sizeof(*paramCounts));
+	int *ids = calloc(total+1, sizeof(*ids));
+	size_t resultCount = 0;
+	if(!results || !paramCounts || !ids) {
+		file->error = RLX_ERR_OOM;
+		goto err;
+	}
+
+	for(size_t i = 0; i < groupCount; ++i) {
+		struct rlx_circuit_group *group = groups[i];
+		struct rlx_fitparam ***params = rlx_get_fit_parameters_many_untraced(file, group->ids, group->length, paramCounts);
+		if(!params)
+			goto err;
+
+		// spectra without parameters are not fitted
+		size_t count = 0;
+		for(size_t j = 0; j < group->length; ++j) {
+			if(paramCounts[j] == 0) {
+				rlx_fitparam_free_array(params[j]);
+				continue;
+			}
+			ids[count] = group->ids[j];
+			params[count] = params[j];
+			++count;
+		}
+		params[count] = NULL;
+
+		struct rlx_spectra **spectra = count > 0 ? rlx_get_spectra_many_untraced(file, project, ids, count) : NULL;
+		if(count > 0 && !spectra) {
+			for(size_t j = 0; j < count; ++j)
+				rlx_fitparam_free_array(params[j]);
+			free(params);
+			goto err;
+		}
+
+		// neither are spectra without datapoints
+		size_t fitCount = 0;
+		for(size_t j = 0; j < count; ++j) {
+			if(!spectra[j]->datapoints) {
+				rlx_spectra_free(spectra[j]);
+				rlx_fitparam_free_array(params[j]);
+				continue;
+			}
+			spectra[fitCount] = spectra[j];
+			params[fitCount] = params[j];
+			++fitCount;
+		}
+
+		struct rlx_fit_result **groupResults = fitCount > 0 ? rlx_fit_global(spectra, params, fitCount, options, threads) : NULL;
+		for(size_t j = 0; j < fitCount; ++j) {
+			rlx_spectra_free(spectra[j]);
+			rlx_fitparam_free_array(params[j]);
+		}
+		free(spectra);
+		free(params);
+		if(fitCount > 0 && !groupResults) {
+			file->error = RLX_ERR_OOM;
+			goto err;
+		}
+		for(size_t j = 0; j < fitCount; ++j)
+			results[resultCount++] = groupResults[j];
+		free(groupResults);
+	}
+
+	free(paramCounts);
+	free(ids);
+	rlx_circuit_group_free_array(groups);
+	return results;
+
+err:
+	if(results)
+		rlx_fit_result_free_array(results);
+	free(paramCounts);
+	free(ids);
+	rlx_circuit_group_free_array(groups);
+	return NULL;
+}
+
+struct rlx_fit_result** rlx_fit_project_global(struct rlxfile* file, const struct rlx_project* project,
+                                               const struct rlx_fit_options* options, int threads)
+{
+	uint64_t trace = rlx_trace_begin();
+	struct rlx_fit_result **results = rlx_fit_project_global_untraced(file, project, options, threads);
+	rlx_trace_end(trace, RLX_CALL_FIT_PROJECT_GLOBAL, file->trace_handle, project->id, threads,
+	              results ? RLX_ERR_SUCESS : file->error, options, options ? sizeof(*options) : 0);
+	return results;
+}
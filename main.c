@@ -16,14 +16,949 @@
  * with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <relaxisloader.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+#include "trace.h"
+
+static bool same_string(const char* a, const char* b)
+{
+	return a == b || (a && b && strcmp(a, b) == 0);
+}
+
+static bool same_spectra(const struct rlx_spectra* a, const struct rlx_spectra* b)
+{
+	if(a->id != b->id || a->project_id != b->project_id || a->fitted != b->fitted || a->length != b->length ||
+	   a->metadata_count != b->metadata_count || !same_string(a->circuit, b->circuit) ||
+	   a->freq_lower_limit != b->freq_lower_limit || a->freq_upper_limit != b->freq_upper_limit ||
+	   a->date_added != b->date_added || (a->fitted && a->date_fitted != b->date_fitted))
+		return false;
+	if(a->length > 0 && memcmp(a->datapoints, b->datapoints, sizeof(*a->datapoints)*a->length) != 0)
+		return false;
+	for(size_t i = 0; i < a->metadata_count; ++i) {
+		if(!same_string(a->metadata[i].key, b->metadata[i].key) || !same_string(a->metadata[i].str, b->metadata[i].str))
+			return false;
+	}
+	return true;
+}
+
+static bool same_spectra_arrays(struct rlx_spectra** a, struct rlx_spectra** b)
+{
+	size_t i = 0;
+	for(; a[i] && b[i]; ++i) {
+		if(!same_spectra(a[i], b[i]))
+			return false;
+	}
+	return !a[i] && !b[i];
+}
+
+static bool same_bits(double a, double b)
+{
+	return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+// compressed spectra must decompress to exactly the datapoints of the spectra reloaded from the file, also in parts
+static bool check_compress(struct rlxfile* file, const struct rlx_project* project)
+{
+	struct rlx_spectra **spectra = rlx_get_all_spectra(file, project);
+	if(!spectra)
+		return false;
+
+	bool ok = true;
+	for(size_t i = 0; spectra[i] && ok; ++i) {
+		struct rlx_compressed_spectra *cspectra = rlx_spectra_compress(spectra[i]);
+		rlx_spectra_free(spectra[i]);
+		spectra[i] = rlx_get_spectra(file, project, cspectra ? rlx_compressed_spectra_get_id(cspectra) : -1);
+		const size_t n = spectra[i] ? spectra[i]->length : 0;
+		double *values = malloc(sizeof(*values)*(n*3+1));
+		ok = cspectra && spectra[i] && values && rlx_compressed_spectra_get_length(cspectra) == n &&
+		     rlx_compressed_spectra_decompress(cspectra, 0, n, values, values + n, values + 2*n) == 0;
+		for(size_t j = 0; j < n && ok; ++j) {
+			const struct rlx_datapoint *dp = &spectra[i]->datapoints[j];
+			ok = same_bits(values[j], dp->re) && same_bits(values[n+j], dp->im) && same_bits(values[2*n+j], dp->omega);
+		}
+
+		// the second half alone, and a range past the end
+		ok = ok && rlx_compressed_spectra_decompress(cspectra, n/2, n - n/2, NULL, NULL, values) == 0;
+		for(size_t j = n/2; j < n && ok; ++j)
+			ok = same_bits(values[j - n/2], spectra[i]->datapoints[j].omega);
+		ok = ok && rlx_compressed_spectra_decompress(cspectra, n, 1, values, NULL, NULL) != 0;
+
+		free(values);
+		rlx_compressed_spectra_free(cspectra);
+	}
+	rlx_spectra_free_array(spectra);
+	return ok;
+}
+
+// rlx_get_spectra_many must load the same spectra as rlx_get_spectra, in the order of the ids given
+static bool check_spectra_many(struct rlxfile* file, const struct rlx_project* project)
+{
+	size_t idCount;
+	int *ids = rlx_get_spectra_ids(file, project, &idCount);
+	if(!ids)
+		return false;
+
+	// reversed, with the first id repeated at the end
+	int *request = malloc(sizeof(*request)*(idCount+1));
+	if(!request) {
+		free(ids);
+		return false;
+	}
+	for(size_t i = 0; i < idCount; ++i)
+		request[i] = ids[idCount-1-i];
+	request[idCount] = ids[0];
+
+	bool ok = true;
+	struct rlx_spectra **many = rlx_get_spectra_many(file, project, request, idCount+1);
+	for(size_t i = 0; many && i < idCount+1 && ok; ++i) {
+		struct rlx_spectra *spectra = rlx_get_spectra(file, project, request[i]);
+		ok = spectra && many[i] && same_spectra(spectra, many[i]);
+		rlx_spectra_free(spectra);
+	}
+	ok = ok && many && !many[idCount+1];
+	if(many)
+		rlx_spectra_free_array(many);
+
+	// a missing id fails the whole call
+	request[0] = -1;
+	many = rlx_get_spectra_many(file, project, request, 1);
+	ok = ok && !many && rlx_get_errnum(file) == RLX_ERR_NON_EXIST_SPECTRA;
+	if(many)
+		rlx_spectra_free_array(many);
+
+	free(request);
+	free(ids);
+	return ok;
+}
+
+// the directory must hold the same projects and spectra as the file
+static bool check_directory(struct rlxfile* file, struct rlx_project** projects, size_t projectCount)
+{
+	struct rlx_directory *dir = rlx_directory_acquire(file);
+	if(!dir)
+		return false;
+
+	size_t dirProjectCount;
+	const struct rlx_project *dirProjects = rlx_directory_get_projects(dir, &dirProjectCount);
+	bool ok = dirProjectCount == projectCount;
+	for(size_t i = 0; i < projectCount && ok; ++i) {
+		ok = dirProjects[i].id == projects[i]->id && same_string(dirProjects[i].name, projects[i]->name);
+
+		size_t idCount;
+		int *ids = rlx_get_spectra_ids(file, projects[i], &idCount);
+		struct rlx_spectra_headers headers;
+		ok = ok && ids && rlx_directory_get_headers(dir, projects[i]->id, &headers) == RLX_ERR_SUCESS &&
+		     headers.length == idCount;
+		for(size_t j = 0; j < idCount && ok; ++j) {
+			size_t index;
+			struct rlx_spectra_headers found;
+			ok = headers.id[j] == ids[j] && headers.project_id[j] == projects[i]->id &&
+			     rlx_directory_find_spectra(dir, ids[j], &found, &index) == RLX_ERR_SUCESS &&
+			     found.id[index] == ids[j] && found.project_id[index] == projects[i]->id;
+		}
+		// the headers of the first spectrum as rlx_get_spectra loads them
+		struct rlx_spectra *spectra = ok && idCount > 0 ? rlx_get_spectra(file, projects[i], headers.id[0]) : NULL;
+		ok = ok && (idCount == 0 || (spectra && headers.fitted[0] == spectra->fitted &&
+		     headers.freq_lower_limit[0] == spectra->freq_lower_limit &&
+		     headers.freq_upper_limit[0] == spectra->freq_upper_limit && headers.date_added[0] == spectra->date_added &&
+		     same_string(headers.circuit[0], spectra->circuit)));
+		rlx_spectra_free(spectra);
+		free(ids);
+	}
+
+	struct rlx_spectra_headers headers;
+	ok = ok && rlx_directory_find_spectra(dir, -1, &headers, NULL) != RLX_ERR_SUCESS;
+	ok = ok && rlx_directory_get_headers(dir, -1, &headers) != RLX_ERR_SUCESS;
+	rlx_directory_release(dir);
+	return ok;
+}
+
+// every spectrum of project in file must be the same as in other
+static bool check_same_project(struct rlxfile* file, struct rlxfile* other, const struct rlx_project* project)
+{
+	struct rlx_spectra **spectra = rlx_get_all_spectra(file, project);
+	struct rlx_spectra **otherSpectra = rlx_get_all_spectra(other, project);
+	bool ok = spectra && otherSpectra && same_spectra_arrays(spectra, otherSpectra);
+	if(spectra)
+		rlx_spectra_free_array(spectra);
+	if(otherSpectra)
+		rlx_spectra_free_array(otherSpectra);
+	return ok;
+}
+
+// the file at path must hold the same projects and spectra as file
+static bool check_same_file(struct rlxfile* file, struct rlx_project** projects, size_t projectCount, const char* path)
+{
+	struct rlxfile *copy = rlx_open_file(path, NULL);
+	size_t copyProjectCount = 0;
+	struct rlx_project **copyProjects = copy ? rlx_get_projects(copy, &copyProjectCount) : NULL;
+	bool ok = copyProjects && copyProjectCount == projectCount;
+	for(size_t i = 0; i < projectCount && ok; ++i)
+		ok = copyProjects[i]->id == projects[i]->id && check_same_project(file, copy, projects[i]);
+	if(copyProjects)
+		rlx_project_free_array(copyProjects);
+	if(copy)
+		rlx_close_file(copy);
+	return ok;
+}
+
+// extracting a project must yield a file with just that project and its spectra
+static bool check_extract(struct rlxfile* file, const struct rlx_project* project, const char* dir)
+{
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/extract.eis3", dir);
+	struct rlx_selection selection = {.projects = &project->id, .project_count = 1};
+	if(rlx_extract(file, &selection, path) != RLX_ERR_SUCESS)
+		return false;
+
+	bool ok = rlx_extract(file, &selection, path) == RLX_ERR_EXISTS;
+	struct rlxfile *extracted = rlx_open_file(path, NULL);
+	size_t projectCount = 0;
+	struct rlx_project **projects = extracted ? rlx_get_projects(extracted, &projectCount) : NULL;
+	ok = ok && projects && projectCount == 1 && projects[0]->id == project->id &&
+	     check_same_project(file, extracted, project);
+	if(projects)
+		rlx_project_free_array(projects);
+	if(extracted)
+		rlx_close_file(extracted);
+	remove(path);
+	return ok;
+}
+
+// applying the changesets of a file in order to an empty mirror must yield a copy of the file
+static bool check_changeset(struct rlxfile* file, struct rlx_project** projects, size_t projectCount, const char* dir)
+{
+	char state[4096];
+	char changeset[4096];
+	char mirror[4096];
+	snprintf(state, sizeof(state), "%s/state", dir);
+	snprintf(mirror, sizeof(mirror), "%s/mirror.eis3", dir);
+
+	bool ok = true;
+	// the second changeset contains no changes, but must still apply on top of the first
+	for(int generation = 0; generation < 2 && ok; ++generation) {
+		snprintf(changeset, sizeof(changeset), "%s/changeset%d", dir, generation);
+		ok = rlx_changeset_create(file, state, changeset) == RLX_ERR_SUCESS &&
+		     rlx_changeset_apply(mirror, changeset) == RLX_ERR_SUCESS;
+		// applying the changeset the mirror is at again changes nothing
+		ok = ok && rlx_changeset_apply(mirror, changeset) == RLX_ERR_SUCESS;
+	}
+	// while an older one is refused
+	snprintf(changeset, sizeof(changeset), "%s/changeset0", dir);
+	ok = ok && rlx_changeset_apply(mirror, changeset) == RLX_ERR_CHANGESET;
+	for(int generation = 0; generation < 2; ++generation) {
+		snprintf(changeset, sizeof(changeset), "%s/changeset%d", dir, generation);
+		remove(changeset);
+	}
+
+	ok = ok && check_same_file(file, projects, projectCount, mirror);
+	remove(mirror);
+	remove(state);
+	return ok;
+}
+
+// a spectrum viewed in place must be the same as the one serialized
+static bool check_wire(struct rlxfile* file, const struct rlx_project* project, int id)
+{
+	struct rlx_spectra *spectra = rlx_get_spectra(file, project, id);
+	size_t paramCount;
+	struct rlx_fitparam **params = rlx_get_fit_parameters(file, project, id, &paramCount);
+	if(!spectra || !params) {
+		rlx_spectra_free(spectra);
+		if(params)
+			rlx_fitparam_free_array(params);
+		return false;
+	}
+
+	size_t size = rlx_wire_serialize(spectra, params, NULL, 0);
+	void *buffer = malloc(size);
+	struct rlx_wire_view view;
+	bool ok = size > 0 && size % 8 == 0 && buffer && rlx_wire_serialize(spectra, params, buffer, size) == size &&
+	          rlx_wire_view(buffer, size, &view) == 0;
+	ok = ok && view.id == spectra->id && view.project_id == spectra->project_id && view.fitted == spectra->fitted &&
+	     view.freq_lower_limit == spectra->freq_lower_limit && view.freq_upper_limit == spectra->freq_upper_limit &&
+	     view.date_added == spectra->date_added && same_string(view.circuit, spectra->circuit) &&
+	     view.length == spectra->length && view.metadata_count == spectra->metadata_count &&
+	     view.param_count == paramCount && view.size == size &&
+	     (spectra->length == 0 || memcmp(view.datapoints, spectra->datapoints, sizeof(*view.datapoints)*view.length) == 0);
+	for(size_t i = 0; i < spectra->metadata_count && ok; ++i) {
+		struct rlx_metadata metadata;
+		rlx_wire_view_metadata(&view, i, &metadata);
+		ok = same_string(metadata.key, spectra->metadata[i].key) && same_string(metadata.str, spectra->metadata[i].str);
+	}
+	for(size_t i = 0; i < paramCount && ok; ++i) {
+		struct rlx_fitparam param;
+		rlx_wire_view_fitparam(&view, i, &param);
+		ok = param.p_index == params[i]->p_index && same_string(param.name, params[i]->name) &&
+		     param.value == params[i]->value && param.error == params[i]->error &&
+		     param.lower_limit == params[i]->lower_limit && param.upper_limit == params[i]->upper_limit &&
+		     param.fixed == params[i]->fixed && param.global == params[i]->global;
+	}
+
+	// a truncated buffer must be rejected
+	ok = ok && rlx_wire_view(buffer, size - 8, &view) == RLX_ERR_WIRE;
+
+	free(buffer);
+	rlx_spectra_free(spectra);
+	rlx_fitparam_free_array(params);
+	return ok;
+}
+
+// a released file must be handed out again by the pool
+static bool check_pool(const char* path)
+{
+	rlx_pool_clear();
+	struct rlx_pool_stats before;
+	rlx_pool_get_stats(&before);
+	struct rlxfile *file = rlx_pool_acquire(path, NULL);
+	if(!file)
+		return false;
+	rlx_pool_release(file);
+	struct rlxfile *again = rlx_pool_acquire(path, NULL);
+	struct rlxfile *other = rlx_pool_acquire(path, NULL);
+	struct rlx_pool_stats after;
+	rlx_pool_get_stats(&after);
+	bool ok = again == file && other && other != file &&
+	          after.hits == before.hits + 1 && after.misses == before.misses + 2 && after.idle == 0;
+	rlx_pool_release(again);
+	rlx_pool_release(other);
+	rlx_pool_clear();
+	rlx_pool_get_stats(&after);
+	return ok && after.idle == 0;
+}
+
+// a global fit of noise free spectra from perturbed starting values must recover the values they were generated with
+static bool check_global_fit(void)
+{
+	#define SPECTRA_COUNT 4
+	#define POINT_COUNT 40
+	const char *circuit = "R-(R)(C)";
+	const char *names[] = {"Resistance 1", "Resistance 2", "Capacitance 1"};
+	struct rlx_circuit *model = rlx_circuit_compile(circuit, NULL);
+	if(!model)
+		return false;
+
+	struct rlx_spectra spectra[SPECTRA_COUNT] = {0};
+	struct rlx_spectra *spectraPtrs[SPECTRA_COUNT+1] = {0};
+	struct rlx_datapoint datapoints[SPECTRA_COUNT][POINT_COUNT];
+	struct rlx_fitparam params[SPECTRA_COUNT][3];
+	struct rlx_fitparam *paramPtrs[SPECTRA_COUNT][4] = {{0}};
+	struct rlx_fitparam **initial[SPECTRA_COUNT];
+	double truth[SPECTRA_COUNT][3];
+	bool ok = true;
+	for(size_t i = 0; i < SPECTRA_COUNT && ok; ++i) {
+		// the series resistance is shared, the arc differs between the spectra
+		truth[i][0] = 100;
+		truth[i][1] = 1000*(i+1);
+		truth[i][2] = 1e-6/(i+1);
+		double omega[POINT_COUNT];
+		double re[POINT_COUNT];
+		double im[POINT_COUNT];
+		for(size_t j = 0; j < POINT_COUNT; ++j)
+			omega[j] = 2*M_PI*pow(10, -1 + 7.0*j/(POINT_COUNT-1));
+		ok = rlx_circuit_evaluate(model, truth[i], omega, POINT_COUNT, re, im) == 0;
+		for(size_t j = 0; j < POINT_COUNT; ++j)
+			datapoints[i][j] = (struct rlx_datapoint){.im = im[j], .re = re[j], .omega = omega[j]};
+
+		spectra[i].id = i+1;
+		spectra[i].datapoints = datapoints[i];
+		spectra[i].length = POINT_COUNT;
+		spectra[i].circuit = (char*)circuit;
+		spectraPtrs[i] = &spectra[i];
+		for(size_t j = 0; j < 3; ++j) {
+			params[i][j] = (struct rlx_fitparam){.spectra_id = i+1, .p_index = j, .name = (char*)names[j],
+			                                     .value = truth[i][j]*(j == 2 ? 0.6 : 1.5), .lower_limit = j == 2 ? 1e-15 : 0,
+			                                     .upper_limit = 1e15, .global = j == 0};
+			paramPtrs[i][j] = &params[i][j];
+		}
+		initial[i] = paramPtrs[i];
+	}
+	rlx_circuit_free(model);
+	if(!ok)
+		return false;
+
+	struct rlx_fit_result **results = rlx_fit_global(spectraPtrs, initial, SPECTRA_COUNT, NULL, 1);
+	if(!results)
+		return false;
+	for(size_t i = 0; i < SPECTRA_COUNT && ok; ++i) {
+		ok = results[i] && results[i]->error == 0 && results[i]->spectra_id == spectra[i].id && results[i]->param_count == 3;
+		for(size_t j = 0; j < 3 && ok; ++j)
+			ok = fabs(results[i]->params[j]->value/truth[i][j] - 1) < 1e-4;
+	}
+	ok = ok && !results[SPECTRA_COUNT];
+	rlx_fit_result_free_array(results);
+	return ok;
+	#undef SPECTRA_COUNT
+	#undef POINT_COUNT
+}
+
+// a memory budget every spectrum of project fits into, but that splits the project into several chunks
+static size_t chunk_budget(struct rlxfile* file, const struct rlx_project* project)
+{
+	rlx_set_memory_budget(file, 0);
+	struct rlx_spectra **spectra = rlx_get_all_spectra(file, project);
+	if(!spectra)
+		return 0;
+	rlx_spectra_free_array(spectra);
+
+	// raised to the size of every spectrum that does not fit
+	size_t budget = rlx_get_memory_required(file)/4;
+	rlx_set_memory_budget(file, budget);
+	int cursor = 0;
+	while((spectra = rlx_get_spectra_chunk(file, project, &cursor, NULL)) || rlx_get_errnum(file) == RLX_ERR_BUDGET) {
+		if(spectra) {
+			rlx_spectra_free_array(spectra);
+			continue;
+		}
+		budget = rlx_get_memory_required(file);
+		rlx_set_memory_budget(file, budget);
+	}
+	rlx_set_memory_budget(file, 0);
+	return budget;
+}
+
+// fitting a project chunk by chunk within a memory budget must give the same results as fitting its spectra one by one
+static bool check_fit_project(struct rlxfile* file, const struct rlx_project* project)
+{
+	size_t budget = chunk_budget(file, project);
+	rlx_set_memory_budget(file, budget);
+	struct rlx_fit_result **results = budget > 0 ? rlx_fit_project(file, project, NULL, 2) : NULL;
+	rlx_set_memory_budget(file, 0);
+	size_t idCount;
+	int *ids = rlx_get_spectra_ids(file, project, &idCount);
+	if(!results || !ids) {
+		if(results)
+			rlx_fit_result_free_array(results);
+		free(ids);
+		return false;
+	}
+
+	// only spectra with parameters and datapoints are fitted
+	bool ok = true;
+	size_t fitCount = 0;
+	for(size_t i = 0; i < idCount && ok; ++i) {
+		struct rlx_spectra *spectra = rlx_get_spectra(file, project, ids[i]);
+		size_t paramCount;
+		struct rlx_fitparam **params = rlx_get_fit_parameters(file, project, ids[i], &paramCount);
+		ok = spectra && params;
+		if(ok && paramCount > 0 && spectra->datapoints)
+			++fitCount;
+		rlx_spectra_free(spectra);
+		if(params)
+			rlx_fitparam_free_array(params);
+	}
+
+	size_t i = 0;
+	for(; ok && results[i]; ++i) {
+		struct rlx_spectra *spectra = rlx_get_spectra(file, project, results[i]->spectra_id);
+		struct rlx_fitparam **params = rlx_get_fit_parameters(file, project, results[i]->spectra_id, NULL);
+		struct rlx_fit_result *result = spectra && params ? rlx_fit_spectra(spectra, params, NULL) : NULL;
+		ok = result && result->error == results[i]->error && result->param_count == results[i]->param_count &&
+		     same_bits(result->chi2, results[i]->chi2);
+		for(size_t j = 0; ok && j < result->param_count; ++j)
+			ok = same_bits(result->params[j]->value, results[i]->params[j]->value);
+		rlx_fit_result_free(result);
+		rlx_spectra_free(spectra);
+		if(params)
+			rlx_fitparam_free_array(params);
+	}
+	ok = ok && i == fitCount;
+
+	rlx_fit_result_free_array(results);
+	free(ids);
+	return ok;
+}
+
+// the feature matrix of a project extracted within a memory budget must hold the features of every spectrum
+static bool check_features(struct rlxfile* file, const struct rlx_project* project)
+{
+	size_t budget = chunk_budget(file, project);
+	rlx_set_memory_budget(file, budget);
+	int *ids = NULL;
+	size_t length = 0;
+	double *matrix = budget > 0 ? rlx_get_project_features(file, project, 2, &ids, &length) : NULL;
+	rlx_set_memory_budget(file, 0);
+	size_t idCount = 0;
+	int *allIds = rlx_get_spectra_ids(file, project, &idCount);
+
+	bool ok = matrix && ids && allIds && length == idCount;
+	for(size_t i = 0; i < length && ok; ++i) {
+		struct rlx_spectra *spectra = rlx_get_spectra(file, project, ids[i]);
+		double features[RLX_FEATURE_COUNT];
+		ok = spectra != NULL;
+		if(ok)
+			rlx_spectra_features(spectra, features);
+		for(size_t f = 0; f < RLX_FEATURE_COUNT && ok; ++f)
+			ok = same_bits(matrix[f*length + i], features[f]);
+		rlx_spectra_free(spectra);
+	}
+	free(matrix);
+	free(ids);
+	free(allIds);
+	return ok;
+}
+
+static void count_spectra(const char* path, struct rlxfile* file, struct rlx_spectra* spectra, void* userdata)
+{
+	(void)path;
+	(void)file;
+	rlx_spectra_free(spectra);
+	++*(size_t*)userdata;
+}
+
+// a file appearing in a watched directory must be ingested once, with all of its spectra
+static bool check_watcher(struct rlxfile* file, const struct rlx_project* project, const char* dir)
+{
+	size_t ingested = 0;
+	struct rlx_watcher *watcher = rlx_watcher_create(dir, 50, false, count_spectra, &ingested, NULL);
+	if(!watcher)
+		return false;
+
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/watched.eis3", dir);
+	struct rlx_selection selection = {.projects = &project->id, .project_count = 1};
+	size_t idCount = 0;
+	int *ids = rlx_get_spectra_ids(file, project, &idCount);
+	bool ok = ids && rlx_extract(file, &selection, path) == RLX_ERR_SUCESS;
+	while(ok && ingested < idCount)
+		ok = rlx_watcher_run(watcher, 5000) > 0;
+	// nothing changed since
+	ok = ok && ingested == idCount && rlx_watcher_run(watcher, 200) == 0;
+
+	rlx_watcher_free(watcher);
+	remove(path);
+	free(ids);
+	return ok;
+}
+
+// every spectrum of a project must be in exactly one group, the one of its circuit, and loaded like by rlx_get_spectra
+static bool check_grouped(struct rlxfile* file, const struct rlx_project* project)
+{
+	size_t groupCount = 0;
+	struct rlx_circuit_group **groups = rlx_get_spectra_grouped_by_circuit(file, project, true, &groupCount);
+	size_t idCount = 0;
+	int *ids = rlx_get_spectra_ids(file, project, &idCount);
+	bool ok = groups && ids && groupCount > 0;
+
+	size_t total = 0;
+	for(size_t i = 0; i < groupCount && ok; ++i) {
+		const struct rlx_circuit_group *group = groups[i];
+		ok = group->spectra && (i == 0 || strcmp(groups[i-1]->circuit, group->circuit) < 0);
+		for(size_t j = 0; j < group->length && ok; ++j) {
+			struct rlx_spectra *spectra = rlx_get_spectra(file, project, group->ids[j]);
+			ok = (j == 0 || group->ids[j-1] < group->ids[j]) && spectra && group->spectra[j] &&
+			     same_spectra(spectra, group->spectra[j]) && same_string(spectra->circuit ? spectra->circuit : "", group->circuit);
+			rlx_spectra_free(spectra);
+		}
+		ok = ok && !group->spectra[group->length];
+		total += group->length;
+	}
+	ok = ok && !groups[groupCount] && total == idCount;
+
+	if(groups)
+		rlx_circuit_group_free_array(groups);
+	free(ids);
+	return ok;
+}
+
+// the headers of a project must match its spectra loaded one by one, with interned circuit strings
+static bool check_headers(struct rlxfile* file, const struct rlx_project* project)
+{
+	struct rlx_spectra_headers *headers = rlx_get_spectra_headers(file, project);
+	size_t idCount = 0;
+	int *ids = rlx_get_spectra_ids(file, project, &idCount);
+	bool ok = headers && ids && headers->length == idCount;
+	for(size_t i = 0; i < idCount && ok; ++i) {
+		struct rlx_spectra *spectra = rlx_get_spectra(file, project, headers->id[i]);
+		ok = (i == 0 || headers->id[i-1] < headers->id[i]) && spectra &&
+		     headers->project_id[i] == spectra->project_id && headers->fitted[i] == spectra->fitted &&
+		     headers->freq_lower_limit[i] == spectra->freq_lower_limit &&
+		     headers->freq_upper_limit[i] == spectra->freq_upper_limit && headers->date_added[i] == spectra->date_added &&
+		     (!spectra->fitted || headers->date_fitted[i] == spectra->date_fitted) &&
+		     same_string(headers->circuit[i], spectra->circuit);
+		for(size_t j = 0; j < i && ok; ++j)
+			ok = !same_string(headers->circuit[i], headers->circuit[j]) || headers->circuit[i] == headers->circuit[j];
+		rlx_spectra_free(spectra);
+	}
+	rlx_spectra_headers_free(headers);
+	free(ids);
+	return ok;
+}
+
+// every derived element must belong to a fitted spectrum of the project and satisfy 2*pi*f*C = 1/R for one
+// of its resistances, the conductivity times R is constant within a spectrum
+static bool check_quantities(struct rlxfile* file, const struct rlx_project* project)
+{
+	struct rlx_derived_quantities *quantities = rlx_get_project_quantities(file, project);
+	size_t idCount = 0;
+	int *ids = rlx_get_spectra_ids(file, project, &idCount);
+	bool ok = quantities && ids;
+	size_t id = 0;
+	struct rlx_fitparam **params = NULL;
+	for(size_t i = 0; ok && i < quantities->length; ++i) {
+		const double *value = NULL;
+		if(i == 0 || quantities->spectra_id[i] != quantities->spectra_id[i-1]) {
+			while(id < idCount && ids[id] < quantities->spectra_id[i])
+				++id;
+			if(params)
+				rlx_fitparam_free_array(params);
+			params = id < idCount && ids[id] == quantities->spectra_id[i] ?
+				rlx_get_fit_parameters(file, project, ids[id], NULL) : NULL;
+			ok = params && quantities->element[i] == 0;
+		}
+		else {
+			ok = quantities->element[i] == quantities->element[i-1] + 1;
+		}
+		double r = 1/(2*M_PI*quantities->value[RLX_QUANTITY_RELAXATION_FREQUENCY][i]*
+		              quantities->value[RLX_QUANTITY_CAPACITANCE][i]);
+		for(size_t j = 0; ok && params[j] && !value; ++j) {
+			if(strncmp(params[j]->name, "Resistance", strlen("Resistance")) == 0 &&
+			   fabs(params[j]->value - r) <= 1e-9*fabs(r))
+				value = &params[j]->value;
+		}
+		ok = ok && value;
+		double cond = quantities->value[RLX_QUANTITY_CONDUCTIVITY][i];
+		if(ok && quantities->element[i] > 0) {
+			double prev = quantities->value[RLX_QUANTITY_CONDUCTIVITY][i-1];
+			double prevR = 1/(2*M_PI*quantities->value[RLX_QUANTITY_RELAXATION_FREQUENCY][i-1]*
+			                  quantities->value[RLX_QUANTITY_CAPACITANCE][i-1]);
+			ok = isnan(cond) ? isnan(prev) : fabs(cond*r - prev*prevR) <= 1e-9*fabs(cond*r);
+		}
+	}
+	if(params)
+		rlx_fitparam_free_array(params);
+	rlx_derived_quantities_free(quantities);
+	free(ids);
+	return ok;
+}
+
+// results must be ordered by project, vtf with T0 = 0 must match arrhenius and an unknown parameter yields no projects
+static bool check_activation(struct rlxfile* file, struct rlx_project** projects, size_t projectCount)
+{
+	size_t length = 0;
+	size_t vtfLength = 0;
+	size_t noneLength = 1;
+	struct rlx_activation **arrhenius = rlx_get_activation_energies(file, "Resistance 1", RLX_LAW_ARRHENIUS, 0, &length);
+	struct rlx_activation **vtf = rlx_get_activation_energies(file, "Resistance 1", RLX_LAW_VTF, 0, &vtfLength);
+	struct rlx_activation **none = rlx_get_activation_energies(file, "No such parameter", RLX_LAW_ARRHENIUS, 0, &noneLength);
+	bool ok = arrhenius && vtf && none && length <= projectCount && vtfLength == length && noneLength == 0 &&
+	          !arrhenius[length] && !vtf[length] && !none[0];
+	size_t project = 0;
+	for(size_t i = 0; i < length && ok; ++i) {
+		while(project < projectCount && projects[project]->id != arrhenius[i]->project_id)
+			++project;
+		size_t idCount = 0;
+		int *ids = project < projectCount ? rlx_get_spectra_ids(file, projects[project], &idCount) : NULL;
+		ok = ids && vtf[i]->project_id == arrhenius[i]->project_id &&
+		     arrhenius[i]->error == vtf[i]->error && arrhenius[i]->points == vtf[i]->points && arrhenius[i]->points <= idCount &&
+		     (arrhenius[i]->error != RLX_ERR_SUCESS ||
+		      (arrhenius[i]->t0 == 0 && arrhenius[i]->activation_energy_error >= 0 && arrhenius[i]->log_prefactor_error >= 0 &&
+		       same_bits(arrhenius[i]->activation_energy, vtf[i]->activation_energy) &&
+		       same_bits(arrhenius[i]->log_prefactor, vtf[i]->log_prefactor)));
+		free(ids);
+		++project;
+	}
+	if(arrhenius)
+		rlx_activation_free_array(arrhenius);
+	if(vtf)
+		rlx_activation_free_array(vtf);
+	if(none)
+		rlx_activation_free_array(none);
+	return ok;
+}
+
+// the tiles of a project, rendered fresh or from a cache, must match its spectra rendered one by one
+static bool check_render(struct rlxfile* file, const struct rlx_project* project)
+{
+	struct rlx_tile_options options;
+	rlx_tile_options_default(&options);
+	options.plot = RLX_PLOT_BODE;
+	options.format = RLX_TILE_RGBA;
+	options.width = 64;
+	options.height = 48;
+	struct rlx_tile_cache *cache = rlx_tile_cache_create(1024);
+	struct rlx_tile **tiles = rlx_render_project(file, project, &options, cache, 2);
+	struct rlx_tile **cached = rlx_render_project(file, project, &options, cache, 2);
+	struct rlx_spectra **spectra = rlx_get_all_spectra(file, project);
+	bool ok = cache && tiles && cached && spectra;
+	size_t j = 0;
+	for(size_t i = 0; ok && spectra[i]; ++i) {
+		if(spectra[i]->length == 0)
+			continue;
+		struct rlx_tile *tile = rlx_render_spectra(spectra[i], &options);
+		const size_t size = (size_t)options.width*options.height*4;
+		ok = tile && tiles[j] && cached[j] && tile->rgba && !tile->png && tiles[j]->rgba && cached[j]->rgba &&
+		     tiles[j]->spectra_id == spectra[i]->id && cached[j]->spectra_id == spectra[i]->id &&
+		     tiles[j]->width == options.width && tiles[j]->height == options.height &&
+		     memcmp(tile->rgba, tiles[j]->rgba, size) == 0 && memcmp(tile->rgba, cached[j]->rgba, size) == 0;
+		rlx_tile_free(tile);
+		++j;
+	}
+	ok = ok && !tiles[j] && !cached[j];
+
+	// the default png tile
+	struct rlx_tile *tile = ok && spectra[0] ? rlx_render_spectra(spectra[0], NULL) : NULL;
+	ok = ok && (!spectra[0] || (tile && tile->width == 128 && tile->height == 96 &&
+	     (tile->rgba || (tile->png_size > 8 && memcmp(tile->png, "\x89PNG\r\n\x1a\n", 8) == 0))));
+	rlx_tile_free(tile);
+	if(tiles)
+		rlx_tile_free_array(tiles);
+	if(cached)
+		rlx_tile_free_array(cached);
+	if(spectra)
+		rlx_spectra_free_array(spectra);
+	rlx_tile_cache_free(cache);
+	return ok;
+}
+
+// bulk loads must fail above the budget, and the chunks of a project must add up to the whole project
+static bool check_budget(struct rlxfile* file, const struct rlx_project* project)
+{
+	rlx_set_memory_budget(file, 0);
+	struct rlx_spectra **all = rlx_get_all_spectra(file, project);
+	size_t required = rlx_get_memory_required(file);
+	bool ok = all && required > 0;
+
+	rlx_set_memory_budget(file, required - 1);
+	struct rlx_spectra **over = ok ? rlx_get_all_spectra(file, project) : NULL;
+	ok = ok && !over && rlx_get_errnum(file) == RLX_ERR_BUDGET && rlx_get_memory_required(file) == required;
+	rlx_set_memory_budget(file, required);
+	struct rlx_spectra **fits = ok ? rlx_get_all_spectra(file, project) : NULL;
+	ok = ok && fits && same_spectra_arrays(all, fits);
+	if(fits)
+		rlx_spectra_free_array(fits);
+
+	// a budget no spectrum fits into
+	int cursor = 0;
+	rlx_set_memory_budget(file, 1);
+	struct rlx_spectra **chunk = ok && all[0] ? rlx_get_spectra_chunk(file, project, &cursor, NULL) : NULL;
+	ok = ok && !chunk && (!all[0] || (rlx_get_errnum(file) == RLX_ERR_BUDGET && rlx_get_memory_required(file) > 1));
+
+	size_t budget = ok ? chunk_budget(file, project) : 0;
+	rlx_set_memory_budget(file, budget);
+	size_t index = 0;
+	size_t chunks = 0;
+	size_t length;
+	cursor = 0;
+	while(ok && (chunk = rlx_get_spectra_chunk(file, project, &cursor, &length))) {
+		ok = length > 0;
+		for(size_t i = 0; i < length && ok; ++i, ++index)
+			ok = all[index] && same_spectra(chunk[i], all[index]);
+		ok = ok && !chunk[length];
+		++chunks;
+		rlx_spectra_free_array(chunk);
+	}
+	ok = ok && rlx_get_errnum(file) == RLX_ERR_SUCESS && !all[index] && (index < 2 || chunks > 1);
+	rlx_set_memory_budget(file, 0);
+	if(all)
+		rlx_spectra_free_array(all);
+	return ok;
+}
+
+// a trace must record the calls made between rlx_trace_start and rlx_trace_stop in the order they completed
+static bool check_trace(const char* path, const char* dir)
+{
+	char tracePath[4096];
+	snprintf(tracePath, sizeof(tracePath), "%s/missing/trace", dir);
+	if(rlx_trace_start(tracePath) != RLX_ERR_NO_ENT)
+		return false;
+	snprintf(tracePath, sizeof(tracePath), "%s/trace", dir);
+	if(rlx_trace_start(tracePath) != RLX_ERR_SUCESS)
+		return false;
+
+	struct rlxfile *file = rlx_open_file(path, NULL);
+	struct rlx_project **projects = file ? rlx_get_projects(file, NULL) : NULL;
+	size_t idCount = 0;
+	int *ids = projects && projects[0] ? rlx_get_spectra_ids(file, projects[0], &idCount) : NULL;
+	struct rlx_spectra *spectra = ids && idCount > 0 ? rlx_get_spectra(file, projects[0], ids[0]) : NULL;
+	struct rlx_spectra *missing = spectra ? rlx_get_spectra(file, projects[0], -1) : NULL;
+	if(file)
+		rlx_close_file(file);
+	rlx_trace_stop();
+	struct rlxfile *untraced = rlx_open_file(path, NULL);
+	if(untraced)
+		rlx_close_file(untraced);
+	bool ok = spectra && !missing;
+
+	// call, project, arg and result of every record
+	const int project = ok ? projects[0]->id : 0;
+	const int expected[][4] = {
+		{RLX_CALL_OPEN, -1, 0, RLX_ERR_SUCESS},
+		{RLX_CALL_GET_PROJECTS, -1, 0, RLX_ERR_SUCESS},
+		{RLX_CALL_GET_SPECTRA_IDS, project, 0, RLX_ERR_SUCESS},
+		{RLX_CALL_GET_SPECTRA, project, ok ? ids[0] : 0, RLX_ERR_SUCESS},
+		{RLX_CALL_GET_SPECTRA, project, -1, RLX_ERR_NON_EXIST_SPECTRA},
+		{RLX_CALL_CLOSE, -1, 0, RLX_ERR_SUCESS},
+	};
+	const size_t expectedCount = sizeof(expected)/sizeof(*expected);
+	FILE *trace = fopen(tracePath, "rb");
+	struct rlx_trace_header header;
+	ok = ok && trace && fread(&header, sizeof(header), 1, trace) == 1 &&
+	     memcmp(header.magic, RLX_TRACE_MAGIC, sizeof(header.magic)) == 0 &&
+	     header.version == RLX_TRACE_VERSION && header.record_size == sizeof(struct rlx_trace_record);
+	size_t count = 0;
+	struct rlx_trace_record record;
+	uint32_t handle = 0;
+	while(ok && fread(&record, sizeof(record), 1, trace) == 1) {
+		char payload[4096] = {0};
+		ok = count < expectedCount && record.payload_size < sizeof(payload) &&
+		     fread(payload, 1, record.payload_size, trace) == record.payload_size &&
+		     record.call == expected[count][0] && record.project == expected[count][1] &&
+		     record.arg == expected[count][2] && record.result == expected[count][3] &&
+		     record.thread == 0 && (count == 0 || record.handle == handle) &&
+		     (record.call != RLX_CALL_OPEN || strcmp(payload, path) == 0);
+		handle = record.handle;
+		++count;
+	}
+	ok = ok && count == expectedCount;
+	if(trace)
+		fclose(trace);
+	unlink(tracePath);
+	rlx_spectra_free(spectra);
+	free(ids);
+	if(projects)
+		rlx_project_free_array(projects);
+	return ok;
+}
+
+// perf counters must count the calls of every section, nest inclusively and be reset to zero
+static bool check_perf(struct rlxfile* file, const char* path)
+{
+	struct rlx_perf_counters counters;
+	if(rlx_get_perf_counters(file, RLX_PERF_GET_SPECTRA, &counters) != RLX_ERR_NO_ENT)
+		return false;
+
+	struct rlxfile *perfFile = rlx_open_file_flags(path, RLX_OPEN_PERF_COUNTERS, NULL);
+	struct rlx_project **projects = perfFile ? rlx_get_projects(perfFile, NULL) : NULL;
+	size_t idCount = 0;
+	int *ids = projects && projects[0] ? rlx_get_spectra_ids(perfFile, projects[0], &idCount) : NULL;
+	bool ok = ids && idCount > 0;
+	for(int i = 0; i < 2 && ok; ++i) {
+		struct rlx_spectra *spectra = rlx_get_spectra(perfFile, projects[0], ids[0]);
+		ok = spectra;
+		rlx_spectra_free(spectra);
+	}
+
+	struct rlx_perf_counters spectra;
+	struct rlx_perf_counters datapoints;
+	ok = ok && rlx_get_perf_counters(perfFile, RLX_PERF_GET_SPECTRA, &spectra) == RLX_ERR_SUCESS &&
+	     rlx_get_perf_counters(perfFile, RLX_PERF_DATAPOINTS, &datapoints) == RLX_ERR_SUCESS &&
+	     spectra.calls == 2 && spectra.time_ns > 0 && datapoints.calls == 2 && datapoints.time_ns <= spectra.time_ns &&
+	     rlx_get_perf_counters(perfFile, RLX_PERF_GET_PROJECTS, &counters) == RLX_ERR_SUCESS && counters.calls == 1 &&
+	     rlx_get_perf_counters(perfFile, RLX_PERF_GET_ALL_SPECTRA, &counters) == RLX_ERR_SUCESS &&
+	     counters.calls == 0 && counters.valid == 0 &&
+	     rlx_get_perf_counters(perfFile, RLX_PERF_SECTION_COUNT, &counters) == RLX_ERR_NO_ENT;
+
+	rlx_reset_perf_counters(perfFile);
+	for(int i = 0; i < RLX_PERF_SECTION_COUNT && ok; ++i) {
+		ok = rlx_perf_section_name(i) && rlx_get_perf_counters(perfFile, i, &counters) == RLX_ERR_SUCESS &&
+		     counters.calls == 0 && counters.time_ns == 0;
+		for(int j = 0; j < i && ok; ++j)
+			ok = strcmp(rlx_perf_section_name(i), rlx_perf_section_name(j)) != 0;
+	}
+
+	free(ids);
+	if(projects)
+		rlx_project_free_array(projects);
+	if(perfFile)
+		rlx_close_file(perfFile);
+	return ok;
+}
+
+struct for_each_state
+{
+	struct rlx_spectra **spectra;
+	atomic_int *visits;
+	atomic_bool ok;
+	int flags;
+	int threads;
+	bool stop;
+};
+
+static bool compare_spectrum(const struct rlx_spectra* spectra, int thread, void* userdata)
+{
+	struct for_each_state *state = userdata;
+	size_t i = 0;
+	while(state->spectra[i] && state->spectra[i]->id != spectra->id)
+		++i;
+	struct rlx_spectra expected;
+	bool ok = state->spectra[i] && thread >= 0 && thread < state->threads;
+	if(ok) {
+		expected = *state->spectra[i];
+		if(state->flags & RLX_FOR_EACH_SKIP_DATAPOINTS) {
+			expected.length = 0;
+			ok = !spectra->datapoints;
+		}
+		if(state->flags & RLX_FOR_EACH_SKIP_METADATA) {
+			expected.metadata_count = 0;
+			ok = ok && !spectra->metadata;
+		}
+		ok = ok && same_spectra(&expected, spectra);
+		atomic_fetch_add(&state->visits[i], 1);
+	}
+	if(!ok)
+		atomic_store(&state->ok, false);
+	return !state->stop;
+}
+
+// every spectrum must be passed to the kernel exactly once as rlx_get_spectra loads it, also without datapoints and metadata
+static bool check_for_each(struct rlxfile* file, const struct rlx_project* project)
+{
+	struct for_each_state state = {.spectra = rlx_get_all_spectra(file, project), .threads = 3};
+	size_t count = 0;
+	while(state.spectra && state.spectra[count])
+		++count;
+	state.visits = malloc(sizeof(*state.visits)*(count+1));
+	bool ok = state.spectra && state.visits;
+	const int flags[] = {0, RLX_FOR_EACH_SKIP_DATAPOINTS | RLX_FOR_EACH_SKIP_METADATA};
+	for(size_t i = 0; i < sizeof(flags)/sizeof(*flags) && ok; ++i) {
+		for(size_t j = 0; j < count; ++j)
+			atomic_init(&state.visits[j], 0);
+		atomic_init(&state.ok, true);
+		state.flags = flags[i];
+		ok = rlx_for_each_spectrum(file, project, state.flags, compare_spectrum, &state, state.threads) == RLX_ERR_SUCESS &&
+		     atomic_load(&state.ok);
+		for(size_t j = 0; j < count && ok; ++j)
+			ok = atomic_load(&state.visits[j]) == 1;
+	}
+
+	// a kernel stopping the loop leaves every thread with at most one spectrum
+	size_t visited = 0;
+	if(ok) {
+		for(size_t j = 0; j < count; ++j)
+			atomic_init(&state.visits[j], 0);
+		state.flags = 0;
+		state.stop = true;
+		ok = rlx_for_each_spectrum(file, project, state.flags, compare_spectrum, &state, state.threads) == RLX_ERR_SUCESS &&
+		     atomic_load(&state.ok);
+		for(size_t j = 0; j < count; ++j)
+			visited += atomic_load(&state.visits[j]);
+	}
+	ok = ok && visited <= (size_t)state.threads && (count == 0 || visited > 0);
+
+	free(state.visits);
+	if(state.spectra)
+		rlx_spectra_free_array(state.spectra);
+	return ok;
+}
+
+static int check(const char* name, bool ok)
+{
+	printf("%s: %s\n", name, ok ? "ok" : "FAILED");
+	return ok ? 0 : 1;
+}
 
 int main(int argc, char** argv)
 {
 	if(argc < 2) {
-		printf("Usage %s [FILE]\n", argc == 1 ? argv[0] : "NULL");
+		printf("Usage %s [FILE] [COPY]\n", argc == 1 ? argv[0] : "NULL");
 		return 1;
 	}
 
@@ -88,10 +1023,45 @@ int main(int argc, char** argv)
 		free(ids);
 	}
 
+	// Check that the different ways of getting at the contents of the file agree
+	int failed = 0;
+	char dir[] = "/tmp/relaxisloader_testXXXXXX";
+	if(!mkdtemp(dir)) {
+		printf("Unable to create a temporary directory\n");
+		return 2;
+	}
+	size_t idCount;
+	int *ids = rlx_get_spectra_ids(file, projects[0], &idCount);
+	failed += check("compress", check_compress(file, projects[0]));
+	failed += check("spectra many", check_spectra_many(file, projects[0]));
+	failed += check("directory", check_directory(file, projects, projectCount));
+	failed += check("extract", check_extract(file, projects[0], dir));
+	failed += check("changeset", check_changeset(file, projects, projectCount, dir));
+	failed += check("wire", ids && idCount > 0 && check_wire(file, projects[0], ids[0]));
+	failed += check("pool", check_pool(argv[1]));
+	failed += check("global fit", check_global_fit());
+	failed += check("fit project", check_fit_project(file, projects[0]));
+	failed += check("features", check_features(file, projects[0]));
+	failed += check("watcher", check_watcher(file, projects[0], dir));
+	failed += check("grouped", check_grouped(file, projects[0]));
+	failed += check("headers", check_headers(file, projects[0]));
+	failed += check("quantities", check_quantities(file, projects[0]));
+	failed += check("activation", check_activation(file, projects, projectCount));
+	failed += check("render", check_render(file, projects[0]));
+	failed += check("budget", check_budget(file, projects[0]));
+	failed += check("trace", check_trace(argv[1], dir));
+	failed += check("perf", check_perf(file, argv[1]));
+	failed += check("for each", check_for_each(file, projects[0]));
+	// a copy of the file, eg. one rewritten by relaxisloader_optimize, must load the same
+	if(argc > 2)
+		failed += check("copy", check_same_file(file, projects, projectCount, argv[2]));
+	free(ids);
+	rmdir(dir);
+
 	// Free aquired structs
 	rlx_project_free_array(projects);
 
 	// Close RelaxIS3 file
 	rlx_close_file(file);
-	return 0;
+	return failed > 0 ? 5 : 0;
 }
@@ -0,0 +1,268 @@
+/*
+ * relaxisloader
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * relaxisloader is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * relaxisloader is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include "perf.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "rlxfile.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/perf_event.h>)
+#define RLX_HAVE_PERF_EVENT
+#endif
+#endif
+
+#ifdef RLX_HAVE_PERF_EVENT
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+/*
+ * Counters are per thread, as perf events opened for the calling thread only count while it runs. Every thread
+ * lazily opens one event group, so that all counters are read with a single read. Events the kernel refuses
+ * are left out of the group and reported as invalid.
+ */
+
+#define RLX_PERF_HW_COUNT (RLX_PERF_VALUE_COUNT-1)
+
+#ifdef RLX_HAVE_PERF_EVENT
+struct rlx_perf_thread
+{
+	int fd;
+	int fds[RLX_PERF_HW_COUNT];
+	int order[RLX_PERF_HW_COUNT];
+	int count;
+	unsigned int valid;
+};
+
+static pthread_key_t perf_key;
+static pthread_once_t perf_once = PTHREAD_ONCE_INIT;
+
+static void rlx_perf_thread_free(void* userdata)
+{
+	struct rlx_perf_thread *thread = userdata;
+	for(int i = 0; i < RLX_PERF_HW_COUNT; ++i) {
+		if(thread->fds[i] >= 0)
+			close(thread->fds[i]);
+	}
+	free(thread);
+}
+
+static void rlx_perf_key_create(void)
+{
+	pthread_key_create(&perf_key, rlx_perf_thread_free);
+}
+
+static int rlx_perf_event_open(uint32_t type, uint64_t config, int group)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, group, PERF_FLAG_FD_CLOEXEC);
+}
+
+static struct rlx_perf_thread* rlx_perf_thread_get(void)
+{
+	pthread_once(&perf_once, rlx_perf_key_create);
+	struct rlx_perf_thread *thread = pthread_getspecific(perf_key);
+	if(thread)
+		return thread;
+
+	thread = calloc(1, sizeof(*thread));
+	if(!thread)
+		return NULL;
+
+	static const struct {
+		uint32_t type;
+		uint64_t config;
+	} events[RLX_PERF_HW_COUNT] = {
+		{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+		{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+		{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+		{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+	};
+
+	thread->fd = -1;
+	for(int i = 0; i < RLX_PERF_HW_COUNT; ++i) {
+		thread->fds[i] = rlx_perf_event_open(events[i].type, events[i].config, thread->fd);
+		if(thread->fds[i] < 0)
+			continue;
+		if(thread->fd < 0)
+			thread->fd = thread->fds[i];
+		thread->order[thread->count++] = i;
+		thread->valid |= 1u << i;
+	}
+	if(thread->fd >= 0) {
+		ioctl(thread->fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(thread->fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+	pthread_setspecific(perf_key, thread);
+	return thread;
+}
+
+static void rlx_perf_read(uint64_t* values, unsigned int* valid)
+{
+	*valid = 0;
+	struct rlx_perf_thread *thread = rlx_perf_thread_get();
+	if(!thread || thread->fd < 0)
+		return;
+
+	uint64_t buffer[1+RLX_PERF_HW_COUNT];
+	ssize_t size = read(thread->fd, buffer, sizeof(buffer));
+	if(size < (ssize_t)sizeof(uint64_t) || buffer[0] != (uint64_t)thread->count)
+		return;
+	for(int i = 0; i < thread->count; ++i)
+		values[1+thread->order[i]] = buffer[1+i];
+	*valid = thread->valid;
+}
+#else
+static void rlx_perf_read(uint64_t* values, unsigned int* valid)
+{
+	(void)values;
+	*valid = 0;
+}
+#endif
+
+static uint64_t rlx_perf_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+struct rlx_perf* rlx_perf_create(void)
+{
+	struct rlx_perf *perf = calloc(1, sizeof(*perf));
+	if(!perf)
+		return NULL;
+	pthread_mutex_init(&perf->lock, NULL);
+	for(int i = 0; i < RLX_PERF_SECTION_COUNT; ++i)
+		perf->sections[i].valid = ~0u;
+	return perf;
+}
+
+void rlx_perf_free(struct rlx_perf* perf)
+{
+	if(!perf)
+		return;
+	pthread_mutex_destroy(&perf->lock);
+	free(perf);
+}
+
+void rlx_perf_begin(const struct rlx_perf* perf, struct rlx_perf_sample* sample)
+{
+	if(!perf)
+		return;
+	memset(sample->values, 0, sizeof(sample->values));
+	rlx_perf_read(sample->values, &sample->valid);
+	sample->values[0] = rlx_perf_now();
+}
+
+void rlx_perf_end(struct rlx_perf* perf, enum rlx_perf_section section, const struct rlx_perf_sample* sample)
+{
+	if(!perf)
+		return;
+	uint64_t end = rlx_perf_now();
+	uint64_t values[RLX_PERF_VALUE_COUNT] = {0};
+	unsigned int valid;
+	rlx_perf_read(values, &valid);
+	valid &= sample->valid;
+
+	pthread_mutex_lock(&perf->lock);
+	struct rlx_perf_counters *counters = &perf->sections[section];
+	++counters->calls;
+	counters->time_ns += end - sample->values[0];
+	counters->cycles += values[1] - sample->values[1];
+	counters->instructions += values[2] - sample->values[2];
+	counters->cache_misses += values[3] - sample->values[3];
+	counters->page_faults += values[4] - sample->values[4];
+	counters->valid &= valid;
+	pthread_mutex_unlock(&perf->lock);
+}
+
+int rlx_get_perf_counters(struct rlxfile* file, enum rlx_perf_section section, struct rlx_perf_counters* counters)
+{
+	if(!file->perf || section < 0 || section >= RLX_PERF_SECTION_COUNT)
+		return RLX_ERR_NO_ENT;
+	pthread_mutex_lock(&file->perf->lock);
+	*counters = file->perf->sections[section];
+	pthread_mutex_unlock(&file->perf->lock);
+	if(counters->calls == 0)
+		counters->valid = 0;
+	return RLX_ERR_SUCESS;
+}
+
+void rlx_reset_perf_counters(struct rlxfile* file)
+{
+	if(!file->perf)
+		return;
+	pthread_mutex_lock(&file->perf->lock);
+	memset(file->perf->sections, 0, sizeof(file->perf->sections));
+	for(int i = 0; i < RLX_PERF_SECTION_COUNT; ++i)
+		file->perf->sections[i].valid = ~0u;
+	pthread_mutex_unlock(&file->perf->lock);
+}
+
+const char* rlx_perf_section_name(enum rlx_perf_section section)
+{
+	switch(section)
+	{
+		case RLX_PERF_GET_PROJECTS:
+			return "rlx_get_projects";
+		case RLX_PERF_GET_SPECTRA:
+			return "rlx_get_spectra";
+		case RLX_PERF_GET_ALL_SPECTRA:
+			return "rlx_get_all_spectra";
+		case RLX_PERF_GET_SPECTRA_CHUNK:
+			return "rlx_get_spectra_chunk";
+		case RLX_PERF_GET_SPECTRA_MANY:
+			return "rlx_get_spectra_many";
+		case RLX_PERF_GET_SPECTRA_IDS:
+			return "rlx_get_spectra_ids";
+		case RLX_PERF_GET_GROUPED:
+			return "rlx_get_spectra_grouped_by_circuit";
+		case RLX_PERF_GET_FIT_PARAMETERS:
+			return "rlx_get_fit_parameters";
+		case RLX_PERF_GET_SPECTRA_HEADERS:
+			return "rlx_get_spectra_headers";
+		case RLX_PERF_SQLITE:
+			return "sqlite";
+		case RLX_PERF_DATAPOINTS:
+			return "datapoints";
+		case RLX_PERF_METADATA:
+			return "metadata";
+		case RLX_PERF_STR_TO_TIME:
+			return "str_to_time";
+		case RLX_PERF_FOR_EACH_SPECTRUM:
+			return "rlx_for_each_spectrum";
+		case RLX_PERF_SECTION_COUNT:
+		default:
+			return "Unkown";
+	}
+}
@@ -0,0 +1,45 @@
+/*
+ * relaxisloader
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * relaxisloader is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * relaxisloader is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <stdint.h>
+#include <pthread.h>
+#include "relaxisloader.h"
+
+#define RLX_PERF_VALUE_COUNT 5
+
+struct rlx_perf
+{
+	pthread_mutex_t lock;
+	struct rlx_perf_counters sections[RLX_PERF_SECTION_COUNT];
+};
+
+struct rlx_perf_sample
+{
+	uint64_t values[RLX_PERF_VALUE_COUNT];
+	unsigned int valid;
+};
+
+struct rlx_perf* rlx_perf_create(void);
+
+void rlx_perf_free(struct rlx_perf* perf);
+
+/* Both do nothing if perf is NULL, so that call sites need not check if a file has counters enabled */
+void rlx_perf_begin(const struct rlx_perf* perf, struct rlx_perf_sample* sample);
+
+void rlx_perf_end(struct rlx_perf* perf, enum rlx_perf_section section, const struct rlx_perf_sample* sample);
@@ -0,0 +1,263 @@
+/*
+ * relaxisloader
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * relaxisloader is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * relaxisloader is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include "relaxisloader.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "utils.h"
+#include "rlxfile.h"
+#include "trace.h"
+
+/*
+ * Idle handles are kept in a list ordered by the time they were released, most recent first. A handle is only
+ * handed out again if the file it was opened on still has the same device, inode, modification time and size,
+ * which a single stat checks. Idle handles of a path or inode whose file has changed are closed as soon as this
+ * is noticed, the remaining ones age out of the list. As the pool is expected to hold tens of handles the list
+ * is simply searched under the lock, the handles are opened and closed outside of it.
+ *
+ * Every handle opened by the pool owns its rlx_pool_entry, so that closing it with rlx_close_file is fine too.
+ */
+
+#define RLX_POOL_DEFAULT_CAPACITY 64
+
+struct rlx_pool_key
+{
+	dev_t dev;
+	ino_t ino;
+	int64_t mtime;
+	int64_t size;
+};
+
+struct rlx_pool_entry
+{
+	struct rlx_pool_key key;
+	char *path;
+	struct rlxfile *file;
+	struct rlx_pool_entry *prev;
+	struct rlx_pool_entry *next;
+};
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct rlx_pool_entry *pool_head;
+static struct rlx_pool_entry *pool_tail;
+static size_t pool_capacity = RLX_POOL_DEFAULT_CAPACITY;
+static struct rlx_pool_stats pool_stats;
+
+static int rlx_pool_stat(const char *path, struct rlx_pool_key *key)
+{
+	struct stat st;
+	if(stat(path, &st) != 0)
+		return -1;
+	key->dev = st.st_dev;
+	key->ino = st.st_ino;
+#ifdef __linux__
+	key->mtime = (int64_t)st.st_mtim.tv_sec*1000000000 + st.st_mtim.tv_nsec;
+#else
+	key->mtime = (int64_t)st.st_mtime*1000000000;
+#endif
+	key->size = st.st_size;
+	return 0;
+}
+
+static bool rlx_pool_key_equal(const struct rlx_pool_key *a, const struct rlx_pool_key *b)
+{
+	return a->dev == b->dev && a->ino == b->ino && a->mtime == b->mtime && a->size == b->size;
+}
+
+static void rlx_pool_unlink(struct rlx_pool_entry *entry)
+{
+	if(entry->prev)
+		entry->prev->next = entry->next;
+	else
+		pool_head = entry->next;
+	if(entry->next)
+		entry->next->prev = entry->prev;
+	else
+		pool_tail = entry->prev;
+	entry->prev = NULL;
+	entry->next = NULL;
+	--pool_stats.idle;
+}
+
+/* Moves the idle entries beyond the capacity to the list at evicted, the caller closes them once unlocked */
+static void rlx_pool_trim(size_t capacity, struct rlx_pool_entry **evicted)
+{
+	while(pool_stats.idle > capacity) {
+		struct rlx_pool_entry *entry = pool_tail;
+		rlx_pool_unlink(entry);
+		entry->next = *evicted;
+		*evicted = entry;
+		++pool_stats.evictions;
+	}
+}
+
+static void rlx_pool_close_list(struct rlx_pool_entry *entry)
+{
+	while(entry) {
+		struct rlx_pool_entry *next = entry->next;
+		rlx_close_file(entry->file);
+		entry = next;
+	}
+}
+
+void rlx_pool_file_close(struct rlxfile* file)
+{
+	if(!file->pool)
+		return;
+	free(file->pool->path);
+	free(file->pool);
+	file->pool = NULL;
+}
+
+static struct rlxfile* rlx_pool_acquire_untraced(const char* path, const char** error)
+{
+	struct rlx_pool_key key;
+	if(rlx_pool_stat(path, &key) != 0) {
+		if(error)
+			*error = sqlite3_errstr(SQLITE_CANTOPEN);
+		return NULL;
+	}
+
+	struct rlx_pool_entry *stale = NULL;
+	struct rlxfile *file = NULL;
+	pthread_mutex_lock(&pool_lock);
+	struct rlx_pool_entry *entry = pool_head;
+	while(entry) {
+		struct rlx_pool_entry *next = entry->next;
+		if(rlx_pool_key_equal(&entry->key, &key)) {
+			rlx_pool_unlink(entry);
+			file = entry->file;
+			break;
+		}
+		if((entry->key.dev == key.dev && entry->key.ino == key.ino) || strcmp(entry->path, path) == 0) {
+			rlx_pool_unlink(entry);
+			entry->next = stale;
+			stale = entry;
+			++pool_stats.evictions;
+		}
+		entry = next;
+	}
+	if(file)
+		++pool_stats.hits;
+	else
+		++pool_stats.misses;
+	pthread_mutex_unlock(&pool_lock);
+	rlx_pool_close_list(stale);
+
+	if(file) {
+		if(error)
+			*error = NULL;
+		return file;
+	}
+
+	file = rlx_open_file(path, error);
+	if(!file)
+		return NULL;
+	entry = calloc(1, sizeof(*entry));
+	if(entry)
+		entry->path = rlx_strdup(path);
+	if(!entry || !entry->path) {
+		free(entry);
+		rlx_close_file(file);
+		if(error)
+			*error = rlx_get_errnum_str(RLX_ERR_OOM);
+		return NULL;
+	}
+	entry->key = key;
+	entry->file = file;
+	file->pool = entry;
+	return file;
+}
+
+struct rlxfile* rlx_pool_acquire(const char* path, const char** error)
+{
+	uint64_t trace = rlx_trace_begin();
+	struct rlxfile *file = rlx_pool_acquire_untraced(path, error);
+	rlx_trace_end(trace, RLX_CALL_POOL_ACQUIRE, file ? file->trace_handle : 0, -1, 0,
+	              file ? RLX_ERR_SUCESS : RLX_ERR_NO_ENT, path, strlen(path));
+	return file;
+}
+
+static void rlx_pool_release_untraced(struct rlxfile* file)
+{
+	if(!file->pool) {
+		rlx_close_file(file);
+		return;
+	}
+
+	// the next user gets the handle as if it was just opened
+	file->error = RLX_ERR_SUCESS;
+	file->memory_budget = 0;
+	file->memory_required = 0;
+
+	struct rlx_pool_entry *entry = file->pool;
+	struct rlx_pool_entry *evicted = NULL;
+	pthread_mutex_lock(&pool_lock);
+	entry->prev = NULL;
+	entry->next = pool_head;
+	if(pool_head)
+		pool_head->prev = entry;
+	else
+		pool_tail = entry;
+	pool_head = entry;
+	++pool_stats.idle;
+	rlx_pool_trim(pool_capacity, &evicted);
+	pthread_mutex_unlock(&pool_lock);
+	rlx_pool_close_list(evicted);
+}
+
+void rlx_pool_release(struct rlxfile* file)
+{
+	if(!file)
+		return;
+	uint64_t trace = rlx_trace_begin();
+	uint32_t handle = file->trace_handle;
+	rlx_pool_release_untraced(file);
+	rlx_trace_end(trace, RLX_CALL_POOL_RELEASE, handle, -1, 0, RLX_ERR_SUCESS, NULL, 0);
+}
+
+void rlx_pool_set_capacity(size_t capacity)
+{
+	struct rlx_pool_entry *evicted = NULL;
+	pthread_mutex_lock(&pool_lock);
+	pool_capacity = capacity;
+	rlx_pool_trim(pool_capacity, &evicted);
+	pthread_mutex_unlock(&pool_lock);
+	rlx_pool_close_list(evicted);
+}
+
+void rlx_pool_clear(void)
+{
+	struct rlx_pool_entry *evicted = NULL;
+	pthread_mutex_lock(&pool_lock);
+	rlx_pool_trim(0, &evicted);
+	pthread_mutex_unlock(&pool_lock);
+	rlx_pool_close_list(evicted);
+}
+
+void rlx_pool_get_stats(struct rlx_pool_stats* stats)
+{
+	pthread_mutex_lock(&pool_lock);
+	*stats = pool_stats;
+	pthread_mutex_unlock(&pool_lock);
+}
@@ -0,0 +1,47 @@
+/*
+ * relaxisloader
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * relaxisloader is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * relaxisloader is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/*
+ * USDT probes of the provider relaxisloader. A probe compiles to a single nop that a tracer like bpftrace
+ * patches at runtime, so probe arguments should be values that are at hand anyway. Where sys/sdt.h is
+ * not available, eg. on windows, probes compile to nothing. See the bpftrace directory for the probes
+ * and their arguments.
+ */
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define RLX_HAVE_SDT
+#endif
+#endif
+
+#ifdef RLX_HAVE_SDT
+#define RLX_PROBE0(name) DTRACE_PROBE(relaxisloader, name)
+#define RLX_PROBE1(name, a) DTRACE_PROBE1(relaxisloader, name, a)
+#define RLX_PROBE2(name, a, b) DTRACE_PROBE2(relaxisloader, name, a, b)
+#define RLX_PROBE3(name, a, b, c) DTRACE_PROBE3(relaxisloader, name, a, b, c)
+#define RLX_PROBE4(name, a, b, c, d) DTRACE_PROBE4(relaxisloader, name, a, b, c, d)
+#else
+#define RLX_PROBE0(name) do {} while(0)
+#define RLX_PROBE1(name, a) do {(void)(a);} while(0)
+#define RLX_PROBE2(name, a, b) do {(void)(a); (void)(b);} while(0)
+#define RLX_PROBE3(name, a, b, c) do {(void)(a); (void)(b); (void)(c);} while(0)
+#define RLX_PROBE4(name, a, b, c, d) do {(void)(a); (void)(b); (void)(c); (void)(d);} while(0)
+#endif
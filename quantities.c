@@ -0,0 +1,358 @@
+/*
+ * relaxisloader
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * relaxisloader is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * relaxisloader is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "relaxisloader.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "utils.h"
+#include "rlxfile.h"
+#include "circuit.h"
+#include "trace.h"
+
+/*
+ * Quantities are derived for every resistor parallel to a cpe or capacitor in the circuit of every fitted spectrum.
+ * The fit parameters and metadata of the whole project are gathered with one query each into flat arrays,
+ * all elements are then evaluated in a single loop. Errors are propagated to first order assuming
+ * uncorrelated parameters, using the derivatives of the logarithm of each quantity.
+ */
+
+struct rlx_circuit_cache
+{
+	const char *str;
+	struct rlx_circuit *circuit;
+	struct rlx_rc_element *elements;
+	size_t element_count;
+};
+
+struct rlx_quantity_inputs
+{
+	double *r;
+	double *r_err;
+	double *q;
+	double *q_err;
+	double *n;
+	double *n_err;
+	double *area;
+	double *thickness;
+};
+
+const char* rlx_quantity_get_name(enum rlx_quantity quantity)
+{
+	switch(quantity)
+	{
+		case RLX_QUANTITY_CAPACITANCE:
+			return "Capacitance";
+		case RLX_QUANTITY_RELAXATION_FREQUENCY:
+			return "RelaxationFrequency";
+		case RLX_QUANTITY_CONDUCTIVITY:
+			return "Conductivity";
+		case RLX_QUANTITY_COUNT:
+		default:
+			return "Unkown";
+	}
+}
+
+void rlx_derived_quantities_free(struct rlx_derived_quantities* quantities)
+{
+	if(!quantities)
+		return;
+	free(quantities->spectra_id);
+	free(quantities->element);
+	for(size_t i = 0; i < RLX_QUANTITY_COUNT; ++i) {
+		free(quantities->value[i]);
+		free(quantities->error[i]);
+	}
+	free(quantities);
+}
+
+static void rlx_quantity_inputs_free(struct rlx_quantity_inputs *in)
+{
+	free(in->r);
+	free(in->r_err);
+	free(in->q);
+	free(in->q_err);
+	free(in->n);
+	free(in->n_err);
+	free(in->area);
+	free(in->thickness);
+}
+
+static struct rlx_circuit_cache *rlx_circuit_cache_get(struct rlx_circuit_cache *cache, size_t *count, const char *str)
+{
+	// circuit strings are interned, so comparing pointers suffices
+	for(size_t i = 0; i < *count; ++i) {
+		if(cache[i].str == str)
+			return &cache[i];
+	}
+
+	struct rlx_circuit_cache *entry = &cache[(*count)++];
+	entry->str = str;
+	entry->circuit = rlx_circuit_compile(str, NULL);
+	entry->elements = NULL;
+	entry->element_count = 0;
+	if(entry->circuit) {
+		entry->element_count = rlx_circuit_rc_elements(entry->circuit, NULL);
+		entry->elements = malloc(sizeof(*entry->elements)*(entry->element_count+1));
+		if(entry->elements)
+			rlx_circuit_rc_elements(entry->circuit, entry->elements);
+		else
+			entry->element_count = 0;
+	}
+	return entry;
+}
+
+static long rlx_find_index(const int *ids, size_t length, int id)
+{
+	size_t low = 0;
+	size_t high = length;
+	while(low < high) {
+		size_t mid = low + (high - low)/2;
+		if(ids[mid] < id)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low < length && ids[low] == id ? (long)low : -1;
+}
+
+/* Stores the value and error of every fit parameter of the project at the offset of its spectrum */
+static int rlx_load_project_params(struct rlxfile *file, int project_id, const struct rlx_spectra_headers *headers,
+                                   const size_t *offsets, const size_t *counts, double *values, double *errors)
+{
+	const char *req = "SELECT file_id,pindex,value,error FROM Fitparameters "
+		"WHERE file_id IN (SELECT ID FROM Files WHERE project_id=? AND fitted=1)";
+	sqlite3_stmt *ppStmt;
+	int ret = sqlite3_prepare_v2(file->db, req, -1, &ppStmt, NULL);
+	if(ret != SQLITE_OK)
+		return ret;
+	sqlite3_bind_int(ppStmt, 1, project_id);
+
+	while((ret = sqlite3_step(ppStmt)) == SQLITE_ROW) {
+		long spectrum = rlx_find_index(headers->id, headers->length, sqlite3_column_int(ppStmt, 0));
+		int pindex = sqlite3_column_int(ppStmt, 1);
+		if(spectrum < 0 || pindex < 0 || (size_t)pindex >= counts[spectrum])
+			continue;
+		values[offsets[spectrum] + pindex] = sqlite3_column_double(ppStmt, 2);
+		errors[offsets[spectrum] + pindex] = sqlite3_column_type(ppStmt, 3) == SQLITE_NULL ? 0 : sqlite3_column_double(ppStmt, 3);
+	}
+	sqlite3_finalize(ppStmt);
+	return ret == SQLITE_DONE ? SQLITE_OK : ret;
+}
+
+static int rlx_load_project_geometry(struct rlxfile *file, int project_id, const struct rlx_spectra_headers *headers,
+                                     double *area, double *thickness)
+{
+	const char *req = "SELECT file_id,name,value FROM FileInformation "
+		"WHERE name IN ('Area','Thickness') AND file_id IN (SELECT ID FROM Files WHERE project_id=?)";
+	sqlite3_stmt *ppStmt;
+	int ret = sqlite3_prepare_v2(file->db, req, -1, &ppStmt, NULL);
+	if(ret != SQLITE_OK)
+		return ret;
+	sqlite3_bind_int(ppStmt, 1, project_id);
+
+	while((ret = sqlite3_step(ppStmt)) == SQLITE_ROW) {
+		long spectrum = rlx_find_index(headers->id, headers->length, sqlite3_column_int(ppStmt, 0));
+		if(spectrum < 0)
+			continue;
+		const char *name = (const char*)sqlite3_column_text(ppStmt, 1);
+		if(strcmp(name, "Area") == 0)
+			area[spectrum] = sqlite3_column_double(ppStmt, 2);
+		else
+			thickness[spectrum] = sqlite3_column_double(ppStmt, 2);
+	}
+	sqlite3_finalize(ppStmt);
+	return ret == SQLITE_DONE ? SQLITE_OK : ret;
+}
+
+static void rlx_compute_quantities(const struct rlx_quantity_inputs *in, struct rlx_derived_quantities *out)
+{
+	double *cap = out->value[RLX_QUANTITY_CAPACITANCE];
+	double *capErr = out->error[RLX_QUANTITY_CAPACITANCE];
+	double *freq = out->value[RLX_QUANTITY_RELAXATION_FREQUENCY];
+	double *freqErr = out->error[RLX_QUANTITY_RELAXATION_FREQUENCY];
+	double *cond = out->value[RLX_QUANTITY_CONDUCTIVITY];
+	double *condErr = out->error[RLX_QUANTITY_CONDUCTIVITY];
+
+	for(size_t i = 0; i < out->length; ++i) {
+		const double r = in->r[i];
+		const double q = in->q[i];
+		const double n = in->n[i];
+		const double logRQ = log(r) + log(q);
+		const double rRel = in->r_err[i]/r;
+		const double qRel = in->q_err[i]/q;
+
+		// C = (Q*R^(1-n))^(1/n)
+		cap[i] = exp((log(q) + (1 - n)*log(r))/n);
+		const double dCdQ = 1/n;
+		const double dCdR = (1 - n)/n;
+		const double dCdn = -logRQ/(n*n);
+		capErr[i] = cap[i]*sqrt(dCdQ*dCdQ*qRel*qRel + dCdR*dCdR*rRel*rRel + dCdn*dCdn*in->n_err[i]*in->n_err[i]);
+
+		// f = 1/(2*pi*(R*Q)^(1/n))
+		freq[i] = exp(-logRQ/n)/(2*M_PI);
+		const double dfdn = logRQ/(n*n);
+		freqErr[i] = freq[i]*sqrt((qRel*qRel + rRel*rRel)/(n*n) + dfdn*dfdn*in->n_err[i]*in->n_err[i]);
+
+		// sigma = thickness/(R*area)
+		cond[i] = in->thickness[i]/(r*in->area[i]);
+		condErr[i] = fabs(cond[i])*rRel;
+	}
+}
+
+static struct rlx_derived_quantities *rlx_derived_quantities_alloc(size_t length)
+{
+	struct rlx_derived_quantities *out = calloc(1, sizeof(*out));
+	if(!out)
+		return NULL;
+	out->length = length;
+	out->spectra_id = malloc(sizeof(*out->spectra_id)*(length+1));
+	out->element = malloc(sizeof(*out->element)*(length+1));
+	bool oom = !out->spectra_id || !out->element;
+	for(size_t i = 0; i < RLX_QUANTITY_COUNT; ++i) {
+		out->value[i] = malloc(sizeof(*out->value[i])*(length+1));
+		out->error[i] = malloc(sizeof(*out->error[i])*(length+1));
+		oom = oom || !out->value[i] || !out->error[i];
+	}
+	if(oom) {
+		rlx_derived_quantities_free(out);
+		return NULL;
+	}
+	return out;
+}
+
+static struct rlx_derived_quantities* rlx_get_project_quantities_untraced(struct rlxfile* file, const struct rlx_project* project)
+{
+	struct rlx_spectra_headers *headers = rlx_get_spectra_headers_untraced(file, project);
+	if(!headers)
+		return NULL;
+
+	const size_t length = headers->length;
+	struct rlx_circuit_cache *cache = malloc(sizeof(*cache)*(length+1));
+	struct rlx_circuit_cache **circuits = calloc(length+1, sizeof(*circuits));
+	size_t *offsets = malloc(sizeof(*offsets)*(length+1));
+	size_t *counts = malloc(sizeof(*counts)*(length+1));
+	double *area = malloc(sizeof(*area)*(length+1));
+	double *thickness = malloc(sizeof(*thickness)*(length+1));
+	double *values = NULL;
+	double *errors = NULL;
+	struct rlx_quantity_inputs in = {0};
+	struct rlx_derived_quantities *out = NULL;
+	size_t cacheCount = 0;
+	int ret = RLX_ERR_OOM;
+
+	if(!cache || !circuits || !offsets || !counts || !area || !thickness)
+		goto out;
+
+	size_t paramCount = 0;
+	size_t rows = 0;
+	for(size_t i = 0; i < length; ++i) {
+		offsets[i] = paramCount;
+		counts[i] = 0;
+		area[i] = NAN;
+		thickness[i] = NAN;
+		if(!headers->fitted[i])
+			continue;
+		circuits[i] = rlx_circuit_cache_get(cache, &cacheCount, headers->circuit[i]);
+		if(!circuits[i]->circuit)
+			continue;
+		counts[i] = circuits[i]->circuit->param_count;
+		paramCount += counts[i];
+		rows += circuits[i]->element_count;
+	}
+
+	values = malloc(sizeof(*values)*(paramCount+1));
+	errors = malloc(sizeof(*errors)*(paramCount+1));
+	out = rlx_derived_quantities_alloc(rows);
+	in.r = malloc(sizeof(double)*(rows+1));
+	in.r_err = malloc(sizeof(double)*(rows+1));
+	in.q = malloc(sizeof(double)*(rows+1));
+	in.q_err = malloc(sizeof(double)*(rows+1));
+	in.n = malloc(sizeof(double)*(rows+1));
+	in.n_err = malloc(sizeof(double)*(rows+1));
+	in.area = malloc(sizeof(double)*(rows+1));
+	in.thickness = malloc(sizeof(double)*(rows+1));
+	if(!values || !errors || !out || !in.r || !in.r_err || !in.q || !in.q_err || !in.n || !in.n_err || !in.area || !in.thickness)
+		goto out;
+
+	for(size_t i = 0; i < paramCount; ++i) {
+		values[i] = NAN;
+		errors[i] = NAN;
+	}
+
+	ret = rlx_load_project_params(file, project->id, headers, offsets, counts, values, errors);
+	if(ret == SQLITE_OK)
+		ret = rlx_load_project_geometry(file, project->id, headers, area, thickness);
+	if(ret != SQLITE_OK)
+		goto out;
+
+	size_t row = 0;
+	for(size_t i = 0; i < length; ++i) {
+		if(counts[i] == 0)
+			continue;
+		const double *v = values + offsets[i];
+		const double *e = errors + offsets[i];
+		for(size_t j = 0; j < circuits[i]->element_count; ++j, ++row) {
+			const struct rlx_rc_element *element = &circuits[i]->elements[j];
+			out->spectra_id[row] = headers->id[i];
+			out->element[row] = j;
+			in.r[row] = v[element->resistance];
+			in.r_err[row] = e[element->resistance];
+			in.q[row] = v[element->capacitance];
+			in.q_err[row] = e[element->capacitance];
+			in.n[row] = element->cpe ? v[element->capacitance+1] : 1;
+			in.n_err[row] = element->cpe ? e[element->capacitance+1] : 0;
+			in.area[row] = area[i];
+			in.thickness[row] = thickness[i];
+		}
+	}
+	rlx_compute_quantities(&in, out);
+
+out:
+	if(ret != SQLITE_OK) {
+		file->error = ret;
+		rlx_derived_quantities_free(out);
+		out = NULL;
+	}
+	for(size_t i = 0; i < cacheCount; ++i) {
+		rlx_circuit_free(cache[i].circuit);
+		free(cache[i].elements);
+	}
+	rlx_quantity_inputs_free(&in);
+	free(cache);
+	free(circuits);
+	free(offsets);
+	free(counts);
+	free(area);
+	free(thickness);
+	free(values);
+	free(errors);
+	rlx_spectra_headers_free(headers);
+	return out;
+}
+
+struct rlx_derived_quantities* rlx_get_project_quantities(struct rlxfile* file, const struct rlx_project* project)
+{
+	uint64_t trace = rlx_trace_begin();
+	struct rlx_derived_quantities *quantities = rlx_get_project_quantities_untraced(file, project);
+	rlx_trace_end(trace, RLX_CALL_GET_PROJECT_QUANTITIES, file->trace_handle, project->id, 0,
+	              quantities ? RLX_ERR_SUCESS : file->error, NULL, 0);
+	return quantities;
+}
@@ -0,0 +1,678 @@
+/*
+ * relaxisloader
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * relaxisloader is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * relaxisloader is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "relaxisloader.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#ifdef RLX_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "utils.h"
+#include "rlxfile.h"
+#include "trace.h"
+
+/*
+ * Tiles are drawn with Xiaolin Wu's anti aliased lines blended over the background. For whole projects the
+ * datapoints of all spectra are decoded in one query into flat arrays while a fingerprint of every spectrum
+ * is hashed along, spectra whose fingerprint is in the cache are copied from there and the rest is rendered
+ * in parallel and then added to the cache.
+ */
+
+#define RLX_TILE_MARGIN 3.0f
+
+struct rlx_canvas
+{
+	unsigned char *rgba;
+	int width;
+	int height;
+	uint32_t color;
+};
+
+struct rlx_tile_cache_entry
+{
+	uint64_t last_use;
+	struct rlx_tile *tile;
+};
+
+struct rlx_tile_cache
+{
+	pthread_mutex_t lock;
+	size_t capacity;
+	size_t count;
+	uint64_t clock;
+	uint64_t *keys;
+	struct rlx_tile_cache_entry *entries;
+};
+
+void rlx_tile_options_default(struct rlx_tile_options* options)
+{
+	options->plot = RLX_PLOT_NYQUIST;
+	options->format = RLX_TILE_PNG;
+	options->width = 128;
+	options->height = 96;
+	options->background = 0xFFFFFFFF;
+	options->color = 0x1F77B4FF;
+	options->color2 = 0xD62728FF;
+}
+
+void rlx_tile_free(struct rlx_tile* tile)
+{
+	if(!tile)
+		return;
+	free(tile->rgba);
+	free(tile->png);
+	free(tile);
+}
+
+void rlx_tile_free_array(struct rlx_tile** tiles)
+{
+	struct rlx_tile** first = tiles;
+	while(*tiles) {
+		rlx_tile_free(*tiles);
+		++tiles;
+	}
+	free(first);
+}
+
+static struct rlx_tile *rlx_tile_copy(const struct rlx_tile *tile)
+{
+	struct rlx_tile *copy = malloc(sizeof(*copy));
+	if(!copy)
+		return NULL;
+	*copy = *tile;
+	copy->rgba = NULL;
+	copy->png = NULL;
+	if(tile->rgba) {
+		copy->rgba = malloc((size_t)tile->width*tile->height*4);
+		if(copy->rgba)
+			memcpy(copy->rgba, tile->rgba, (size_t)tile->width*tile->height*4);
+	}
+	if(tile->png) {
+		copy->png = malloc(tile->png_size);
+		if(copy->png)
+			memcpy(copy->png, tile->png, tile->png_size);
+	}
+	if((tile->rgba && !copy->rgba) || (tile->png && !copy->png)) {
+		rlx_tile_free(copy);
+		return NULL;
+	}
+	return copy;
+}
+
+static void rlx_canvas_plot(struct rlx_canvas *canvas, int x, int y, float coverage)
+{
+	if(x < 0 || y < 0 || x >= canvas->width || y >= canvas->height)
+		return;
+	unsigned char *pixel = canvas->rgba + ((size_t)y*canvas->width + x)*4;
+	const float alpha = coverage*(canvas->color & 0xFF)/255.0f;
+	for(int i = 0; i < 3; ++i) {
+		const float src = (canvas->color >> (24 - 8*i)) & 0xFF;
+		pixel[i] = pixel[i] + (src - pixel[i])*alpha + 0.5f;
+	}
+	pixel[3] = pixel[3] + (255 - pixel[3])*alpha + 0.5f;
+}
+
+static float rlx_fpart(float x)
+{
+	return x - floorf(x);
+}
+
+static void rlx_canvas_line(struct rlx_canvas *canvas, float x0, float y0, float x1, float y1)
+{
+	const bool steep = fabsf(y1 - y0) > fabsf(x1 - x0);
+	float tmp;
+	if(steep) {
+		tmp = x0; x0 = y0; y0 = tmp;
+		tmp = x1; x1 = y1; y1 = tmp;
+	}
+	if(x0 > x1) {
+		tmp = x0; x0 = x1; x1 = tmp;
+		tmp = y0; y0 = y1; y1 = tmp;
+	}
+
+	const float dx = x1 - x0;
+	const float gradient = dx == 0 ? 1 : (y1 - y0)/dx;
+
+	int xStart = roundf(x0);
+	int xEnd = roundf(x1);
+	float y = y0 + gradient*(xStart - x0);
+	for(int x = xStart; x <= xEnd; ++x) {
+		// the end points are weighted by how much of their pixel the line covers
+		float weight = 1;
+		if(x == xStart)
+			weight = 1 - rlx_fpart(x0 + 0.5f);
+		if(x == xEnd)
+			weight = xStart == xEnd ? dx : rlx_fpart(x1 + 0.5f);
+		const int yi = floorf(y);
+		const float frac = y - yi;
+		if(steep) {
+			rlx_canvas_plot(canvas, yi, x, (1 - frac)*weight);
+			rlx_canvas_plot(canvas, yi + 1, x, frac*weight);
+		}
+		else {
+			rlx_canvas_plot(canvas, x, yi, (1 - frac)*weight);
+			rlx_canvas_plot(canvas, x, yi + 1, frac*weight);
+		}
+		y += gradient;
+	}
+}
+
+static void rlx_canvas_polyline(struct rlx_canvas *canvas, const float *x, const float *y, size_t count, uint32_t color)
+{
+	canvas->color = color;
+	for(size_t i = 1; i < count; ++i)
+		rlx_canvas_line(canvas, x[i-1], y[i-1], x[i], y[i]);
+}
+
+/* Maps the finite range of values linearly to [low, high] of the tile */
+static void rlx_scale_axis(const double *values, size_t count, float *out, float low, float high, bool flip)
+{
+	double min = INFINITY;
+	double max = -INFINITY;
+	for(size_t i = 0; i < count; ++i) {
+		if(isfinite(values[i])) {
+			min = fmin(min, values[i]);
+			max = fmax(max, values[i]);
+		}
+	}
+	const double range = max > min ? max - min : 1;
+	const float scale = (high - low)/range;
+	for(size_t i = 0; i < count; ++i) {
+		const float pos = (values[i] - min)*scale;
+		out[i] = flip ? high - pos : low + pos;
+	}
+}
+
+static void rlx_draw_nyquist(struct rlx_canvas *canvas, const double *re, const double *im, size_t count, float *x, float *y,
+                             const struct rlx_tile_options *options)
+{
+	double reMin = INFINITY, reMax = -INFINITY, imMin = INFINITY, imMax = -INFINITY;
+	for(size_t i = 0; i < count; ++i) {
+		reMin = fmin(reMin, re[i]);
+		reMax = fmax(reMax, re[i]);
+		imMin = fmin(imMin, -im[i]);
+		imMax = fmax(imMax, -im[i]);
+	}
+
+	// both axes share one scale so that semicircles stay round
+	const float width = canvas->width - 2*RLX_TILE_MARGIN;
+	const float height = canvas->height - 2*RLX_TILE_MARGIN;
+	const double reRange = reMax > reMin ? reMax - reMin : 1;
+	const double imRange = imMax > imMin ? imMax - imMin : 1;
+	const float scale = fmin(width/reRange, height/imRange);
+	const float xOffset = RLX_TILE_MARGIN + (width - reRange*scale)/2;
+	const float yOffset = RLX_TILE_MARGIN + (height - imRange*scale)/2;
+	for(size_t i = 0; i < count; ++i) {
+		x[i] = xOffset + (re[i] - reMin)*scale;
+		y[i] = canvas->height - (yOffset + (-im[i] - imMin)*scale);
+	}
+	rlx_canvas_polyline(canvas, x, y, count, options->color);
+}
+
+static void rlx_draw_bode(struct rlx_canvas *canvas, const double *omega, const double *re, const double *im, size_t count,
+                          float *x, float *y, double *tmp, const struct rlx_tile_options *options)
+{
+	const float right = canvas->width - RLX_TILE_MARGIN;
+	const float bottom = canvas->height - RLX_TILE_MARGIN;
+
+	for(size_t i = 0; i < count; ++i)
+		tmp[i] = log10(omega[i]/(2*M_PI));
+	rlx_scale_axis(tmp, count, x, RLX_TILE_MARGIN, right, false);
+
+	for(size_t i = 0; i < count; ++i)
+		tmp[i] = log10(sqrt(re[i]*re[i] + im[i]*im[i]));
+	rlx_scale_axis(tmp, count, y, RLX_TILE_MARGIN, bottom, true);
+	rlx_canvas_polyline(canvas, x, y, count, options->color);
+
+	for(size_t i = 0; i < count; ++i)
+		tmp[i] = atan2(im[i], re[i]);
+	rlx_scale_axis(tmp, count, y, RLX_TILE_MARGIN, bottom, false);
+	rlx_canvas_polyline(canvas, x, y, count, options->color2);
+}
+
+#ifdef RLX_HAVE_ZLIB
+static unsigned char *rlx_png_chunk(unsigned char *out, const char *type, const unsigned char *data, uint32_t length)
+{
+	out[0] = length >> 24;
+	out[1] = length >> 16;
+	out[2] = length >> 8;
+	out[3] = length;
+	memcpy(out + 4, type, 4);
+	if(length)
+		memcpy(out + 8, data, length);
+	uint32_t crc = crc32(0, out + 4, length + 4);
+	out[8 + length] = crc >> 24;
+	out[9 + length] = crc >> 16;
+	out[10 + length] = crc >> 8;
+	out[11 + length] = crc;
+	return out + 12 + length;
+}
+
+/* Encodes an 8 bit RGBA png, every row uses the sub filter which suits mostly uniform tiles well */
+static unsigned char *rlx_png_encode(const unsigned char *rgba, int width, int height, size_t *size)
+{
+	const size_t stride = (size_t)width*4;
+	const size_t rawSize = (stride + 1)*height;
+	unsigned char *raw = malloc(rawSize);
+	uLongf compSize = compressBound(rawSize);
+	unsigned char *comp = malloc(compSize);
+	unsigned char *png = NULL;
+	if(!raw || !comp)
+		goto out;
+
+	for(int row = 0; row < height; ++row) {
+		unsigned char *dst = raw + row*(stride + 1);
+		const unsigned char *src = rgba + row*stride;
+		dst[0] = 1;
+		memcpy(dst + 1, src, 4);
+		for(size_t i = 4; i < stride; ++i)
+			dst[1 + i] = src[i] - src[i - 4];
+	}
+	if(compress2(comp, &compSize, raw, rawSize, Z_DEFAULT_COMPRESSION) != Z_OK)
+		goto out;
+
+	static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+	unsigned char header[13] = {width >> 24, width >> 16, width >> 8, width, height >> 24, height >> 16, height >> 8, height,
+	                            8, 6, 0, 0, 0};
+	*size = sizeof(signature) + 3*12 + sizeof(header) + compSize;
+	png = malloc(*size);
+	if(!png)
+		goto out;
+	memcpy(png, signature, sizeof(signature));
+	unsigned char *ptr = rlx_png_chunk(png + sizeof(signature), "IHDR", header, sizeof(header));
+	ptr = rlx_png_chunk(ptr, "IDAT", comp, compSize);
+	rlx_png_chunk(ptr, "IEND", NULL, 0);
+
+out:
+	free(raw);
+	free(comp);
+	return png;
+}
+#endif
+
+static struct rlx_tile *rlx_render(int id, const double *omega, const double *re, const double *im, size_t count,
+                                   const struct rlx_tile_options *options)
+{
+	struct rlx_tile *tile = calloc(1, sizeof(*tile));
+	if(!tile)
+		return NULL;
+	tile->spectra_id = id;
+	tile->width = options->width;
+	tile->height = options->height;
+
+	const size_t pixels = (size_t)options->width*options->height;
+	struct rlx_canvas canvas = {.rgba = malloc(pixels*4 + 1), .width = options->width, .height = options->height};
+	float *x = malloc(sizeof(*x)*(count+1));
+	float *y = malloc(sizeof(*y)*(count+1));
+	double *tmp = calloc(count+1, sizeof(*tmp));
+	if(!canvas.rgba || !x || !y || !tmp) {
+		free(canvas.rgba);
+		canvas.rgba = NULL;
+		goto out;
+	}
+
+	for(size_t i = 0; i < pixels; ++i) {
+		canvas.rgba[i*4] = options->background >> 24;
+		canvas.rgba[i*4+1] = options->background >> 16;
+		canvas.rgba[i*4+2] = options->background >> 8;
+		canvas.rgba[i*4+3] = options->background;
+	}
+
+	if(options->plot == RLX_PLOT_BODE)
+		rlx_draw_bode(&canvas, omega, re, im, count, x, y, tmp, options);
+	else
+		rlx_draw_nyquist(&canvas, re, im, count, x, y, options);
+
+#ifdef RLX_HAVE_ZLIB
+	if(options->format == RLX_TILE_PNG) {
+		tile->png = rlx_png_encode(canvas.rgba, canvas.width, canvas.height, &tile->png_size);
+		free(canvas.rgba);
+		canvas.rgba = NULL;
+	}
+#endif
+
+out:
+	free(x);
+	free(y);
+	free(tmp);
+	tile->rgba = canvas.rgba;
+	if(!tile->rgba && !tile->png) {
+		rlx_tile_free(tile);
+		return NULL;
+	}
+	return tile;
+}
+
+struct rlx_tile* rlx_render_spectra(const struct rlx_spectra* spectra, const struct rlx_tile_options* options)
+{
+	struct rlx_tile_options defaults;
+	if(!options) {
+		rlx_tile_options_default(&defaults);
+		options = &defaults;
+	}
+
+	double *values = malloc(sizeof(*values)*(spectra->length*3+1));
+	if(!values)
+		return NULL;
+	double *omega = values;
+	double *re = values + spectra->length;
+	double *im = values + spectra->length*2;
+	for(size_t i = 0; i < spectra->length; ++i) {
+		omega[i] = spectra->datapoints[i].omega;
+		re[i] = spectra->datapoints[i].re;
+		im[i] = spectra->datapoints[i].im;
+	}
+	struct rlx_tile *tile = rlx_render(spectra->id, omega, re, im, spectra->length, options);
+	free(values);
+	return tile;
+}
+
+struct rlx_tile_cache* rlx_tile_cache_create(size_t capacity)
+{
+	struct rlx_tile_cache *cache = calloc(1, sizeof(*cache));
+	if(!cache)
+		return NULL;
+	cache->capacity = capacity > 0 ? capacity : 1;
+	cache->keys = malloc(sizeof(*cache->keys)*cache->capacity);
+	cache->entries = malloc(sizeof(*cache->entries)*cache->capacity);
+	if(!cache->keys || !cache->entries) {
+		free(cache->keys);
+		free(cache->entries);
+		free(cache);
+		return NULL;
+	}
+	pthread_mutex_init(&cache->lock, NULL);
+	return cache;
+}
+
+void rlx_tile_cache_free(struct rlx_tile_cache* cache)
+{
+	if(!cache)
+		return;
+	for(size_t i = 0; i < cache->count; ++i)
+		rlx_tile_free(cache->entries[i].tile);
+	pthread_mutex_destroy(&cache->lock);
+	free(cache->keys);
+	free(cache->entries);
+	free(cache);
+}
+
+static struct rlx_tile *rlx_tile_cache_lookup(struct rlx_tile_cache *cache, uint64_t key, int id)
+{
+	struct rlx_tile *tile = NULL;
+	pthread_mutex_lock(&cache->lock);
+	for(size_t i = 0; i < cache->count; ++i) {
+		if(cache->keys[i] == key) {
+			cache->entries[i].last_use = ++cache->clock;
+			tile = rlx_tile_copy(cache->entries[i].tile);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&cache->lock);
+	if(tile)
+		tile->spectra_id = id;
+	return tile;
+}
+
+static void rlx_tile_cache_insert(struct rlx_tile_cache *cache, uint64_t key, const struct rlx_tile *tile)
+{
+	struct rlx_tile *copy = rlx_tile_copy(tile);
+	if(!copy)
+		return;
+
+	pthread_mutex_lock(&cache->lock);
+	size_t index = cache->count;
+	if(cache->count == cache->capacity) {
+		index = 0;
+		for(size_t i = 1; i < cache->count; ++i) {
+			if(cache->entries[i].last_use < cache->entries[index].last_use)
+				index = i;
+		}
+		rlx_tile_free(cache->entries[index].tile);
+	}
+	else {
+		++cache->count;
+	}
+	cache->keys[index] = key;
+	cache->entries[index].tile = copy;
+	cache->entries[index].last_use = ++cache->clock;
+	pthread_mutex_unlock(&cache->lock);
+}
+
+static uint64_t rlx_hash(uint64_t hash, const void *data, size_t length)
+{
+	const unsigned char *bytes = data;
+	for(size_t i = 0; i < length; ++i) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+static uint64_t rlx_options_hash(const struct rlx_tile_options *options)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+	int values[] = {options->plot, options->format, options->width, options->height};
+	uint32_t colors[] = {options->background, options->color, options->color2};
+	hash = rlx_hash(hash, values, sizeof(values));
+	return rlx_hash(hash, colors, sizeof(colors));
+}
+
+struct rlx_render_job
+{
+	const struct rlx_tile_options *options;
+	const int *ids;
+	const size_t *start;
+	const size_t *count;
+	const double *omega;
+	const double *re;
+	const double *im;
+	const size_t *pending;
+	struct rlx_tile **tiles;
+};
+
+static void rlx_render_worker(size_t index, int thread, void *userdata)
+{
+	(void)thread;
+	struct rlx_render_job *job = userdata;
+	size_t i = job->pending[index];
+	size_t start = job->start[i];
+	job->tiles[i] = rlx_render(job->ids[i], job->omega + start, job->re + start, job->im + start, job->count[i], job->options);
+}
+
+struct rlx_spectra_points
+{
+	size_t length;
+	size_t size;
+	double *omega;
+	double *re;
+	double *im;
+
+	size_t spectra_count;
+	size_t spectra_size;
+	int *ids;
+	size_t *start;
+	size_t *count;
+	uint64_t *keys;
+};
+
+static void rlx_spectra_points_free(struct rlx_spectra_points *points)
+{
+	free(points->omega);
+	free(points->re);
+	free(points->im);
+	free(points->ids);
+	free(points->start);
+	free(points->count);
+	free(points->keys);
+}
+
+static int rlx_spectra_points_add(struct rlx_spectra_points *points, int id, uint64_t key)
+{
+	if(points->spectra_count == points->spectra_size) {
+		size_t size = points->spectra_size ? points->spectra_size*2 : 64;
+		int *ids = realloc(points->ids, sizeof(*ids)*size);
+		if(ids)
+			points->ids = ids;
+		size_t *start = realloc(points->start, sizeof(*start)*size);
+		if(start)
+			points->start = start;
+		size_t *count = realloc(points->count, sizeof(*count)*size);
+		if(count)
+			points->count = count;
+		uint64_t *keys = realloc(points->keys, sizeof(*keys)*size);
+		if(keys)
+			points->keys = keys;
+		if(!ids || !start || !count || !keys)
+			return RLX_ERR_OOM;
+		points->spectra_size = size;
+	}
+	points->ids[points->spectra_count] = id;
+	points->start[points->spectra_count] = points->length;
+	points->count[points->spectra_count] = 0;
+	points->keys[points->spectra_count] = key;
+	++points->spectra_count;
+	return RLX_ERR_SUCESS;
+}
+
+static int rlx_spectra_points_push(struct rlx_spectra_points *points, double omega, double re, double im)
+{
+	if(points->length == points->size) {
+		size_t size = points->size ? points->size*2 : 4096;
+		double *newOmega = realloc(points->omega, sizeof(double)*size);
+		if(newOmega)
+			points->omega = newOmega;
+		double *newRe = realloc(points->re, sizeof(double)*size);
+		if(newRe)
+			points->re = newRe;
+		double *newIm = realloc(points->im, sizeof(double)*size);
+		if(newIm)
+			points->im = newIm;
+		if(!newOmega || !newRe || !newIm)
+			return RLX_ERR_OOM;
+		points->size = size;
+	}
+	points->omega[points->length] = omega;
+	points->re[points->length] = re;
+	points->im[points->length] = im;
+	++points->length;
+	++points->count[points->spectra_count-1];
+	return RLX_ERR_SUCESS;
+}
+
+static int rlx_decode_project(struct rlxfile *file, int project_id, uint64_t seed, struct rlx_spectra_points *points)
+{
+	const char *req = "SELECT file_id,frequency,zreal,zimag FROM Datapoints "
+		"WHERE file_id IN (SELECT ID FROM Files WHERE project_id=?) ORDER BY file_id,ID";
+	sqlite3_stmt *ppStmt;
+	int ret = sqlite3_prepare_v2(file->db, req, -1, &ppStmt, NULL);
+	if(ret != SQLITE_OK)
+		return ret;
+	sqlite3_bind_int(ppStmt, 1, project_id);
+
+	while((ret = sqlite3_step(ppStmt)) == SQLITE_ROW) {
+		int id = sqlite3_column_int(ppStmt, 0);
+		if(points->spectra_count == 0 || points->ids[points->spectra_count-1] != id) {
+			if(rlx_spectra_points_add(points, id, seed) != RLX_ERR_SUCESS) {
+				ret = RLX_ERR_OOM;
+				break;
+			}
+		}
+		double values[3] = {sqlite3_column_double(ppStmt, 1)*2*M_PI, sqlite3_column_double(ppStmt, 2),
+		                    sqlite3_column_double(ppStmt, 3)};
+		uint64_t *key = &points->keys[points->spectra_count-1];
+		*key = rlx_hash(*key, values, sizeof(values));
+		if(rlx_spectra_points_push(points, values[0], values[1], values[2]) != RLX_ERR_SUCESS) {
+			ret = RLX_ERR_OOM;
+			break;
+		}
+	}
+	sqlite3_finalize(ppStmt);
+	return ret == SQLITE_DONE ? SQLITE_OK : ret;
+}
+
+static struct rlx_tile** rlx_render_project_untraced(struct rlxfile* file, const struct rlx_project* project, const struct rlx_tile_options* options,
+                                                     struct rlx_tile_cache* cache, int threads)
+{
+	struct rlx_tile_options defaults;
+	if(!options) {
+		rlx_tile_options_default(&defaults);
+		options = &defaults;
+	}
+
+	struct rlx_spectra_points points = {0};
+	int ret = rlx_decode_project(file, project->id, rlx_options_hash(options), &points);
+	if(ret != SQLITE_OK) {
+		rlx_spectra_points_free(&points);
+		file->error = ret;
+		return NULL;
+	}
+
+	struct rlx_tile **tiles = calloc(points.spectra_count+1, sizeof(*tiles));
+	size_t *pending = malloc(sizeof(*pending)*(points.spectra_count+1));
+	if(!tiles || !pending) {
+		free(tiles);
+		free(pending);
+		rlx_spectra_points_free(&points);
+		file->error = RLX_ERR_OOM;
+		return NULL;
+	}
+
+	size_t pendingCount = 0;
+	for(size_t i = 0; i < points.spectra_count; ++i) {
+		if(cache)
+			tiles[i] = rlx_tile_cache_lookup(cache, points.keys[i], points.ids[i]);
+		if(!tiles[i])
+			pending[pendingCount++] = i;
+	}
+
+	struct rlx_render_job job = {.options = options, .ids = points.ids, .start = points.start, .count = points.count,
+	                             .omega = points.omega, .re = points.re, .im = points.im, .pending = pending, .tiles = tiles};
+	ret = rlx_parallel_for(pendingCount, threads, rlx_render_worker, &job);
+	for(size_t i = 0; i < pendingCount && ret == 0; ++i) {
+		if(!tiles[pending[i]])
+			ret = RLX_ERR_OOM;
+		else if(cache)
+			rlx_tile_cache_insert(cache, points.keys[pending[i]], tiles[pending[i]]);
+	}
+
+	free(pending);
+	rlx_spectra_points_free(&points);
+	if(ret != 0) {
+		for(size_t i = 0; i < points.spectra_count; ++i)
+			rlx_tile_free(tiles[i]);
+		free(tiles);
+		file->error = RLX_ERR_OOM;
+		return NULL;
+	}
+	return tiles;
+}
+
+struct rlx_tile** rlx_render_project(struct rlxfile* file, const struct rlx_project* project, const struct rlx_tile_options* options,
+                                     struct rlx_tile_cache* cache, int threads)
+{
+	uint64_t trace = rlx_trace_begin();
+	struct rlx_tile **tiles = rlx_render_project_untraced(file, project, options, cache, threads);
+	rlx_trace_end(trace, RLX_CALL_RENDER_PROJECT, file->trace_handle, project->id, threads, tiles ? RLX_ERR_SUCESS : file->error,
+	              options, options ? sizeof(*options) : 0);
+	return tiles;
+}
@@ -26,12 +26,13 @@
 #include <string.h>
 
 #include "utils.h"
+#include "rlxfile.h"
+#include "vfs.h"
+#include "trace.h"
+#include "perf.h"
+#include "probes.h"
 
-struct rlxfile
-{
-	int error;
-	sqlite3 *db;
-};
+#define RLX_PREFETCH_WINDOW 32
 
 const struct rlx_version_fixed rlx_get_version(void)
 {
@@ -112,58 +113,142 @@ void rlx_metadata_free(struct rlx_metadata* metadata)
 
 struct rlxfile* rlx_open_file(const char* path, const char** error)
 {
+	return rlx_open_file_flags(path, 0, error);
+}
+
+static struct rlxfile* rlx_open_file_untraced(const char* path, int flags, const char** error)
+{
+	const char *vfs = NULL;
+	if(rlx_vfs_is_zstd(path)) {
+		vfs = rlx_vfs_zstd();
+		if(!vfs) {
+			if(error)
+				*error = "Compressed files are not supported by this build";
+			return NULL;
+		}
+	}
+	else if(flags & RLX_OPEN_PREFETCH) {
+		vfs = rlx_vfs_uring();
+	}
+
 	struct rlxfile *file = calloc(1, sizeof(*file));
-	int ret = sqlite3_open_v2(path, &file->db, SQLITE_OPEN_READONLY, NULL);
+	if(!file) {
+		if(error)
+			*error = rlx_get_errnum_str(RLX_ERR_OOM);
+		return NULL;
+	}
+
+	int ret = sqlite3_open_v2(path, &file->db, SQLITE_OPEN_READONLY, vfs);
 	if(!(ret == SQLITE_OK || ret == SQLITE_DONE)) {
 		if(error)
 			*error = sqlite3_errstr(ret);
+		sqlite3_close(file->db);
 		free(file);
 		return NULL;
 	}
 
 	const char *req = "SELECT Value FROM Properties WHERE Name=\"DatabaseFormat\"";
-	sqlite3_stmt *ppStmt;
+	sqlite3_stmt *ppStmt = NULL;
+	const char *message = NULL;
 	ret = sqlite3_prepare_v2(file->db, req, strlen(req), &ppStmt, NULL);
 	if(ret != SQLITE_OK) {
-		if(error)
-			*error = "Unable to read file version";
-		return NULL;
+		message = "Unable to read file version";
+	}
+	else {
+		ret = sqlite3_step(ppStmt);
+		if((ret != SQLITE_OK && ret != SQLITE_DONE && ret != SQLITE_ROW) || sqlite3_column_count(ppStmt) != 1) {
+			message = "Unable to read file version, field missing";
+		}
+		else {
+			int version = sqlite3_column_int(ppStmt, 0);
+			if(version != 1 && version != 2)
+				message = "Unsupported file version";
+		}
 	}
+	sqlite3_finalize(ppStmt);
 
-	ret = sqlite3_step(ppStmt);
-	if((ret != SQLITE_OK && ret != SQLITE_DONE && ret != SQLITE_ROW) || sqlite3_column_count(ppStmt) != 1) {
-		if(error)
-			*error = "Unable to read file version, field missing";
+	if(error)
+		*error = message;
+	if(message) {
+		sqlite3_close(file->db);
+		free(file);
 		return NULL;
 	}
 
-	int version = sqlite3_column_int(ppStmt, 0);
-	if(version != 1 && version != 2) {
-		if(error)
-			*error = "Unsupported file version";
-		return NULL;
+	if(flags & RLX_OPEN_PERF_COUNTERS) {
+		file->perf = rlx_perf_create();
+		if(!file->perf) {
+			if(error)
+				*error = rlx_get_errnum_str(RLX_ERR_OOM);
+			sqlite3_close(file->db);
+			free(file);
+			return NULL;
+		}
 	}
 
-	if(error)
-		*error = NULL;
+	pthread_mutex_init(&file->directory_lock, NULL);
+	file->vfs = vfs;
+	file->trace_handle = rlx_trace_new_handle();
+	file->prefetch = (flags & RLX_OPEN_PREFETCH) && vfs && vfs == rlx_vfs_uring();
+	return file;
+}
 
-	sqlite3_finalize(ppStmt);
+struct rlxfile* rlx_open_file_flags(const char* path, int flags, const char** error)
+{
+	uint64_t trace = rlx_trace_begin();
+	struct rlxfile *file = rlx_open_file_untraced(path, flags, error);
+	RLX_PROBE3(open, path, file ? file->trace_handle : 0, flags);
+	rlx_trace_end(trace, RLX_CALL_OPEN, file ? file->trace_handle : 0, -1, flags,
+	              file ? RLX_ERR_SUCESS : RLX_ERR_NO_ENT, path, strlen(path));
 	return file;
 }
 
-void rlx_close_file(struct rlxfile* file)
+static void rlx_close_file_untraced(struct rlxfile* file)
 {
+	rlx_directory_file_close(file);
+	rlx_pool_file_close(file);
+	pthread_mutex_destroy(&file->directory_lock);
+	rlx_perf_free(file->perf);
 	sqlite3_close(file->db);
 	free(file);
 }
 
-struct rlx_project** rlx_get_projects(struct rlxfile* file, size_t* length)
+void rlx_close_file(struct rlxfile* file)
+{
+	uint64_t trace = rlx_trace_begin();
+	uint32_t handle = file->trace_handle;
+	RLX_PROBE1(close, handle);
+	rlx_close_file_untraced(file);
+	rlx_trace_end(trace, RLX_CALL_CLOSE, handle, -1, 0, RLX_ERR_SUCESS, NULL, 0);
+}
+
+static int rlx_get_table(struct rlxfile* file, int id, const char* req, char*** table, int* rows, int* cols, char** error)
+{
+	struct rlx_perf_sample perf;
+	RLX_PROBE3(query_start, file->trace_handle, id, req);
+	rlx_perf_begin(file->perf, &perf);
+	int ret = sqlite3_get_table(file->db, req, table, rows, cols, error);
+	rlx_perf_end(file->perf, RLX_PERF_SQLITE, &perf);
+	RLX_PROBE4(query_end, file->trace_handle, id, *rows, ret);
+	return ret;
+}
+
+static time_t rlx_file_str_to_time(struct rlxfile* file, const char* str)
+{
+	struct rlx_perf_sample perf;
+	rlx_perf_begin(file->perf, &perf);
+	time_t time = str ? rlx_str_to_time(str) : 0;
+	rlx_perf_end(file->perf, RLX_PERF_STR_TO_TIME, &perf);
+	return time;
+}
+
+static struct rlx_project** rlx_get_projects_untraced(struct rlxfile* file, size_t* length)
 {
 	char **table;
 	int rows;
 	int cols;
 	char *error;
-	int ret = sqlite3_get_table(file->db, "SELECT ID,NAME,DATE FROM Projects", &table, &rows, &cols, &error);
+	int ret = rlx_get_table(file, -1, "SELECT ID,NAME,DATE FROM Projects", &table, &rows, &cols, &error);
 
 	if(ret != SQLITE_OK) {
 		file->error = ret;
@@ -174,36 +259,56 @@ struct rlx_project** rlx_get_projects(struct rlxfile* file, size_t* length)
 	}
 	rows++;
 
+	if(length)
+		*length = 0;
+
 	if(cols != 3) {
 		sqlite3_free_table(table);
 		file->error = RLX_ERR_FMT;
 		return NULL;
 	}
 
-	struct rlx_project **projects = malloc(sizeof(*projects)*(rows));
+	struct rlx_project **projects = calloc(rows, sizeof(*projects));
 	if(!projects) {
 		sqlite3_free_table(table);
 		file->error = RLX_ERR_OOM;
 		return NULL;
 	}
 
-	if(length)
-		*length = rows-1;
-
 	for(int i = 1; i < rows; ++i) {
 		projects[i-1] = malloc(sizeof(struct rlx_project));
-		assert(projects[i-1]);
-		projects[i-1]->name = rlx_strdup(table[i*cols+1]);
+		if(!projects[i-1] || !(projects[i-1]->name = rlx_strdup(table[i*cols+1]))) {
+			free(projects[i-1]);
+			projects[i-1] = NULL;
+			rlx_project_free_array(projects);
+			sqlite3_free_table(table);
+			file->error = RLX_ERR_OOM;
+			return NULL;
+		}
 		int ret = sscanf(table[i*cols], "%d", &projects[i-1]->id);
 		assert(ret == 1);
-		projects[i-1]->date = rlx_str_to_time(table[i*cols+2]);
+		projects[i-1]->date = rlx_file_str_to_time(file, table[i*cols+2]);
 	}
 	projects[rows-1] = NULL;
 
+	if(length)
+		*length = rows-1;
+
 	sqlite3_free_table(table);
 	return projects;
 }
 
+struct rlx_project** rlx_get_projects(struct rlxfile* file, size_t* length)
+{
+	uint64_t trace = rlx_trace_begin();
+	struct rlx_perf_sample perf;
+	rlx_perf_begin(file->perf, &perf);
+	struct rlx_project **projects = rlx_get_projects_untraced(file, length);
+	rlx_perf_end(file->perf, RLX_PERF_GET_PROJECTS, &perf);
+	rlx_trace_end(trace, RLX_CALL_GET_PROJECTS, file->trace_handle, -1, 0, projects ? RLX_ERR_SUCESS : file->error, NULL, 0);
+	return projects;
+}
+
 static struct rlx_datapoint* rlx_get_datapoints(struct rlxfile* file, int id, size_t *length)
 {
 	char **table;
@@ -211,7 +316,7 @@ static struct rlx_datapoint* rlx_get_datapoints(struct rlxfile* file, int id, si
 	int cols;
 	char *error;
 	char *req = rlx_alloc_printf("SELECT frequency,zreal,zimag FROM Datapoints WHERE file_id=%d", id);
-	int ret = sqlite3_get_table(file->db, req, &table, &rows, &cols, &error);
+	int ret = rlx_get_table(file, id, req, &table, &rows, &cols, &error);
 	free(req);
 	++rows;
 	if(ret != SQLITE_OK) {
@@ -235,7 +340,15 @@ static struct rlx_datapoint* rlx_get_datapoints(struct rlxfile* file, int id, si
 
 	if(length)
 		*length = rows-1;
+	RLX_PROBE3(alloc, file->trace_handle, "datapoints", sizeof(struct rlx_datapoint)*(rows-1));
 	struct rlx_datapoint *out = malloc(sizeof(*out)*(rows-1));
+	if(!out) {
+		file->error = RLX_ERR_OOM;
+		sqlite3_free_table(table);
+		if(length)
+			*length = 0;
+		return NULL;
+	}
 
 	for(int i = 1; i < rows; ++i) {
 		int ret = sscanf(table[i*cols], "%lf", &out[i-1].omega);
@@ -247,6 +360,7 @@ static struct rlx_datapoint* rlx_get_datapoints(struct rlxfile* file, int id, si
 		assert(ret == 1);
 	}
 	sqlite3_free_table(table);
+	RLX_PROBE3(datapoints_decoded, file->trace_handle, id, rows-1);
 	return out;
 }
 
@@ -341,7 +455,7 @@ static struct rlx_metadata* rlx_get_metadata(struct rlxfile* file, int id, size_
 	int cols;
 	char *error;
 	char *req = rlx_alloc_printf("SELECT name,value FROM FileInformation WHERE file_id=%d", id);
-	int ret = sqlite3_get_table(file->db, req, &table, &rows, &cols, &error);
+	int ret = rlx_get_table(file, id, req, &table, &rows, &cols, &error);
 	if(length)
 		*length = 0;
 	free(req);
@@ -358,21 +472,36 @@ static struct rlx_metadata* rlx_get_metadata(struct rlxfile* file, int id, size_
 		return NULL;
 	}
 
-	if(length)
-		*length = rows-1;
-	struct rlx_metadata *out = malloc(sizeof(*out)*(rows-1));
+	RLX_PROBE3(alloc, file->trace_handle, "metadata", sizeof(struct rlx_metadata)*(rows > 1 ? rows-1 : 1));
+	struct rlx_metadata *out = calloc(rows > 1 ? rows-1 : 1, sizeof(*out));
+	if(!out) {
+		file->error = RLX_ERR_OOM;
+		sqlite3_free_table(table);
+		return NULL;
+	}
 
 	for(int i = 1; i < rows; ++i) {
 		out[i-1].key = rlx_strdup(table[i*cols]);
 		out[i-1].str = rlx_strdup(table[i*cols+1]);
+		if(!out[i-1].key || !out[i-1].str) {
+			for(int j = 0; j < i; ++j)
+				rlx_metadata_free(out+j);
+			free(out);
+			file->error = RLX_ERR_OOM;
+			sqlite3_free_table(table);
+			return NULL;
+		}
 		int ret = sscanf(table[i*cols+1], "%lf", &out[i-1].value);
 		out[i-1].type = ret == 1 ? RLX_FIELD_TYPE_DOUBLE : RLX_FIELD_TYPE_STR;
 	}
 	sqlite3_free_table(table);
+
+	if(length)
+		*length = rows-1;
 	return out;
 }
 
-struct rlx_spectra* rlx_get_spectra(struct rlxfile* file, const struct rlx_project* project, int id)
+static struct rlx_spectra* rlx_get_spectra_untraced(struct rlxfile* file, const struct rlx_project* project, int id)
 {
 	char **table;
 	int rows;
@@ -381,7 +510,7 @@ struct rlx_spectra* rlx_get_spectra(struct rlxfile* file, const struct rlx_proje
 	char *req = rlx_alloc_printf(
 		"SELECT groupname,fitted,lowfreqlimit,highfreqlimit,dateadded,datefitted FROM Files WHERE project_id=%d AND ID=%d",
 		project->id, id);
-	int ret = sqlite3_get_table(file->db, req, &table, &rows, &cols, &error);
+	int ret = rlx_get_table(file, id, req, &table, &rows, &cols, &error);
 	free(req);
 	++rows;
 	if(ret != SQLITE_OK) {
@@ -401,46 +530,583 @@ struct rlx_spectra* rlx_get_spectra(struct rlxfile* file, const struct rlx_proje
 		return NULL;
 	}
 
-	struct rlx_spectra *out = malloc(sizeof(*out));
+	struct rlx_spectra *out = calloc(1, sizeof(*out));
+	if(!out || !(out->circuit = rlx_strdup(table[6]))) {
+		free(out);
+		file->error = RLX_ERR_OOM;
+		sqlite3_free_table(table);
+		return NULL;
+	}
 	out->id = id;
-	out->circuit = rlx_strdup(table[6]);
 	out->fitted = table[7][0] == '1';
 	out->project_id = project->id;
 	ret = sscanf(table[8], "%lf", &out->freq_lower_limit);
 	assert(ret == 1);
 	ret = sscanf(table[9], "%lf", &out->freq_upper_limit);
 	assert(ret == 1);
-	out->date_added  = rlx_str_to_time(table[10]);
-	out->date_fitted = rlx_str_to_time(table[11]);
+	out->date_added  = rlx_file_str_to_time(file, table[10]);
+	out->date_fitted = rlx_file_str_to_time(file, table[11]);
 	sqlite3_free_table(table);
 
+	struct rlx_perf_sample perf;
+	rlx_perf_begin(file->perf, &perf);
 	out->datapoints = rlx_get_datapoints(file, id, &out->length);
+	rlx_perf_end(file->perf, RLX_PERF_DATAPOINTS, &perf);
+	if(!out->datapoints && file->error == RLX_ERR_OOM) {
+		rlx_spectra_free(out);
+		return NULL;
+	}
+	rlx_perf_begin(file->perf, &perf);
 	out->metadata = rlx_get_metadata(file, id, &out->metadata_count);
+	rlx_perf_end(file->perf, RLX_PERF_METADATA, &perf);
+	if(!out->metadata && file->error == RLX_ERR_OOM) {
+		rlx_spectra_free(out);
+		return NULL;
+	}
 	return out;
 }
 
-struct rlx_spectra** rlx_get_all_spectra(struct rlxfile* file, const struct rlx_project* project)
+struct rlx_spectra* rlx_get_spectra(struct rlxfile* file, const struct rlx_project* project, int id)
 {
-	size_t length;
-	int *ids = rlx_get_spectra_ids(file, project, &length);
+	uint64_t trace = rlx_trace_begin();
+	struct rlx_perf_sample perf;
+	rlx_perf_begin(file->perf, &perf);
+	struct rlx_spectra *spectra = rlx_get_spectra_untraced(file, project, id);
+	rlx_perf_end(file->perf, RLX_PERF_GET_SPECTRA, &perf);
+	rlx_trace_end(trace, RLX_CALL_GET_SPECTRA, file->trace_handle, project->id, id, spectra ? RLX_ERR_SUCESS : file->error, NULL, 0);
+	return spectra;
+}
 
-	if(!ids)
+void rlx_set_memory_budget(struct rlxfile* file, size_t bytes)
+{
+	uint64_t trace = rlx_trace_begin();
+	file->memory_budget = bytes;
+	uint64_t budget = bytes;
+	rlx_trace_end(trace, RLX_CALL_SET_MEMORY_BUDGET, file->trace_handle, -1, 0, RLX_ERR_SUCESS, &budget, sizeof(budget));
+}
+
+size_t rlx_get_memory_required(const struct rlxfile* file)
+{
+	return file->memory_required;
+}
+
+/*
+ * The memory a spectrum will hold once loaded is projected from the row counts and string lengths of its
+ * entries, so that bulk loads can be planned without touching the datapoints themselves.
+ */
+static size_t rlx_spectra_projected_size(sqlite3_stmt* ppStmt)
+{
+	return sizeof(struct rlx_spectra) + sizeof(struct rlx_spectra*) +
+		sqlite3_column_int64(ppStmt, 1)*sizeof(struct rlx_datapoint) +
+		sqlite3_column_int64(ppStmt, 2)*sizeof(struct rlx_metadata) +
+		sqlite3_column_int64(ppStmt, 3) + sqlite3_column_int64(ppStmt, 4);
+}
+
+/*
+ * Collects the ids of the spectra in project starting at id first in ascending order until the projected
+ * size of the spectra would exceed budget, a budget of 0 admits all spectra. complete is set if no spectra remain.
+ * If not even the first spectrum fits, length is 0 and required holds the size of that spectrum instead.
+ */
+static int* rlx_plan_spectra(struct rlxfile* file, const struct rlx_project* project, int first, size_t budget,
+                             size_t* length, size_t* required, bool* complete)
+{
+	*length = 0;
+	*required = sizeof(struct rlx_spectra*);
+	*complete = true;
+	char *req = rlx_alloc_printf("SELECT ID,"
+		"(SELECT COUNT(*) FROM Datapoints WHERE file_id=Files.ID),"
+		"(SELECT COUNT(*) FROM FileInformation WHERE file_id=Files.ID),"
+		"(SELECT TOTAL(length(CAST(name AS BLOB))+length(CAST(value AS BLOB))+2) FROM FileInformation WHERE file_id=Files.ID),"
+		"length(CAST(groupname AS BLOB))+1 "
+		"FROM Files WHERE project_id=%d AND ID>=%d ORDER BY ID", project->id, first);
+	sqlite3_stmt *ppStmt;
+	int ret = sqlite3_prepare_v2(file->db, req, strlen(req), &ppStmt, NULL);
+	free(req);
+	if(ret != SQLITE_OK) {
+		file->error = ret;
+		return NULL;
+	}
+
+	size_t size = 64;
+	int *ids = malloc(sizeof(*ids)*size);
+	if(!ids) {
+		sqlite3_finalize(ppStmt);
+		file->error = RLX_ERR_OOM;
+		return NULL;
+	}
+
+	RLX_PROBE3(query_start, file->trace_handle, -1, sqlite3_sql(ppStmt));
+	int rows = 0;
+	while((ret = sqlite3_step(ppStmt)) == SQLITE_ROW) {
+		++rows;
+		size_t spectraSize = rlx_spectra_projected_size(ppStmt);
+		if(budget > 0 && *required + spectraSize > budget) {
+			if(*length == 0)
+				*required += spectraSize;
+			*complete = false;
+			ret = SQLITE_DONE;
+			break;
+		}
+		if(*length == size) {
+			int *newIds = realloc(ids, sizeof(*ids)*size*2);
+			if(!newIds) {
+				ret = RLX_ERR_OOM;
+				break;
+			}
+			ids = newIds;
+			size *= 2;
+		}
+		ids[(*length)++] = sqlite3_column_int(ppStmt, 0);
+		*required += spectraSize;
+	}
+	sqlite3_finalize(ppStmt);
+	RLX_PROBE4(query_end, file->trace_handle, -1, rows, ret);
+
+	if(ret != SQLITE_DONE) {
+		free(ids);
+		*length = 0;
+		file->error = ret;
+		return NULL;
+	}
+	RLX_PROBE4(plan, file->trace_handle, project->id, *length, *required);
+	return ids;
+}
+
+static int rlx_table_root(struct rlxfile* file, const char* table, uint32_t* root)
+{
+	sqlite3_stmt *ppStmt;
+	const char *req = "SELECT rootpage FROM sqlite_master WHERE type='table' AND name=?";
+	int ret = sqlite3_prepare_v2(file->db, req, strlen(req), &ppStmt, NULL);
+	if(ret != SQLITE_OK)
+		return ret;
+	sqlite3_bind_text(ppStmt, 1, table, -1, SQLITE_STATIC);
+	ret = sqlite3_step(ppStmt);
+	if(ret == SQLITE_ROW) {
+		*root = sqlite3_column_int64(ppStmt, 0);
+		ret = SQLITE_OK;
+	}
+	sqlite3_finalize(ppStmt);
+	return ret;
+}
+
+/*
+ * Hands the rows that loading the given spectra will read to the read ahead vfs. The row ids of the datapoints and
+ * metadata of every spectrum are looked up in the file_id indices only, so no table page is read synchronously here.
+ * Errors are ignored as the loads that follow will report them. Must be called within the read transaction of
+ * these loads, otherwise the file could change between the prefetch and the reads it warms.
+ */
+static void rlx_prefetch_spectra(struct rlxfile* file, const int* ids, size_t count)
+{
+	if(!file->prefetch || count == 0)
+		return;
+
+	uint32_t *roots = file->prefetch_roots;
+	if(roots[0] == 0 && (rlx_table_root(file, "Files", &roots[0]) != SQLITE_OK ||
+	   rlx_table_root(file, "Datapoints", &roots[1]) != SQLITE_OK ||
+	   rlx_table_root(file, "FileInformation", &roots[2]) != SQLITE_OK)) {
+		roots[0] = 0;
+		return;
+	}
+
+	sqlite3_str *list = sqlite3_str_new(file->db);
+	for(size_t i = 0; i < count; ++i)
+		sqlite3_str_appendf(list, i == 0 ? "%d" : ",%d", ids[i]);
+	char *idList = sqlite3_str_finish(list);
+	char *req = idList ? rlx_alloc_printf(
+		"SELECT %u,MIN(ID),MAX(ID) FROM Datapoints WHERE file_id IN (%s) GROUP BY file_id UNION ALL "
+		"SELECT %u,MIN(ID),MAX(ID) FROM FileInformation WHERE file_id IN (%s) GROUP BY file_id",
+		roots[1], idList, roots[2], idList) : NULL;
+	sqlite3_free(idList);
+
+	struct rlx_vfs_range *ranges = malloc(sizeof(*ranges)*count*3);
+	sqlite3_stmt *ppStmt = NULL;
+	if(!req || !ranges || sqlite3_prepare_v2(file->db, req, strlen(req), &ppStmt, NULL) != SQLITE_OK) {
+		free(req);
+		free(ranges);
+		return;
+	}
+	free(req);
+
+	size_t length = 0;
+	for(size_t i = 0; i < count; ++i)
+		ranges[length++] = (struct rlx_vfs_range){roots[0], ids[i], ids[i]};
+	while(length < count*3 && sqlite3_step(ppStmt) == SQLITE_ROW) {
+		ranges[length].root = sqlite3_column_int64(ppStmt, 0);
+		ranges[length].first = sqlite3_column_int64(ppStmt, 1);
+		ranges[length].last = sqlite3_column_int64(ppStmt, 2);
+		++length;
+	}
+	sqlite3_finalize(ppStmt);
+
+	rlx_vfs_uring_prefetch(file->db, ranges, length);
+	free(ranges);
+}
+
+static struct rlx_spectra** rlx_load_spectra(struct rlxfile* file, const struct rlx_project* project,
+                                             const int* ids, size_t count, size_t* length)
+{
+	RLX_PROBE3(alloc, file->trace_handle, "spectra", sizeof(struct rlx_spectra*)*(count+1));
+	struct rlx_spectra **out = malloc(sizeof(*out)*(count+1));
+	if(!out) {
+		file->error = RLX_ERR_OOM;
 		return NULL;
+	}
 
-	struct rlx_spectra **out = malloc(sizeof(*out)*(length+1));
+	/* one read transaction, so that the pages prefetched for a window are the ones its loads read */
+	bool transaction = sqlite3_get_autocommit(file->db) && sqlite3_exec(file->db, "BEGIN", NULL, NULL, NULL) == SQLITE_OK;
+
+	/* the reads of the next window are in flight while the current one is loaded */
+	rlx_prefetch_spectra(file, ids, count < RLX_PREFETCH_WINDOW ? count : RLX_PREFETCH_WINDOW);
 	size_t index = 0;
-	for(size_t i = 0; i < length; ++i) {
-		out[index] = rlx_get_spectra(file, project, ids[i]);
-		if(out[index])
+	for(size_t i = 0; i < count; ++i) {
+		if(i % RLX_PREFETCH_WINDOW == 0 && i + RLX_PREFETCH_WINDOW < count) {
+			size_t next = i + RLX_PREFETCH_WINDOW;
+			rlx_prefetch_spectra(file, ids + next, count - next < RLX_PREFETCH_WINDOW ? count - next : RLX_PREFETCH_WINDOW);
+		}
+		out[index] = rlx_get_spectra_untraced(file, project, ids[i]);
+		if(out[index]) {
 			++index;
+		}
+		else if(file->error == RLX_ERR_OOM) {
+			out[index] = NULL;
+			rlx_spectra_free_array(out);
+			if(transaction)
+				sqlite3_exec(file->db, "COMMIT", NULL, NULL, NULL);
+			return NULL;
+		}
 	}
-	out[length] = NULL;
+	out[index] = NULL;
+	if(transaction)
+		sqlite3_exec(file->db, "COMMIT", NULL, NULL, NULL);
+
+	if(length)
+		*length = index;
+	return out;
+}
 
+static struct rlx_spectra** rlx_get_all_spectra_untraced(struct rlxfile* file, const struct rlx_project* project)
+{
+	size_t length;
+	size_t required;
+	bool complete;
+	int *ids = rlx_plan_spectra(file, project, 0, 0, &length, &required, &complete);
+	if(!ids)
+		return NULL;
+
+	file->memory_required = required;
+	if(length == 0 || (file->memory_budget > 0 && required > file->memory_budget)) {
+		file->error = length == 0 ? RLX_ERR_NO_ENT : RLX_ERR_BUDGET;
+		free(ids);
+		return NULL;
+	}
+
+	struct rlx_spectra **out = rlx_load_spectra(file, project, ids, length, NULL);
 	free(ids);
 	return out;
 }
 
-int* rlx_get_spectra_ids(struct rlxfile* file, const struct rlx_project* project, size_t* length)
+struct rlx_spectra** rlx_get_all_spectra(struct rlxfile* file, const struct rlx_project* project)
+{
+	uint64_t trace = rlx_trace_begin();
+	struct rlx_perf_sample perf;
+	rlx_perf_begin(file->perf, &perf);
+	struct rlx_spectra **spectra = rlx_get_all_spectra_untraced(file, project);
+	rlx_perf_end(file->perf, RLX_PERF_GET_ALL_SPECTRA, &perf);
+	rlx_trace_end(trace, RLX_CALL_GET_ALL_SPECTRA, file->trace_handle, project->id, 0, spectra ? RLX_ERR_SUCESS : file->error, NULL, 0);
+	return spectra;
+}
+
+struct rlx_spectra** rlx_get_spectra_chunk_untraced(struct rlxfile* file, const struct rlx_project* project, int* cursor, size_t* length)
+{
+	if(length)
+		*length = 0;
+
+	size_t count;
+	size_t required;
+	bool complete;
+	int *ids = rlx_plan_spectra(file, project, *cursor, file->memory_budget, &count, &required, &complete);
+	if(!ids)
+		return NULL;
+
+	file->memory_required = required;
+	if(count == 0) {
+		file->error = complete ? RLX_ERR_SUCESS : RLX_ERR_BUDGET;
+		free(ids);
+		return NULL;
+	}
+
+	struct rlx_spectra **out = rlx_load_spectra(file, project, ids, count, length);
+	if(out)
+		*cursor = ids[count-1] + 1;
+	free(ids);
+	return out;
+}
+
+struct rlx_spectra** rlx_get_spectra_chunk(struct rlxfile* file, const struct rlx_project* project, int* cursor, size_t* length)
+{
+	uint64_t trace = rlx_trace_begin();
+	struct rlx_perf_sample perf;
+	rlx_perf_begin(file->perf, &perf);
+	int start = *cursor;
+	struct rlx_spectra **spectra = rlx_get_spectra_chunk_untraced(file, project, cursor, length);
+	rlx_perf_end(file->perf, RLX_PERF_GET_SPECTRA_CHUNK, &perf);
+	rlx_trace_end(trace, RLX_CALL_GET_SPECTRA_CHUNK, file->trace_handle, project->id, start,
+	              spectra ? RLX_ERR_SUCESS : file->error, NULL, 0);
+	return spectra;
+}
+
+double rlx_column_number(sqlite3_stmt* ppStmt, int col)
+{
+	const char *str = (const char*)sqlite3_column_text(ppStmt, col);
+	return str ? strtod(str, NULL) : NAN;
+}
+
+static int rlx_many_headers(struct rlxfile* file, const struct rlx_project* project, int64_t call, struct rlx_spectra** out,
+                            size_t* capacity, size_t count)
+{
+	const char *req = "SELECT t.pos,"
+		"(SELECT COUNT(*) FROM Datapoints WHERE file_id=f.ID),"
+		"(SELECT COUNT(*) FROM FileInformation WHERE file_id=f.ID),"
+		"(SELECT TOTAL(length(CAST(name AS BLOB))+length(CAST(value AS BLOB))+2) FROM FileInformation WHERE file_id=f.ID),"
+		"length(CAST(f.groupname AS BLOB))+1,"
+		"f.groupname,f.fitted,f.lowfreqlimit,f.highfreqlimit,f.dateadded,f.datefitted,t.id "
+		"FROM temp.rlx_ids t LEFT JOIN Files f ON f.ID=t.id AND f.project_id=?2 WHERE t.call=?1 ORDER BY t.pos";
+	sqlite3_stmt *ppStmt;
+	int ret = sqlite3_prepare_v2(file->db, req, strlen(req), &ppStmt, NULL);
+	if(ret != SQLITE_OK)
+		return ret;
+	sqlite3_bind_int64(ppStmt, 1, call);
+	sqlite3_bind_int(ppStmt, 2, project->id);
+
+	RLX_PROBE3(query_start, file->trace_handle, -1, req);
+	size_t required = sizeof(*out);
+	int rows = 0;
+	while((ret = sqlite3_step(ppStmt)) == SQLITE_ROW) {
+		++rows;
+		size_t pos = sqlite3_column_int64(ppStmt, 0);
+		const char *circuit = (const char*)sqlite3_column_text(ppStmt, 5);
+		if(!circuit) {
+			ret = RLX_ERR_NON_EXIST_SPECTRA;
+			break;
+		}
+		required += rlx_spectra_projected_size(ppStmt);
+		if(pos >= count || (file->memory_budget > 0 && required > file->memory_budget))
+			continue;
+
+		struct rlx_spectra *spectra = calloc(1, sizeof(*spectra));
+		if(!spectra || !(spectra->circuit = rlx_strdup(circuit))) {
+			free(spectra);
+			ret = RLX_ERR_OOM;
+			break;
+		}
+		out[pos] = spectra;
+		spectra->id = sqlite3_column_int(ppStmt, 11);
+		spectra->project_id = project->id;
+		const char *fitted = (const char*)sqlite3_column_text(ppStmt, 6);
+		spectra->fitted = fitted && fitted[0] == '1';
+		spectra->freq_lower_limit = rlx_column_number(ppStmt, 7);
+		spectra->freq_upper_limit = rlx_column_number(ppStmt, 8);
+		spectra->date_added = rlx_file_str_to_time(file, (const char*)sqlite3_column_text(ppStmt, 9));
+		spectra->date_fitted = rlx_file_str_to_time(file, (const char*)sqlite3_column_text(ppStmt, 10));
+
+		size_t points = sqlite3_column_int64(ppStmt, 1);
+		size_t metadata = sqlite3_column_int64(ppStmt, 2);
+		RLX_PROBE3(alloc, file->trace_handle, "datapoints", sizeof(struct rlx_datapoint)*points);
+		spectra->datapoints = points > 0 ? malloc(sizeof(*spectra->datapoints)*points) : NULL;
+		spectra->metadata = calloc(metadata > 0 ? metadata : 1, sizeof(*spectra->metadata));
+		if((points > 0 && !spectra->datapoints) || !spectra->metadata) {
+			ret = RLX_ERR_OOM;
+			break;
+		}
+		capacity[pos*2] = points;
+		capacity[pos*2+1] = metadata;
+	}
+	sqlite3_finalize(ppStmt);
+	RLX_PROBE4(query_end, file->trace_handle, -1, rows, ret);
+
+	file->memory_required = required;
+	if(ret == SQLITE_DONE && file->memory_budget > 0 && required > file->memory_budget)
+		ret = RLX_ERR_BUDGET;
+	return ret == SQLITE_DONE ? SQLITE_OK : ret;
+}
+
+static int rlx_many_datapoints(struct rlxfile* file, int64_t call, struct rlx_spectra** out, const size_t* capacity, size_t count)
+{
+	const char *req = "SELECT t.pos,d.frequency,d.zreal,d.zimag FROM temp.rlx_ids t "
+		"JOIN Datapoints d ON d.file_id=t.id WHERE t.call=? ORDER BY t.pos,d.ID";
+	sqlite3_stmt *ppStmt;
+	int ret = sqlite3_prepare_v2(file->db, req, strlen(req), &ppStmt, NULL);
+	if(ret != SQLITE_OK)
+		return ret;
+	sqlite3_bind_int64(ppStmt, 1, call);
+
+	RLX_PROBE3(query_start, file->trace_handle, -1, req);
+	int rows = 0;
+	while((ret = sqlite3_step(ppStmt)) == SQLITE_ROW) {
+		++rows;
+		size_t pos = sqlite3_column_int64(ppStmt, 0);
+		if(pos >= count || !out[pos] || !out[pos]->datapoints)
+			continue;
+		if(out[pos]->length >= capacity[pos*2]) {
+			ret = RLX_ERR_FMT;
+			break;
+		}
+		struct rlx_datapoint *point = &out[pos]->datapoints[out[pos]->length++];
+		point->omega = rlx_column_number(ppStmt, 1)*2*M_PI;
+		point->re = rlx_column_number(ppStmt, 2);
+		point->im = rlx_column_number(ppStmt, 3);
+	}
+	sqlite3_finalize(ppStmt);
+	RLX_PROBE4(query_end, file->trace_handle, -1, rows, ret);
+	RLX_PROBE3(datapoints_decoded, file->trace_handle, -1, rows);
+	return ret == SQLITE_DONE ? SQLITE_OK : ret;
+}
+
+static int rlx_many_metadata(struct rlxfile* file, int64_t call, struct rlx_spectra** out, const size_t* capacity, size_t count)
+{
+	const char *req = "SELECT t.pos,i.name,i.value FROM temp.rlx_ids t "
+		"JOIN FileInformation i ON i.file_id=t.id WHERE t.call=? ORDER BY t.pos,i.ID";
+	sqlite3_stmt *ppStmt;
+	int ret = sqlite3_prepare_v2(file->db, req, strlen(req), &ppStmt, NULL);
+	if(ret != SQLITE_OK)
+		return ret;
+	sqlite3_bind_int64(ppStmt, 1, call);
+
+	RLX_PROBE3(query_start, file->trace_handle, -1, req);
+	int rows = 0;
+	while((ret = sqlite3_step(ppStmt)) == SQLITE_ROW) {
+		++rows;
+		size_t pos = sqlite3_column_int64(ppStmt, 0);
+		if(pos >= count || !out[pos])
+			continue;
+		if(out[pos]->metadata_count >= capacity[pos*2+1]) {
+			ret = RLX_ERR_FMT;
+			break;
+		}
+		struct rlx_metadata *metadata = &out[pos]->metadata[out[pos]->metadata_count];
+		metadata->key = rlx_strdup((const char*)sqlite3_column_text(ppStmt, 1));
+		metadata->str = rlx_strdup((const char*)sqlite3_column_text(ppStmt, 2));
+		if(!metadata->key || !metadata->str) {
+			free(metadata->key);
+			free(metadata->str);
+			ret = RLX_ERR_OOM;
+			break;
+		}
+		metadata->type = sscanf(metadata->str, "%lf", &metadata->value) == 1 ? RLX_FIELD_TYPE_DOUBLE : RLX_FIELD_TYPE_STR;
+		++out[pos]->metadata_count;
+	}
+	sqlite3_finalize(ppStmt);
+	RLX_PROBE4(query_end, file->trace_handle, -1, rows, ret);
+	return ret == SQLITE_DONE ? SQLITE_OK : ret;
+}
+
+/*
+ * The ids are bound once by inserting them into a temporary table keyed by a number unique to the call and their
+ * position, which is then joined against Files, Datapoints and FileInformation. Every join is one scan in position
+ * order, so the spectra are filled in the order of the caller. The ids are inserted from a json array in a single
+ * statement and deleted again at the end, concurrent calls on the same file, which all share the table, never see
+ * each others rows.
+ *
+ * The buffers are sized by the counts of the header query, so all queries run in one read transaction, unless one
+ * is already open on the connection. Every write is still checked against the counts, should a transaction opened
+ * by someone else end early, a spectrum that grew in the meantime fails the call with RLX_ERR_FMT.
+ */
+static int rlx_many_bind_ids(struct rlxfile* file, int64_t call, const int* ids, size_t count)
+{
+	char *json = malloc(count*12 + 3);
+	if(!json)
+		return RLX_ERR_OOM;
+	size_t pos = 0;
+	json[pos++] = '[';
+	for(size_t i = 0; i < count; ++i)
+		pos += sprintf(json + pos, i > 0 ? ",%d" : "%d", ids[i]);
+	json[pos++] = ']';
+
+	int ret = sqlite3_exec(file->db, "CREATE TEMP TABLE IF NOT EXISTS rlx_ids(call INTEGER NOT NULL, pos INTEGER NOT NULL, "
+	                       "id INTEGER NOT NULL, PRIMARY KEY(call,pos)) WITHOUT ROWID", NULL, NULL, NULL);
+	const char *req = "INSERT INTO temp.rlx_ids(call,pos,id) SELECT ?,key,value FROM json_each(?)";
+	sqlite3_stmt *ppStmt = NULL;
+	if(ret == SQLITE_OK)
+		ret = sqlite3_prepare_v2(file->db, req, strlen(req), &ppStmt, NULL);
+	if(ret == SQLITE_OK) {
+		sqlite3_bind_int64(ppStmt, 1, call);
+		sqlite3_bind_text(ppStmt, 2, json, pos, SQLITE_STATIC);
+		ret = sqlite3_step(ppStmt);
+		ret = ret == SQLITE_DONE ? SQLITE_OK : ret;
+	}
+	sqlite3_finalize(ppStmt);
+	free(json);
+	return ret;
+}
+
+static void rlx_many_unbind_ids(struct rlxfile* file, int64_t call)
+{
+	sqlite3_stmt *ppStmt;
+	const char *req = "DELETE FROM temp.rlx_ids WHERE call=?";
+	if(sqlite3_prepare_v2(file->db, req, strlen(req), &ppStmt, NULL) != SQLITE_OK)
+		return;
+	sqlite3_bind_int64(ppStmt, 1, call);
+	sqlite3_step(ppStmt);
+	sqlite3_finalize(ppStmt);
+}
+
+struct rlx_spectra** rlx_get_spectra_many_untraced(struct rlxfile* file, const struct rlx_project* project, const int* ids, size_t count)
+{
+	RLX_PROBE3(alloc, file->trace_handle, "spectra", sizeof(struct rlx_spectra*)*(count+1));
+	struct rlx_spectra **out = calloc(count+1, sizeof(*out));
+	size_t *capacity = calloc(count*2+1, sizeof(*capacity));
+	if(!out || !capacity) {
+		free(out);
+		free(capacity);
+		file->error = RLX_ERR_OOM;
+		return NULL;
+	}
+
+	bool transaction = sqlite3_get_autocommit(file->db) && sqlite3_exec(file->db, "BEGIN", NULL, NULL, NULL) == SQLITE_OK;
+	int64_t call = atomic_fetch_add(&file->many_calls, 1);
+	int ret = rlx_many_bind_ids(file, call, ids, count);
+	if(ret == SQLITE_OK)
+		ret = rlx_many_headers(file, project, call, out, capacity, count);
+	struct rlx_perf_sample perf;
+	if(ret == SQLITE_OK) {
+		rlx_prefetch_spectra(file, ids, count);
+		rlx_perf_begin(file->perf, &perf);
+		ret = rlx_many_datapoints(file, call, out, capacity, count);
+		rlx_perf_end(file->perf, RLX_PERF_DATAPOINTS, &perf);
+	}
+	if(ret == SQLITE_OK) {
+		rlx_perf_begin(file->perf, &perf);
+		ret = rlx_many_metadata(file, call, out, capacity, count);
+		rlx_perf_end(file->perf, RLX_PERF_METADATA, &perf);
+	}
+	rlx_many_unbind_ids(file, call);
+	if(transaction)
+		sqlite3_exec(file->db, "COMMIT", NULL, NULL, NULL);
+	free(capacity);
+
+	if(ret != SQLITE_OK) {
+		for(size_t i = 0; i < count; ++i)
+			rlx_spectra_free(out[i]);
+		free(out);
+		file->error = ret;
+		return NULL;
+	}
+	return out;
+}
+
+struct rlx_spectra** rlx_get_spectra_many(struct rlxfile* file, const struct rlx_project* project, const int* ids, size_t count)
+{
+	uint64_t trace = rlx_trace_begin();
+	struct rlx_perf_sample perf;
+	rlx_perf_begin(file->perf, &perf);
+	struct rlx_spectra **spectra = rlx_get_spectra_many_untraced(file, project, ids, count);
+	rlx_perf_end(file->perf, RLX_PERF_GET_SPECTRA_MANY, &perf);
+	rlx_trace_end(trace, RLX_CALL_GET_SPECTRA_MANY, file->trace_handle, project->id, 0,
+	              spectra ? RLX_ERR_SUCESS : file->error, ids, sizeof(*ids)*count);
+	return spectra;
+}
+
+int* rlx_get_spectra_ids_untraced(struct rlxfile* file, const struct rlx_project* project, size_t* length)
 {
 	char **table;
 	int rows;
@@ -449,7 +1115,7 @@ int* rlx_get_spectra_ids(struct rlxfile* file, const struct rlx_project* project
 	if(length)
 		*length = 0;
 	char *req = rlx_alloc_printf("SELECT ID FROM Files where project_id=%d", project->id);
-	int ret = sqlite3_get_table(file->db, req, &table, &rows, &cols, &error);
+	int ret = rlx_get_table(file, -1, req, &table, &rows, &cols, &error);
 	free(req);
 	if(ret != SQLITE_OK) {
 		file->error = ret;
@@ -457,7 +1123,6 @@ int* rlx_get_spectra_ids(struct rlxfile* file, const struct rlx_project* project
 		return NULL;
 	}
 	++rows;
-	printf("%s: got %dx%d\n", __func__, rows, cols);
 
 	if(cols == 0) {
 		file->error = RLX_ERR_NO_ENT;
@@ -476,11 +1141,15 @@ int* rlx_get_spectra_ids(struct rlxfile* file, const struct rlx_project* project
 		return NULL;
 	}
 
+	int *ids = malloc(sizeof(*ids)*(rows-1));
+	if(!ids) {
+		file->error = RLX_ERR_OOM;
+		sqlite3_free_table(table);
+		return NULL;
+	}
 	if(length)
 		*length = rows-1;
 
-	int *ids = malloc(sizeof(*ids)*(rows-1));
-
 	for(int i = 1; i < rows; ++i) {
 		int ret = sscanf(table[i], "%d", &ids[i-1]);
 		assert(ret == 1);
@@ -490,19 +1159,175 @@ int* rlx_get_spectra_ids(struct rlxfile* file, const struct rlx_project* project
 	return ids;
 }
 
+int* rlx_get_spectra_ids(struct rlxfile* file, const struct rlx_project* project, size_t* length)
+{
+	uint64_t trace = rlx_trace_begin();
+	struct rlx_perf_sample perf;
+	rlx_perf_begin(file->perf, &perf);
+	int *ids = rlx_get_spectra_ids_untraced(file, project, length);
+	rlx_perf_end(file->perf, RLX_PERF_GET_SPECTRA_IDS, &perf);
+	rlx_trace_end(trace, RLX_CALL_GET_SPECTRA_IDS, file->trace_handle, project->id, 0, ids ? RLX_ERR_SUCESS : file->error, NULL, 0);
+	return ids;
+}
+
+void rlx_circuit_group_free(struct rlx_circuit_group* group)
+{
+	if(!group)
+		return;
+	free(group->circuit);
+	free(group->ids);
+	if(group->spectra)
+		rlx_spectra_free_array(group->spectra);
+	rlx_circuit_free(group->model);
+	free(group);
+}
+
+void rlx_circuit_group_free_array(struct rlx_circuit_group** groups)
+{
+	struct rlx_circuit_group** firstgroup = groups;
+	while(*groups) {
+		rlx_circuit_group_free(*groups);
+		++groups;
+	}
+	free(firstgroup);
+}
+
+static struct rlx_circuit_group* rlx_circuit_group_new(const char* circuit)
+{
+	struct rlx_circuit_group *group = calloc(1, sizeof(*group));
+	if(!group)
+		return NULL;
+
+	group->circuit = rlx_strdup(circuit ? circuit : "");
+	if(!group->circuit) {
+		free(group);
+		return NULL;
+	}
+	group->model = rlx_circuit_compile(group->circuit, NULL);
+	return group;
+}
+
+static bool rlx_circuit_group_add_id(struct rlx_circuit_group* group, int id, size_t* allocated)
+{
+	if(group->length == *allocated) {
+		size_t size = *allocated > 0 ? *allocated*2 : 16;
+		int *ids = realloc(group->ids, sizeof(*ids)*size);
+		if(!ids)
+			return false;
+		group->ids = ids;
+		*allocated = size;
+	}
+	group->ids[group->length++] = id;
+	return true;
+}
+
+struct rlx_circuit_group** rlx_get_spectra_grouped_by_circuit_untraced(struct rlxfile* file, const struct rlx_project* project,
+                                                                       bool load, size_t* length)
+{
+	if(length)
+		*length = 0;
+	// group_concat has no defined order before SQLite 3.44, so the id lists are built from a scan ordered by group and id
+	char *req = rlx_alloc_printf("SELECT groupname,ID FROM Files WHERE project_id=%d ORDER BY groupname,ID", project->id);
+	sqlite3_stmt *ppStmt;
+	int ret = sqlite3_prepare_v2(file->db, req, strlen(req), &ppStmt, NULL);
+	free(req);
+	if(ret != SQLITE_OK) {
+		file->error = ret;
+		return NULL;
+	}
+
+	struct rlx_circuit_group **groups = NULL;
+	size_t count = 0;
+	size_t allocated = 0;
+	RLX_PROBE3(query_start, file->trace_handle, -1, sqlite3_sql(ppStmt));
+	int rows = 0;
+	while((ret = sqlite3_step(ppStmt)) == SQLITE_ROW) {
+		++rows;
+		const char *circuit = (const char*)sqlite3_column_text(ppStmt, 0);
+		if(count == 0 || strcmp(groups[count-1]->circuit, circuit ? circuit : "") != 0) {
+			struct rlx_circuit_group **newGroups = realloc(groups, sizeof(*groups)*(count+2));
+			if(newGroups)
+				groups = newGroups;
+			struct rlx_circuit_group *group = newGroups ? rlx_circuit_group_new(circuit) : NULL;
+			if(!group) {
+				ret = RLX_ERR_OOM;
+				break;
+			}
+			groups[count++] = group;
+			groups[count] = NULL;
+			allocated = 0;
+		}
+		if(!rlx_circuit_group_add_id(groups[count-1], sqlite3_column_int(ppStmt, 1), &allocated)) {
+			ret = RLX_ERR_OOM;
+			break;
+		}
+	}
+	sqlite3_finalize(ppStmt);
+	RLX_PROBE4(query_end, file->trace_handle, -1, rows, ret);
+
+	if(ret != SQLITE_DONE || count == 0) {
+		file->error = ret == SQLITE_DONE ? RLX_ERR_NO_ENT : ret;
+		if(groups)
+			rlx_circuit_group_free_array(groups);
+		return NULL;
+	}
+
+	if(load && file->memory_budget > 0) {
+		size_t total;
+		size_t required;
+		bool complete;
+		int *ids = rlx_plan_spectra(file, project, 0, 0, &total, &required, &complete);
+		free(ids);
+		if(ids)
+			file->memory_required = required;
+		if(!ids || required > file->memory_budget) {
+			if(ids)
+				file->error = RLX_ERR_BUDGET;
+			rlx_circuit_group_free_array(groups);
+			return NULL;
+		}
+	}
+
+	for(size_t i = 0; load && i < count; ++i) {
+		struct rlx_circuit_group *group = groups[i];
+		group->spectra = rlx_load_spectra(file, project, group->ids, group->length, NULL);
+		if(!group->spectra) {
+			rlx_circuit_group_free_array(groups);
+			return NULL;
+		}
+	}
+
+	if(length)
+		*length = count;
+	return groups;
+}
+
+struct rlx_circuit_group** rlx_get_spectra_grouped_by_circuit(struct rlxfile* file, const struct rlx_project* project,
+                                                              bool load, size_t* length)
+{
+	uint64_t trace = rlx_trace_begin();
+	struct rlx_perf_sample perf;
+	rlx_perf_begin(file->perf, &perf);
+	struct rlx_circuit_group **groups = rlx_get_spectra_grouped_by_circuit_untraced(file, project, load, length);
+	rlx_perf_end(file->perf, RLX_PERF_GET_GROUPED, &perf);
+	rlx_trace_end(trace, RLX_CALL_GET_GROUPED, file->trace_handle, project->id, load, groups ? RLX_ERR_SUCESS : file->error, NULL, 0);
+	return groups;
+}
+
 int rlx_get_float_arrays(const struct rlx_spectra *spectra, float **re, float **im, float **omega)
 {
 	*re = malloc(sizeof(float)*spectra->length);
-	if(!*re)
-		return RLX_ERR_OOM;
-
 	*im = malloc(sizeof(float)*spectra->length);
-	if(!*im)
-		return RLX_ERR_OOM;
-
 	*omega = malloc(sizeof(float)*spectra->length);
-	if(!*omega)
+	if(!*re || !*im || !*omega) {
+		free(*re);
+		free(*im);
+		free(*omega);
+		*re = NULL;
+		*im = NULL;
+		*omega = NULL;
 		return RLX_ERR_OOM;
+	}
 
 	for(size_t i = 0; i <spectra->length; ++i)
 	{
@@ -517,16 +1342,17 @@ int rlx_get_float_arrays(const struct rlx_spectra *spectra, float **re, float **
 int rlx_get_double_arrays(const struct rlx_spectra *spectra, double **re, double **im, double **omega)
 {
 	*re = malloc(sizeof(double)*spectra->length);
-	if(!*re)
-		return RLX_ERR_OOM;
-
 	*im = malloc(sizeof(double)*spectra->length);
-	if(!*im)
-		return RLX_ERR_OOM;
-
 	*omega = malloc(sizeof(double)*spectra->length);
-	if(!*omega)
+	if(!*re || !*im || !*omega) {
+		free(*re);
+		free(*im);
+		free(*omega);
+		*re = NULL;
+		*im = NULL;
+		*omega = NULL;
 		return RLX_ERR_OOM;
+	}
 
 	for(size_t i = 0; i <spectra->length; ++i)
 	{
@@ -538,12 +1364,31 @@ int rlx_get_double_arrays(const struct rlx_spectra *spectra, double **re, double
 	return 0;
 }
 
-struct rlx_fitparam** rlx_get_fit_parameters(struct rlxfile* file, const struct rlx_project* project, int id, size_t *length)
+/* Reads one row of a Fitparameters query starting at column col into a newly allocated rlx_fitparam struct */
+static struct rlx_fitparam* rlx_fitparam_from_row(sqlite3_stmt* ppStmt, int col, int id)
+{
+	struct rlx_fitparam *param = malloc(sizeof(*param));
+	if(!param || !(param->name = rlx_strdup((char*)sqlite3_column_text(ppStmt, col+1)))) {
+		free(param);
+		return NULL;
+	}
+	param->p_index = sqlite3_column_int(ppStmt, col);
+	param->spectra_id = id;
+	param->value = sqlite3_column_double(ppStmt, col+2);
+	param->error = sqlite3_column_double(ppStmt, col+3);
+	param->lower_limit = sqlite3_column_double(ppStmt, col+4);
+	param->upper_limit = sqlite3_column_double(ppStmt, col+5);
+	param->fixed = sqlite3_column_int(ppStmt, col+6) != 0;
+	param->global = sqlite3_column_int(ppStmt, col+7) != 0;
+	return param;
+}
+
+static struct rlx_fitparam** rlx_get_fit_parameters_untraced(struct rlxfile* file, const struct rlx_project* project, int id, size_t *length)
 {
 	(void)project;
 	if(length)
 		*length = 0;
-	char *req = rlx_alloc_printf("SELECT pindex,name,value,error,lowerlimit,upperlimit FROM Fitparameters WHERE file_id=%d", id);
+	char *req = rlx_alloc_printf("SELECT pindex,name,value,error,lowerlimit,upperlimit,fixed,isglobal FROM Fitparameters WHERE file_id=%d", id);
 	sqlite3_stmt *ppStmt;
 	int ret = sqlite3_prepare_v2(file->db, req, strlen(req), &ppStmt, NULL);
 	free(req);
@@ -555,43 +1400,132 @@ struct rlx_fitparam** rlx_get_fit_parameters(struct rlxfile* file, const struct
 	size_t outSize = 8;
 	size_t outIndex = 0;
 	struct rlx_fitparam **out = malloc(sizeof(*out)*outSize);
+	if(!out) {
+		sqlite3_finalize(ppStmt);
+		file->error = RLX_ERR_OOM;
+		return NULL;
+	}
 
+	RLX_PROBE3(query_start, file->trace_handle, id, sqlite3_sql(ppStmt));
 	while((ret = sqlite3_step(ppStmt)) == SQLITE_ROW) {
-		assert(sqlite3_column_count(ppStmt) == 6);
-		struct rlx_fitparam *param = malloc(sizeof(*param));
-		param->p_index = sqlite3_column_int(ppStmt, 0);
-		param->spectra_id = id;
-		param->name = rlx_strdup((char*)sqlite3_column_text(ppStmt, 1));
-		param->value = sqlite3_column_double(ppStmt, 2);
-		param->error = sqlite3_column_double(ppStmt, 3);
-		param->lower_limit = sqlite3_column_double(ppStmt, 4);
-		param->upper_limit = sqlite3_column_double(ppStmt, 5);
-		if(outIndex == outSize) {
+		assert(sqlite3_column_count(ppStmt) == 8);
+		if(outIndex + 1 >= outSize) {
+			struct rlx_fitparam **newOut = realloc(out, sizeof(*out)*outSize*2);
+			if(!newOut) {
+				ret = RLX_ERR_OOM;
+				break;
+			}
+			out = newOut;
 			outSize *= 2;
-			assert((out = realloc(out, sizeof(*out)*outSize)));
+		}
+		struct rlx_fitparam *param = rlx_fitparam_from_row(ppStmt, 0, id);
+		if(!param) {
+			ret = RLX_ERR_OOM;
+			break;
 		}
 		out[outIndex] = param;
 		++outIndex;
 	}
+	out[outIndex] = NULL;
+	RLX_PROBE4(query_end, file->trace_handle, id, (int)outIndex, ret);
 
 	if(ret != SQLITE_OK && ret != SQLITE_DONE) {
-		free(out);
+		rlx_fitparam_free_array(out);
+		sqlite3_finalize(ppStmt);
 		file->error = ret;
 		return NULL;
 	}
 
-	if(outIndex == outSize) {
-		outSize += 1;
-		assert((out = realloc(out, sizeof(*out)*outSize)));
-	}
-	out[outIndex] = NULL;
-
 	if(length)
 		*length = outIndex;
 	file->error = sqlite3_finalize(ppStmt);
 	return out;
 }
 
+struct rlx_fitparam** rlx_get_fit_parameters(struct rlxfile* file, const struct rlx_project* project, int id, size_t *length)
+{
+	uint64_t trace = rlx_trace_begin();
+	struct rlx_perf_sample perf;
+	rlx_perf_begin(file->perf, &perf);
+	struct rlx_fitparam **params = rlx_get_fit_parameters_untraced(file, project, id, length);
+	rlx_perf_end(file->perf, RLX_PERF_GET_FIT_PARAMETERS, &perf);
+	rlx_trace_end(trace, RLX_CALL_GET_FIT_PARAMETERS, file->trace_handle, project ? project->id : -1, id,
+	              params ? RLX_ERR_SUCESS : file->error, NULL, 0);
+	return params;
+}
+
+struct rlx_fitparam*** rlx_get_fit_parameters_many_untraced(struct rlxfile* file, const int* ids, size_t count, size_t* lengths)
+{
+	struct rlx_fitparam ***out = calloc(count+1, sizeof(*out));
+	size_t *sizes = calloc(count+1, sizeof(*sizes));
+	if(!out || !sizes) {
+		free(out);
+		free(sizes);
+		file->error = RLX_ERR_OOM;
+		return NULL;
+	}
+	for(size_t i = 0; i < count; ++i)
+		lengths[i] = 0;
+
+	int64_t call = atomic_fetch_add(&file->many_calls, 1);
+	int ret = rlx_many_bind_ids(file, call, ids, count);
+	const char *req = "SELECT t.pos,t.id,p.pindex,p.name,p.value,p.error,p.lowerlimit,p.upperlimit,p.fixed,p.isglobal "
+		"FROM temp.rlx_ids t JOIN Fitparameters p ON p.file_id=t.id WHERE t.call=? ORDER BY t.pos,p.ID";
+	sqlite3_stmt *ppStmt = NULL;
+	if(ret == SQLITE_OK)
+		ret = sqlite3_prepare_v2(file->db, req, strlen(req), &ppStmt, NULL);
+	if(ret == SQLITE_OK) {
+		sqlite3_bind_int64(ppStmt, 1, call);
+		RLX_PROBE3(query_start, file->trace_handle, -1, req);
+		int rows = 0;
+		while((ret = sqlite3_step(ppStmt)) == SQLITE_ROW) {
+			++rows;
+			size_t pos = sqlite3_column_int64(ppStmt, 0);
+			if(pos >= count)
+				continue;
+			if(lengths[pos] + 1 >= sizes[pos]) {
+				size_t size = sizes[pos] ? sizes[pos]*2 : 8;
+				struct rlx_fitparam **params = realloc(out[pos], sizeof(*params)*size);
+				if(!params) {
+					ret = RLX_ERR_OOM;
+					break;
+				}
+				params[lengths[pos]] = NULL;
+				out[pos] = params;
+				sizes[pos] = size;
+			}
+			struct rlx_fitparam *param = rlx_fitparam_from_row(ppStmt, 2, sqlite3_column_int(ppStmt, 1));
+			if(!param) {
+				ret = RLX_ERR_OOM;
+				break;
+			}
+			out[pos][lengths[pos]++] = param;
+			out[pos][lengths[pos]] = NULL;
+		}
+		RLX_PROBE4(query_end, file->trace_handle, -1, rows, ret);
+	}
+	sqlite3_finalize(ppStmt);
+	rlx_many_unbind_ids(file, call);
+
+	// spectra without parameters get an empty array like from rlx_get_fit_parameters
+	for(size_t i = 0; i < count && ret == SQLITE_DONE; ++i) {
+		if(!out[i] && !(out[i] = calloc(1, sizeof(**out))))
+			ret = RLX_ERR_OOM;
+	}
+	free(sizes);
+
+	if(ret != SQLITE_DONE) {
+		for(size_t i = 0; i < count; ++i) {
+			if(out[i])
+				rlx_fitparam_free_array(out[i]);
+		}
+		free(out);
+		file->error = ret;
+		return NULL;
+	}
+	return out;
+}
+
 int rlx_get_errnum(const struct rlxfile* file)
 {
 	return file->error;
@@ -613,6 +1547,16 @@ const char* rlx_get_errnum_str(int errnum)
 		return "Out of memory";
 	if(errnum == RLX_ERR_FMT)
 		return "Relaxis file is invalid";
+	if(errnum == RLX_ERR_CIRCUIT)
+		return "Invalid or unsupported circuit";
+	if(errnum == RLX_ERR_BUDGET)
+		return "Memory budget exceeded";
+	if(errnum == RLX_ERR_EXISTS)
+		return "File already exists";
+	if(errnum == RLX_ERR_CHANGESET)
+		return "Changeset does not follow the state of the mirror";
+	if(errnum == RLX_ERR_WIRE)
+		return "Invalid or truncated wire format buffer";
 	return "Unkown error";
 }
 
@@ -18,6 +18,7 @@
 
 #pragma once
 #include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
 
 #ifdef __cplusplus
@@ -38,6 +39,11 @@ enum {
 	RLX_ERR_NON_EXIST_SPECTRA = -102,
 	RLX_ERR_OOM = -103,
 	RLX_ERR_FMT = -104,
+	RLX_ERR_CIRCUIT = -105,
+	RLX_ERR_BUDGET = -106,
+	RLX_ERR_EXISTS = -107,
+	RLX_ERR_CHANGESET = -108,
+	RLX_ERR_WIRE = -109,
 };
 
 struct rlx_version_fixed {
@@ -207,6 +213,8 @@ struct rlx_fitparam {
 	double error;
 	double lower_limit;
 	double upper_limit;
+	bool fixed; /**< If true the parameter is held at its value by rlx_fit_spectra, rlx_fit_project and rlx_fit_global*/
+	bool global; /**< If true the parameter is shared by all spectra of a global fit, see rlx_fit_global*/
 };
 
 /**
@@ -226,6 +234,9 @@ void rlx_fitparam_free_array(struct rlx_fitparam** param_array);
 /**
  * @brief opens a project struct
  *
+ * Files compressed in the zstd seekable format, as created by the relaxisloader_compress tool,
+ * are read without decompressing them to disk if librelaxisloader was built with zstd support.
+ *
  * @param path the file system path where the file shall be opened
  * @param error if an error occurs and NULL is returned, pointer to an error string is set here,
  * owned by librelaxisloader, do not free, valid only until next call to librelaxisloader
@@ -233,8 +244,96 @@ void rlx_fitparam_free_array(struct rlx_fitparam** param_array);
  */
 struct rlxfile* rlx_open_file(const char* path, const char** error);
 
+/**
+ * @brief Flags for rlx_open_file_flags
+ */
+enum rlx_open_flag {
+	RLX_OPEN_PREFETCH = 1 << 0, /**< Read the pages bulk loads need ahead in batches, on linux via io_uring, off by default, see rlx_open_file_flags */
+	RLX_OPEN_PERF_COUNTERS = 1 << 1, /**< Count time and hardware events spent in the calls made on this file, see rlx_get_perf_counters */
+};
+
+/**
+ * @brief opens a project struct with the given flags
+ *
+ * With RLX_OPEN_PREFETCH bulk loads, like rlx_get_all_spectra, look up which pages of the file the next spectra
+ * will be read from and submit all of these reads at once, on linux via io_uring. The reads complete in the background
+ * while the preceding spectra are loaded. If io_uring is not available the kernel is asked to read the pages ahead instead.
+ * On other platforms and for compressed files this flag has no effect.
+ *
+ * Prefetching is strictly opt in, no other function enables it. The lookups it adds make loads of files that are
+ * already in the page cache slower, and no gain was measured so far for cold loads from local storage either.
+ * It is meant for cold loads from storage with a high latency per read, measure with relaxisloader_bench before
+ * enabling it.
+ *
+ * @param path the file system path where the file shall be opened
+ * @param flags a combination of rlx_open_flag values
+ * @param error if an error occurs and NULL is returned, pointer to an error string is set here,
+ * owned by librelaxisloader, do not free, valid only until next call to librelaxisloader
+ * @return a rlxfile struct or NULL if opening was unsuccessful, to be closed with rlx_close_file
+ */
+struct rlxfile* rlx_open_file_flags(const char* path, int flags, const char** error);
+
 void rlx_close_file(struct rlxfile* file);
 
+/**
+ * @brief Gets an open file from the process wide pool of open files, or opens it.
+ *
+ * Files released with rlx_pool_release are kept open and handed out again if the file has not changed since,
+ * as determined by its device, inode, modification time and size. This costs a stat instead of opening and
+ * validating the file, and keeps the caches of the file, like the one behind rlx_directory_acquire, warm.
+ * Changes made to a file in WAL mode that are not yet checkpointed do not change these, files written by RelaxIS
+ * are not affected by this.
+ *
+ * The file is used exclusively by the caller until it is released, several threads acquiring the same path
+ * get different handles. This function is thread safe.
+ *
+ * @param path the file system path of the file
+ * @param error if an error occurs and NULL is returned, pointer to an error string is set here,
+ * owned by librelaxisloader, do not free
+ * @return a rlxfile struct or NULL if opening was unsuccessful, to be returned with rlx_pool_release
+ */
+struct rlxfile* rlx_pool_acquire(const char* path, const char** error);
+
+/**
+ * @brief Returns a file acquired with rlx_pool_acquire to the pool.
+ *
+ * The error and memory budget of the file are reset. If the pool holds more idle files than its capacity
+ * the least recently released one is closed. Files opened with rlx_open_file are closed.
+ * This function is thread safe.
+ *
+ * @param file the file to release, or NULL
+ */
+void rlx_pool_release(struct rlxfile* file);
+
+/**
+ * @brief Sets the amount of idle files the pool keeps open, 64 by default.
+ *
+ * @param capacity the maximum amount of idle files, 0 disables pooling
+ */
+void rlx_pool_set_capacity(size_t capacity);
+
+/**
+ * @brief Closes all idle files in the pool.
+ */
+void rlx_pool_clear(void);
+
+/**
+ * @brief Statistics of the pool of open files.
+ */
+struct rlx_pool_stats {
+	uint64_t hits; /**< Amount of rlx_pool_acquire calls that reused an idle file*/
+	uint64_t misses; /**< Amount of rlx_pool_acquire calls that had to open the file*/
+	uint64_t evictions; /**< Amount of idle files closed because the pool was full, cleared or the file changed*/
+	size_t idle; /**< Amount of idle files currently in the pool*/
+};
+
+/**
+ * @brief Gets the statistics of the pool of open files.
+ *
+ * @param stats struct where the statistics will be stored
+ */
+void rlx_pool_get_stats(struct rlx_pool_stats* stats);
+
 /**
  * @brief Gets all the projects in a given RelaxIS file
  *
@@ -250,6 +349,9 @@ struct rlx_project** rlx_get_projects(struct rlxfile* file, size_t* length);
  * @brief Loads all spectra from file in given project
  *
  * If this function encounters an error it will return NULL and set an error at rlx_get_errnum.
+ * The memory the spectra will occupy is projected before anything is loaded, if it exceeds the budget
+ * set with rlx_set_memory_budget nothing is loaded and RLX_ERR_BUDGET is set,
+ * rlx_get_memory_required then reports the amount of memory that would have been needed.
  *
  * @param file file to load spectra from
  * @param project project to load spectra from
@@ -257,6 +359,163 @@ struct rlx_project** rlx_get_projects(struct rlxfile* file, size_t* length);
  */
 struct rlx_spectra** rlx_get_all_spectra(struct rlxfile* file, const struct rlx_project* project);
 
+/**
+ * @brief Sets the amount of memory bulk loads on this file may allocate
+ *
+ * Bulk loads, ie. rlx_get_all_spectra and rlx_get_spectra_grouped_by_circuit, project the memory their result
+ * will occupy from the sizes of the entries in the file and fail with RLX_ERR_BUDGET instead of allocating more than this.
+ * rlx_get_spectra_chunk can be used to load projects that do not fit into the budget piece by piece.
+ * The projection covers the returned structures, not allocator overhead or the transient use of sqlite while loading.
+ *
+ * @param file file to set the budget for
+ * @param bytes the budget in bytes, 0 for unlimited, the default
+ */
+void rlx_set_memory_budget(struct rlxfile* file, size_t bytes);
+
+/**
+ * @brief Gets the projected size of the last bulk load
+ *
+ * @param file file the load was performed on
+ * @return the amount of memory in bytes the last bulk load needed or would have needed
+ */
+size_t rlx_get_memory_required(const struct rlxfile* file);
+
+/**
+ * @brief Loads the next chunk of spectra in a project that fits into the memory budget
+ *
+ * Spectra are delivered in ascending order of their ids, every chunk contains as many spectra as fit into
+ * the budget set with rlx_set_memory_budget, or all remaining spectra if no budget is set.
+ * Once all spectra have been delivered this function returns NULL and rlx_get_errnum returns RLX_ERR_SUCESS.
+ * If a single spectrum does not fit into the budget NULL is returned and RLX_ERR_BUDGET is set,
+ * rlx_get_memory_required then reports the size of this spectrum.
+ *
+ * @param file file to load spectra from
+ * @param project project to load spectra from
+ * @param cursor position in the project, must be set to 0 before the first call and is advanced by every chunk
+ * @param length pointer to a size_t where the number of spectra in the chunk will be stored, or NULL
+ * @return A NULL terminated array of spectra structs will be allocated here, to be freed with rlx_spectra_free_array, or NULL when done or on error
+ */
+struct rlx_spectra** rlx_get_spectra_chunk(struct rlxfile* file, const struct rlx_project* project, int* cursor, size_t* length);
+
+/**
+ * @brief Loads the spectra with the given ids from file in given project
+ *
+ * This is considerably faster than calling rlx_get_spectra for every id, as the ids are bound once and all spectra
+ * are loaded with three queries. Ids may repeat, every occurrence gets its own spectra struct.
+ * The memory budget set with rlx_set_memory_budget is enforced like in rlx_get_all_spectra.
+ *
+ * If this function encounters an error it will return NULL and set an error at rlx_get_errnum,
+ * if any of the ids does not exist in the project this error is RLX_ERR_NON_EXIST_SPECTRA.
+ *
+ * @param file file to load spectra from
+ * @param project project to load spectra from
+ * @param ids array of ids of the spectra to load
+ * @param count number of ids
+ * @return A NULL terminated array of count spectra structs in the order of ids, to be freed with rlx_spectra_free_array, or NULL on error
+ */
+struct rlx_spectra** rlx_get_spectra_many(struct rlxfile* file, const struct rlx_project* project, const int* ids, size_t count);
+
+/**
+ * @brief Flags for rlx_for_each_spectrum
+ */
+enum rlx_for_each_flag {
+	RLX_FOR_EACH_SKIP_DATAPOINTS = 1 << 0, /**< Do not load datapoints, datapoints is NULL and length 0 */
+	RLX_FOR_EACH_SKIP_METADATA = 1 << 1, /**< Do not load metadata, metadata is NULL and metadata_count 0 */
+};
+
+/**
+ * @brief Kernel called by rlx_for_each_spectrum for every spectrum
+ *
+ * @param spectra the spectrum, owned by librelaxisloader and only valid until the kernel returns, do not free
+ * @param thread index of the calling worker thread, from 0 to the number of threads - 1
+ * @param userdata the userdata passed to rlx_for_each_spectrum
+ * @return true to continue, false to stop the loop
+ */
+typedef bool (*rlx_spectrum_fn)(const struct rlx_spectra* spectra, int thread, void* userdata);
+
+/**
+ * @brief Calls a kernel for every spectrum in a project on multiple threads
+ *
+ * Every worker thread loads spectra into buffers it reuses for the whole loop and calls fn on them in place,
+ * so at no point are more spectra in memory than there are threads. Spectra are handed out to the workers one at a time,
+ * so that spectra of uneven length balance across the threads. The order in which spectra are passed to fn is unspecified
+ * and fn is called concurrently from multiple threads. The values in the spectra are identical to those from rlx_get_spectra.
+ * Every thread besides the calling one opens its own connection to the file. The file must not be used otherwise until this function returns.
+ *
+ * @param file file to load the spectra from
+ * @param project project to load the spectra of
+ * @param flags a combination of rlx_for_each_flag values
+ * @param fn kernel to call for every spectrum
+ * @param userdata passed to fn
+ * @param threads number of threads to use, 0 for one per cpu
+ * @return RLX_ERR_SUCESS, also if fn stopped the loop, or an error code that is also set on file
+ */
+int rlx_for_each_spectrum(struct rlxfile* file, const struct rlx_project* project, int flags,
+                          rlx_spectrum_fn fn, void* userdata, int threads);
+
+/**
+ * @brief A selection of projects and spectra of a file
+ */
+struct rlx_selection {
+	const int* projects; /**< Ids of projects to select with all their spectra */
+	size_t project_count; /**< Number of ids in projects */
+	const int* spectra; /**< Ids of single spectra to select, their projects are selected without the other spectra */
+	size_t spectra_count; /**< Number of ids in spectra */
+};
+
+/**
+ * @brief Extracts a selection of projects and spectra into a new RelaxIS3 file
+ *
+ * The new file has the schema of file and contains the selected projects and spectra with their metadata, datapoints
+ * and fit parameters under their original ids, as well as the properties of file. Stored results are only copied
+ * for projects that are selected entirely, as they may refer to any spectrum of their project.
+ * All rows are copied in one transaction and the indexes are built after the rows are in place.
+ * If the extraction fails, the partially written output is removed.
+ *
+ * @param file file to extract from
+ * @param selection projects and spectra to extract
+ * @param out_path path of the file to create, must not exist or be empty
+ * @return RLX_ERR_SUCESS, RLX_ERR_EXISTS if out_path already holds data, RLX_ERR_NO_ENT or RLX_ERR_NON_EXIST_SPECTRA
+ * if a selected project or spectrum does not exist or another error code, the error is also set on file
+ */
+int rlx_extract(struct rlxfile* file, const struct rlx_selection* selection, const char* out_path);
+
+/**
+ * @brief Writes the changes made to a file since the last changeset
+ *
+ * The state of the file at the last changeset is kept in a small state database at state_path, which is created if
+ * it does not exist, in which case the changeset contains the whole file. New rows of the per spectrum tables
+ * Datapoints, FileInformation and Fitparameters are found via the largest rowid seen, so that the time and size of
+ * a changeset scale with the number of changed spectra. All other tables, like Files and Projects, are compared
+ * row by row via hashes kept in the state, this finds new, modified and deleted rows. All rows of the per spectrum
+ * tables of new or modified spectra are included. The state is only updated if the changeset was written.
+ *
+ * Every changeset applies to the state of the mirror the previous one left behind, thus all changesets
+ * must be applied in order. If a changeset is lost, the state and the mirror have to be removed to start over.
+ *
+ * @param file the file to write the changes of
+ * @param state_path path of the state database
+ * @param changeset_path path of the changeset to create, must not exist or be empty
+ * @return RLX_ERR_SUCESS, RLX_ERR_EXISTS if changeset_path already holds data or another error code, the error is also set on file
+ */
+int rlx_changeset_create(struct rlxfile* file, const char* state_path, const char* changeset_path);
+
+/**
+ * @brief Applies a changeset created by rlx_changeset_create to a mirror of the file
+ *
+ * The changeset is applied in one transaction. If the mirror does not exist, it is created, applying all changesets
+ * of a file in order to an empty mirror thus yields a copy of the file. The generation the mirror is at is recorded
+ * in the rlx_replication table of the mirror. Applying the changeset the mirror is already at again changes nothing.
+ *
+ * As rlx_changeset_create advances the state when it writes the changeset, a changeset that could not be applied
+ * must be kept and applied before the next one is created.
+ *
+ * @param mirror_path path of the mirror
+ * @param changeset_path path of the changeset
+ * @return RLX_ERR_SUCESS, RLX_ERR_CHANGESET if the changeset does not follow the last one applied to the mirror or another error code
+ */
+int rlx_changeset_apply(const char* mirror_path, const char* changeset_path);
+
 /**
  * @brief Loads spectra ids that are associated with a given project
  *
@@ -308,6 +567,80 @@ int rlx_get_float_arrays(const struct rlx_spectra *spectra, float **re, float **
  */
 int rlx_get_double_arrays(const struct rlx_spectra *spectra, double **re, double **im, double **omega);
 
+/**
+ * @brief This struct represents the datapoints of a spectrum in compressed form, suitable for keeping large amounts of spectra resident.
+ *
+ * The datapoints are stored losslessly in independently decodable blocks, allowing random access.
+ * Each column of a block is stored either as the xor with the previous value or as the second difference
+ * of the bit patterns (approximately a delta of the logarithm), whichever is smaller.
+ **/
+struct rlx_compressed_spectra;
+
+/**
+ * @brief Compresses the datapoints of a spectrum.
+ *
+ * @param spectra the spectra to compress, the spectra is not modified and still needs to be freed by the caller.
+ * @return a newly allocated rlx_compressed_spectra struct, to be freed with rlx_compressed_spectra_free, or NULL if out of memory.
+ */
+struct rlx_compressed_spectra* rlx_spectra_compress(const struct rlx_spectra* spectra);
+
+/**
+ * @brief Frees a rlx_compressed_spectra struct.
+ *
+ * It is safe to pass NULL to this function.
+ *
+ * @param cspectra the compressed spectra to be freed, or NULL.
+ */
+void rlx_compressed_spectra_free(struct rlx_compressed_spectra* cspectra);
+
+/**
+ * @brief Gets the id of the spectrum a rlx_compressed_spectra struct was created from.
+ *
+ * @param cspectra the compressed spectra.
+ * @return the spectra id.
+ */
+int rlx_compressed_spectra_get_id(const struct rlx_compressed_spectra* cspectra);
+
+/**
+ * @brief Gets the amount of data points in a compressed spectrum.
+ *
+ * @param cspectra the compressed spectra.
+ * @return the amount of data points.
+ */
+size_t rlx_compressed_spectra_get_length(const struct rlx_compressed_spectra* cspectra);
+
+/**
+ * @brief Gets the amount of memory in bytes used by a compressed spectrum.
+ *
+ * @param cspectra the compressed spectra.
+ * @return the memory used in bytes.
+ */
+size_t rlx_compressed_spectra_get_size(const struct rlx_compressed_spectra* cspectra);
+
+/**
+ * @brief Gets the compression ratio achieved, ie. the size of the uncompressed datapoints divided by rlx_compressed_spectra_get_size.
+ *
+ * @param cspectra the compressed spectra.
+ * @return the compression ratio.
+ */
+double rlx_compressed_spectra_get_ratio(const struct rlx_compressed_spectra* cspectra);
+
+/**
+ * @brief Decompresses a range of datapoints of a compressed spectrum into caller provided buffers.
+ *
+ * Only the blocks overlapping the requested range are decoded.
+ *
+ * @param cspectra the compressed spectra.
+ * @param start index of the first datapoint to decompress.
+ * @param count amount of datapoints to decompress.
+ * @param re buffer of at least count doubles where the real parts will be stored, or NULL if not required.
+ * @param im buffer of at least count doubles where the imaginary parts will be stored, or NULL if not required.
+ * @param omega buffer of at least count doubles where the omega values will be stored, or NULL if not required.
+ * @return 0 if successful or an error number < 0 interpertable by rlx_get_errnum_str if the range is out of bounds.
+ */
+int rlx_compressed_spectra_decompress(const struct rlx_compressed_spectra* cspectra, size_t start, size_t count,
+                                      double *re, double *im, double *omega);
+
 /**
  * @brief Loads the parameters for a given spectra id from file
  *
@@ -321,6 +654,845 @@ int rlx_get_double_arrays(const struct rlx_spectra *spectra, double **re, double
  */
 struct rlx_fitparam** rlx_get_fit_parameters(struct rlxfile* file, const struct rlx_project* project, int id, size_t *length);
 
+/**
+ * @brief A spectrum in the wire format of rlx_wire_serialize, viewed in place by rlx_wire_view.
+ *
+ * All pointers point into the viewed buffer and are valid as long as it is.
+ **/
+struct rlx_wire_view {
+	int id; /**< Spectra id, see rlx_spectra::id*/
+	int project_id; /**< Id of the project this spectrum belongs to*/
+	bool fitted; /**< True if circuit has been fitted to spectrum*/
+	double freq_lower_limit; /**< Lower limit of frequency range of this spectrum*/
+	double freq_upper_limit; /**< Upper limit of frequency range of this spectrum*/
+	time_t date_added; /**< UNIX time the spectra was added, see rlx_spectra::date_added*/
+	time_t date_fitted; /**< UNIX time the spectra was last fitted, see rlx_spectra::date_fitted*/
+	const char* circuit; /**< RelaxIS circuit description string or NULL*/
+	const struct rlx_datapoint* datapoints; /**< The Data points of the spectrum*/
+	size_t length; /**< Amount of data points in the spectrum*/
+	size_t metadata_count; /**< Amount of Metadata key-value pairs, get them with rlx_wire_view_metadata*/
+	size_t param_count; /**< Amount of fit parameters, get them with rlx_wire_view_fitparam*/
+	size_t size; /**< Amount of bytes of the buffer used by the spectrum, a further spectrum may follow at this offset*/
+	const unsigned char* metadata; /**< Internal, do not use*/
+	const unsigned char* params; /**< Internal, do not use*/
+	const char* strings; /**< Internal, do not use*/
+};
+
+/**
+ * @brief Serializes a spectrum and its fit parameters into a flat, versioned, little endian binary format.
+ *
+ * The result contains no pointers and can be sent to an other process or machine as is, where it is accessed with rlx_wire_view.
+ * Like snprintf this function returns the size the spectrum requires and only writes to buffer if it is at least this large,
+ * so passing NULL and 0 gets the size to allocate. The size is always a multiple of 8.
+ *
+ * @param spectra the spectrum to serialize.
+ * @param params a NULL terminated array of parameters as returned by rlx_get_fit_parameters or NULL.
+ * @param buffer the buffer to write to, or NULL.
+ * @param size the size of buffer in bytes.
+ * @return the size of the serialized spectrum in bytes, or 0 if it is too large to be represented (4 GiB or more).
+ */
+size_t rlx_wire_serialize(const struct rlx_spectra* spectra, struct rlx_fitparam** params, void* buffer, size_t size);
+
+/**
+ * @brief Views a spectrum serialized by rlx_wire_serialize in place, without parsing or allocating.
+ *
+ * The buffer is fully validated, so that it may come from an untrusted source: every offset and count is checked to lie inside of it and
+ * every string to be terminated inside of it. The effort is proportional to the amount of metadata and parameters only.
+ * The buffer must be aligned to 8 bytes, as memory from malloc is, and the host must be little endian, as the datapoints are used in place.
+ *
+ * @param buffer the buffer containing the serialized spectrum.
+ * @param size the size of buffer in bytes, may be larger than the serialized spectrum.
+ * @param view the view that will be filled.
+ * @return 0 if successful or RLX_ERR_WIRE if the buffer does not contain a valid spectrum.
+ */
+int rlx_wire_view(const void* buffer, size_t size, struct rlx_wire_view* view);
+
+/**
+ * @brief Gets a Metadata key-value pair of a viewed spectrum.
+ *
+ * The strings point into the viewed buffer, do not modify them or call rlx_metadata_free on metadata.
+ *
+ * @param view the view as filled by rlx_wire_view.
+ * @param index the index of the pair, smaller than rlx_wire_view::metadata_count.
+ * @param metadata the struct that will be filled.
+ */
+void rlx_wire_view_metadata(const struct rlx_wire_view* view, size_t index, struct rlx_metadata* metadata);
+
+/**
+ * @brief Gets a fit parameter of a viewed spectrum.
+ *
+ * The name points into the viewed buffer, do not modify it or call rlx_fitparam_free on param.
+ *
+ * @param view the view as filled by rlx_wire_view.
+ * @param index the index of the parameter, smaller than rlx_wire_view::param_count.
+ * @param param the struct that will be filled.
+ */
+void rlx_wire_view_fitparam(const struct rlx_wire_view* view, size_t index, struct rlx_fitparam* param);
+
+/**
+ * @brief This struct houses the header fields of a set of spectra as a structure of arrays.
+ *
+ * Every array has length elements, element i of every array belongs to the same spectrum.
+ **/
+struct rlx_spectra_headers {
+	size_t length; /**< Amount of spectra*/
+	const int *id; /**< Spectra ids*/
+	const int *project_id; /**< Ids of the projects the spectra belong to*/
+	const bool *fitted; /**< True if circuit has been fitted to spectrum*/
+	const double *freq_lower_limit; /**< Lower limits of the frequency range of the spectra*/
+	const double *freq_upper_limit; /**< Upper limits of the frequency range of the spectra*/
+	const time_t *date_added; /**< UNIX times the spectra where added, see rlx_spectra::date_added*/
+	const time_t *date_fitted; /**< UNIX times the spectra where last fitted, see rlx_spectra::date_fitted*/
+	const char *const *circuit; /**< RelaxIS circuit description strings, equal strings share the same pointer*/
+};
+
+/**
+ * @brief Loads the headers of all spectra in a project without their datapoints
+ *
+ * The headers are loaded with a single query on the Files table, the circuit strings are interned.
+ *
+ * If this function encounters an error it will return NULL and set an error at rlx_get_errnum.
+ *
+ * @param file file to load the headers from
+ * @param project project to load the headers of
+ * @return newly allocated headers ordered by spectrum id, to be freed with rlx_spectra_headers_free, or NULL on error
+ */
+struct rlx_spectra_headers* rlx_get_spectra_headers(struct rlxfile* file, const struct rlx_project* project);
+
+/**
+ * @brief Frees spectrum headers returned by rlx_get_spectra_headers
+ *
+ * Only headers allocated by rlx_get_spectra_headers may be passed here, not those filled in by a rlx_directory.
+ *
+ * @param headers the headers to be freed, may be NULL
+ */
+void rlx_spectra_headers_free(struct rlx_spectra_headers* headers);
+
+/**
+ * @brief This struct represents an immutable snapshot of the projects and spectrum headers of a file.
+ *
+ * A directory is built once per version of the file and can then be used by any number of threads concurrently,
+ * lookups in a directory require no locks and perform no queries on the file.
+ **/
+struct rlx_directory;
+
+/**
+ * @brief Gets the current directory snapshot of a file, building it if none exists yet.
+ *
+ * This function is thread safe and does not block on other threads using the directory,
+ * apart from building the very first snapshot of a file it performs no queries.
+ * The snapshot stays valid until it is released, even if the file is closed or the directory refreshed in the meantime.
+ *
+ * If this function encounters an error it will return NULL and set an error at rlx_get_errnum.
+ *
+ * @param file file to get the directory of
+ * @return A reference to the directory, to be released with rlx_directory_release, or NULL on error
+ */
+struct rlx_directory* rlx_directory_acquire(struct rlxfile* file);
+
+/**
+ * @brief Releases a reference to a directory acquired with rlx_directory_acquire.
+ *
+ * It is safe to pass NULL to this function.
+ *
+ * @param dir the directory to release, or NULL.
+ */
+void rlx_directory_release(struct rlx_directory* dir);
+
+/**
+ * @brief Checks if a file has been modified since its directory was built and if so builds and installs a new directory.
+ *
+ * Threads holding the old directory may continue to use it until they release it.
+ * This function is thread safe, concurrent refreshes are serialized. The directory is built on a separate read only
+ * connection to the file, so calls made on file by other threads at the same time are not affected.
+ *
+ * @param file file to refresh the directory of
+ * @return 0 if successful or an error number < 0 interpertable by rlx_get_errnum_str otherwise.
+ */
+int rlx_directory_refresh(struct rlxfile* file);
+
+/**
+ * @brief Gets the projects in a directory
+ *
+ * @param dir the directory
+ * @param length pointer to a size_t where the number of projects will be stored, or NULL
+ * @return An array of projects sorted by id, owned by the directory and valid until it is released.
+ */
+const struct rlx_project* rlx_directory_get_projects(const struct rlx_directory* dir, size_t* length);
+
+/**
+ * @brief Gets the headers of all spectra in a project of a directory
+ *
+ * @param dir the directory
+ * @param project_id id of the project
+ * @param headers struct where the headers of the spectra sorted by id will be stored, the arrays therein are owned by the directory
+ * and valid until it is released.
+ * @return 0 if successful or an error number < 0 interpertable by rlx_get_errnum_str if the project dose not exist.
+ */
+int rlx_directory_get_headers(const struct rlx_directory* dir, int project_id, struct rlx_spectra_headers* headers);
+
+/**
+ * @brief Finds a spectrum by its id in a directory
+ *
+ * @param dir the directory
+ * @param id id of the spectrum
+ * @param headers struct where the headers of the project the spectrum belongs to will be stored, as with rlx_directory_get_headers
+ * @param index pointer to a size_t where the index of the spectrum in headers will be stored, or NULL
+ * @return 0 if successful or an error number < 0 interpertable by rlx_get_errnum_str if the spectrum dose not exist.
+ */
+int rlx_directory_find_spectra(const struct rlx_directory* dir, int id, struct rlx_spectra_headers* headers, size_t* index);
+
+/**
+ * @brief This struct represents a RelaxIS circuit description compiled for evaluation.
+ **/
+struct rlx_circuit;
+
+/**
+ * @brief Compiles a RelaxIS circuit description string, as found in rlx_spectra::circuit
+ *
+ * Elements are joined in series by '-', elements or sub circuits in parentheses directly following each other
+ * are in parallel. The supported elements are R (resistance), C (capacitance), L (inductance),
+ * P (constant phase element with the parameters Q and alpha) and W (semi-infinite warburg element).
+ * Parameters are numbered in the order the elements appear in the string, as in the p_index of rlx_fitparam.
+ *
+ * @param circuit the circuit description string
+ * @param error if an error occurs and NULL is returned, pointer to an error string is set here,
+ * owned by librelaxisloader, do not free
+ * @return a newly allocated rlx_circuit struct, to be freed with rlx_circuit_free, or NULL on error
+ */
+struct rlx_circuit* rlx_circuit_compile(const char* circuit, const char** error);
+
+/**
+ * @brief Frees a rlx_circuit struct.
+ *
+ * It is safe to pass NULL to this function.
+ *
+ * @param circuit the circuit to be freed, or NULL.
+ */
+void rlx_circuit_free(struct rlx_circuit* circuit);
+
+/**
+ * @brief Gets the amount of parameters a compiled circuit has.
+ *
+ * @param circuit the circuit
+ * @return the amount of parameters
+ */
+size_t rlx_circuit_get_parameter_count(const struct rlx_circuit* circuit);
+
+/**
+ * @brief Evaluates the impedance of a compiled circuit.
+ *
+ * @param circuit the circuit
+ * @param params array of rlx_circuit_get_parameter_count parameter values
+ * @param omega array of count angular frequencies in rad/s to evaluate the circuit at
+ * @param count amount of frequencies
+ * @param re array of count doubles where the real part of the impedance will be stored
+ * @param im array of count doubles where the imaginary part of the impedance will be stored
+ * @return 0 if successful or an error number < 0 interpertable by rlx_get_errnum_str otherwise.
+ */
+int rlx_circuit_evaluate(const struct rlx_circuit* circuit, const double* params, const double* omega, size_t count,
+                         double* re, double* im);
+
+/**
+ * @brief A group of spectra that share the same circuit
+ */
+struct rlx_circuit_group {
+	char* circuit; /**< RelaxIS circuit description string shared by all spectra in the group*/
+	struct rlx_circuit* model; /**< The compiled circuit, or NULL if the circuit string is not supported by rlx_circuit_compile*/
+	int* ids; /**< Ids of the spectra in the group, in ascending order*/
+	size_t length; /**< Amount of spectra in the group*/
+	struct rlx_spectra** spectra; /**< NULL terminated array of the loaded spectra, or NULL if they where not requested*/
+};
+
+/**
+ * @brief Frees a circuit group struct including its spectra and compiled circuit
+ *
+ * @param group the group to be freed, may be NULL
+ */
+void rlx_circuit_group_free(struct rlx_circuit_group* group);
+
+/**
+ * @brief Frees an array of circuit group structs
+ *
+ * @param groups array of circuit group structs to be freed
+ */
+void rlx_circuit_group_free_array(struct rlx_circuit_group** groups);
+
+/**
+ * @brief Gets the spectra of a project grouped by their circuit.
+ *
+ * The groups are determined with a single query, this allows per circuit state, like the compiled circuit
+ * or fit workspaces, to be reused for all spectra of a group.
+ *
+ * If this function encounters an error it will return NULL and set an error at rlx_get_errnum.
+ * When loading, the memory budget set with rlx_set_memory_budget is enforced like in rlx_get_all_spectra.
+ *
+ * @param file file to load spectra from
+ * @param project project to load spectra from
+ * @param load if true the spectra of every group are loaded too, otherwise only their ids are returned
+ * @param length pointer to size_t where the number of groups will be stored or NULL
+ * @return A NULL terminated array of groups ordered by circuit string, to be freed with rlx_circuit_group_free_array, or NULL on error
+ */
+struct rlx_circuit_group** rlx_get_spectra_grouped_by_circuit(struct rlxfile* file, const struct rlx_project* project,
+                                                              bool load, size_t* length);
+
+enum rlx_fit_weighting
+{
+	RLX_FIT_WEIGHT_NONE, /**< All datapoints are weighted equally*/
+	RLX_FIT_WEIGHT_PROPORTIONAL, /**< Datapoints are weighted with the inverse of their magnitude*/
+};
+
+/**
+ * @brief Options controlling the refitting of spectra.
+ **/
+struct rlx_fit_options {
+	enum rlx_fit_weighting weighting; /**< Weighting of the datapoints*/
+	int max_iterations; /**< Maximum amount of Levenberg-Marquardt iterations*/
+	double tolerance; /**< Fitting stops once an iteration reduces the residual by less than this fraction*/
+	double freq_lower_limit; /**< Lower limit of the frequency range to fit in Hz, if <= 0 the limit stored with the spectrum is used*/
+	double freq_upper_limit; /**< Upper limit of the frequency range to fit in Hz, if <= 0 the limit stored with the spectrum is used*/
+};
+
+/**
+ * @brief Fills a rlx_fit_options struct with the default options.
+ *
+ * @param options the struct to fill
+ */
+void rlx_fit_options_default(struct rlx_fit_options* options);
+
+/**
+ * @brief This struct houses the result of refitting a spectrum.
+ **/
+struct rlx_fit_result {
+	int spectra_id; /**< Id of the spectrum fitted*/
+	int error; /**< 0 if successful or an error number < 0 interpertable by rlx_get_errnum_str*/
+	int iterations; /**< Amount of iterations performed*/
+	double chi2; /**< Weighted sum of squared residuals divided by the degrees of freedom*/
+	struct rlx_fitparam** params; /**< NULL terminated array of the fitted parameters sorted by p_index with values and errors, or NULL on error*/
+	size_t param_count; /**< Amount of parameters in params*/
+};
+
+/**
+ * @brief Frees a rlx_fit_result struct
+ *
+ * It is safe to pass NULL to this function.
+ *
+ * @param result the result to be freed, or NULL.
+ */
+void rlx_fit_result_free(struct rlx_fit_result* result);
+
+/**
+ * @brief Frees an array of rlx_fit_result structs
+ *
+ * @param results the NULL terminated array to be freed.
+ */
+void rlx_fit_result_free_array(struct rlx_fit_result** results);
+
+/**
+ * @brief Fits the circuit of a spectrum to its datapoints using the Levenberg-Marquardt algorithm.
+ *
+ * The parameters are kept within their lower and upper limits during the fit, parameters marked with
+ * rlx_fitparam::fixed are held at their value and reported with an error of 0.
+ *
+ * @param spectra the spectrum to fit
+ * @param initial NULL terminated array of parameters as returned by rlx_get_fit_parameters, used as starting values and bounds
+ * @param options the fit options or NULL for the defaults
+ * @return a newly allocated rlx_fit_result, to be freed with rlx_fit_result_free, or NULL if out of memory.
+ * Other errors are reported in rlx_fit_result::error.
+ */
+struct rlx_fit_result* rlx_fit_spectra(const struct rlx_spectra* spectra, struct rlx_fitparam** initial, const struct rlx_fit_options* options);
+
+/**
+ * @brief Refits all spectra in a project that have fit parameters.
+ *
+ * The spectra are loaded in chunks like by rlx_get_spectra_chunk, so that the memory budget set with
+ * rlx_set_memory_budget is respected, the spectra of every chunk are fitted in parallel before the next one is loaded.
+ * If a single spectrum does not fit into the budget RLX_ERR_BUDGET is set.
+ *
+ * If this function encounters an error it will return NULL and set an error at rlx_get_errnum.
+ *
+ * @param file file to load spectra from
+ * @param project project to fit
+ * @param options the fit options or NULL for the defaults
+ * @param threads amount of threads to use, or 0 to use one per cpu
+ * @return A NULL terminated array of rlx_fit_result structs, to be freed with rlx_fit_result_free_array, or NULL on error
+ */
+struct rlx_fit_result** rlx_fit_project(struct rlxfile* file, const struct rlx_project* project,
+                                        const struct rlx_fit_options* options, int threads);
+
+/**
+ * @brief Fits the circuit of several spectra simultaneously, sharing the global parameters between all of them.
+ *
+ * The parameters marked with rlx_fitparam::global in the initial parameters of the first spectrum are global,
+ * their starting values, limits and whether they are fixed are taken from the first spectrum. All other parameters
+ * are local to each spectrum. Parameters marked with rlx_fitparam::fixed are held at their value.
+ *
+ * The Levenberg-Marquardt steps are solved by eliminating the local parameters of every spectrum via the schur
+ * complement, so the time and memory required grow linearly with the amount of spectra. All spectra must have
+ * the same circuit.
+ *
+ * @param spectra array of count spectra to fit
+ * @param initial array of count NULL terminated parameter arrays as returned by rlx_get_fit_parameters, one per spectrum
+ * @param count amount of spectra
+ * @param options the fit options or NULL for the defaults
+ * @param threads amount of threads to use, or 0 to use one per cpu
+ * @return A NULL terminated array of count rlx_fit_result structs in the order of spectra, to be freed with
+ * rlx_fit_result_free_array, or NULL if out of memory. All results share the error, iterations and chi2 of the global fit.
+ */
+struct rlx_fit_result** rlx_fit_global(struct rlx_spectra** spectra, struct rlx_fitparam*** initial, size_t count,
+                                       const struct rlx_fit_options* options, int threads);
+
+/**
+ * @brief Globally fits all spectra in a project that have fit parameters, one global fit per circuit.
+ *
+ * The spectra are grouped as with rlx_get_spectra_grouped_by_circuit and every group is fitted with rlx_fit_global.
+ *
+ * If this function encounters an error it will return NULL and set an error at rlx_get_errnum.
+ *
+ * @param file file to load spectra from
+ * @param project project to fit
+ * @param options the fit options or NULL for the defaults
+ * @param threads amount of threads to use, or 0 to use one per cpu
+ * @return A NULL terminated array of rlx_fit_result structs, to be freed with rlx_fit_result_free_array, or NULL on error
+ */
+struct rlx_fit_result** rlx_fit_project_global(struct rlxfile* file, const struct rlx_project* project,
+                                               const struct rlx_fit_options* options, int threads);
+
+/**
+ * @brief Features that can be extracted from a spectrum
+ **/
+enum rlx_feature
+{
+	RLX_FEATURE_HF_INTERCEPT, /**< Real part at the zero crossing of the imaginary part with the highest frequency in Ohms*/
+	RLX_FEATURE_LF_INTERCEPT, /**< Real part at the lowest frequency local minimum of -im, ie. where a diffusion tail starts, in Ohms*/
+	RLX_FEATURE_APEX_FREQUENCY, /**< Frequency of the largest local maximum of -im in Hz*/
+	RLX_FEATURE_APEX_MAGNITUDE, /**< Largest local maximum of -im in Ohms*/
+	RLX_FEATURE_PHASE_MIN, /**< Minimum of the phase angle in degrees*/
+	RLX_FEATURE_PHASE_MIN_FREQUENCY, /**< Frequency of the minimum of the phase angle in Hz*/
+	RLX_FEATURE_WARBURG_SLOPE, /**< Slope of -im over re of the lowest frequency datapoints, 1 for a warburg element*/
+	RLX_FEATURE_COUNT, /**< Amount of features*/
+};
+
+/**
+ * @brief Gets a human readable name of a feature.
+ *
+ * @param feature the feature
+ * @return The name of the feature, static lifetime, owned by librelaxisloader do not free
+ */
+const char* rlx_feature_get_name(enum rlx_feature feature);
+
+/**
+ * @brief Extracts the features of a spectrum in one pass over its datapoints.
+ *
+ * @param spectra the spectrum
+ * @param features array of RLX_FEATURE_COUNT doubles where the features will be stored in the order of enum rlx_feature,
+ * features that can not be determined are set to NAN
+ */
+void rlx_spectra_features(const struct rlx_spectra* spectra, double* features);
+
+/**
+ * @brief Extracts the features of all spectra in a project in parallel.
+ *
+ * The spectra are loaded in chunks like by rlx_get_spectra_chunk, so that the memory budget set with
+ * rlx_set_memory_budget is respected, only the features are kept.
+ *
+ * If this function encounters an error it will return NULL and set an error at rlx_get_errnum.
+ *
+ * @param file file to load spectra from
+ * @param project project to load spectra from
+ * @param threads amount of threads to use, or 0 to use one per cpu
+ * @param ids a newly allocated array with the ids of the spectra in the order of the matrix columns will be stored here, to be freed with free(), or NULL
+ * @param length pointer to a size_t where the number of spectra will be stored, or NULL
+ * @return A newly allocated row major RLX_FEATURE_COUNT x length matrix, ie. feature f of spectrum s is at [f*length + s], to be freed with free(), or NULL on error
+ */
+double* rlx_get_project_features(struct rlxfile* file, const struct rlx_project* project, int threads, int** ids, size_t* length);
+
+/**
+ * @brief Physical quantities that can be derived from the fit parameters of a resistor parallel to a cpe or capacitor
+ **/
+enum rlx_quantity
+{
+	RLX_QUANTITY_CAPACITANCE, /**< Effective capacitance in F, for a cpe by the Brug formula (Q*R^(1-alpha))^(1/alpha)*/
+	RLX_QUANTITY_RELAXATION_FREQUENCY, /**< Relaxation frequency 1/(2*pi*(R*Q)^(1/alpha)) in Hz*/
+	RLX_QUANTITY_CONDUCTIVITY, /**< Specific conductivity Thickness/(R*Area) in the units of the Area and Thickness metadata, NAN if they are missing*/
+	RLX_QUANTITY_COUNT, /**< Amount of quantities*/
+};
+
+/**
+ * @brief Quantities derived from the fit parameters of all spectra in a project, as a struct of arrays.
+ *
+ * Every array has length elements, there is one element for every resistor parallel to a cpe or capacitor
+ * in the circuit of every fitted spectrum.
+ **/
+struct rlx_derived_quantities {
+	size_t length; /**< Amount of elements*/
+	int *spectra_id; /**< Ids of the spectra the elements belong to*/
+	int *element; /**< Index of the element among the resistor parallel to cpe or capacitor elements of its circuit, in order of appearance*/
+	double *value[RLX_QUANTITY_COUNT]; /**< The quantities indexed by enum rlx_quantity*/
+	double *error[RLX_QUANTITY_COUNT]; /**< First order errors of the quantities propagated from the errors of the fit parameters*/
+};
+
+/**
+ * @brief Gets a human readable name of a quantity.
+ *
+ * @param quantity the quantity
+ * @return The name of the quantity, static lifetime, owned by librelaxisloader do not free
+ */
+const char* rlx_quantity_get_name(enum rlx_quantity quantity);
+
+/**
+ * @brief Derives physical quantities from the stored fit parameters of all spectra in a project.
+ *
+ * Fit parameters are mapped to the elements of the circuit by their position, the parameters and the
+ * Area and Thickness metadata of the project are loaded with one query each.
+ *
+ * If this function encounters an error it will return NULL and set an error at rlx_get_errnum.
+ *
+ * @param file file to load the parameters from
+ * @param project project to derive the quantities for
+ * @return a newly allocated rlx_derived_quantities struct, to be freed with rlx_derived_quantities_free, or NULL on error
+ */
+struct rlx_derived_quantities* rlx_get_project_quantities(struct rlxfile* file, const struct rlx_project* project);
+
+/**
+ * @brief Frees a rlx_derived_quantities struct
+ *
+ * @param quantities the struct to be freed, may be NULL
+ */
+void rlx_derived_quantities_free(struct rlx_derived_quantities* quantities);
+
+/**
+ * @brief Laws describing the temperature dependence of the conductivity
+ **/
+enum rlx_temperature_law
+{
+	RLX_LAW_ARRHENIUS, /**< sigma = sigma0*exp(-Ea/(k_B*T))*/
+	RLX_LAW_VTF, /**< Vogel-Tammann-Fulcher law sigma = sigma0*exp(-Ea/(k_B*(T-T0)))*/
+};
+
+/**
+ * @brief This struct houses the result of fitting a temperature law to the spectra of a project.
+ **/
+struct rlx_activation {
+	int project_id; /**< Id of the project*/
+	int error; /**< 0 if successful or an error number < 0 interpertable by rlx_get_errnum_str, RLX_ERR_NO_SPECTRA if there where too few usable spectra*/
+	size_t points; /**< Amount of spectra used*/
+	double activation_energy; /**< Activation energy Ea in eV*/
+	double activation_energy_error; /**< Standard error of the activation energy in eV*/
+	double log_prefactor; /**< Natural logarithm of the prefactor sigma0*/
+	double log_prefactor_error; /**< Standard error of log_prefactor*/
+	double t0; /**< T0 of the VTF law in K, 0 for the arrhenius law*/
+};
+
+/**
+ * @brief Frees a rlx_activation struct
+ *
+ * It is safe to pass NULL to this function.
+ *
+ * @param activation the struct to be freed
+ */
+void rlx_activation_free(struct rlx_activation* activation);
+
+/**
+ * @brief Frees an array of rlx_activation structs
+ *
+ * @param activations array of rlx_activation structs to be freed
+ */
+void rlx_activation_free_array(struct rlx_activation** activations);
+
+/**
+ * @brief Fits a temperature law to the conductivity of the spectra of every project in a file.
+ *
+ * For every fitted spectrum with a Temperature metadata entry, given in degrees celsius as by RelaxIS, the conductivity
+ * Thickness/(R*Area) is computed from the fit parameter with the given name. Spectra without Area or Thickness
+ * metadata use 1 instead, this only affects the prefactor. The law is fitted by weighted linear regression of ln(sigma)
+ * over 1/(k_B*(T-T0)) with the weights taken from the stored parameter errors.
+ * All projects are handled in one call with a single query.
+ *
+ * If this function encounters an error it will return NULL and set an error at rlx_get_errnum.
+ *
+ * @param file file to load the parameters from
+ * @param parameter name of the resistance fit parameter, as in rlx_fitparam::name, for instance "Resistance 1"
+ * @param law the law to fit
+ * @param t0 T0 of the VTF law in K, or NAN to fit it too, ignored for the arrhenius law
+ * @param length pointer to size_t where the number of projects will be stored or NULL
+ * @return A NULL terminated array of rlx_activation structs ordered by project id, to be freed with rlx_activation_free_array, or NULL on error
+ */
+struct rlx_activation** rlx_get_activation_energies(struct rlxfile* file, const char* parameter,
+                                                    enum rlx_temperature_law law, double t0, size_t* length);
+
+/**
+ * @brief Plots that can be rendered into tiles
+ **/
+enum rlx_plot
+{
+	RLX_PLOT_NYQUIST, /**< -im over re with equally scaled axes*/
+	RLX_PLOT_BODE, /**< log magnitude and phase over log frequency, each scaled to the height of the tile*/
+};
+
+/**
+ * @brief Formats of rendered tiles
+ **/
+enum rlx_tile_format
+{
+	RLX_TILE_RGBA, /**< Uncompressed 8 bit RGBA pixels*/
+	RLX_TILE_PNG, /**< PNG image, falls back to RGBA if librelaxisloader was built without zlib*/
+};
+
+/**
+ * @brief Options for rendering tiles
+ **/
+struct rlx_tile_options {
+	enum rlx_plot plot; /**< The plot to render*/
+	enum rlx_tile_format format; /**< The format of the tile*/
+	int width; /**< Width of the tile in pixels*/
+	int height; /**< Height of the tile in pixels*/
+	uint32_t background; /**< Background color as 0xRRGGBBAA*/
+	uint32_t color; /**< Color of the line, of the magnitude for bode plots, as 0xRRGGBBAA*/
+	uint32_t color2; /**< Color of the phase line for bode plots as 0xRRGGBBAA*/
+};
+
+/**
+ * @brief A rendered thumbnail of a spectrum
+ **/
+struct rlx_tile {
+	int spectra_id; /**< Id of the spectrum rendered*/
+	int width; /**< Width of the tile in pixels*/
+	int height; /**< Height of the tile in pixels*/
+	unsigned char* rgba; /**< width*height RGBA pixels, top row first, or NULL if the tile is a PNG*/
+	unsigned char* png; /**< The PNG image, or NULL if the tile is uncompressed*/
+	size_t png_size; /**< Size of png in bytes*/
+};
+
+/**
+ * @brief A cache of rendered tiles keyed by a fingerprint of the datapoints and the render options.
+ *
+ * A cache may be shared by multiple threads and files.
+ **/
+struct rlx_tile_cache;
+
+/**
+ * @brief Fills a rlx_tile_options struct with the default options, a 128x96 PNG nyquist plot.
+ *
+ * @param options the struct to fill
+ */
+void rlx_tile_options_default(struct rlx_tile_options* options);
+
+/**
+ * @brief Frees a tile
+ *
+ * @param tile the tile to be freed, may be NULL
+ */
+void rlx_tile_free(struct rlx_tile* tile);
+
+/**
+ * @brief Frees an array of tiles
+ *
+ * @param tiles array of tiles to be freed
+ */
+void rlx_tile_free_array(struct rlx_tile** tiles);
+
+/**
+ * @brief Renders a spectrum into a tile with anti aliased lines.
+ *
+ * @param spectra the spectrum to render
+ * @param options the render options or NULL for the defaults
+ * @return a newly allocated tile, to be freed with rlx_tile_free, or NULL if out of memory
+ */
+struct rlx_tile* rlx_render_spectra(const struct rlx_spectra* spectra, const struct rlx_tile_options* options);
+
+/**
+ * @brief Renders all spectra of a project into tiles in parallel.
+ *
+ * The datapoints are read directly from the file without loading the spectra, spectra without datapoints are skipped.
+ *
+ * If this function encounters an error it will return NULL and set an error at rlx_get_errnum.
+ *
+ * @param file file to load the datapoints from
+ * @param project project to render
+ * @param options the render options or NULL for the defaults
+ * @param cache cache to take unchanged tiles from and add new ones to, or NULL
+ * @param threads amount of threads to use, or 0 to use one per cpu
+ * @return A NULL terminated array of tiles ordered by spectrum id, to be freed with rlx_tile_free_array, or NULL on error
+ */
+struct rlx_tile** rlx_render_project(struct rlxfile* file, const struct rlx_project* project, const struct rlx_tile_options* options,
+                                     struct rlx_tile_cache* cache, int threads);
+
+/**
+ * @brief Creates a tile cache
+ *
+ * @param capacity the maximum amount of tiles kept, the least recently used tiles are evicted first
+ * @return a new cache, to be freed with rlx_tile_cache_free, or NULL if out of memory
+ */
+struct rlx_tile_cache* rlx_tile_cache_create(size_t capacity);
+
+/**
+ * @brief Frees a tile cache and all tiles in it
+ *
+ * @param cache the cache to be freed, may be NULL
+ */
+void rlx_tile_cache_free(struct rlx_tile_cache* cache);
+
+/**
+ * @brief Starts recording a trace of the calls made to librelaxisloader
+ *
+ * Every call that takes a file or hands one out, ie. opening and closing files, acquiring and releasing them from
+ * the pool, the functions loading projects, spectra, headers and fit parameters, the directory, fitting, features,
+ * derived quantities, activation energies, rendering, extraction and changeset creation, is recorded with its
+ * arguments, the calling thread, its start time and duration and its result to a compact binary trace.
+ * Tile caches and rlx_changeset_apply, which works on paths only, are not recorded, neither are calls made by
+ * librelaxisloader internally.
+ * Files should be opened after the trace was started, so that the trace contains their paths.
+ * The trace can be replayed against the same or another file with the relaxisloader_replay tool.
+ * If a trace is already being recorded, it is finished and a new one started.
+ *
+ * @param path the path to write the trace to
+ * @return RLX_ERR_SUCESS or RLX_ERR_NO_ENT if the trace file could not be created
+ */
+int rlx_trace_start(const char* path);
+
+/**
+ * @brief Stops recording the trace and closes the trace file
+ */
+void rlx_trace_stop(void);
+
+/**
+ * @brief Sections of librelaxisloader for which performance counters are kept
+ *
+ * The RLX_PERF_GET_* sections cover the public function of the same name, the remaining sections cover phases
+ * inside of these functions. Sections are inclusive, ie. the time spent in RLX_PERF_SQLITE while loading datapoints
+ * is also counted in RLX_PERF_DATAPOINTS and RLX_PERF_GET_SPECTRA.
+ */
+enum rlx_perf_section {
+	RLX_PERF_GET_PROJECTS,
+	RLX_PERF_GET_SPECTRA,
+	RLX_PERF_GET_ALL_SPECTRA,
+	RLX_PERF_GET_SPECTRA_CHUNK,
+	RLX_PERF_GET_SPECTRA_MANY,
+	RLX_PERF_GET_SPECTRA_IDS,
+	RLX_PERF_GET_GROUPED,
+	RLX_PERF_GET_FIT_PARAMETERS,
+	RLX_PERF_GET_SPECTRA_HEADERS,
+	RLX_PERF_SQLITE, /**< Queries run by sqlite for projects, spectrum headers, datapoints and metadata */
+	RLX_PERF_DATAPOINTS, /**< Loading and decoding the datapoints of spectra */
+	RLX_PERF_METADATA, /**< Loading and decoding the metadata of spectra */
+	RLX_PERF_STR_TO_TIME, /**< Parsing dates of projects and spectra */
+	RLX_PERF_FOR_EACH_SPECTRUM,
+	RLX_PERF_SECTION_COUNT
+};
+
+/**
+ * @brief Hardware and software events that may be counted
+ */
+enum rlx_perf_counter {
+	RLX_PERF_CYCLES = 1 << 0,
+	RLX_PERF_INSTRUCTIONS = 1 << 1,
+	RLX_PERF_CACHE_MISSES = 1 << 2,
+	RLX_PERF_PAGE_FAULTS = 1 << 3,
+};
+
+/**
+ * @brief Counters aggregated over all calls to a section
+ */
+struct rlx_perf_counters {
+	uint64_t calls; /**< Number of times the section was entered */
+	uint64_t time_ns; /**< Wall clock time spent in the section in ns */
+	uint64_t cycles; /**< Cpu cycles spent in user space */
+	uint64_t instructions; /**< Instructions retired in user space */
+	uint64_t cache_misses; /**< Last level cache misses */
+	uint64_t page_faults; /**< Page faults */
+	unsigned int valid; /**< rlx_perf_counter values of the counters that were available for every call */
+};
+
+/**
+ * @brief Gets the performance counters of a section for a file opened with RLX_OPEN_PERF_COUNTERS
+ *
+ * Counters are read via perf_event_open on linux. Where hardware counters are unavailable, eg. on other platforms,
+ * in virtual machines or due to perf_event_paranoid, only calls and time_ns are counted and the respective bits of valid are unset.
+ * Reading the counters costs a few system calls per section, so timings of short sections are inflated.
+ *
+ * @param file file to get the counters for
+ * @param section the section to get the counters of
+ * @param counters struct the counters are written to
+ * @return RLX_ERR_SUCESS or RLX_ERR_NO_ENT if the file was not opened with RLX_OPEN_PERF_COUNTERS
+ */
+int rlx_get_perf_counters(struct rlxfile* file, enum rlx_perf_section section, struct rlx_perf_counters* counters);
+
+/**
+ * @brief Resets all performance counters of a file to zero
+ *
+ * @param file file to reset the counters of
+ */
+void rlx_reset_perf_counters(struct rlxfile* file);
+
+/**
+ * @brief Gets a human readable name for a section
+ *
+ * @param section the section to get the name of
+ * @return a string owned by librelaxisloader
+ */
+const char* rlx_perf_section_name(enum rlx_perf_section section);
+
+struct rlx_watcher;
+
+/**
+ * @brief Callback receiving spectra ingested by a rlx_watcher
+ *
+ * @param path path of the file the spectrum was loaded from
+ * @param file the opened file, valid only for the duration of the callback
+ * @param spectra a new or changed spectrum, ownership is passed to the callback, to be freed with rlx_spectra_free
+ * @param userdata the userdata pointer given to rlx_watcher_create
+ */
+typedef void (*rlx_watch_sink)(const char* path, struct rlxfile* file, struct rlx_spectra* spectra, void* userdata);
+
+/**
+ * @brief Creates a watcher that ingests new and changed spectra from RelaxIS3 files in a directory.
+ *
+ * The directory is monitored with inotify, so this is only supported on Linux.
+ * Files are ingested once they have not been written to for debounce_ms and RelaxIS holds no locks on them,
+ * writes to the write ahead log of a file count as writes to the file.
+ * Spectra that did not change since the last time a file was ingested are skipped, spectra that failed to load
+ * are tried again on the next ingestion of the file.
+ *
+ * @param directory the directory to watch
+ * @param debounce_ms time in milliseconds a file must remain unmodified before it is ingested
+ * @param scan_existing if true the files already present in the directory are ingested too
+ * @param sink callback that receives the spectra
+ * @param userdata pointer passed to sink
+ * @param error if an error occurs and NULL is returned, pointer to an error string is set here,
+ * owned by librelaxisloader, do not free, valid only until next call to librelaxisloader
+ * @return a new watcher, to be freed with rlx_watcher_free, or NULL on error
+ */
+struct rlx_watcher* rlx_watcher_create(const char* directory, int debounce_ms, bool scan_existing,
+                                       rlx_watch_sink sink, void* userdata, const char** error);
+
+/**
+ * @brief Gets a file descriptor that becomes readable when the watched directory changes.
+ *
+ * This allows the watcher to be integrated into an existing poll loop, rlx_watcher_run with a timeout of 0
+ * should be called when the descriptor becomes readable and once the debounce period has passed.
+ *
+ * @param watcher the watcher
+ * @return the file descriptor, owned by the watcher, or -1 if unsupported
+ */
+int rlx_watcher_get_fd(const struct rlx_watcher* watcher);
+
+/**
+ * @brief Waits for changes to the watched directory and passes new or changed spectra to the sink.
+ *
+ * @param watcher the watcher
+ * @param timeout_ms the maximum time to wait in milliseconds, -1 to wait until spectra have been ingested
+ * @return the number of spectra passed to the sink, 0 if the timeout expired or a negative error number
+ */
+int rlx_watcher_run(struct rlx_watcher* watcher, int timeout_ms);
+
+/**
+ * @brief Frees a watcher.
+ *
+ * @param watcher the watcher to free, may be NULL
+ */
+void rlx_watcher_free(struct rlx_watcher* watcher);
+
 /**
  * @brief Returns the last error returned on a file operation
  *
@@ -0,0 +1,176 @@
+/*
+ * relaxisloader
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * relaxisloader is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * relaxisloader is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <relaxisloader.h>
+
+/*
+ * Measures the time rlx_get_all_spectra takes for every project of a file, once with the default io path and
+ * once with RLX_OPEN_PREFETCH. Unless asked to run warm, the file is evicted from the page cache before every
+ * run, so that the io of the device itself is measured. Afterwards one more run of each is made with RLX_OPEN_PERF_COUNTERS
+ * and the counters of every section of librelaxisloader that was entered are printed.
+ */
+
+#define DEFAULT_RUNS 5
+
+struct bench_result
+{
+	double best;
+	double mean;
+	size_t spectra;
+};
+
+static void drop_cache(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if(fd < 0)
+		return;
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+}
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1e3 + ts.tv_nsec/1e6;
+}
+
+static void print_counters(struct rlxfile *file)
+{
+	printf("%-36s %8s %12s %14s %14s %12s %10s\n", "section", "calls", "time us", "cycles", "instructions", "cache misses", "faults");
+	for(int i = 0; i < RLX_PERF_SECTION_COUNT; ++i) {
+		struct rlx_perf_counters counters;
+		if(rlx_get_perf_counters(file, i, &counters) != RLX_ERR_SUCESS || counters.calls == 0)
+			continue;
+		printf("%-36s %8llu %12.1f", rlx_perf_section_name(i), (unsigned long long)counters.calls, counters.time_ns/1e3);
+		const uint64_t values[] = {counters.cycles, counters.instructions, counters.cache_misses, counters.page_faults};
+		const int widths[] = {14, 14, 12, 10};
+		for(int j = 0; j < 4; ++j) {
+			if(counters.valid & (1 << j))
+				printf(" %*llu", widths[j], (unsigned long long)values[j]);
+			else
+				printf(" %*s", widths[j], "n/a");
+		}
+		printf("\n");
+	}
+}
+
+static int bench(const char *path, int flags, int runs, bool warm, struct bench_result *result)
+{
+	result->best = -1;
+	result->mean = 0;
+	result->spectra = 0;
+	for(int i = 0; i < runs; ++i) {
+		if(!warm)
+			drop_cache(path);
+
+		double start = now_ms();
+		const char *error;
+		struct rlxfile *file = rlx_open_file_flags(path, flags, &error);
+		if(!file) {
+			printf("Unable to open %s: %s\n", path, error);
+			return -1;
+		}
+
+		size_t spectraCount = 0;
+		size_t projectCount;
+		struct rlx_project **projects = rlx_get_projects(file, &projectCount);
+		for(size_t j = 0; projects && j < projectCount; ++j) {
+			struct rlx_spectra **spectra = rlx_get_all_spectra(file, projects[j]);
+			if(!spectra)
+				continue;
+			for(struct rlx_spectra **iter = spectra; *iter; ++iter)
+				++spectraCount;
+			rlx_spectra_free_array(spectra);
+		}
+		if(projects)
+			rlx_project_free_array(projects);
+		if(flags & RLX_OPEN_PERF_COUNTERS)
+			print_counters(file);
+		rlx_close_file(file);
+
+		double ms = now_ms() - start;
+		if(result->best < 0 || ms < result->best)
+			result->best = ms;
+		result->mean += ms/runs;
+		result->spectra = spectraCount;
+	}
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage %s [-r RUNS] [-w] [FILE]\n", name);
+}
+
+int main(int argc, char** argv)
+{
+	int runs = DEFAULT_RUNS;
+	bool warm = false;
+	int opt;
+	while((opt = getopt(argc, argv, "r:wh")) != -1) {
+		switch(opt) {
+			case 'r':
+				runs = atoi(optarg);
+				if(runs < 1) {
+					printf("Runs must be at least 1\n");
+					return 1;
+				}
+				break;
+			case 'w':
+				warm = true;
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if(argc - optind != 1) {
+		usage(argv[0]);
+		return 1;
+	}
+	const char *path = argv[optind];
+
+	struct bench_result plain, prefetch;
+	if(bench(path, 0, runs, warm, &plain) != 0 || bench(path, RLX_OPEN_PREFETCH, runs, warm, &prefetch) != 0)
+		return 2;
+
+	printf("%zu spectra, %d %s runs\n", plain.spectra, runs, warm ? "warm" : "cold");
+	printf("default:  best %.3f ms, mean %.3f ms\n", plain.best, plain.mean);
+	printf("prefetch: best %.3f ms, mean %.3f ms\n", prefetch.best, prefetch.mean);
+	if(plain.spectra != prefetch.spectra) {
+		printf("Prefetching loaded %zu spectra instead of %zu\n", prefetch.spectra, plain.spectra);
+		return 3;
+	}
+
+	struct bench_result counted;
+	printf("\ndefault counters:\n");
+	if(bench(path, RLX_OPEN_PERF_COUNTERS, 1, warm, &counted) != 0)
+		return 2;
+	printf("\nprefetch counters:\n");
+	if(bench(path, RLX_OPEN_PREFETCH | RLX_OPEN_PERF_COUNTERS, 1, warm, &counted) != 0)
+		return 2;
+	return 0;
+}
@@ -0,0 +1,201 @@
+/*
+ * relaxisloader
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * relaxisloader is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * relaxisloader is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <zstd.h>
+
+/*
+ * Compresses a RelaxIS3 file into the zstd seekable format read transparently by rlx_open_file.
+ * Frames hold a whole number of database pages so that every page read decompresses exactly one frame.
+ */
+
+#define SQLITE_HEADER_SIZE 100
+#define DEFAULT_FRAME_TARGET (64*1024)
+#define SKIPPABLE_MAGIC 0x184D2A5Eu
+#define SEEKABLE_MAGIC 0x8F92EAB1u
+
+static void write_le32(unsigned char *data, uint32_t value)
+{
+	data[0] = value;
+	data[1] = value >> 8;
+	data[2] = value >> 16;
+	data[3] = value >> 24;
+}
+
+static size_t read_page_size(FILE *fp)
+{
+	unsigned char header[SQLITE_HEADER_SIZE];
+	if(fread(header, 1, sizeof(header), fp) != sizeof(header) || memcmp(header, "SQLite format 3", 16) != 0)
+		return 0;
+	rewind(fp);
+	size_t pageSize = header[16] << 8 | header[17];
+	return pageSize == 1 ? 65536 : pageSize;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage %s [-l LEVEL] [-p PAGES_PER_FRAME] [INPUT] [OUTPUT]\n", name);
+}
+
+int main(int argc, char** argv)
+{
+	int level = 19;
+	long pagesPerFrame = 0;
+	int opt;
+	while((opt = getopt(argc, argv, "l:p:h")) != -1) {
+		switch(opt) {
+			case 'l':
+				level = atoi(optarg);
+				break;
+			case 'p':
+				pagesPerFrame = strtol(optarg, NULL, 10);
+				if(pagesPerFrame < 1) {
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if(argc - optind != 2) {
+		usage(argv[0]);
+		return 1;
+	}
+	const char *inPath = argv[optind];
+	const char *outPath = argv[optind+1];
+
+	FILE *in = fopen(inPath, "rb");
+	if(!in) {
+		printf("Unable to open %s\n", inPath);
+		return 2;
+	}
+
+	size_t pageSize = read_page_size(in);
+	if(pageSize < 512) {
+		printf("%s is not a sqlite database\n", inPath);
+		fclose(in);
+		return 2;
+	}
+
+	char *walPath = malloc(strlen(inPath) + 5);
+	sprintf(walPath, "%s-wal", inPath);
+	if(access(walPath, F_OK) == 0)
+		printf("Warning: %s exists, changes not yet checkpointed into %s will be missing\n", walPath, inPath);
+	free(walPath);
+
+	if(pagesPerFrame == 0)
+		pagesPerFrame = pageSize < DEFAULT_FRAME_TARGET ? DEFAULT_FRAME_TARGET/pageSize : 1;
+	const size_t frameSize = pageSize*pagesPerFrame;
+
+	FILE *out = fopen(outPath, "wb");
+	if(!out) {
+		printf("Unable to open %s\n", outPath);
+		fclose(in);
+		return 2;
+	}
+
+	const size_t bound = ZSTD_compressBound(frameSize);
+	unsigned char *frame = malloc(frameSize);
+	unsigned char *compressed = malloc(bound);
+	ZSTD_CCtx *cctx = ZSTD_createCCtx();
+	unsigned char *table = NULL;
+	size_t frameCount = 0;
+	uint64_t inSize = 0;
+	uint64_t outSize = 0;
+	int ret = 0;
+
+	if(!frame || !compressed || !cctx) {
+		puts("Out of memory");
+		ret = 3;
+		goto out;
+	}
+
+	size_t length;
+	while((length = fread(frame, 1, frameSize, in)) > 0) {
+		size_t compSize = ZSTD_compressCCtx(cctx, compressed, bound, frame, length, level);
+		if(ZSTD_isError(compSize)) {
+			printf("Compression failed: %s\n", ZSTD_getErrorName(compSize));
+			ret = 3;
+			goto out;
+		}
+		if(fwrite(compressed, 1, compSize, out) != compSize) {
+			printf("Unable to write %s\n", outPath);
+			ret = 2;
+			goto out;
+		}
+
+		unsigned char *newTable = realloc(table, (frameCount+1)*8);
+		if(!newTable) {
+			puts("Out of memory");
+			ret = 3;
+			goto out;
+		}
+		table = newTable;
+		write_le32(table + frameCount*8, compSize);
+		write_le32(table + frameCount*8 + 4, length);
+		++frameCount;
+		inSize += length;
+		outSize += compSize;
+	}
+
+	if(ferror(in) || frameCount == 0) {
+		printf("Unable to read %s\n", inPath);
+		ret = 2;
+		goto out;
+	}
+
+	unsigned char header[8];
+	unsigned char footer[9];
+	write_le32(header, SKIPPABLE_MAGIC);
+	write_le32(header + 4, frameCount*8 + sizeof(footer));
+	write_le32(footer, frameCount);
+	footer[4] = 0;
+	write_le32(footer + 5, SEEKABLE_MAGIC);
+	if(fwrite(header, 1, sizeof(header), out) != sizeof(header) ||
+	   fwrite(table, 8, frameCount, out) != frameCount ||
+	   fwrite(footer, 1, sizeof(footer), out) != sizeof(footer)) {
+		printf("Unable to write %s\n", outPath);
+		ret = 2;
+		goto out;
+	}
+	outSize += sizeof(header) + frameCount*8 + sizeof(footer);
+
+	printf("%zu frames of %zu pages of %zu bytes, %llu -> %llu bytes (%.2fx)\n", frameCount, (size_t)pagesPerFrame,
+	       pageSize, (unsigned long long)inSize, (unsigned long long)outSize, (double)inSize/outSize);
+
+out:
+	ZSTD_freeCCtx(cctx);
+	free(frame);
+	free(compressed);
+	free(table);
+	fclose(in);
+	if(fclose(out) != 0 && ret == 0) {
+		printf("Unable to write %s\n", outPath);
+		ret = 2;
+	}
+	if(ret != 0)
+		remove(outPath);
+	return ret;
+}
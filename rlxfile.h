@@ -0,0 +1,75 @@
+/*
+ * relaxisloader
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * relaxisloader is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * relaxisloader is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <sqlite3.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+struct rlx_directory;
+struct rlx_perf;
+struct rlx_pool_entry;
+
+struct rlxfile
+{
+	int error;
+	sqlite3 *db;
+	size_t memory_budget;
+	size_t memory_required;
+	bool prefetch;
+	uint32_t trace_handle;
+	uint32_t prefetch_roots[3];
+	struct rlx_perf *perf;
+	const char *vfs;
+	struct rlx_pool_entry *pool; // set if the file was opened by rlx_pool_acquire
+	atomic_int_fast64_t many_calls; // numbers the calls of rlx_get_spectra_many, see rlx_many_bind_ids
+
+	_Atomic(struct rlx_directory*) directory;
+	atomic_int directory_readers;
+	pthread_mutex_t directory_lock;
+	int64_t directory_version;
+};
+
+struct rlx_project;
+struct rlx_spectra;
+struct rlx_fitparam;
+struct rlx_circuit_group;
+struct rlx_spectra_headers;
+
+/* Converts a column like the text based loaders do, so that all paths yield bit identical values */
+double rlx_column_number(sqlite3_stmt* ppStmt, int col);
+
+void rlx_directory_file_close(struct rlxfile* file);
+void rlx_pool_file_close(struct rlxfile* file);
+
+/* Loaders for use within the library, they are neither traced nor counted as api calls by the perf counters */
+int* rlx_get_spectra_ids_untraced(struct rlxfile* file, const struct rlx_project* project, size_t* length);
+struct rlx_spectra** rlx_get_spectra_many_untraced(struct rlxfile* file, const struct rlx_project* project, const int* ids, size_t count);
+struct rlx_spectra_headers* rlx_get_spectra_headers_untraced(struct rlxfile* file, const struct rlx_project* project);
+struct rlx_spectra** rlx_get_spectra_chunk_untraced(struct rlxfile* file, const struct rlx_project* project, int* cursor, size_t* length);
+struct rlx_circuit_group** rlx_get_spectra_grouped_by_circuit_untraced(struct rlxfile* file, const struct rlx_project* project,
+                                                                       bool load, size_t* length);
+
+/*
+ * Loads the parameters of count spectra with one query. Returns an array of count NULL terminated parameter arrays,
+ * empty for spectra without parameters, whose lengths are stored in lengths. Free every array with
+ * rlx_fitparam_free_array and the outer one with free.
+ */
+struct rlx_fitparam*** rlx_get_fit_parameters_many_untraced(struct rlxfile* file, const int* ids, size_t count, size_t* lengths);
@@ -0,0 +1,168 @@
+/*
+ * relaxisloader
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * relaxisloader is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * relaxisloader is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <relaxisloader.h>
+
+/*
+ * Mirrors every RelaxIS3 file of a source directory into a mirror directory via changesets. The state of every
+ * source file is kept in a state directory, by default .rlxstate inside the mirror directory, the changesets are
+ * written next to the mirror and removed once applied. A changeset that could not be applied is kept and applied
+ * first on the next run. Run it again after files in the source directory changed to transfer only the changes.
+ */
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1e3 + ts.tv_nsec/1e6;
+}
+
+static long long file_size(const char *path)
+{
+	struct stat st;
+	return stat(path, &st) == 0 ? (long long)st.st_size : -1;
+}
+
+static bool is_eis3(const char *name)
+{
+	size_t length = strlen(name);
+	return length > 5 && strcasecmp(name + length - 5, ".eis3") == 0;
+}
+
+static int mirror_file(const char *sourceDir, const char *mirrorDir, const char *stateDir, const char *name)
+{
+	char *source = NULL, *mirror = NULL, *state = NULL, *changeset = NULL;
+	int ret = 0;
+	if(asprintf(&source, "%s/%s", sourceDir, name) < 0 || asprintf(&mirror, "%s/%s", mirrorDir, name) < 0 ||
+	   asprintf(&state, "%s/%s.state", stateDir, name) < 0 || asprintf(&changeset, "%s/%s.changeset", mirrorDir, name) < 0) {
+		ret = -1;
+		goto out;
+	}
+
+	double start = now_ms();
+	const char *error;
+	struct rlxfile *file = rlx_open_file(source, &error);
+	if(!file) {
+		printf("Unable to open %s: %s\n", source, error);
+		ret = -1;
+		goto out;
+	}
+
+	/* the state already includes a changeset left behind by a run that failed to apply it, so it goes first */
+	int err = access(changeset, F_OK) == 0 ? rlx_changeset_apply(mirror, changeset) : RLX_ERR_SUCESS;
+	if(err != RLX_ERR_SUCESS) {
+		printf("Unable to apply the remaining changeset %s to %s: %s\n", changeset, mirror, rlx_get_errnum_str(err));
+		rlx_close_file(file);
+		ret = -1;
+		goto out;
+	}
+	remove(changeset);
+
+	err = rlx_changeset_create(file, state, changeset);
+	rlx_close_file(file);
+	if(err != RLX_ERR_SUCESS) {
+		printf("Unable to create changeset for %s: %s\n", source, rlx_get_errnum_str(err));
+		ret = -1;
+		goto out;
+	}
+	double created = now_ms();
+
+	err = rlx_changeset_apply(mirror, changeset);
+	if(err != RLX_ERR_SUCESS) {
+		printf("Unable to apply changeset to %s: %s\n", mirror, rlx_get_errnum_str(err));
+		if(err == RLX_ERR_CHANGESET)
+			printf("Remove %s and %s to mirror the file again from scratch\n", state, mirror);
+		ret = -1;
+		goto out;
+	}
+	double applied = now_ms();
+
+	printf("%-40s %12lld %12lld %10.1f %10.1f\n", name, file_size(source), file_size(changeset), created - start, applied - created);
+	remove(changeset);
+
+out:
+	free(source);
+	free(mirror);
+	free(state);
+	free(changeset);
+	return ret;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage %s [-s STATE_DIR] SOURCE_DIR MIRROR_DIR\n", name);
+}
+
+int main(int argc, char** argv)
+{
+	const char *stateDir = NULL;
+	int opt;
+	while((opt = getopt(argc, argv, "s:h")) != -1) {
+		switch(opt) {
+			case 's':
+				stateDir = optarg;
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if(argc - optind != 2) {
+		usage(argv[0]);
+		return 1;
+	}
+	const char *sourceDir = argv[optind];
+	const char *mirrorDir = argv[optind+1];
+
+	char *defaultStateDir = NULL;
+	if(!stateDir) {
+		if(asprintf(&defaultStateDir, "%s/.rlxstate", mirrorDir) < 0)
+			return 2;
+		stateDir = defaultStateDir;
+	}
+	mkdir(mirrorDir, 0755);
+	mkdir(stateDir, 0755);
+
+	DIR *dir = opendir(sourceDir);
+	if(!dir) {
+		printf("Unable to open %s\n", sourceDir);
+		free(defaultStateDir);
+		return 2;
+	}
+
+	printf("%-40s %12s %12s %10s %10s\n", "file", "bytes", "changeset", "create ms", "apply ms");
+	int failed = 0;
+	struct dirent *ent;
+	while((ent = readdir(dir))) {
+		if(is_eis3(ent->d_name) && mirror_file(sourceDir, mirrorDir, stateDir, ent->d_name) != 0)
+			++failed;
+	}
+	closedir(dir);
+	free(defaultStateDir);
+	return failed ? 3 : 0;
+}
@@ -0,0 +1,349 @@
+/*
+ * relaxisloader
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * relaxisloader is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * relaxisloader is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sqlite3.h>
+#include <relaxisloader.h>
+
+#include "utils.h"
+
+/*
+ * Rewrites a RelaxIS3 file into a read optimized copy with the same schema: rows of the per spectrum tables
+ * are renumbered in file_id order so that every spectrum occupies contiguous pages, planner statistics are gathered
+ * and the copy is vacuumed. No indexes are added, as with the rows in file_id order the existing file_id indexes
+ * already lead to contiguous rows, so the copy is not larger than the original. This reduces the pages read per
+ * spectrum for files whose spectra where written interleaved, files already in file_id order gain nothing.
+ * The copy is then loaded with librelaxisloader and compared to the original.
+ */
+
+#define BENCH_RUNS 5
+
+static int exec(sqlite3 *db, const char *sql)
+{
+	char *error = NULL;
+	int ret = sqlite3_exec(db, sql, NULL, NULL, &error);
+	if(ret != SQLITE_OK) {
+		printf("%s failed: %s\n", sql, error ? error : sqlite3_errstr(ret));
+		sqlite3_free(error);
+	}
+	return ret;
+}
+
+static bool table_has_column(sqlite3 *db, const char *table, const char *column)
+{
+	char *sql = sqlite3_mprintf("SELECT 1 FROM pragma_table_info(%Q, 'src') WHERE name=%Q", table, column);
+	sqlite3_stmt *stmt;
+	bool ret = false;
+	if(sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+		ret = sqlite3_step(stmt) == SQLITE_ROW;
+		sqlite3_finalize(stmt);
+	}
+	sqlite3_free(sql);
+	return ret;
+}
+
+/* Copies a table, if it has a file_id column the rows are renumbered so that rowid order equals file_id order */
+static int copy_table(sqlite3 *db, const char *table)
+{
+	char *sql;
+	if(table_has_column(db, table, "file_id") && table_has_column(db, table, "ID")) {
+		char *columns = sqlite3_mprintf("");
+		sqlite3_stmt *stmt;
+		char *req = sqlite3_mprintf("SELECT name FROM pragma_table_info(%Q, 'src') WHERE name != 'ID'", table);
+		int ret = sqlite3_prepare_v2(db, req, -1, &stmt, NULL);
+		sqlite3_free(req);
+		if(ret != SQLITE_OK) {
+			sqlite3_free(columns);
+			return ret;
+		}
+		while(columns && (ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+			char *newColumns = sqlite3_mprintf("%s,\"%w\"", columns, (const char*)sqlite3_column_text(stmt, 0));
+			sqlite3_free(columns);
+			columns = newColumns;
+		}
+		sqlite3_finalize(stmt);
+		if(!columns || ret != SQLITE_DONE) {
+			ret = columns ? ret : SQLITE_NOMEM;
+			sqlite3_free(columns);
+			return ret;
+		}
+		sql = sqlite3_mprintf("INSERT INTO main.\"%w\" (ID%s) SELECT row_number() OVER (ORDER BY file_id,ID)%s FROM src.\"%w\" ORDER BY file_id,ID",
+		                      table, columns, columns, table);
+		sqlite3_free(columns);
+	}
+	else {
+		sql = sqlite3_mprintf("INSERT INTO main.\"%w\" SELECT * FROM src.\"%w\"", table, table);
+	}
+	int ret = exec(db, sql);
+	sqlite3_free(sql);
+	return ret;
+}
+
+static int copy_schema(sqlite3 *db, const char *type)
+{
+	sqlite3_stmt *stmt;
+	int ret = sqlite3_prepare_v2(db, "SELECT name,sql FROM src.sqlite_master WHERE type=? AND sql NOT NULL AND name NOT LIKE 'sqlite_%'",
+	                             -1, &stmt, NULL);
+	if(ret != SQLITE_OK)
+		return ret;
+	sqlite3_bind_text(stmt, 1, type, -1, SQLITE_STATIC);
+	int step = SQLITE_DONE;
+	while(ret == SQLITE_OK && (step = sqlite3_step(stmt)) == SQLITE_ROW) {
+		ret = exec(db, (const char*)sqlite3_column_text(stmt, 1));
+		if(ret == SQLITE_OK && strcmp(type, "table") == 0)
+			ret = copy_table(db, (const char*)sqlite3_column_text(stmt, 0));
+	}
+	sqlite3_finalize(stmt);
+	return ret == SQLITE_OK && step != SQLITE_DONE ? step : ret;
+}
+
+static int copy_pragma(sqlite3 *db, const char *pragma)
+{
+	char *sql = sqlite3_mprintf("PRAGMA src.%s", pragma);
+	sqlite3_stmt *stmt;
+	int ret = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+	sqlite3_free(sql);
+	if(ret != SQLITE_OK)
+		return ret;
+	if(sqlite3_step(stmt) == SQLITE_ROW) {
+		sql = sqlite3_mprintf("PRAGMA main.%s=%s", pragma, (const char*)sqlite3_column_text(stmt, 0));
+		ret = exec(db, sql);
+		sqlite3_free(sql);
+	}
+	sqlite3_finalize(stmt);
+	return ret;
+}
+
+static int optimize(const char *inPath, const char *outPath, int pageSize)
+{
+	sqlite3 *db;
+	int ret = sqlite3_open_v2(outPath, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_URI, NULL);
+	if(ret != SQLITE_OK) {
+		printf("Unable to create %s: %s\n", outPath, sqlite3_errstr(ret));
+		sqlite3_close(db);
+		return ret;
+	}
+
+	char *uri = rlx_uri_readonly(inPath, NULL);
+	char *sql = uri ? sqlite3_mprintf("ATTACH %Q AS src", uri) : NULL;
+	ret = sql ? exec(db, sql) : SQLITE_NOMEM;
+	sqlite3_free(sql);
+	free(uri);
+
+	// the page size of the copy is the one of the original unless one is given
+	if(ret == SQLITE_OK && pageSize > 0) {
+		sql = sqlite3_mprintf("PRAGMA main.page_size=%d", pageSize);
+		ret = exec(db, sql);
+		sqlite3_free(sql);
+	}
+	else if(ret == SQLITE_OK) {
+		ret = copy_pragma(db, "page_size");
+	}
+	if(ret == SQLITE_OK)
+		ret = exec(db, "BEGIN");
+	if(ret == SQLITE_OK)
+		ret = copy_pragma(db, "user_version");
+	if(ret == SQLITE_OK)
+		ret = copy_pragma(db, "application_id");
+	if(ret == SQLITE_OK)
+		ret = copy_schema(db, "table");
+	if(ret == SQLITE_OK)
+		ret = copy_schema(db, "index");
+	if(ret == SQLITE_OK)
+		ret = copy_schema(db, "view");
+	if(ret == SQLITE_OK)
+		ret = copy_schema(db, "trigger");
+	if(ret == SQLITE_OK)
+		ret = exec(db, "COMMIT");
+	if(ret == SQLITE_OK)
+		ret = exec(db, "DETACH src");
+	if(ret == SQLITE_OK)
+		ret = exec(db, "ANALYZE");
+	if(ret == SQLITE_OK)
+		ret = exec(db, "VACUUM");
+
+	if(ret != SQLITE_OK)
+		printf("Unable to write %s: %s\n", outPath, sqlite3_errmsg(db));
+	sqlite3_close(db);
+	return ret;
+}
+
+static bool spectra_equal(const struct rlx_spectra *a, const struct rlx_spectra *b)
+{
+	if(a->length != b->length || a->metadata_count != b->metadata_count || a->fitted != b->fitted ||
+	   a->project_id != b->project_id || strcmp(a->circuit, b->circuit) != 0 ||
+	   a->date_added != b->date_added || a->date_fitted != b->date_fitted ||
+	   memcmp(&a->freq_lower_limit, &b->freq_lower_limit, sizeof(double)) != 0 ||
+	   memcmp(&a->freq_upper_limit, &b->freq_upper_limit, sizeof(double)) != 0)
+		return false;
+	if(a->length && memcmp(a->datapoints, b->datapoints, sizeof(*a->datapoints)*a->length) != 0)
+		return false;
+	for(size_t i = 0; i < a->metadata_count; ++i) {
+		if(strcmp(a->metadata[i].key, b->metadata[i].key) != 0 || strcmp(a->metadata[i].str, b->metadata[i].str) != 0)
+			return false;
+	}
+	return true;
+}
+
+static bool params_equal(struct rlx_fitparam **a, struct rlx_fitparam **b)
+{
+	if(!a || !b)
+		return a == b;
+	for(; *a && *b; ++a, ++b) {
+		if((*a)->p_index != (*b)->p_index || strcmp((*a)->name, (*b)->name) != 0 ||
+		   memcmp(&(*a)->value, &(*b)->value, sizeof(double)*4) != 0 ||
+		   (*a)->fixed != (*b)->fixed || (*a)->global != (*b)->global)
+			return false;
+	}
+	return !*a && !*b;
+}
+
+/* Loads every spectrum and its parameters, if other is given the result is compared to it, returns mismatches */
+static int load_all(struct rlxfile *file, struct rlxfile *other)
+{
+	struct rlx_directory *dir = rlx_directory_acquire(file);
+	if(!dir)
+		return -1;
+
+	int mismatches = 0;
+	size_t projectCount;
+	const struct rlx_project *projects = rlx_directory_get_projects(dir, &projectCount);
+	for(size_t i = 0; i < projectCount; ++i) {
+		struct rlx_spectra_headers headers;
+		if(rlx_directory_get_headers(dir, projects[i].id, &headers) != RLX_ERR_SUCESS)
+			continue;
+		for(size_t j = 0; j < headers.length; ++j) {
+			struct rlx_spectra *spectra = rlx_get_spectra(file, &projects[i], headers.id[j]);
+			struct rlx_fitparam **params = rlx_get_fit_parameters(file, &projects[i], headers.id[j], NULL);
+			if(other) {
+				struct rlx_spectra *otherSpectra = rlx_get_spectra(other, &projects[i], headers.id[j]);
+				struct rlx_fitparam **otherParams = rlx_get_fit_parameters(other, &projects[i], headers.id[j], NULL);
+				if(!spectra || !otherSpectra || !spectra_equal(spectra, otherSpectra) || !params_equal(params, otherParams)) {
+					printf("Spectrum %d differs\n", headers.id[j]);
+					++mismatches;
+				}
+				rlx_spectra_free(otherSpectra);
+				if(otherParams)
+					rlx_fitparam_free_array(otherParams);
+			}
+			rlx_spectra_free(spectra);
+			if(params)
+				rlx_fitparam_free_array(params);
+		}
+	}
+	rlx_directory_release(dir);
+	return mismatches;
+}
+
+static double bench(const char *path)
+{
+	double best = -1;
+	for(int i = 0; i < BENCH_RUNS; ++i) {
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		struct rlxfile *file = rlx_open_file(path, NULL);
+		if(!file)
+			return -1;
+		load_all(file, NULL);
+		rlx_close_file(file);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double ms = (end.tv_sec - start.tv_sec)*1e3 + (end.tv_nsec - start.tv_nsec)/1e6;
+		if(best < 0 || ms < best)
+			best = ms;
+	}
+	return best;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage %s [-p PAGE_SIZE] [INPUT] [OUTPUT]\n", name);
+	printf("\t-p PAGE_SIZE page size of the copy, default the page size of INPUT\n");
+}
+
+int main(int argc, char** argv)
+{
+	int pageSize = 0;
+	int opt;
+	while((opt = getopt(argc, argv, "p:h")) != -1) {
+		switch(opt) {
+			case 'p':
+				pageSize = atoi(optarg);
+				if(pageSize < 512 || pageSize > 65536 || (pageSize & (pageSize - 1)) != 0) {
+					printf("Page size must be a power of two between 512 and 65536\n");
+					return 1;
+				}
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if(argc - optind != 2) {
+		usage(argv[0]);
+		return 1;
+	}
+	const char *inPath = argv[optind];
+	const char *outPath = argv[optind+1];
+
+	if(access(outPath, F_OK) == 0) {
+		printf("%s already exists\n", outPath);
+		return 2;
+	}
+
+	const char *error;
+	struct rlxfile *in = rlx_open_file(inPath, &error);
+	if(!in) {
+		printf("Unable to open %s: %s\n", inPath, error);
+		return 2;
+	}
+
+	if(optimize(inPath, outPath, pageSize) != SQLITE_OK) {
+		rlx_close_file(in);
+		remove(outPath);
+		return 3;
+	}
+
+	struct rlxfile *out = rlx_open_file(outPath, &error);
+	if(!out) {
+		printf("Unable to open %s: %s\n", outPath, error);
+		rlx_close_file(in);
+		remove(outPath);
+		return 3;
+	}
+	int mismatches = load_all(in, out);
+	rlx_close_file(in);
+	rlx_close_file(out);
+	if(mismatches != 0) {
+		printf("Verification failed, %s does not load the same as %s\n", outPath, inPath);
+		remove(outPath);
+		return 4;
+	}
+
+	printf("Verified %s\n", outPath);
+	struct stat inStat, outStat;
+	if(stat(inPath, &inStat) == 0 && stat(outPath, &outStat) == 0)
+		printf("Size: %lld bytes before, %lld bytes after\n", (long long)inStat.st_size, (long long)outStat.st_size);
+	printf("Load time of all spectra: %.3f ms before, %.3f ms after\n", bench(inPath), bench(outPath));
+	return 0;
+}
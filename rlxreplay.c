@@ -0,0 +1,533 @@
+/*
+ * relaxisloader
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * relaxisloader is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * relaxisloader is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <relaxisloader.h>
+
+#include "trace.h"
+
+/*
+ * Replays a trace recorded with rlx_trace_start. Every recorded thread is replayed by its own thread, which issues
+ * its calls at the recorded start times, scaled by the speed factor. A call on a file waits until the file has been
+ * opened by whichever thread opened it during recording, closing a file waits until all calls on it have completed.
+ * Files taken from the pool are opened by the first rlx_pool_acquire of their handle, later acquires and releases
+ * only wait for that. Extractions are written to temporary files, which are removed right away, and the other calls
+ * are replayed without a tile cache. rlx_changeset_create is not replayed, as its cost depends on the state it was
+ * recorded against, its calls are reported with their recorded latencies only.
+ * The latencies of the replayed calls are reported next to the recorded ones.
+ */
+
+struct replay_record
+{
+	struct rlx_trace_record record;
+	unsigned char *payload;
+	uint64_t latency;
+	bool opens;
+	bool skipped;
+	bool diverged;
+};
+
+struct replay_handle
+{
+	struct rlxfile *file;
+	bool recorded_open;
+	bool opened;
+	bool closed;
+	int uses;
+};
+
+struct replay
+{
+	struct replay_record *records;
+	size_t record_count;
+	struct replay_handle *handles;
+	size_t handle_count;
+	const char *path;
+	double speed;
+	bool pace;
+	uint64_t origin;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+struct replay_thread
+{
+	struct replay *replay;
+	size_t *records;
+	size_t count;
+	pthread_t thread;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t deadline)
+{
+	uint64_t now = now_ns();
+	if(deadline <= now)
+		return;
+	struct timespec ts = {.tv_sec = (deadline - now)/1000000000, .tv_nsec = (deadline - now)%1000000000};
+	nanosleep(&ts, NULL);
+}
+
+static int record_compare(const void *a, const void *b)
+{
+	const struct replay_record *ra = a;
+	const struct replay_record *rb = b;
+	return ra->record.start < rb->record.start ? -1 : ra->record.start > rb->record.start;
+}
+
+static int load_trace(const char *path, struct replay *replay)
+{
+	FILE *fp = fopen(path, "rb");
+	if(!fp)
+		return -1;
+
+	struct rlx_trace_header header;
+	if(fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, RLX_TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+	   header.version != RLX_TRACE_VERSION || header.record_size != sizeof(struct rlx_trace_record)) {
+		fclose(fp);
+		return -1;
+	}
+
+	size_t size = 0;
+	struct replay_record record = {0};
+	while(fread(&record.record, sizeof(record.record), 1, fp) == 1) {
+		if(record.record.call >= RLX_CALL_COUNT)
+			break;
+		record.payload = NULL;
+		if(record.record.payload_size > 0) {
+			record.payload = calloc(1, record.record.payload_size + 1);
+			if(!record.payload || fread(record.payload, 1, record.record.payload_size, fp) != record.record.payload_size) {
+				free(record.payload);
+				break;
+			}
+		}
+		if(replay->record_count == size) {
+			size = size ? size*2 : 1024;
+			struct replay_record *records = realloc(replay->records, sizeof(*records)*size);
+			if(!records) {
+				free(record.payload);
+				break;
+			}
+			replay->records = records;
+		}
+		replay->records[replay->record_count++] = record;
+		if(record.record.handle >= replay->handle_count)
+			replay->handle_count = record.record.handle + 1;
+	}
+	fclose(fp);
+
+	qsort(replay->records, replay->record_count, sizeof(*replay->records), record_compare);
+	replay->handles = calloc(replay->handle_count ? replay->handle_count : 1, sizeof(*replay->handles));
+	if(!replay->handles)
+		return -1;
+	for(size_t i = 0; i < replay->record_count; ++i) {
+		struct replay_record *record = &replay->records[i];
+		struct replay_handle *handle = &replay->handles[record->record.handle];
+		record->opens = record->record.call == RLX_CALL_OPEN ||
+			(record->record.call == RLX_CALL_POOL_ACQUIRE && !handle->recorded_open);
+		if(record->opens)
+			handle->recorded_open = true;
+		else if(record->record.call != RLX_CALL_CLOSE)
+			++handle->uses;
+	}
+	return 0;
+}
+
+/* Waits until the file of the record is open, returns NULL if it could not be opened or was never opened in the trace */
+static struct rlxfile *acquire_file(struct replay *replay, const struct rlx_trace_record *rec, bool close)
+{
+	struct replay_handle *handle = &replay->handles[rec->handle];
+	if(!handle->recorded_open || rec->handle == 0)
+		return NULL;
+	pthread_mutex_lock(&replay->lock);
+	while(!handle->opened || (close && handle->uses > 0))
+		pthread_cond_wait(&replay->cond, &replay->lock);
+	struct rlxfile *file = handle->file;
+	pthread_mutex_unlock(&replay->lock);
+	return file;
+}
+
+static void release_file(struct replay *replay, const struct rlx_trace_record *rec)
+{
+	pthread_mutex_lock(&replay->lock);
+	--replay->handles[rec->handle].uses;
+	pthread_cond_broadcast(&replay->cond);
+	pthread_mutex_unlock(&replay->lock);
+}
+
+static bool replay_spectrum(const struct rlx_spectra *spectra, int thread, void *userdata)
+{
+	(void)spectra;
+	(void)thread;
+	(void)userdata;
+	return true;
+}
+
+/* Executes a call, returns true if it succeeded */
+static bool execute(struct rlxfile *file, struct replay_record *record)
+{
+	const struct rlx_trace_record *rec = &record->record;
+	struct rlx_project project = {.id = rec->project};
+	switch(rec->call) {
+		case RLX_CALL_GET_PROJECTS: {
+			struct rlx_project **projects = rlx_get_projects(file, NULL);
+			if(projects)
+				rlx_project_free_array(projects);
+			return projects;
+		}
+		case RLX_CALL_GET_SPECTRA: {
+			struct rlx_spectra *spectra = rlx_get_spectra(file, &project, rec->arg);
+			rlx_spectra_free(spectra);
+			return spectra;
+		}
+		case RLX_CALL_GET_ALL_SPECTRA: {
+			struct rlx_spectra **spectra = rlx_get_all_spectra(file, &project);
+			if(spectra)
+				rlx_spectra_free_array(spectra);
+			return spectra;
+		}
+		case RLX_CALL_GET_SPECTRA_CHUNK: {
+			int cursor = rec->arg;
+			struct rlx_spectra **spectra = rlx_get_spectra_chunk(file, &project, &cursor, NULL);
+			if(spectra)
+				rlx_spectra_free_array(spectra);
+			return spectra;
+		}
+		case RLX_CALL_GET_SPECTRA_MANY: {
+			struct rlx_spectra **spectra = rlx_get_spectra_many(file, &project, (const int*)record->payload,
+			                                                    rec->payload_size/sizeof(int32_t));
+			if(spectra)
+				rlx_spectra_free_array(spectra);
+			return spectra;
+		}
+		case RLX_CALL_GET_SPECTRA_IDS: {
+			int *ids = rlx_get_spectra_ids(file, &project, NULL);
+			free(ids);
+			return ids;
+		}
+		case RLX_CALL_GET_GROUPED: {
+			struct rlx_circuit_group **groups = rlx_get_spectra_grouped_by_circuit(file, &project, rec->arg, NULL);
+			if(groups)
+				rlx_circuit_group_free_array(groups);
+			return groups;
+		}
+		case RLX_CALL_GET_FIT_PARAMETERS: {
+			struct rlx_fitparam **params = rlx_get_fit_parameters(file, &project, rec->arg, NULL);
+			if(params)
+				rlx_fitparam_free_array(params);
+			return params;
+		}
+		case RLX_CALL_GET_SPECTRA_HEADERS: {
+			struct rlx_spectra_headers *headers = rlx_get_spectra_headers(file, &project);
+			rlx_spectra_headers_free(headers);
+			return headers;
+		}
+		case RLX_CALL_FOR_EACH_SPECTRUM:
+			return rlx_for_each_spectrum(file, &project, rec->arg, replay_spectrum, NULL, 0) == RLX_ERR_SUCESS;
+		case RLX_CALL_SET_MEMORY_BUDGET: {
+			uint64_t budget = 0;
+			if(record->payload && rec->payload_size == sizeof(budget))
+				memcpy(&budget, record->payload, sizeof(budget));
+			rlx_set_memory_budget(file, budget);
+			return true;
+		}
+		case RLX_CALL_DIRECTORY_ACQUIRE: {
+			struct rlx_directory *dir = rlx_directory_acquire(file);
+			rlx_directory_release(dir);
+			return dir;
+		}
+		case RLX_CALL_DIRECTORY_REFRESH:
+			return rlx_directory_refresh(file) == RLX_ERR_SUCESS;
+		case RLX_CALL_FIT_PROJECT:
+		case RLX_CALL_FIT_PROJECT_GLOBAL: {
+			struct rlx_fit_options options;
+			bool haveOptions = record->payload && rec->payload_size == sizeof(options);
+			if(haveOptions)
+				memcpy(&options, record->payload, sizeof(options));
+			struct rlx_fit_result **results = rec->call == RLX_CALL_FIT_PROJECT ?
+				rlx_fit_project(file, &project, haveOptions ? &options : NULL, rec->arg) :
+				rlx_fit_project_global(file, &project, haveOptions ? &options : NULL, rec->arg);
+			if(results)
+				rlx_fit_result_free_array(results);
+			return results;
+		}
+		case RLX_CALL_GET_PROJECT_FEATURES: {
+			double *matrix = rlx_get_project_features(file, &project, rec->arg, NULL, NULL);
+			free(matrix);
+			return matrix;
+		}
+		case RLX_CALL_GET_PROJECT_QUANTITIES: {
+			struct rlx_derived_quantities *quantities = rlx_get_project_quantities(file, &project);
+			rlx_derived_quantities_free(quantities);
+			return quantities;
+		}
+		case RLX_CALL_GET_ACTIVATION_ENERGIES: {
+			double t0;
+			if(!record->payload || rec->payload_size < sizeof(t0))
+				return false;
+			memcpy(&t0, record->payload, sizeof(t0));
+			struct rlx_activation **results = rlx_get_activation_energies(file, (const char*)record->payload + sizeof(t0),
+			                                                              rec->arg, t0, NULL);
+			if(results)
+				rlx_activation_free_array(results);
+			return results;
+		}
+		case RLX_CALL_RENDER_PROJECT: {
+			struct rlx_tile_options options;
+			bool haveOptions = record->payload && rec->payload_size == sizeof(options);
+			if(haveOptions)
+				memcpy(&options, record->payload, sizeof(options));
+			struct rlx_tile **tiles = rlx_render_project(file, &project, haveOptions ? &options : NULL, NULL, rec->arg);
+			if(tiles)
+				rlx_tile_free_array(tiles);
+			return tiles;
+		}
+		case RLX_CALL_EXTRACT: {
+			size_t count = rec->payload_size/sizeof(int32_t);
+			if(rec->arg < 0 || (size_t)rec->arg > count)
+				return false;
+			const int *ids = (const int*)record->payload;
+			struct rlx_selection selection = {.projects = ids, .project_count = rec->arg,
+			                                  .spectra = ids ? ids + rec->arg : NULL, .spectra_count = count - rec->arg};
+			char path[] = "/tmp/rlxreplayXXXXXX";
+			int fd = mkstemp(path);
+			if(fd < 0)
+				return false;
+			close(fd);
+			int ret = rlx_extract(file, &selection, path);
+			remove(path);
+			return ret == RLX_ERR_SUCESS;
+		}
+		case RLX_CALL_CHANGESET_CREATE:
+			record->skipped = true;
+			return rec->result == RLX_ERR_SUCESS;
+		case RLX_CALL_POOL_ACQUIRE:
+		case RLX_CALL_POOL_RELEASE:
+			return true;
+		default:
+			return false;
+	}
+}
+
+static void *replay_worker(void *userdata)
+{
+	struct replay_thread *thread = userdata;
+	struct replay *replay = thread->replay;
+	for(size_t i = 0; i < thread->count; ++i) {
+		struct replay_record *record = &replay->records[thread->records[i]];
+		const struct rlx_trace_record *rec = &record->record;
+		if(replay->pace)
+			sleep_until(replay->origin + rec->start/replay->speed);
+
+		if(record->opens) {
+			const char *path = replay->path ? replay->path : (const char*)record->payload;
+			uint64_t start = now_ns();
+			struct rlxfile *file = path ? rlx_open_file_flags(path, rec->arg, NULL) : NULL;
+			record->latency = now_ns() - start;
+			record->diverged = !file != (rec->result != RLX_ERR_SUCESS);
+			pthread_mutex_lock(&replay->lock);
+			replay->handles[rec->handle].file = file;
+			replay->handles[rec->handle].opened = true;
+			pthread_cond_broadcast(&replay->cond);
+			pthread_mutex_unlock(&replay->lock);
+			continue;
+		}
+
+		struct rlxfile *file = acquire_file(replay, rec, rec->call == RLX_CALL_CLOSE);
+		if(!file) {
+			record->diverged = true;
+			if(rec->call != RLX_CALL_CLOSE && replay->handles[rec->handle].recorded_open)
+				release_file(replay, rec);
+			continue;
+		}
+
+		uint64_t start = now_ns();
+		bool success = true;
+		if(rec->call == RLX_CALL_CLOSE) {
+			rlx_close_file(file);
+			replay->handles[rec->handle].closed = true;
+		}
+		else
+			success = execute(file, record);
+		record->latency = now_ns() - start;
+		record->diverged = success != (rec->result == RLX_ERR_SUCESS);
+		if(rec->call != RLX_CALL_CLOSE)
+			release_file(replay, rec);
+	}
+	return NULL;
+}
+
+static int latency_compare(const void *a, const void *b)
+{
+	uint64_t la = *(const uint64_t*)a;
+	uint64_t lb = *(const uint64_t*)b;
+	return la < lb ? -1 : la > lb;
+}
+
+static double percentile(const uint64_t *sorted, size_t count, double p)
+{
+	size_t index = p*(count - 1) + 0.5;
+	return sorted[index]/1e3;
+}
+
+static void report(const struct replay *replay)
+{
+	uint64_t *recorded = malloc(sizeof(*recorded)*(replay->record_count + 1));
+	uint64_t *replayed = malloc(sizeof(*replayed)*(replay->record_count + 1));
+	if(!recorded || !replayed) {
+		free(recorded);
+		free(replayed);
+		return;
+	}
+
+	printf("%-36s %8s %9s %10s %10s %10s %10s %10s %10s\n", "call", "count", "diverged",
+	       "rec p50", "rec p99", "p50", "p90", "p99", "max");
+	for(int call = 0; call < RLX_CALL_COUNT; ++call) {
+		size_t count = 0;
+		size_t replayedCount = 0;
+		size_t diverged = 0;
+		for(size_t i = 0; i < replay->record_count; ++i) {
+			const struct replay_record *record = &replay->records[i];
+			if(record->record.call != call)
+				continue;
+			recorded[count++] = record->record.duration;
+			if(!record->skipped)
+				replayed[replayedCount++] = record->latency;
+			diverged += record->diverged;
+		}
+		if(count == 0)
+			continue;
+		qsort(recorded, count, sizeof(*recorded), latency_compare);
+		printf("%-36s %8zu %9zu %10.1f %10.1f", rlx_trace_call_name(call), count, diverged,
+		       percentile(recorded, count, 0.5), percentile(recorded, count, 0.99));
+		if(replayedCount > 0) {
+			qsort(replayed, replayedCount, sizeof(*replayed), latency_compare);
+			printf(" %10.1f %10.1f %10.1f %10.1f\n", percentile(replayed, replayedCount, 0.5), percentile(replayed, replayedCount, 0.9),
+			       percentile(replayed, replayedCount, 0.99), replayed[replayedCount-1]/1e3);
+		}
+		else
+			printf(" %10s %10s %10s %10s\n", "-", "-", "-", "-");
+	}
+	printf("latencies in us, diverged calls succeeded during recording but failed during replay or vice versa\n");
+	free(recorded);
+	free(replayed);
+}
+
+static void usage(const char *name)
+{
+	printf("Usage %s [-f FILE] [-s SPEED] [-n] [TRACE]\n", name);
+	printf("\t-f FILE  replay against FILE instead of the recorded files\n");
+	printf("\t-s SPEED replay SPEED times faster than recorded\n");
+	printf("\t-n       issue calls as fast as possible instead of at the recorded times\n");
+}
+
+int main(int argc, char** argv)
+{
+	struct replay replay = {.speed = 1, .pace = true};
+	int opt;
+	while((opt = getopt(argc, argv, "f:s:nh")) != -1) {
+		switch(opt) {
+			case 'f':
+				replay.path = optarg;
+				break;
+			case 's':
+				replay.speed = atof(optarg);
+				if(replay.speed <= 0) {
+					printf("Speed must be larger than 0\n");
+					return 1;
+				}
+				break;
+			case 'n':
+				replay.pace = false;
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if(argc - optind != 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if(load_trace(argv[optind], &replay) != 0) {
+		printf("Unable to load trace %s\n", argv[optind]);
+		return 2;
+	}
+
+	size_t threadCount = 0;
+	for(size_t i = 0; i < replay.record_count; ++i) {
+		if(replay.records[i].record.thread >= threadCount)
+			threadCount = replay.records[i].record.thread + 1;
+	}
+	struct replay_thread *threads = calloc(threadCount ? threadCount : 1, sizeof(*threads));
+	if(!threads)
+		return 2;
+	for(size_t i = 0; i < threadCount; ++i) {
+		threads[i].replay = &replay;
+		threads[i].records = malloc(sizeof(*threads[i].records)*(replay.record_count + 1));
+		if(!threads[i].records)
+			return 2;
+	}
+	for(size_t i = 0; i < replay.record_count; ++i) {
+		struct replay_thread *thread = &threads[replay.records[i].record.thread];
+		thread->records[thread->count++] = i;
+	}
+
+	pthread_mutex_init(&replay.lock, NULL);
+	pthread_cond_init(&replay.cond, NULL);
+	replay.origin = now_ns();
+	for(size_t i = 0; i < threadCount; ++i)
+		pthread_create(&threads[i].thread, NULL, replay_worker, &threads[i]);
+	for(size_t i = 0; i < threadCount; ++i)
+		pthread_join(threads[i].thread, NULL);
+	double ms = (now_ns() - replay.origin)/1e6;
+
+	/* files whose close was not recorded are still open */
+	for(size_t i = 0; i < replay.handle_count; ++i) {
+		if(replay.handles[i].file && !replay.handles[i].closed)
+			rlx_close_file(replay.handles[i].file);
+	}
+
+	printf("Replayed %zu calls from %zu threads in %.3f ms\n", replay.record_count, threadCount, ms);
+	report(&replay);
+
+	for(size_t i = 0; i < threadCount; ++i)
+		free(threads[i].records);
+	free(threads);
+	for(size_t i = 0; i < replay.record_count; ++i)
+		free(replay.records[i].payload);
+	free(replay.records);
+	free(replay.handles);
+	pthread_mutex_destroy(&replay.lock);
+	pthread_cond_destroy(&replay.cond);
+	return 0;
+}
@@ -0,0 +1,614 @@
+/*
+ * relaxisloader
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * relaxisloader is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * relaxisloader is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sqlite3.h>
+#include <relaxisloader.h>
+
+/*
+ * Generates a RelaxIS3 file of synthetic spectra for training and testing. Every spectrum gets a circuit, either
+ * sampled from typical topologies or chosen from the ones given, parameters sampled from per element distributions,
+ * a logarithmic frequency sweep and proportional gaussian noise. The parameters the spectrum was generated with are
+ * stored as its fit parameters and the noise level as metadata, so every spectrum carries its ground truth.
+ *
+ * Worker threads generate batches of spectra while the main thread writes each batch, in order, in one transaction.
+ * Every spectrum draws from its own random number generator seeded from the seed and its index, so the output
+ * only depends on the seed and not on the amount of threads.
+ */
+
+#define DEFAULT_SPECTRA 10000
+#define DEFAULT_PER_PROJECT 10000
+#define DEFAULT_BATCH 1000
+#define DEFAULT_NOISE 0.01
+#define CIRCUIT_MAX 64
+#define PARAM_MAX 32
+#define POINTS_MAX 256
+#define NAME_MAX_LEN 24
+
+static const char *schema =
+	"CREATE TABLE Projects ( ID INTEGER NOT NULL PRIMARY KEY,name TEXT NOT NULL,comment TEXT,date TEXT );"
+	"CREATE TABLE Properties ( ID INTEGER NOT NULL PRIMARY KEY,name TEXT NOT NULL,value TEXT );"
+	"CREATE TABLE Locks ( ID INTEGER NOT NULL PRIMARY KEY,procIdent TEXT NOT NULL,LockDate TEXT );"
+	"CREATE TABLE Files ( ID INTEGER NOT NULL PRIMARY KEY,project_id INTEGER NOT NULL,groupname TEXT NOT NULL,"
+	"datasource TEXT,fitted INTEGER,lastweightmode TEXT,lasttransferfunction TEXT,lowfreqlimit NUMERIC,highfreqlimit NUMERIC,"
+	"dateadded TEXT,datefitted TEXT,FOREIGN KEY(project_id) REFERENCES Projects(ID) ON DELETE CASCADE );"
+	"CREATE TABLE FileInformation ( ID INTEGER NOT NULL PRIMARY KEY,file_id INTEGER NOT NULL,name TEXT NOT NULL,"
+	"value NUMERIC NOT NULL,FOREIGN KEY(file_id) REFERENCES Files(ID) ON DELETE CASCADE );"
+	"CREATE TABLE Datapoints ( ID INTEGER NOT NULL PRIMARY KEY,file_id INTEGER NOT NULL,frequency NUMERIC NOT NULL,"
+	"zreal NUMERIC NOT NULL,zimag NUMERIC NOT NULL,FOREIGN KEY(file_id) REFERENCES Files(ID) ON DELETE CASCADE );"
+	"CREATE TABLE Fitparameters ( ID INTEGER NOT NULL PRIMARY KEY,file_id INTEGER NOT NULL,pindex INTEGER NOT NULL,name TEXT,"
+	"fixed INTEGER,value NUMERIC,error NUMERIC,lowerlimit NUMERIC,upperlimit NUMERIC,isglobal INTEGER,"
+	"FOREIGN KEY(file_id) REFERENCES Files(ID) ON DELETE CASCADE );"
+	"CREATE TABLE StoredResults ( ID INTEGER NOT NULL PRIMARY KEY,project_id INTEGER NOT NULL,evaltype TEXT NOT NULL,"
+	"version TEXT NOT NULL,date TEXT NOT NULL,title TEXT,comment TEXT,data TEXT,"
+	"FOREIGN KEY(project_id) REFERENCES Projects(ID) ON DELETE CASCADE );"
+	"INSERT INTO Properties(name,value) VALUES('DatabaseFormat','1');"
+	"INSERT INTO Properties(name,value) VALUES('RelaxISVersion','relaxisloader_synth');";
+
+/* created once all rows are in place, which is much faster than maintaining them while inserting */
+static const char *indexes =
+	"CREATE INDEX Files_project_id_index ON Files(project_id);"
+	"CREATE INDEX FileInformation_file_id_index ON FileInformation(file_id);"
+	"CREATE INDEX Datapoints_file_id_index ON Datapoints(file_id);"
+	"CREATE INDEX Fitparameters_file_id_index ON Fitparameters(file_id);"
+	"CREATE INDEX StoredResults_project_id_index ON StoredResults(project_id);";
+
+/* The distribution of the parameters of a circuit element and the limits stored with them, names as RelaxIS uses */
+struct element
+{
+	char symbol;
+	int param_count;
+	const char *names[2];
+	double low[2];
+	double high[2];
+	bool logarithmic[2];
+	double lower_limit[2];
+	double upper_limit[2];
+};
+
+static const struct element elements[] = {
+	{'R', 1, {"Resistance"}, {1}, {1e5}, {true}, {0}, {1e15}},
+	{'C', 1, {"Capacitance"}, {1e-10}, {1e-4}, {true}, {1e-15}, {1e15}},
+	{'L', 1, {"Inductance"}, {1e-8}, {1e-5}, {true}, {0}, {1e15}},
+	{'P', 2, {"CPE Q", "CPE Alpha"}, {1e-10, 0.5}, {1e-4, 1}, {true, false}, {1e-15, -1}, {1e15, 1}},
+	{'W', 1, {"Warburg"}, {1}, {1e3}, {true}, {0}, {1e15}},
+};
+
+struct param
+{
+	char name[NAME_MAX_LEN];
+	double value;
+	double lower_limit;
+	double upper_limit;
+};
+
+struct spectrum
+{
+	char circuit[CIRCUIT_MAX];
+	struct param params[PARAM_MAX];
+	size_t param_count;
+	double frequency[POINTS_MAX];
+	double omega[POINTS_MAX];
+	double re[POINTS_MAX];
+	double im[POINTS_MAX];
+	size_t length;
+	double noise;
+	double temperature;
+	bool valid;
+};
+
+struct batch
+{
+	struct spectrum *spectra;
+	size_t index;
+	size_t count;
+	bool ready;
+};
+
+struct synth
+{
+	size_t spectra;
+	size_t per_project;
+	size_t batch_size;
+	double noise;
+	uint64_t seed;
+	char **circuits;
+	size_t circuit_count;
+
+	struct batch *batches;
+	size_t slots;
+	size_t next_batch;
+	size_t written;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+/* splitmix64, small, fast and good enough to sample from */
+static uint64_t rng_next(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+	z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27))*0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+static double rng_uniform(uint64_t *state, double low, double high)
+{
+	return low + (high - low)*((rng_next(state) >> 11)*0x1.0p-53);
+}
+
+static double rng_log_uniform(uint64_t *state, double low, double high)
+{
+	return exp(rng_uniform(state, log(low), log(high)));
+}
+
+static double rng_normal(uint64_t *state)
+{
+	double u = rng_uniform(state, 0x1.0p-53, 1);
+	return sqrt(-2*log(u))*cos(2*M_PI*rng_uniform(state, 0, 1));
+}
+
+static bool rng_chance(uint64_t *state, double probability)
+{
+	return rng_uniform(state, 0, 1) < probability;
+}
+
+/* An optional inductance and a series resistance followed by one to three arcs and an optional low frequency tail */
+static void sample_circuit(uint64_t *rng, char *circuit)
+{
+	static const char *arcs[] = {"(R)(P)", "(R)(P)", "(R)(P)", "(R)(C)", "(R-W)(P)"};
+	static const char *tails[] = {"", "", "-P", "-W", "-C"};
+
+	strcpy(circuit, rng_chance(rng, 0.2) ? "L-R" : "R");
+	int arcCount = 1 + rng_next(rng)%3;
+	for(int i = 0; i < arcCount; ++i) {
+		strcat(circuit, "-");
+		strcat(circuit, arcs[rng_next(rng)%(sizeof(arcs)/sizeof(*arcs))]);
+	}
+	strcat(circuit, tails[rng_next(rng)%(sizeof(tails)/sizeof(*tails))]);
+}
+
+/* Samples the parameters in the order rlx_circuit_compile numbers them, ie. the order the elements appear in */
+static bool sample_params(uint64_t *rng, struct spectrum *spectrum)
+{
+	int counts[sizeof(elements)/sizeof(*elements)] = {0};
+	spectrum->param_count = 0;
+	for(const char *c = spectrum->circuit; *c; ++c) {
+		for(size_t e = 0; e < sizeof(elements)/sizeof(*elements); ++e) {
+			const struct element *element = &elements[e];
+			if(element->symbol != *c)
+				continue;
+			if(spectrum->param_count + element->param_count > PARAM_MAX)
+				return false;
+			++counts[e];
+			for(int i = 0; i < element->param_count; ++i) {
+				struct param *param = &spectrum->params[spectrum->param_count++];
+				snprintf(param->name, sizeof(param->name), "%s %i", element->names[i], counts[e]);
+				param->value = element->logarithmic[i] ? rng_log_uniform(rng, element->low[i], element->high[i]) :
+				                                          rng_uniform(rng, element->low[i], element->high[i]);
+				param->lower_limit = element->lower_limit[i];
+				param->upper_limit = element->upper_limit[i];
+			}
+		}
+	}
+	return true;
+}
+
+static void generate(const struct synth *synth, size_t index, struct spectrum *spectrum)
+{
+	uint64_t rng = synth->seed ^ (index*0xd1b54a32d192ed03ull);
+	rng_next(&rng);
+
+	if(synth->circuit_count > 0)
+		strcpy(spectrum->circuit, synth->circuits[rng_next(&rng)%synth->circuit_count]);
+	else
+		sample_circuit(&rng, spectrum->circuit);
+	spectrum->valid = false;
+	if(!sample_params(&rng, spectrum))
+		return;
+
+	double lowDecade = rng_uniform(&rng, -2, 0);
+	double highDecade = rng_uniform(&rng, 5, 7);
+	int perDecade = 5 + rng_next(&rng)%16;
+	spectrum->length = (highDecade - lowDecade)*perDecade + 1;
+	if(spectrum->length > POINTS_MAX)
+		spectrum->length = POINTS_MAX;
+	for(size_t i = 0; i < spectrum->length; ++i) {
+		spectrum->frequency[i] = pow(10, lowDecade + (highDecade - lowDecade)*i/(spectrum->length - 1));
+		spectrum->omega[i] = spectrum->frequency[i]*2*M_PI;
+	}
+
+	const char *error;
+	struct rlx_circuit *circuit = rlx_circuit_compile(spectrum->circuit, &error);
+	if(!circuit)
+		return;
+	double params[PARAM_MAX];
+	for(size_t i = 0; i < spectrum->param_count; ++i)
+		params[i] = spectrum->params[i].value;
+	int ret = rlx_circuit_evaluate(circuit, params, spectrum->omega, spectrum->length, spectrum->re, spectrum->im);
+	rlx_circuit_free(circuit);
+	if(ret != 0)
+		return;
+
+	spectrum->noise = synth->noise > 0 ? rng_log_uniform(&rng, synth->noise/10, synth->noise) : 0;
+	for(size_t i = 0; i < spectrum->length && spectrum->noise > 0; ++i) {
+		double sigma = hypot(spectrum->re[i], spectrum->im[i])*spectrum->noise;
+		spectrum->re[i] += sigma*rng_normal(&rng);
+		spectrum->im[i] += sigma*rng_normal(&rng);
+	}
+	spectrum->temperature = rng_uniform(&rng, -40, 80);
+	spectrum->valid = true;
+}
+
+static void *worker(void *userdata)
+{
+	struct synth *synth = userdata;
+	size_t batchCount = (synth->spectra + synth->batch_size - 1)/synth->batch_size;
+	pthread_mutex_lock(&synth->lock);
+	while(synth->next_batch < batchCount) {
+		size_t index = synth->next_batch++;
+		struct batch *batch = &synth->batches[index%synth->slots];
+		// the slot is free once the batch that used it before has been written
+		while(synth->written + synth->slots <= index)
+			pthread_cond_wait(&synth->cond, &synth->lock);
+		pthread_mutex_unlock(&synth->lock);
+
+		batch->index = index;
+		batch->count = synth->spectra - index*synth->batch_size < synth->batch_size ?
+		               synth->spectra - index*synth->batch_size : synth->batch_size;
+		for(size_t i = 0; i < batch->count; ++i)
+			generate(synth, index*synth->batch_size + i, &batch->spectra[i]);
+
+		pthread_mutex_lock(&synth->lock);
+		batch->ready = true;
+		pthread_cond_broadcast(&synth->cond);
+	}
+	pthread_mutex_unlock(&synth->lock);
+	return NULL;
+}
+
+enum {
+	STMT_PROJECT,
+	STMT_FILE,
+	STMT_INFO,
+	STMT_POINT,
+	STMT_PARAM,
+	STMT_COUNT
+};
+
+static const char *statements[STMT_COUNT] = {
+	"INSERT INTO Projects(ID,name,comment,date) VALUES(?,?,'Synthetic spectra generated by relaxisloader_synth',?)",
+	"INSERT INTO Files(ID,project_id,groupname,datasource,fitted,lastweightmode,lasttransferfunction,lowfreqlimit,highfreqlimit,"
+	"dateadded,datefitted) VALUES(?,?,?,?,1,'Proportional Weighting','Impedance',?,?,?,?)",
+	"INSERT INTO FileInformation(file_id,name,value) VALUES(?,?,?)",
+	"INSERT INTO Datapoints(file_id,frequency,zreal,zimag) VALUES(?,?,?,?)",
+	"INSERT INTO Fitparameters(file_id,pindex,name,fixed,value,error,lowerlimit,upperlimit,isglobal) VALUES(?,?,?,0,?,0,?,?,0)",
+};
+
+static int step(sqlite3_stmt *stmt)
+{
+	int ret = sqlite3_step(stmt);
+	sqlite3_reset(stmt);
+	return ret == SQLITE_DONE ? SQLITE_OK : ret;
+}
+
+static int write_info(sqlite3_stmt *stmt, sqlite3_int64 id, const char *name, double value)
+{
+	sqlite3_bind_int64(stmt, 1, id);
+	sqlite3_bind_text(stmt, 2, name, -1, SQLITE_STATIC);
+	sqlite3_bind_double(stmt, 3, value);
+	return step(stmt);
+}
+
+static int write_batch(const struct synth *synth, sqlite3 *db, sqlite3_stmt **stmts, const struct batch *batch,
+                       const char *date, size_t *points)
+{
+	int ret = sqlite3_exec(db, "BEGIN", NULL, NULL, NULL);
+	for(size_t i = 0; i < batch->count && ret == SQLITE_OK; ++i) {
+		const struct spectrum *spectrum = &batch->spectra[i];
+		size_t index = batch->index*synth->batch_size + i;
+		sqlite3_int64 id = index + 1;
+		sqlite3_int64 project = index/synth->per_project + 1;
+
+		if(index%synth->per_project == 0) {
+			char name[64];
+			snprintf(name, sizeof(name), "Synthetic %lld", (long long)project);
+			sqlite3_bind_int64(stmts[STMT_PROJECT], 1, project);
+			sqlite3_bind_text(stmts[STMT_PROJECT], 2, name, -1, SQLITE_TRANSIENT);
+			sqlite3_bind_text(stmts[STMT_PROJECT], 3, date, -1, SQLITE_STATIC);
+			ret = step(stmts[STMT_PROJECT]);
+		}
+		if(!spectrum->valid)
+			continue;
+
+		char source[64];
+		snprintf(source, sizeof(source), "synth_%zu", index);
+		sqlite3_stmt *stmt = stmts[STMT_FILE];
+		sqlite3_bind_int64(stmt, 1, id);
+		sqlite3_bind_int64(stmt, 2, project);
+		sqlite3_bind_text(stmt, 3, spectrum->circuit, -1, SQLITE_STATIC);
+		sqlite3_bind_text(stmt, 4, source, -1, SQLITE_STATIC);
+		sqlite3_bind_double(stmt, 5, spectrum->frequency[0]);
+		sqlite3_bind_double(stmt, 6, spectrum->frequency[spectrum->length-1]);
+		sqlite3_bind_text(stmt, 7, date, -1, SQLITE_STATIC);
+		sqlite3_bind_text(stmt, 8, date, -1, SQLITE_STATIC);
+		if(ret == SQLITE_OK)
+			ret = step(stmt);
+
+		if(ret == SQLITE_OK)
+			ret = write_info(stmts[STMT_INFO], id, "Temperature", spectrum->temperature);
+		if(ret == SQLITE_OK)
+			ret = write_info(stmts[STMT_INFO], id, "NoiseLevel", spectrum->noise);
+
+		stmt = stmts[STMT_POINT];
+		for(size_t j = 0; j < spectrum->length && ret == SQLITE_OK; ++j) {
+			sqlite3_bind_int64(stmt, 1, id);
+			sqlite3_bind_double(stmt, 2, spectrum->frequency[j]);
+			sqlite3_bind_double(stmt, 3, spectrum->re[j]);
+			sqlite3_bind_double(stmt, 4, spectrum->im[j]);
+			ret = step(stmt);
+		}
+		*points += spectrum->length;
+
+		stmt = stmts[STMT_PARAM];
+		for(size_t j = 0; j < spectrum->param_count && ret == SQLITE_OK; ++j) {
+			const struct param *param = &spectrum->params[j];
+			sqlite3_bind_int64(stmt, 1, id);
+			sqlite3_bind_int64(stmt, 2, j);
+			sqlite3_bind_text(stmt, 3, param->name, -1, SQLITE_STATIC);
+			sqlite3_bind_double(stmt, 4, param->value);
+			sqlite3_bind_double(stmt, 5, param->lower_limit);
+			sqlite3_bind_double(stmt, 6, param->upper_limit);
+			ret = step(stmt);
+		}
+	}
+	if(ret == SQLITE_OK)
+		ret = sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+	else
+		sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+	return ret;
+}
+
+static double now_s(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static int synthesize(struct synth *synth, sqlite3 *db, int threadCount)
+{
+	sqlite3_stmt *stmts[STMT_COUNT] = {NULL};
+	int ret = SQLITE_OK;
+	for(int i = 0; i < STMT_COUNT && ret == SQLITE_OK; ++i)
+		ret = sqlite3_prepare_v2(db, statements[i], -1, &stmts[i], NULL);
+
+	char date[64];
+	time_t t = time(NULL);
+	strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S.0000000", gmtime(&t));
+
+	size_t batchCount = (synth->spectra + synth->batch_size - 1)/synth->batch_size;
+	pthread_t *threads = calloc(threadCount, sizeof(*threads));
+	int started = 0;
+	while(threads && started < threadCount && ret == SQLITE_OK && pthread_create(&threads[started], NULL, worker, synth) == 0)
+		++started;
+	if(started == 0)
+		ret = SQLITE_NOMEM;
+
+	double start = now_s();
+	size_t points = 0;
+	for(size_t index = 0; index < batchCount && started > 0; ++index) {
+		struct batch *batch = &synth->batches[index%synth->slots];
+		pthread_mutex_lock(&synth->lock);
+		while(!batch->ready || batch->index != index)
+			pthread_cond_wait(&synth->cond, &synth->lock);
+		pthread_mutex_unlock(&synth->lock);
+
+		if(ret == SQLITE_OK)
+			ret = write_batch(synth, db, stmts, batch, date, &points);
+
+		// after an error the remaining batches are only drained so that the workers can finish
+		pthread_mutex_lock(&synth->lock);
+		batch->ready = false;
+		++synth->written;
+		pthread_cond_broadcast(&synth->cond);
+		pthread_mutex_unlock(&synth->lock);
+
+		if(ret == SQLITE_OK && (index + 1)%16 == 0) {
+			double elapsed = now_s() - start;
+			size_t done = (index + 1)*synth->batch_size < synth->spectra ? (index + 1)*synth->batch_size : synth->spectra;
+			printf("\r%zu of %zu spectra, %.0f spectra/s", done, synth->spectra, done/elapsed);
+			fflush(stdout);
+		}
+	}
+	for(int i = 0; i < started; ++i)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	for(int i = 0; i < STMT_COUNT; ++i)
+		sqlite3_finalize(stmts[i]);
+
+	if(ret == SQLITE_OK)
+		ret = sqlite3_exec(db, indexes, NULL, NULL, NULL);
+	double elapsed = now_s() - start;
+	if(ret == SQLITE_OK) {
+		printf("\rWrote %zu spectra with %zu datapoints in %.2f s, %.0f spectra/s\n",
+		       synth->spectra, points, elapsed, synth->spectra/elapsed);
+	}
+	return ret;
+}
+
+/* Loads the spectra of the first project back and checks their parameters against the circuits */
+static int verify(const char *path)
+{
+	const char *error;
+	struct rlxfile *file = rlx_open_file(path, &error);
+	if(!file) {
+		printf("Unable to open %s: %s\n", path, error);
+		return -1;
+	}
+	size_t projectCount;
+	struct rlx_project **projects = rlx_get_projects(file, &projectCount);
+	struct rlx_spectra **spectra = projects && projectCount > 0 ? rlx_get_all_spectra(file, projects[0]) : NULL;
+	int ret = spectra ? 0 : -1;
+	size_t count = 0;
+	for(; spectra && spectra[count] && ret == 0; ++count) {
+		size_t length;
+		struct rlx_fitparam **params = rlx_get_fit_parameters(file, projects[0], spectra[count]->id, &length);
+		struct rlx_circuit *circuit = rlx_circuit_compile(spectra[count]->circuit, &error);
+		if(!params || !circuit || rlx_circuit_get_parameter_count(circuit) != length)
+			ret = -1;
+		rlx_circuit_free(circuit);
+		rlx_fitparam_free_array(params);
+	}
+	if(ret != 0)
+		printf("Verification of %s failed: %s\n", path, rlx_get_errnum_str(rlx_get_errnum(file)));
+	else
+		printf("Loaded %zu spectra of %zu projects back with librelaxisloader\n", count, projectCount);
+	if(spectra)
+		rlx_spectra_free_array(spectra);
+	if(projects)
+		rlx_project_free_array(projects);
+	rlx_close_file(file);
+	return ret;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage %s [-n SPECTRA] [-c CIRCUIT]... [-p PER_PROJECT] [-b BATCH] [-s NOISE] [-r SEED] [-j THREADS] OUTPUT\n", name);
+	printf("\t-n SPECTRA     amount of spectra to generate, default %i\n", DEFAULT_SPECTRA);
+	printf("\t-c CIRCUIT     use CIRCUIT, in RelaxIS notation, instead of sampled circuits, may be given multiple times\n");
+	printf("\t-p PER_PROJECT amount of spectra per project, default %i\n", DEFAULT_PER_PROJECT);
+	printf("\t-b BATCH       amount of spectra written per transaction, default %i\n", DEFAULT_BATCH);
+	printf("\t-s NOISE       largest relative standard deviation of the noise, default %g\n", DEFAULT_NOISE);
+	printf("\t-r SEED        seed of the random number generator, default 0\n");
+	printf("\t-j THREADS     amount of threads generating spectra, default the amount of cpus\n");
+}
+
+int main(int argc, char** argv)
+{
+	struct synth synth = {
+		.spectra = DEFAULT_SPECTRA,
+		.per_project = DEFAULT_PER_PROJECT,
+		.batch_size = DEFAULT_BATCH,
+		.noise = DEFAULT_NOISE,
+	};
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int threadCount = cpus > 0 ? cpus : 1;
+	int opt;
+	while((opt = getopt(argc, argv, "n:c:p:b:s:r:j:h")) != -1) {
+		switch(opt) {
+			case 'n':
+				synth.spectra = strtoull(optarg, NULL, 10);
+				break;
+			case 'c': {
+				const char *error;
+				struct rlx_circuit *circuit = rlx_circuit_compile(optarg, &error);
+				if(!circuit || strlen(optarg) >= CIRCUIT_MAX || rlx_circuit_get_parameter_count(circuit) > PARAM_MAX) {
+					printf("Unsupported circuit %s: %s\n", optarg, circuit ? "too large" : error);
+					rlx_circuit_free(circuit);
+					return 1;
+				}
+				rlx_circuit_free(circuit);
+				synth.circuits = realloc(synth.circuits, sizeof(*synth.circuits)*(synth.circuit_count + 1));
+				synth.circuits[synth.circuit_count++] = optarg;
+				break;
+			}
+			case 'p':
+				synth.per_project = strtoull(optarg, NULL, 10);
+				break;
+			case 'b':
+				synth.batch_size = strtoull(optarg, NULL, 10);
+				break;
+			case 's':
+				synth.noise = atof(optarg);
+				break;
+			case 'r':
+				synth.seed = strtoull(optarg, NULL, 10);
+				break;
+			case 'j':
+				threadCount = atoi(optarg);
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if(argc - optind != 1 || synth.spectra == 0 || synth.per_project == 0 || synth.batch_size == 0 ||
+	   threadCount < 1 || synth.noise < 0) {
+		usage(argv[0]);
+		return 1;
+	}
+	const char *path = argv[optind];
+
+	if(access(path, F_OK) == 0) {
+		printf("%s already exists\n", path);
+		return 2;
+	}
+	sqlite3 *db;
+	int ret = sqlite3_open_v2(path, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
+	// the file is new and worthless if generation is interrupted, so there is nothing for a journal to protect
+	if(ret == SQLITE_OK)
+		ret = sqlite3_exec(db, "PRAGMA journal_mode=OFF; PRAGMA synchronous=OFF", NULL, NULL, NULL);
+	if(ret == SQLITE_OK)
+		ret = sqlite3_exec(db, schema, NULL, NULL, NULL);
+	if(ret != SQLITE_OK) {
+		printf("Unable to create %s: %s\n", path, sqlite3_errmsg(db));
+		sqlite3_close(db);
+		remove(path);
+		return 2;
+	}
+
+	// two batches per thread keep the workers busy while the writer commits
+	synth.slots = threadCount*2;
+	synth.batches = calloc(synth.slots, sizeof(*synth.batches));
+	for(size_t i = 0; synth.batches && i < synth.slots; ++i) {
+		synth.batches[i].spectra = malloc(sizeof(*synth.batches[i].spectra)*synth.batch_size);
+		if(!synth.batches[i].spectra) {
+			printf("Out of memory\n");
+			return 2;
+		}
+	}
+	pthread_mutex_init(&synth.lock, NULL);
+	pthread_cond_init(&synth.cond, NULL);
+
+	ret = synthesize(&synth, db, threadCount);
+	if(ret != SQLITE_OK)
+		printf("\nUnable to write %s: %s\n", path, sqlite3_errmsg(db));
+	sqlite3_close(db);
+
+	for(size_t i = 0; i < synth.slots; ++i)
+		free(synth.batches[i].spectra);
+	free(synth.batches);
+	free(synth.circuits);
+	pthread_mutex_destroy(&synth.lock);
+	pthread_cond_destroy(&synth.cond);
+
+	if(ret != SQLITE_OK) {
+		remove(path);
+		return 3;
+	}
+	return verify(path) == 0 ? 0 : 3;
+}
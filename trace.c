@@ -0,0 +1,170 @@
+/*
+ * relaxisloader
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * relaxisloader is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * relaxisloader is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include "relaxisloader.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "trace.h"
+#include "probes.h"
+
+/*
+ * While no trace is being recorded every traced call costs a single atomic load. Records are buffered
+ * by stdio under a mutex, which is fine as the calls worth tracing take far longer than writing a record.
+ * The call_entry and call_return probes are placed here too, as every public call passes through.
+ */
+
+#define RLX_TOKEN_NONE 0
+#define RLX_TOKEN_NESTED 1
+
+static atomic_bool trace_active;
+static atomic_uint trace_handles;
+static atomic_int trace_threads;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *trace_file;
+static uint64_t trace_origin;
+static _Thread_local int trace_depth;
+static _Thread_local int trace_thread = -1;
+
+static uint64_t rlx_trace_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+static const char* const trace_call_names[RLX_CALL_COUNT] = {
+	[RLX_CALL_OPEN] = "rlx_open_file",
+	[RLX_CALL_CLOSE] = "rlx_close_file",
+	[RLX_CALL_GET_PROJECTS] = "rlx_get_projects",
+	[RLX_CALL_GET_SPECTRA] = "rlx_get_spectra",
+	[RLX_CALL_GET_ALL_SPECTRA] = "rlx_get_all_spectra",
+	[RLX_CALL_GET_SPECTRA_CHUNK] = "rlx_get_spectra_chunk",
+	[RLX_CALL_GET_SPECTRA_MANY] = "rlx_get_spectra_many",
+	[RLX_CALL_GET_SPECTRA_IDS] = "rlx_get_spectra_ids",
+	[RLX_CALL_GET_GROUPED] = "rlx_get_spectra_grouped_by_circuit",
+	[RLX_CALL_GET_FIT_PARAMETERS] = "rlx_get_fit_parameters",
+	[RLX_CALL_GET_SPECTRA_HEADERS] = "rlx_get_spectra_headers",
+	[RLX_CALL_SET_MEMORY_BUDGET] = "rlx_set_memory_budget",
+	[RLX_CALL_FOR_EACH_SPECTRUM] = "rlx_for_each_spectrum",
+	[RLX_CALL_DIRECTORY_ACQUIRE] = "rlx_directory_acquire",
+	[RLX_CALL_DIRECTORY_REFRESH] = "rlx_directory_refresh",
+	[RLX_CALL_FIT_PROJECT] = "rlx_fit_project",
+	[RLX_CALL_FIT_PROJECT_GLOBAL] = "rlx_fit_project_global",
+	[RLX_CALL_GET_PROJECT_FEATURES] = "rlx_get_project_features",
+	[RLX_CALL_GET_PROJECT_QUANTITIES] = "rlx_get_project_quantities",
+	[RLX_CALL_GET_ACTIVATION_ENERGIES] = "rlx_get_activation_energies",
+	[RLX_CALL_RENDER_PROJECT] = "rlx_render_project",
+	[RLX_CALL_EXTRACT] = "rlx_extract",
+	[RLX_CALL_CHANGESET_CREATE] = "rlx_changeset_create",
+	[RLX_CALL_POOL_ACQUIRE] = "rlx_pool_acquire",
+	[RLX_CALL_POOL_RELEASE] = "rlx_pool_release",
+};
+
+const char* rlx_trace_call_name(enum rlx_trace_call call)
+{
+	if(call < 0 || call >= RLX_CALL_COUNT)
+		return "Unkown";
+	return trace_call_names[call];
+}
+
+uint32_t rlx_trace_new_handle(void)
+{
+	return atomic_fetch_add(&trace_handles, 1) + 1;
+}
+
+uint64_t rlx_trace_begin(void)
+{
+	RLX_PROBE0(call_entry);
+	if(!atomic_load_explicit(&trace_active, memory_order_relaxed))
+		return RLX_TOKEN_NONE;
+	return ++trace_depth == 1 ? rlx_trace_now() : RLX_TOKEN_NESTED;
+}
+
+void rlx_trace_end(uint64_t token, enum rlx_trace_call call, uint32_t handle, int project, int arg, int result,
+                   const void* payload, uint32_t payload_size)
+{
+	RLX_PROBE4(call_return, trace_call_names[call], handle, project, result);
+	if(token == RLX_TOKEN_NONE)
+		return;
+	--trace_depth;
+	if(token == RLX_TOKEN_NESTED)
+		return;
+
+	uint64_t end = rlx_trace_now();
+	if(trace_thread < 0)
+		trace_thread = atomic_fetch_add(&trace_threads, 1);
+
+	pthread_mutex_lock(&trace_lock);
+	if(trace_file && token >= trace_origin) {
+		struct rlx_trace_record record = {
+			.start = token - trace_origin,
+			.duration = end - token,
+			.handle = handle,
+			.project = project,
+			.arg = arg,
+			.result = result,
+			.payload_size = payload ? payload_size : 0,
+			.thread = trace_thread,
+			.call = call,
+		};
+		fwrite(&record, sizeof(record), 1, trace_file);
+		if(record.payload_size > 0)
+			fwrite(payload, 1, record.payload_size, trace_file);
+	}
+	pthread_mutex_unlock(&trace_lock);
+}
+
+int rlx_trace_start(const char* path)
+{
+	pthread_mutex_lock(&trace_lock);
+	if(trace_file) {
+		fclose(trace_file);
+		trace_file = NULL;
+	}
+	trace_file = fopen(path, "wb");
+	if(!trace_file) {
+		atomic_store(&trace_active, false);
+		pthread_mutex_unlock(&trace_lock);
+		return RLX_ERR_NO_ENT;
+	}
+
+	struct rlx_trace_header header = {.version = RLX_TRACE_VERSION, .record_size = sizeof(struct rlx_trace_record)};
+	memcpy(header.magic, RLX_TRACE_MAGIC, sizeof(header.magic));
+	fwrite(&header, sizeof(header), 1, trace_file);
+	trace_origin = rlx_trace_now();
+	atomic_store(&trace_active, true);
+	pthread_mutex_unlock(&trace_lock);
+	return RLX_ERR_SUCESS;
+}
+
+void rlx_trace_stop(void)
+{
+	atomic_store(&trace_active, false);
+	pthread_mutex_lock(&trace_lock);
+	if(trace_file) {
+		fclose(trace_file);
+		trace_file = NULL;
+	}
+	pthread_mutex_unlock(&trace_lock);
+}
@@ -0,0 +1,90 @@
+/*
+ * relaxisloader
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * relaxisloader is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * relaxisloader is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <stdint.h>
+
+/*
+ * A trace is a rlx_trace_header followed by rlx_trace_records in the order the calls completed,
+ * every record is followed by payload_size bytes of payload. All values are in native byte order.
+ */
+
+#define RLX_TRACE_MAGIC "RLXTRACE"
+#define RLX_TRACE_VERSION 1
+
+enum rlx_trace_call
+{
+	RLX_CALL_OPEN, // payload: path, arg: flags
+	RLX_CALL_CLOSE,
+	RLX_CALL_GET_PROJECTS,
+	RLX_CALL_GET_SPECTRA, // arg: spectrum id
+	RLX_CALL_GET_ALL_SPECTRA,
+	RLX_CALL_GET_SPECTRA_CHUNK, // arg: cursor
+	RLX_CALL_GET_SPECTRA_MANY, // payload: int32_t spectrum ids
+	RLX_CALL_GET_SPECTRA_IDS,
+	RLX_CALL_GET_GROUPED, // arg: load
+	RLX_CALL_GET_FIT_PARAMETERS, // arg: spectrum id
+	RLX_CALL_GET_SPECTRA_HEADERS,
+	RLX_CALL_SET_MEMORY_BUDGET, // payload: uint64_t budget
+	RLX_CALL_FOR_EACH_SPECTRUM, // arg: flags
+	RLX_CALL_DIRECTORY_ACQUIRE,
+	RLX_CALL_DIRECTORY_REFRESH,
+	RLX_CALL_FIT_PROJECT, // payload: rlx_fit_options if given, arg: threads
+	RLX_CALL_FIT_PROJECT_GLOBAL, // payload: rlx_fit_options if given, arg: threads
+	RLX_CALL_GET_PROJECT_FEATURES, // arg: threads
+	RLX_CALL_GET_PROJECT_QUANTITIES,
+	RLX_CALL_GET_ACTIVATION_ENERGIES, // payload: double t0 followed by the parameter name, arg: law
+	RLX_CALL_RENDER_PROJECT, // payload: rlx_tile_options if given, arg: threads
+	RLX_CALL_EXTRACT, // payload: int32_t project ids followed by int32_t spectrum ids, arg: number of project ids
+	RLX_CALL_CHANGESET_CREATE, // payload: changeset path
+	RLX_CALL_POOL_ACQUIRE, // payload: path
+	RLX_CALL_POOL_RELEASE,
+	RLX_CALL_COUNT
+};
+
+struct rlx_trace_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+};
+
+struct rlx_trace_record
+{
+	uint64_t start; // ns since the trace was started
+	uint64_t duration; // ns
+	uint32_t handle; // handle of the file the call was made on, unique within a process
+	int32_t project; // id of the project the call was made on or -1
+	int32_t arg;
+	int32_t result; // RLX_ERR_SUCESS or the error the call set
+	uint32_t payload_size;
+	uint16_t thread; // index of the calling thread in order of first appearance in the trace
+	uint8_t call;
+	uint8_t reserved;
+};
+
+const char* rlx_trace_call_name(enum rlx_trace_call call);
+
+/* Returns a token to pass to rlx_trace_end, calls made while another traced call is running on the same thread are not recorded */
+uint64_t rlx_trace_begin(void);
+
+void rlx_trace_end(uint64_t token, enum rlx_trace_call call, uint32_t handle, int project, int arg, int result,
+                   const void* payload, uint32_t payload_size);
+
+/* Gets a new handle to identify a file by in traces */
+uint32_t rlx_trace_new_handle(void);
@@ -0,0 +1,907 @@
+/*
+ * relaxisloader
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * relaxisloader is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * relaxisloader is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include "vfs.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define RLX_HAVE_IO_URING
+#endif
+#endif
+
+#ifdef RLX_HAVE_IO_URING
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/*
+ * Wraps the default vfs and serves page reads of the main database from a small page cache. Bulk loads
+ * hand the row id ranges they are about to read to rlx_vfs_uring_prefetch, which walks the interior pages
+ * of the table b-trees to find the leaf pages holding these rows and submits all of them to io_uring at once.
+ * The reads complete in the background while the loads proceed, a read of a page that is still in flight
+ * reaps completions until it has arrived. Leaf pages are dropped from the cache once sqlite has read them,
+ * as sqlite caches them itself from then on.
+ *
+ * If io_uring is not available, eg. due to an old kernel or a seccomp filter, the same leaf pages are
+ * passed to posix_fadvise instead, so that the kernel reads them ahead. The cache is invalidated whenever
+ * sqlite sees a different file change counter and is not used at all for files in wal mode.
+ */
+
+#define RLX_URING_VFS_NAME "rlx-uring"
+#define RLX_URING_ENTRIES 128
+#define RLX_URING_CACHE_PAGES 2048
+#define RLX_URING_MAX_DEPTH 32
+
+#define RLX_BTREE_INTERIOR_TABLE 0x05
+#define RLX_BTREE_LEAF_TABLE 0x0D
+
+enum rlx_page_state
+{
+	RLX_PAGE_FREE,
+	RLX_PAGE_PENDING,
+	RLX_PAGE_VALID,
+};
+
+struct rlx_page_slot
+{
+	uint32_t pgno;
+	enum rlx_page_state state;
+	bool referenced;
+	bool leaf;
+	int next;
+};
+
+struct rlx_uring
+{
+	int fd;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ptr;
+	void *cq_ptr;
+	size_t sq_size;
+	size_t cq_size;
+	size_t sqes_size;
+	unsigned sq_entries;
+	unsigned cq_entries;
+	unsigned inflight;
+};
+
+struct rlx_uring_file
+{
+	sqlite3_file base;
+	sqlite3_file *real;
+	int fd;
+	pthread_mutex_t lock;
+
+	struct rlx_uring ring;
+	bool have_ring;
+
+	bool wal;
+	bool have_counter;
+	uint32_t change_counter;
+
+	size_t page_size;
+	unsigned char *data;
+	struct rlx_page_slot *slots;
+	int *buckets;
+	size_t bucket_mask;
+	size_t hand;
+};
+
+static sqlite3_vfs *base_vfs;
+static sqlite3_vfs uring_vfs;
+static pthread_once_t uring_vfs_once = PTHREAD_ONCE_INIT;
+static bool uring_vfs_registered;
+
+static uint32_t rlx_read_be32(const unsigned char *data)
+{
+	return (uint32_t)data[0] << 24 | data[1] << 16 | data[2] << 8 | data[3];
+}
+
+static unsigned rlx_read_be16(const unsigned char *data)
+{
+	return data[0] << 8 | data[1];
+}
+
+static const unsigned char *rlx_read_varint(const unsigned char *data, const unsigned char *end, int64_t *value)
+{
+	uint64_t out = 0;
+	for(int i = 0; i < 9 && data < end; ++i, ++data) {
+		if(i == 8) {
+			out = out << 8 | *data;
+			*value = out;
+			return data + 1;
+		}
+		out = out << 7 | (*data & 0x7F);
+		if(!(*data & 0x80)) {
+			*value = out;
+			return data + 1;
+		}
+	}
+	return NULL;
+}
+
+static int rlx_uring_setup(struct rlx_uring *ring, unsigned entries)
+{
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+	if(ring->fd < 0)
+		return -1;
+
+	ring->sq_size = params.sq_off.array + params.sq_entries*sizeof(unsigned);
+	ring->cq_size = params.cq_off.cqes + params.cq_entries*sizeof(struct io_uring_cqe);
+	bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+	if(single) {
+		if(ring->cq_size > ring->sq_size)
+			ring->sq_size = ring->cq_size;
+		ring->cq_size = ring->sq_size;
+	}
+
+	ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	ring->cq_ptr = single ? ring->sq_ptr :
+		mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	ring->sqes_size = params.sq_entries*sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if(ring->sq_ptr == MAP_FAILED || ring->cq_ptr == MAP_FAILED || ring->sqes == MAP_FAILED) {
+		if(ring->sq_ptr != MAP_FAILED)
+			munmap(ring->sq_ptr, ring->sq_size);
+		if(!single && ring->cq_ptr != MAP_FAILED)
+			munmap(ring->cq_ptr, ring->cq_size);
+		if(ring->sqes != MAP_FAILED)
+			munmap(ring->sqes, ring->sqes_size);
+		close(ring->fd);
+		return -1;
+	}
+
+	unsigned char *sq = ring->sq_ptr;
+	unsigned char *cq = ring->cq_ptr;
+	ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+	ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+	ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+	ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+	ring->sq_entries = params.sq_entries;
+	ring->cq_entries = params.cq_entries;
+	return 0;
+}
+
+static void rlx_uring_teardown(struct rlx_uring *ring)
+{
+	munmap(ring->sqes, ring->sqes_size);
+	if(ring->cq_ptr != ring->sq_ptr)
+		munmap(ring->cq_ptr, ring->cq_size);
+	munmap(ring->sq_ptr, ring->sq_size);
+	close(ring->fd);
+}
+
+static int rlx_uring_enter(struct rlx_uring *ring, unsigned submit, unsigned complete)
+{
+	int ret;
+	do {
+		ret = syscall(__NR_io_uring_enter, ring->fd, submit, complete, complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	} while(ret < 0 && errno == EINTR);
+	return ret;
+}
+
+static unsigned char *rlx_slot_data(struct rlx_uring_file *uf, int slot)
+{
+	return uf->data + (size_t)slot*uf->page_size;
+}
+
+static int rlx_cache_lookup(struct rlx_uring_file *uf, uint32_t pgno)
+{
+	if(!uf->slots)
+		return -1;
+	int slot = uf->buckets[pgno & uf->bucket_mask];
+	while(slot >= 0 && uf->slots[slot].pgno != pgno)
+		slot = uf->slots[slot].next;
+	return slot;
+}
+
+static void rlx_cache_remove(struct rlx_uring_file *uf, int slot)
+{
+	int *link = &uf->buckets[uf->slots[slot].pgno & uf->bucket_mask];
+	while(*link != slot)
+		link = &uf->slots[*link].next;
+	*link = uf->slots[slot].next;
+	uf->slots[slot].state = RLX_PAGE_FREE;
+}
+
+static void rlx_cache_insert(struct rlx_uring_file *uf, int slot, uint32_t pgno, enum rlx_page_state state, bool leaf)
+{
+	int *bucket = &uf->buckets[pgno & uf->bucket_mask];
+	uf->slots[slot].pgno = pgno;
+	uf->slots[slot].state = state;
+	uf->slots[slot].referenced = true;
+	uf->slots[slot].leaf = leaf;
+	uf->slots[slot].next = *bucket;
+	*bucket = slot;
+}
+
+static int rlx_page_pread(struct rlx_uring_file *uf, uint32_t pgno, unsigned char *buffer)
+{
+	off_t offset = (off_t)(pgno - 1)*uf->page_size;
+	size_t done = 0;
+	while(done < uf->page_size) {
+		ssize_t ret = pread(uf->fd, buffer + done, uf->page_size - done, offset + done);
+		if(ret < 0 && errno == EINTR)
+			continue;
+		if(ret <= 0)
+			return -1;
+		done += ret;
+	}
+	return 0;
+}
+
+static void rlx_uring_complete(struct rlx_uring_file *uf, int slot, int res)
+{
+	struct rlx_page_slot *page = &uf->slots[slot];
+	if(page->state != RLX_PAGE_PENDING)
+		return;
+	if(res == (int)uf->page_size || rlx_page_pread(uf, page->pgno, rlx_slot_data(uf, slot)) == 0)
+		page->state = RLX_PAGE_VALID;
+	else
+		rlx_cache_remove(uf, slot);
+}
+
+/* Processes all available completions, if wait is set blocks until at least one has arrived */
+static void rlx_uring_reap(struct rlx_uring_file *uf, bool wait)
+{
+	struct rlx_uring *ring = &uf->ring;
+	unsigned head = *ring->cq_head;
+	if(wait && head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE) && ring->inflight > 0)
+		rlx_uring_enter(ring, 0, 1);
+
+	unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	while(head != tail) {
+		const struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+		rlx_uring_complete(uf, (int)cqe->user_data, cqe->res);
+		--ring->inflight;
+		++head;
+	}
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static void rlx_uring_drain(struct rlx_uring_file *uf)
+{
+	while(uf->have_ring && uf->ring.inflight > 0)
+		rlx_uring_reap(uf, true);
+}
+
+/* Finds a slot to reuse with the clock algorithm, slots with reads in flight are skipped */
+static int rlx_cache_evict(struct rlx_uring_file *uf)
+{
+	while(true) {
+		for(size_t i = 0; i < RLX_URING_CACHE_PAGES*2; ++i) {
+			int slot = uf->hand;
+			uf->hand = (uf->hand + 1) % RLX_URING_CACHE_PAGES;
+			struct rlx_page_slot *page = &uf->slots[slot];
+			if(page->state == RLX_PAGE_FREE)
+				return slot;
+			if(page->state == RLX_PAGE_PENDING)
+				continue;
+			if(page->referenced) {
+				page->referenced = false;
+				continue;
+			}
+			rlx_cache_remove(uf, slot);
+			return slot;
+		}
+		if(!uf->have_ring || uf->ring.inflight == 0)
+			return -1;
+		rlx_uring_reap(uf, true);
+	}
+}
+
+static void rlx_cache_invalidate(struct rlx_uring_file *uf)
+{
+	if(!uf->slots)
+		return;
+	rlx_uring_drain(uf);
+	for(size_t i = 0; i < RLX_URING_CACHE_PAGES; ++i)
+		uf->slots[i].state = RLX_PAGE_FREE;
+	for(size_t i = 0; i <= uf->bucket_mask; ++i)
+		uf->buckets[i] = -1;
+}
+
+static int rlx_cache_init(struct rlx_uring_file *uf)
+{
+	if(uf->slots)
+		return SQLITE_OK;
+
+	unsigned char header[100];
+	if(pread(uf->fd, header, sizeof(header), 0) != sizeof(header))
+		return SQLITE_IOERR_READ;
+	uf->page_size = rlx_read_be16(header + 16);
+	if(uf->page_size == 1)
+		uf->page_size = 65536;
+	if(uf->page_size < 512 || (uf->page_size & (uf->page_size - 1)))
+		return SQLITE_NOTADB;
+
+	size_t buckets = 1;
+	while(buckets < RLX_URING_CACHE_PAGES)
+		buckets <<= 1;
+	if(posix_memalign((void**)&uf->data, 4096, RLX_URING_CACHE_PAGES*uf->page_size) != 0)
+		uf->data = NULL;
+	uf->slots = calloc(RLX_URING_CACHE_PAGES, sizeof(*uf->slots));
+	uf->buckets = malloc(sizeof(*uf->buckets)*buckets);
+	if(!uf->data || !uf->slots || !uf->buckets) {
+		free(uf->data);
+		free(uf->slots);
+		free(uf->buckets);
+		uf->data = NULL;
+		uf->slots = NULL;
+		uf->buckets = NULL;
+		return SQLITE_NOMEM;
+	}
+	uf->bucket_mask = buckets - 1;
+	for(size_t i = 0; i < buckets; ++i)
+		uf->buckets[i] = -1;
+	return SQLITE_OK;
+}
+
+/* Gets a page synchronously through the cache, the returned pointer is valid until the next eviction */
+static const unsigned char *rlx_cache_page(struct rlx_uring_file *uf, uint32_t pgno)
+{
+	int slot = rlx_cache_lookup(uf, pgno);
+	while(slot >= 0 && uf->slots[slot].state == RLX_PAGE_PENDING) {
+		rlx_uring_reap(uf, true);
+		slot = rlx_cache_lookup(uf, pgno);
+	}
+	if(slot >= 0) {
+		uf->slots[slot].referenced = true;
+		return rlx_slot_data(uf, slot);
+	}
+
+	slot = rlx_cache_evict(uf);
+	if(slot < 0 || rlx_page_pread(uf, pgno, rlx_slot_data(uf, slot)) != 0)
+		return NULL;
+	rlx_cache_insert(uf, slot, pgno, RLX_PAGE_VALID, false);
+	return rlx_slot_data(uf, slot);
+}
+
+static int rlx_uring_close(sqlite3_file *file)
+{
+	struct rlx_uring_file *uf = (struct rlx_uring_file*)file;
+	rlx_uring_drain(uf);
+	if(uf->have_ring)
+		rlx_uring_teardown(&uf->ring);
+	close(uf->fd);
+	free(uf->data);
+	free(uf->slots);
+	free(uf->buckets);
+	pthread_mutex_destroy(&uf->lock);
+	return uf->real->pMethods->xClose(uf->real);
+}
+
+static int rlx_uring_read(sqlite3_file *file, void *buffer, int amount, sqlite3_int64 offset)
+{
+	struct rlx_uring_file *uf = (struct rlx_uring_file*)file;
+	pthread_mutex_lock(&uf->lock);
+	if(uf->slots && !uf->wal && offset > 0 && (size_t)amount == uf->page_size && offset % uf->page_size == 0) {
+		if(uf->have_ring && uf->ring.inflight > 0)
+			rlx_uring_reap(uf, false);
+		uint32_t pgno = offset/uf->page_size + 1;
+		int slot = rlx_cache_lookup(uf, pgno);
+		while(slot >= 0 && uf->slots[slot].state == RLX_PAGE_PENDING) {
+			rlx_uring_reap(uf, true);
+			slot = rlx_cache_lookup(uf, pgno);
+		}
+		if(slot >= 0) {
+			memcpy(buffer, rlx_slot_data(uf, slot), amount);
+			if(uf->slots[slot].leaf)
+				rlx_cache_remove(uf, slot);
+			pthread_mutex_unlock(&uf->lock);
+			return SQLITE_OK;
+		}
+	}
+	pthread_mutex_unlock(&uf->lock);
+
+	int ret = uf->real->pMethods->xRead(uf->real, buffer, amount, offset);
+	if(ret == SQLITE_OK && offset <= 24 && offset + amount >= 28) {
+		const unsigned char *header = (const unsigned char*)buffer - offset;
+		uint32_t counter = rlx_read_be32(header + 24);
+		pthread_mutex_lock(&uf->lock);
+		if(offset == 0 && amount >= 20)
+			uf->wal = header[18] == 2 || header[19] == 2;
+		if(uf->have_counter && counter != uf->change_counter)
+			rlx_cache_invalidate(uf);
+		uf->change_counter = counter;
+		uf->have_counter = true;
+		pthread_mutex_unlock(&uf->lock);
+	}
+	return ret;
+}
+
+static int rlx_uring_write(sqlite3_file *file, const void *buffer, int amount, sqlite3_int64 offset)
+{
+	struct rlx_uring_file *uf = (struct rlx_uring_file*)file;
+	return uf->real->pMethods->xWrite(uf->real, buffer, amount, offset);
+}
+
+static int rlx_uring_truncate(sqlite3_file *file, sqlite3_int64 size)
+{
+	struct rlx_uring_file *uf = (struct rlx_uring_file*)file;
+	return uf->real->pMethods->xTruncate(uf->real, size);
+}
+
+static int rlx_uring_sync(sqlite3_file *file, int flags)
+{
+	struct rlx_uring_file *uf = (struct rlx_uring_file*)file;
+	return uf->real->pMethods->xSync(uf->real, flags);
+}
+
+static int rlx_uring_file_size(sqlite3_file *file, sqlite3_int64 *size)
+{
+	struct rlx_uring_file *uf = (struct rlx_uring_file*)file;
+	return uf->real->pMethods->xFileSize(uf->real, size);
+}
+
+static int rlx_uring_lock(sqlite3_file *file, int lock)
+{
+	struct rlx_uring_file *uf = (struct rlx_uring_file*)file;
+	return uf->real->pMethods->xLock(uf->real, lock);
+}
+
+static int rlx_uring_unlock(sqlite3_file *file, int lock)
+{
+	struct rlx_uring_file *uf = (struct rlx_uring_file*)file;
+	return uf->real->pMethods->xUnlock(uf->real, lock);
+}
+
+static int rlx_uring_check_reserved_lock(sqlite3_file *file, int *out)
+{
+	struct rlx_uring_file *uf = (struct rlx_uring_file*)file;
+	return uf->real->pMethods->xCheckReservedLock(uf->real, out);
+}
+
+static int rlx_uring_file_control(sqlite3_file *file, int op, void *arg)
+{
+	struct rlx_uring_file *uf = (struct rlx_uring_file*)file;
+	return uf->real->pMethods->xFileControl(uf->real, op, arg);
+}
+
+static int rlx_uring_sector_size(sqlite3_file *file)
+{
+	struct rlx_uring_file *uf = (struct rlx_uring_file*)file;
+	return uf->real->pMethods->xSectorSize(uf->real);
+}
+
+static int rlx_uring_device_characteristics(sqlite3_file *file)
+{
+	struct rlx_uring_file *uf = (struct rlx_uring_file*)file;
+	return uf->real->pMethods->xDeviceCharacteristics(uf->real);
+}
+
+static int rlx_uring_shm_map(sqlite3_file *file, int region, int size, int extend, void volatile **out)
+{
+	struct rlx_uring_file *uf = (struct rlx_uring_file*)file;
+	return uf->real->pMethods->xShmMap(uf->real, region, size, extend, out);
+}
+
+static int rlx_uring_shm_lock(sqlite3_file *file, int offset, int count, int flags)
+{
+	struct rlx_uring_file *uf = (struct rlx_uring_file*)file;
+	return uf->real->pMethods->xShmLock(uf->real, offset, count, flags);
+}
+
+static void rlx_uring_shm_barrier(sqlite3_file *file)
+{
+	struct rlx_uring_file *uf = (struct rlx_uring_file*)file;
+	uf->real->pMethods->xShmBarrier(uf->real);
+}
+
+static int rlx_uring_shm_unmap(sqlite3_file *file, int delete)
+{
+	struct rlx_uring_file *uf = (struct rlx_uring_file*)file;
+	return uf->real->pMethods->xShmUnmap(uf->real, delete);
+}
+
+static const sqlite3_io_methods uring_io_methods = {
+	.iVersion = 2,
+	.xClose = rlx_uring_close,
+	.xRead = rlx_uring_read,
+	.xWrite = rlx_uring_write,
+	.xTruncate = rlx_uring_truncate,
+	.xSync = rlx_uring_sync,
+	.xFileSize = rlx_uring_file_size,
+	.xLock = rlx_uring_lock,
+	.xUnlock = rlx_uring_unlock,
+	.xCheckReservedLock = rlx_uring_check_reserved_lock,
+	.xFileControl = rlx_uring_file_control,
+	.xSectorSize = rlx_uring_sector_size,
+	.xDeviceCharacteristics = rlx_uring_device_characteristics,
+	.xShmMap = rlx_uring_shm_map,
+	.xShmLock = rlx_uring_shm_lock,
+	.xShmBarrier = rlx_uring_shm_barrier,
+	.xShmUnmap = rlx_uring_shm_unmap,
+};
+
+struct rlx_page_list
+{
+	uint32_t *pages;
+	size_t count;
+	size_t size;
+};
+
+static int rlx_page_list_add(struct rlx_page_list *list, uint32_t pgno)
+{
+	if(list->count == list->size) {
+		size_t size = list->size ? list->size*2 : 64;
+		uint32_t *pages = realloc(list->pages, sizeof(*pages)*size);
+		if(!pages)
+			return -1;
+		list->pages = pages;
+		list->size = size;
+	}
+	list->pages[list->count++] = pgno;
+	return 0;
+}
+
+static int rlx_range_compare(const void *a, const void *b)
+{
+	const struct rlx_vfs_range *ra = a;
+	const struct rlx_vfs_range *rb = b;
+	if(ra->root != rb->root)
+		return ra->root < rb->root ? -1 : 1;
+	return ra->first < rb->first ? -1 : ra->first > rb->first;
+}
+
+static int rlx_page_compare(const void *a, const void *b)
+{
+	uint32_t pa = *(const uint32_t*)a;
+	uint32_t pb = *(const uint32_t*)b;
+	return pa < pb ? -1 : pa > pb;
+}
+
+/* true if any of the ranges, sorted by their first row id, intersects the row ids (low, high] */
+static bool rlx_ranges_overlap(const struct rlx_vfs_range *ranges, size_t count, int64_t low, int64_t high)
+{
+	for(size_t i = 0; i < count && ranges[i].first <= high; ++i) {
+		if(ranges[i].last > low)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Collects the children of the interior table page that can hold rows in ranges,
+ * every cell holds a child pointer and the largest row id in this child.
+ * Fails if the page points outside of itself or the file, pageCount being the number of pages in the file.
+ */
+static int rlx_btree_children(const unsigned char *page, size_t pageSize, uint32_t pgno, uint32_t pageCount,
+                              const struct rlx_vfs_range *ranges, size_t count, struct rlx_page_list *out)
+{
+	const unsigned char *header = page + (pgno == 1 ? 100 : 0);
+	const unsigned char *end = page + pageSize;
+	unsigned cells = rlx_read_be16(header + 3);
+	size_t cellsEnd = (header - page) + 12 + (size_t)cells*2;
+	if(cellsEnd > pageSize)
+		return -1;
+	int64_t low = INT64_MIN;
+	for(unsigned i = 0; i < cells; ++i) {
+		unsigned cellOffset = rlx_read_be16(header + 12 + i*2);
+		if(cellOffset < cellsEnd || cellOffset + 5 > pageSize)
+			return -1;
+		uint32_t child = rlx_read_be32(page + cellOffset);
+		if(child < 2 || child > pageCount)
+			return -1;
+		int64_t key;
+		if(!rlx_read_varint(page + cellOffset + 4, end, &key))
+			return -1;
+		if(rlx_ranges_overlap(ranges, count, low, key) && rlx_page_list_add(out, child) != 0)
+			return -1;
+		low = key;
+	}
+	uint32_t right = rlx_read_be32(header + 8);
+	if(right < 2 || right > pageCount)
+		return -1;
+	if(rlx_ranges_overlap(ranges, count, low, INT64_MAX) && rlx_page_list_add(out, right) != 0)
+		return -1;
+	return 0;
+}
+
+/* Walks the table b-tree level by level, the leaf pages holding rows in ranges are added to leaves */
+static int rlx_btree_leaves(struct rlx_uring_file *uf, uint32_t root, uint32_t pageCount, const struct rlx_vfs_range *ranges,
+                            size_t count, struct rlx_page_list *leaves)
+{
+	if(root < 1 || root > pageCount)
+		return -1;
+	struct rlx_page_list level = {0};
+	struct rlx_page_list next = {0};
+	int ret = rlx_page_list_add(&level, root);
+	for(int depth = 0; ret == 0 && level.count > 0 && depth < RLX_URING_MAX_DEPTH; ++depth) {
+		next.count = 0;
+		for(size_t i = 0; i < level.count && ret == 0; ++i) {
+			const unsigned char *page = rlx_cache_page(uf, level.pages[i]);
+			if(!page) {
+				ret = -1;
+				break;
+			}
+			unsigned char type = page[level.pages[i] == 1 ? 100 : 0];
+			if(type == RLX_BTREE_LEAF_TABLE) {
+				uf->slots[rlx_cache_lookup(uf, level.pages[i])].leaf = true;
+				/* all children of a level are of the same kind, the remaining ones need not be read now */
+				for(size_t j = i; j < level.count && ret == 0; ++j)
+					ret = rlx_page_list_add(leaves, level.pages[j]);
+				level.count = 0;
+				break;
+			}
+			if(type != RLX_BTREE_INTERIOR_TABLE)
+				ret = -1;
+			else
+				ret = rlx_btree_children(page, uf->page_size, level.pages[i], pageCount, ranges, count, &next);
+		}
+		struct rlx_page_list tmp = level;
+		level = next;
+		next = tmp;
+	}
+	free(level.pages);
+	free(next.pages);
+	return ret;
+}
+
+static void rlx_uring_submit(struct rlx_uring_file *uf, const uint32_t *pages, size_t count)
+{
+	struct rlx_uring *ring = &uf->ring;
+	size_t index = 0;
+	while(index < count && uf->have_ring) {
+		unsigned batch = 0;
+		unsigned tail = *ring->sq_tail;
+		while(index < count && batch < ring->sq_entries) {
+			if(ring->inflight + batch >= ring->cq_entries) {
+				if(batch > 0)
+					break;
+				rlx_uring_reap(uf, true);
+				continue;
+			}
+			int slot = rlx_cache_evict(uf);
+			if(slot < 0)
+				break;
+			rlx_cache_insert(uf, slot, pages[index], RLX_PAGE_PENDING, true);
+
+			unsigned sqIndex = (tail + batch) & *ring->sq_mask;
+			struct io_uring_sqe *sqe = &ring->sqes[sqIndex];
+			memset(sqe, 0, sizeof(*sqe));
+			sqe->opcode = IORING_OP_READ;
+			sqe->fd = uf->fd;
+			sqe->addr = (uint64_t)(uintptr_t)rlx_slot_data(uf, slot);
+			sqe->len = uf->page_size;
+			sqe->off = (uint64_t)(pages[index] - 1)*uf->page_size;
+			sqe->user_data = slot;
+			ring->sq_array[sqIndex] = sqIndex;
+			++batch;
+			++index;
+		}
+		if(batch == 0)
+			break;
+
+		__atomic_store_n(ring->sq_tail, tail + batch, __ATOMIC_RELEASE);
+		int ret = rlx_uring_enter(ring, batch, 0);
+		if(ret > 0)
+			ring->inflight += ret;
+		if(ret != (int)batch) {
+			/* the ring is unusable, reads that were not submitted are done synchronously instead */
+			for(unsigned i = ret > 0 ? ret : 0; i < batch; ++i) {
+				const struct io_uring_sqe *sqe = &ring->sqes[(tail + i) & *ring->sq_mask];
+				rlx_uring_complete(uf, (int)sqe->user_data, -EIO);
+			}
+			rlx_uring_drain(uf);
+			rlx_uring_teardown(ring);
+			uf->have_ring = false;
+		}
+	}
+}
+
+static void rlx_fadvise_pages(struct rlx_uring_file *uf, const uint32_t *pages, size_t count)
+{
+	for(size_t i = 0; i < count;) {
+		size_t run = 1;
+		while(i + run < count && pages[i + run] == pages[i] + run)
+			++run;
+		posix_fadvise(uf->fd, (off_t)(pages[i] - 1)*uf->page_size, run*uf->page_size, POSIX_FADV_WILLNEED);
+		i += run;
+	}
+}
+
+int rlx_vfs_uring_prefetch(sqlite3* db, struct rlx_vfs_range* ranges, size_t count)
+{
+	sqlite3_file *file = NULL;
+	if(sqlite3_file_control(db, "main", SQLITE_FCNTL_FILE_POINTER, &file) != SQLITE_OK || !file ||
+	   file->pMethods != &uring_io_methods)
+		return SQLITE_NOTFOUND;
+	struct rlx_uring_file *uf = (struct rlx_uring_file*)file;
+
+	pthread_mutex_lock(&uf->lock);
+	int ret = uf->wal ? SQLITE_OK : rlx_cache_init(uf);
+	if(uf->wal || ret != SQLITE_OK) {
+		pthread_mutex_unlock(&uf->lock);
+		return ret;
+	}
+
+	/* a damaged tree stops the prefetch before any page outside of the file is requested */
+	struct stat st;
+	if(fstat(uf->fd, &st) != 0) {
+		pthread_mutex_unlock(&uf->lock);
+		return SQLITE_IOERR_FSTAT;
+	}
+	uint32_t pageCount = st.st_size/uf->page_size > UINT32_MAX ? UINT32_MAX : st.st_size/uf->page_size;
+
+	qsort(ranges, count, sizeof(*ranges), rlx_range_compare);
+	struct rlx_page_list leaves = {0};
+	for(size_t i = 0; i < count && ret == SQLITE_OK;) {
+		size_t end = i;
+		while(end < count && ranges[end].root == ranges[i].root)
+			++end;
+		if(rlx_btree_leaves(uf, ranges[i].root, pageCount, ranges + i, end - i, &leaves) != 0)
+			ret = SQLITE_CORRUPT;
+		i = end;
+	}
+
+	if(ret == SQLITE_OK && leaves.count > 0) {
+		qsort(leaves.pages, leaves.count, sizeof(*leaves.pages), rlx_page_compare);
+		size_t unique = 0;
+		for(size_t i = 0; i < leaves.count; ++i) {
+			if(leaves.pages[i] > 1 && (unique == 0 || leaves.pages[unique-1] != leaves.pages[i]) &&
+			   rlx_cache_lookup(uf, leaves.pages[i]) < 0)
+				leaves.pages[unique++] = leaves.pages[i];
+		}
+		/* at most half of the cache is filled, so that the pages of the previous prefetch survive until they are read */
+		if(unique > RLX_URING_CACHE_PAGES/2)
+			unique = RLX_URING_CACHE_PAGES/2;
+
+		if(uf->have_ring)
+			rlx_uring_submit(uf, leaves.pages, unique);
+		else
+			rlx_fadvise_pages(uf, leaves.pages, unique);
+	}
+	free(leaves.pages);
+	pthread_mutex_unlock(&uf->lock);
+	return ret;
+}
+
+static int rlx_uring_open(sqlite3_vfs *vfs, const char *name, sqlite3_file *file, int flags, int *outFlags)
+{
+	(void)vfs;
+	if(!(flags & SQLITE_OPEN_MAIN_DB) || !name)
+		return base_vfs->xOpen(base_vfs, name, file, flags, outFlags);
+
+	struct rlx_uring_file *uf = (struct rlx_uring_file*)file;
+	memset(uf, 0, sizeof(*uf));
+	uf->real = (sqlite3_file*)(uf + 1);
+	int ret = base_vfs->xOpen(base_vfs, name, uf->real, flags, outFlags);
+	if(ret != SQLITE_OK)
+		return ret;
+
+	uf->fd = open(name, O_RDONLY | O_CLOEXEC);
+	if(uf->fd < 0) {
+		uf->real->pMethods->xClose(uf->real);
+		return SQLITE_CANTOPEN;
+	}
+	uf->have_ring = rlx_uring_setup(&uf->ring, RLX_URING_ENTRIES) == 0;
+	pthread_mutex_init(&uf->lock, NULL);
+	uf->base.pMethods = &uring_io_methods;
+	return SQLITE_OK;
+}
+
+static int rlx_uring_delete(sqlite3_vfs *vfs, const char *name, int syncDir)
+{
+	(void)vfs;
+	return base_vfs->xDelete(base_vfs, name, syncDir);
+}
+
+static int rlx_uring_access(sqlite3_vfs *vfs, const char *name, int flags, int *out)
+{
+	(void)vfs;
+	return base_vfs->xAccess(base_vfs, name, flags, out);
+}
+
+static int rlx_uring_full_pathname(sqlite3_vfs *vfs, const char *name, int size, char *out)
+{
+	(void)vfs;
+	return base_vfs->xFullPathname(base_vfs, name, size, out);
+}
+
+static int rlx_uring_randomness(sqlite3_vfs *vfs, int size, char *out)
+{
+	(void)vfs;
+	return base_vfs->xRandomness(base_vfs, size, out);
+}
+
+static int rlx_uring_sleep(sqlite3_vfs *vfs, int microseconds)
+{
+	(void)vfs;
+	return base_vfs->xSleep(base_vfs, microseconds);
+}
+
+static int rlx_uring_current_time(sqlite3_vfs *vfs, double *out)
+{
+	(void)vfs;
+	return base_vfs->xCurrentTime(base_vfs, out);
+}
+
+static int rlx_uring_get_last_error(sqlite3_vfs *vfs, int size, char *out)
+{
+	(void)vfs;
+	return base_vfs->xGetLastError ? base_vfs->xGetLastError(base_vfs, size, out) : 0;
+}
+
+static void rlx_uring_register(void)
+{
+	base_vfs = sqlite3_vfs_find(NULL);
+	if(!base_vfs)
+		return;
+
+	uring_vfs.iVersion = 1;
+	uring_vfs.szOsFile = sizeof(struct rlx_uring_file) + base_vfs->szOsFile;
+	uring_vfs.mxPathname = base_vfs->mxPathname;
+	uring_vfs.zName = RLX_URING_VFS_NAME;
+	uring_vfs.xOpen = rlx_uring_open;
+	uring_vfs.xDelete = rlx_uring_delete;
+	uring_vfs.xAccess = rlx_uring_access;
+	uring_vfs.xFullPathname = rlx_uring_full_pathname;
+	uring_vfs.xRandomness = rlx_uring_randomness;
+	uring_vfs.xSleep = rlx_uring_sleep;
+	uring_vfs.xCurrentTime = rlx_uring_current_time;
+	uring_vfs.xGetLastError = rlx_uring_get_last_error;
+	uring_vfs_registered = sqlite3_vfs_register(&uring_vfs, 0) == SQLITE_OK;
+}
+
+const char* rlx_vfs_uring(void)
+{
+	pthread_once(&uring_vfs_once, rlx_uring_register);
+	return uring_vfs_registered ? RLX_URING_VFS_NAME : NULL;
+}
+
+#else
+
+const char* rlx_vfs_uring(void)
+{
+	return NULL;
+}
+
+int rlx_vfs_uring_prefetch(sqlite3* db, struct rlx_vfs_range* ranges, size_t count)
+{
+	(void)db;
+	(void)ranges;
+	(void)count;
+	return SQLITE_NOTFOUND;
+}
+
+#endif
@@ -22,6 +22,9 @@
 #include <string.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "strptime.h"
 
 char *rlx_strconcat(const char* a, const char* b)
@@ -36,8 +39,8 @@ char *rlx_strconcat(const char* a, const char* b)
 char *rlx_strdup(const char* a)
 {
 	char *ret = malloc(strlen(a)+1);
-	assert(ret);
-	strcpy(ret, a);
+	if(ret)
+		strcpy(ret, a);
 	return ret;
 }
 
@@ -61,3 +64,175 @@ char *rlx_alloc_printf(const char* fmt, ...)
 	va_end(args);
 	return out;
 }
+
+/* sqlite uri opening path read only, with the characters that are special in uris escaped */
+char *rlx_uri_readonly(const char* path, const char* vfs)
+{
+	size_t length = strlen("file:?mode=ro&vfs=") + strlen(path)*3 + (vfs ? strlen(vfs) : 0) + 1;
+	char *uri = malloc(length);
+	if(!uri)
+		return NULL;
+	char *out = uri + sprintf(uri, "file:");
+	for(const char *c = path; *c; ++c) {
+		if(*c == '%' || *c == '?' || *c == '#')
+			out += sprintf(out, "%%%02X", (unsigned char)*c);
+		else
+			*out++ = *c;
+	}
+	sprintf(out, vfs ? "?mode=ro&vfs=%s" : "?mode=ro", vfs);
+	return uri;
+}
+
+struct rlx_strpool
+{
+	char **table;
+	size_t size;
+	size_t count;
+};
+
+static size_t rlx_strhash(const char *str)
+{
+	size_t hash = 14695981039346656037ULL;
+	for(; *str; ++str)
+		hash = (hash ^ (unsigned char)*str) * 1099511628211ULL;
+	return hash;
+}
+
+struct rlx_strpool *rlx_strpool_create(void)
+{
+	struct rlx_strpool *pool = malloc(sizeof(*pool));
+	if(!pool)
+		return NULL;
+	pool->size = 16;
+	pool->count = 0;
+	pool->table = calloc(pool->size, sizeof(*pool->table));
+	if(!pool->table) {
+		free(pool);
+		return NULL;
+	}
+	return pool;
+}
+
+static char **rlx_strpool_slot(char **table, size_t size, const char *str)
+{
+	size_t index = rlx_strhash(str) & (size-1);
+	while(table[index] && strcmp(table[index], str) != 0)
+		index = (index+1) & (size-1);
+	return &table[index];
+}
+
+const char *rlx_strpool_intern(struct rlx_strpool *pool, const char *str)
+{
+	char **slot = rlx_strpool_slot(pool->table, pool->size, str);
+	if(*slot)
+		return *slot;
+
+	if((pool->count+1)*2 > pool->size) {
+		size_t size = pool->size*2;
+		char **table = calloc(size, sizeof(*table));
+		if(!table)
+			return NULL;
+		for(size_t i = 0; i < pool->size; ++i) {
+			if(pool->table[i])
+				*rlx_strpool_slot(table, size, pool->table[i]) = pool->table[i];
+		}
+		free(pool->table);
+		pool->table = table;
+		pool->size = size;
+		slot = rlx_strpool_slot(pool->table, pool->size, str);
+	}
+
+	*slot = rlx_strdup(str);
+	if(!*slot)
+		return NULL;
+	++pool->count;
+	return *slot;
+}
+
+size_t rlx_strpool_count(const struct rlx_strpool *pool)
+{
+	return pool->count;
+}
+
+void rlx_strpool_free(struct rlx_strpool *pool)
+{
+	if(!pool)
+		return;
+	for(size_t i = 0; i < pool->size; ++i)
+		free(pool->table[i]);
+	free(pool->table);
+	free(pool);
+}
+
+int rlx_thread_count(int threads)
+{
+	if(threads > 0)
+		return threads;
+#ifdef _SC_NPROCESSORS_ONLN
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return cpus > 0 ? cpus : 1;
+#else
+	return 1;
+#endif
+}
+
+struct rlx_parallel_ctx
+{
+	atomic_size_t next;
+	size_t count;
+	rlx_parallel_fn fn;
+	void *userdata;
+};
+
+struct rlx_parallel_thread
+{
+	struct rlx_parallel_ctx *ctx;
+	int thread;
+};
+
+static void *rlx_parallel_worker(void *data)
+{
+	struct rlx_parallel_thread *thread = data;
+	struct rlx_parallel_ctx *ctx = thread->ctx;
+	size_t index;
+	while((index = atomic_fetch_add(&ctx->next, 1)) < ctx->count)
+		ctx->fn(index, thread->thread, ctx->userdata);
+	return NULL;
+}
+
+/* Items are handed out one by one from a shared counter, so uneven items balance across threads */
+int rlx_parallel_for(size_t count, int threads, rlx_parallel_fn fn, void *userdata)
+{
+	threads = rlx_thread_count(threads);
+	if((size_t)threads > count)
+		threads = count > 0 ? count : 1;
+
+	struct rlx_parallel_ctx ctx = {.count = count, .fn = fn, .userdata = userdata};
+	atomic_init(&ctx.next, 0);
+
+	struct rlx_parallel_thread *data = malloc(sizeof(*data)*threads);
+	pthread_t *handles = malloc(sizeof(*handles)*threads);
+	if(!data || !handles) {
+		free(data);
+		free(handles);
+		return -1;
+	}
+
+	int started = 1;
+	for(int i = 0; i < threads; ++i) {
+		data[i].ctx = &ctx;
+		data[i].thread = i;
+	}
+	for(int i = 1; i < threads; ++i) {
+		if(pthread_create(&handles[i], NULL, rlx_parallel_worker, &data[i]) != 0)
+			break;
+		++started;
+	}
+	rlx_parallel_worker(&data[0]);
+	for(int i = 1; i < started; ++i)
+		pthread_join(handles[i], NULL);
+
+	free(data);
+	free(handles);
+	return 0;
+}
@@ -18,8 +18,22 @@
 
 #pragma once
 #include <time.h>
+#include <stddef.h>
 
 char *rlx_strconcat(const char* a, const char* b);
 char *rlx_strdup(const char* a);
 time_t rlx_str_to_time(const char* str);
 char *rlx_alloc_printf(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+char *rlx_uri_readonly(const char* path, const char* vfs);
+
+struct rlx_strpool;
+
+struct rlx_strpool *rlx_strpool_create(void);
+const char *rlx_strpool_intern(struct rlx_strpool *pool, const char *str);
+size_t rlx_strpool_count(const struct rlx_strpool *pool);
+void rlx_strpool_free(struct rlx_strpool *pool);
+
+typedef void (*rlx_parallel_fn)(size_t index, int thread, void *userdata);
+
+int rlx_thread_count(int threads);
+int rlx_parallel_for(size_t count, int threads, rlx_parallel_fn fn, void *userdata);
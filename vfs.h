@@ -0,0 +1,46 @@
+/*
+ * relaxisloader
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * relaxisloader is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * relaxisloader is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sqlite3.h>
+
+/* true if the file at path starts with a zstd frame */
+bool rlx_vfs_is_zstd(const char* path);
+
+/* Registers the read only seekable zstd vfs on first use, returns its name or NULL if zstd support is not built */
+const char* rlx_vfs_zstd(void);
+
+/* Registers the read ahead vfs on first use, returns its name or NULL if it is not supported on this platform */
+const char* rlx_vfs_uring(void);
+
+/* The rows with ids in [first, last] of the table with the b-tree rooted at page root */
+struct rlx_vfs_range
+{
+	uint32_t root;
+	int64_t first;
+	int64_t last;
+};
+
+/*
+ * Starts reading the leaf pages holding the rows in ranges in the background if db was opened with the
+ * read ahead vfs, otherwise SQLITE_NOTFOUND is returned. ranges is sorted in place.
+ */
+int rlx_vfs_uring_prefetch(sqlite3* db, struct rlx_vfs_range* ranges, size_t count);
@@ -0,0 +1,519 @@
+/*
+ * relaxisloader
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * relaxisloader is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * relaxisloader is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include "relaxisloader.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <dirent.h>
+#include <limits.h>
+#include <strings.h>
+#include <sys/inotify.h>
+#include <sqlite3.h>
+
+#include "utils.h"
+#include "rlxfile.h"
+
+/*
+ * Every event on a .eis3 file (re)arms a debounce deadline for it, once the file has been quiet for the
+ * debounce period and RelaxIS holds no locks on it, a fingerprint of every spectrum is computed from its rows
+ * and compared to the fingerprints of the last ingestion. Only spectra with new fingerprints are loaded.
+ * Events on the write ahead log of a file count as events on the file.
+ */
+
+#define RLX_WATCH_RETRIES 10
+#define RLX_WATCH_EVENTS (IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM)
+
+struct rlx_fingerprint
+{
+	int id;
+	int project_id;
+	uint64_t hash;
+};
+
+struct rlx_watched_file
+{
+	char *name;
+	int64_t deadline;
+	int retries;
+	struct rlx_fingerprint *prints;
+	size_t print_count;
+};
+
+struct rlx_watcher
+{
+	int fd;
+	int wd;
+	char *directory;
+	int debounce_ms;
+	rlx_watch_sink sink;
+	void *userdata;
+	struct rlx_watched_file *files;
+	size_t file_count;
+};
+
+static int64_t rlx_monotonic_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+static bool rlx_is_eis3(const char *name)
+{
+	size_t len = strlen(name);
+	return len > 5 && strcasecmp(name + len - 5, ".eis3") == 0;
+}
+
+static bool rlx_is_eis3_wal(const char *name)
+{
+	size_t len = strlen(name);
+	return len > 9 && strcasecmp(name + len - 9, ".eis3-wal") == 0;
+}
+
+static struct rlx_watched_file *rlx_watcher_find(struct rlx_watcher *watcher, const char *name)
+{
+	for(size_t i = 0; i < watcher->file_count; ++i) {
+		if(strcmp(watcher->files[i].name, name) == 0)
+			return &watcher->files[i];
+	}
+	return NULL;
+}
+
+static int rlx_watcher_touch(struct rlx_watcher *watcher, const char *name)
+{
+	struct rlx_watched_file *entry = rlx_watcher_find(watcher, name);
+	if(!entry) {
+		struct rlx_watched_file *files = realloc(watcher->files, sizeof(*files)*(watcher->file_count+1));
+		if(!files)
+			return RLX_ERR_OOM;
+		watcher->files = files;
+		entry = &files[watcher->file_count];
+		memset(entry, 0, sizeof(*entry));
+		entry->name = rlx_strdup(name);
+		if(!entry->name)
+			return RLX_ERR_OOM;
+		++watcher->file_count;
+	}
+	entry->deadline = rlx_monotonic_ms() + watcher->debounce_ms;
+	entry->retries = 0;
+	return RLX_ERR_SUCESS;
+}
+
+static void rlx_watcher_forget(struct rlx_watcher *watcher, const char *name)
+{
+	struct rlx_watched_file *entry = rlx_watcher_find(watcher, name);
+	if(!entry)
+		return;
+	free(entry->name);
+	free(entry->prints);
+	*entry = watcher->files[--watcher->file_count];
+}
+
+static uint64_t rlx_fnv1a(uint64_t hash, const unsigned char *data, size_t length)
+{
+	for(size_t i = 0; i < length; ++i) {
+		hash ^= data[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+static uint64_t rlx_fnv1a_column(uint64_t hash, sqlite3_stmt *stmt, int column)
+{
+	unsigned char type = sqlite3_column_type(stmt, column);
+	hash = rlx_fnv1a(hash, &type, 1);
+	if(type == SQLITE_INTEGER) {
+		int64_t value = sqlite3_column_int64(stmt, column);
+		hash = rlx_fnv1a(hash, (const unsigned char*)&value, sizeof(value));
+	}
+	else if(type == SQLITE_FLOAT) {
+		double value = sqlite3_column_double(stmt, column);
+		hash = rlx_fnv1a(hash, (const unsigned char*)&value, sizeof(value));
+	}
+	else if(type != SQLITE_NULL) {
+		const unsigned char *data = sqlite3_column_blob(stmt, column);
+		uint32_t length = sqlite3_column_bytes(stmt, column);
+		hash = rlx_fnv1a(hash, (const unsigned char*)&length, sizeof(length));
+		if(data)
+			hash = rlx_fnv1a(hash, data, length);
+	}
+	return hash;
+}
+
+static int rlx_compare_fingerprint(const void *a, const void *b)
+{
+	const struct rlx_fingerprint *fa = a;
+	const struct rlx_fingerprint *fb = b;
+	return (fa->id > fb->id) - (fa->id < fb->id);
+}
+
+/*
+ * Folds every row of a table that belongs to a spectrum into the fingerprint of that spectrum. The first column of
+ * req is the id of the spectrum, all others are hashed. Rows are visited in the order of the table, thus the rows
+ * of a spectrum are hashed in the order they where written.
+ */
+static int rlx_fingerprint_table(struct rlxfile *file, const char *req, unsigned char tag,
+                                 struct rlx_fingerprint *prints, size_t count)
+{
+	sqlite3_stmt *stmt;
+	int ret = sqlite3_prepare_v2(file->db, req, -1, &stmt, NULL);
+	if(ret != SQLITE_OK)
+		return ret;
+
+	struct rlx_fingerprint *print = NULL;
+	const int columns = sqlite3_column_count(stmt);
+	while((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+		struct rlx_fingerprint key = {.id = sqlite3_column_int(stmt, 0)};
+		if(!print || print->id != key.id)
+			print = bsearch(&key, prints, count, sizeof(*prints), rlx_compare_fingerprint);
+		if(!print)
+			continue;
+		print->hash = rlx_fnv1a(print->hash, &tag, 1);
+		for(int i = 1; i < columns; ++i)
+			print->hash = rlx_fnv1a_column(print->hash, stmt, i);
+	}
+	sqlite3_finalize(stmt);
+	return ret == SQLITE_DONE ? SQLITE_OK : ret;
+}
+
+/*
+ * Computes the fingerprints of all spectra in a single read transaction, every fingerprint is a FNV-1a hash over
+ * the rows of the spectrum in Files, Datapoints, Fitparameters and FileInformation.
+ */
+static int rlx_get_fingerprints(struct rlxfile *file, struct rlx_fingerprint **prints, size_t *count)
+{
+	const char *req = "SELECT ID,project_id,groupname,fitted,lowfreqlimit,highfreqlimit,dateadded,datefitted "
+		"FROM Files ORDER BY ID";
+	static const char *tables[] = {
+		"SELECT file_id,frequency,zreal,zimag FROM Datapoints",
+		"SELECT file_id,pindex,name,fixed,value,error,lowerlimit,upperlimit,isglobal FROM Fitparameters",
+		"SELECT file_id,name,value FROM FileInformation",
+	};
+
+	*prints = NULL;
+	*count = 0;
+	int ret = sqlite3_exec(file->db, "BEGIN", NULL, NULL, NULL);
+	if(ret != SQLITE_OK)
+		return ret;
+
+	sqlite3_stmt *stmt;
+	ret = sqlite3_prepare_v2(file->db, req, -1, &stmt, NULL);
+	if(ret != SQLITE_OK) {
+		sqlite3_exec(file->db, "COMMIT", NULL, NULL, NULL);
+		return ret;
+	}
+
+	size_t size = 0;
+	while((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+		if(*count == size) {
+			size = size ? size*2 : 64;
+			struct rlx_fingerprint *newPrints = realloc(*prints, sizeof(**prints)*size);
+			if(!newPrints) {
+				ret = RLX_ERR_OOM;
+				break;
+			}
+			*prints = newPrints;
+		}
+		struct rlx_fingerprint *print = &(*prints)[(*count)++];
+		print->id = sqlite3_column_int(stmt, 0);
+		print->project_id = sqlite3_column_int(stmt, 1);
+		print->hash = 0xcbf29ce484222325ull;
+		for(int i = 2; i < sqlite3_column_count(stmt); ++i)
+			print->hash = rlx_fnv1a_column(print->hash, stmt, i);
+	}
+	sqlite3_finalize(stmt);
+	ret = ret == SQLITE_DONE ? SQLITE_OK : ret;
+
+	for(size_t i = 0; ret == SQLITE_OK && i < sizeof(tables)/sizeof(*tables); ++i)
+		ret = rlx_fingerprint_table(file, tables[i], i, *prints, *count);
+	sqlite3_exec(file->db, "COMMIT", NULL, NULL, NULL);
+
+	if(ret != SQLITE_OK) {
+		free(*prints);
+		*prints = NULL;
+		*count = 0;
+		return ret;
+	}
+	return RLX_ERR_SUCESS;
+}
+
+static bool rlx_file_locked(struct rlxfile *file)
+{
+	int64_t locks = 0;
+	sqlite3_stmt *stmt;
+	if(sqlite3_prepare_v2(file->db, "SELECT COUNT(*) FROM Locks", -1, &stmt, NULL) != SQLITE_OK)
+		return false;
+	if(sqlite3_step(stmt) == SQLITE_ROW)
+		locks = sqlite3_column_int64(stmt, 0);
+	sqlite3_finalize(stmt);
+	return locks > 0;
+}
+
+/* Returns the amount of spectra handed to the sink, 0 if the file is not ready yet or a negative error */
+static int rlx_watcher_ingest(struct rlx_watcher *watcher, struct rlx_watched_file *entry)
+{
+	char *path = rlx_alloc_printf("%s/%s", watcher->directory, entry->name);
+	if(!path)
+		return RLX_ERR_OOM;
+
+	struct rlxfile *file = rlx_open_file(path, NULL);
+	if(!file || rlx_file_locked(file)) {
+		if(file)
+			rlx_close_file(file);
+		free(path);
+		if(++entry->retries < RLX_WATCH_RETRIES)
+			entry->deadline = rlx_monotonic_ms() + watcher->debounce_ms;
+		else
+			entry->deadline = 0;
+		return 0;
+	}
+
+	struct rlx_fingerprint *prints;
+	size_t count;
+	int ret = rlx_get_fingerprints(file, &prints, &count);
+	if(ret != RLX_ERR_SUCESS) {
+		rlx_close_file(file);
+		free(path);
+		if(ret == RLX_ERR_OOM)
+			return ret;
+		entry->deadline = ++entry->retries < RLX_WATCH_RETRIES ? rlx_monotonic_ms() + watcher->debounce_ms : 0;
+		return 0;
+	}
+
+	/*
+	 * A new fingerprint is only kept if its spectrum was loaded, otherwise the old one, if any, is kept so that
+	 * the spectrum is loaded again on the next attempt.
+	 */
+	int delivered = 0;
+	size_t kept = 0;
+	bool failed = false;
+	for(size_t i = 0; i < count; ++i) {
+		struct rlx_fingerprint *old = entry->prints ?
+			bsearch(&prints[i], entry->prints, entry->print_count, sizeof(*prints), rlx_compare_fingerprint) : NULL;
+		if(!old || old->hash != prints[i].hash) {
+			struct rlx_project project = {.id = prints[i].project_id};
+			struct rlx_spectra *spectra = rlx_get_spectra(file, &project, prints[i].id);
+			if(!spectra) {
+				failed = true;
+				if(old)
+					prints[kept++] = *old;
+				continue;
+			}
+			watcher->sink(path, file, spectra, watcher->userdata);
+			++delivered;
+		}
+		prints[kept++] = prints[i];
+	}
+
+	rlx_close_file(file);
+	free(path);
+	free(entry->prints);
+	entry->prints = prints;
+	entry->print_count = kept;
+	if(failed && ++entry->retries < RLX_WATCH_RETRIES) {
+		entry->deadline = rlx_monotonic_ms() + watcher->debounce_ms;
+	}
+	else {
+		entry->deadline = 0;
+		entry->retries = 0;
+	}
+	return delivered;
+}
+
+static int rlx_watcher_read_events(struct rlx_watcher *watcher)
+{
+	char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	while(true) {
+		ssize_t length = read(watcher->fd, buffer, sizeof(buffer));
+		if(length <= 0)
+			return length < 0 && errno != EAGAIN && errno != EINTR ? RLX_ERR_NO_ENT : RLX_ERR_SUCESS;
+
+		for(char *ptr = buffer; ptr < buffer + length;) {
+			const struct inotify_event *event = (const struct inotify_event*)ptr;
+			ptr += sizeof(*event) + event->len;
+			if(event->len == 0)
+				continue;
+
+			// in wal mode changes reach the write ahead log long before they are checkpointed into the file
+			char name[NAME_MAX+1];
+			bool wal = rlx_is_eis3_wal(event->name);
+			if(!wal && !rlx_is_eis3(event->name))
+				continue;
+			snprintf(name, sizeof(name), "%.*s", (int)strlen(event->name) - (wal ? 4 : 0), event->name);
+
+			if(!wal && event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+				rlx_watcher_forget(watcher, name);
+			}
+			else {
+				int ret = rlx_watcher_touch(watcher, name);
+				if(ret != RLX_ERR_SUCESS)
+					return ret;
+			}
+		}
+	}
+}
+
+static int rlx_watcher_scan(struct rlx_watcher *watcher)
+{
+	DIR *dir = opendir(watcher->directory);
+	if(!dir)
+		return RLX_ERR_NO_ENT;
+	struct dirent *ent;
+	int ret = RLX_ERR_SUCESS;
+	while(ret == RLX_ERR_SUCESS && (ent = readdir(dir))) {
+		if(rlx_is_eis3(ent->d_name))
+			ret = rlx_watcher_touch(watcher, ent->d_name);
+	}
+	closedir(dir);
+	return ret;
+}
+
+struct rlx_watcher* rlx_watcher_create(const char* directory, int debounce_ms, bool scan_existing,
+                                       rlx_watch_sink sink, void* userdata, const char** error)
+{
+	struct rlx_watcher *watcher = calloc(1, sizeof(*watcher));
+	if(!watcher) {
+		if(error)
+			*error = rlx_get_errnum_str(RLX_ERR_OOM);
+		return NULL;
+	}
+	watcher->debounce_ms = debounce_ms;
+	watcher->sink = sink;
+	watcher->userdata = userdata;
+	watcher->directory = rlx_strdup(directory);
+	watcher->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(watcher->fd >= 0)
+		watcher->wd = inotify_add_watch(watcher->fd, directory, RLX_WATCH_EVENTS | IN_ONLYDIR);
+
+	int ret = !watcher->directory ? RLX_ERR_OOM : watcher->fd < 0 || watcher->wd < 0 ? RLX_ERR_NO_ENT : RLX_ERR_SUCESS;
+	if(ret == RLX_ERR_SUCESS && scan_existing)
+		ret = rlx_watcher_scan(watcher);
+	if(ret != RLX_ERR_SUCESS) {
+		if(error)
+			*error = ret == RLX_ERR_OOM ? rlx_get_errnum_str(ret) : strerror(errno);
+		rlx_watcher_free(watcher);
+		return NULL;
+	}
+
+	if(error)
+		*error = NULL;
+	return watcher;
+}
+
+int rlx_watcher_get_fd(const struct rlx_watcher* watcher)
+{
+	return watcher->fd;
+}
+
+int rlx_watcher_run(struct rlx_watcher* watcher, int timeout_ms)
+{
+	const int64_t end = timeout_ms >= 0 ? rlx_monotonic_ms() + timeout_ms : INT64_MAX;
+	while(true) {
+		int64_t now = rlx_monotonic_ms();
+		int delivered = 0;
+		for(size_t i = 0; i < watcher->file_count; ++i) {
+			if(watcher->files[i].deadline == 0 || watcher->files[i].deadline > now)
+				continue;
+			int ret = rlx_watcher_ingest(watcher, &watcher->files[i]);
+			if(ret < 0)
+				return ret;
+			delivered += ret;
+		}
+		if(delivered > 0)
+			return delivered;
+
+		now = rlx_monotonic_ms();
+		int64_t wakeup = end;
+		for(size_t i = 0; i < watcher->file_count; ++i) {
+			if(watcher->files[i].deadline != 0 && watcher->files[i].deadline < wakeup)
+				wakeup = watcher->files[i].deadline;
+		}
+		if(wakeup <= now && wakeup == end)
+			return 0;
+
+		struct pollfd pfd = {.fd = watcher->fd, .events = POLLIN};
+		int wait = wakeup == INT64_MAX ? -1 : wakeup - now > INT32_MAX ? INT32_MAX : (int)(wakeup > now ? wakeup - now : 0);
+		if(poll(&pfd, 1, wait) < 0 && errno != EINTR)
+			return RLX_ERR_NO_ENT;
+
+		int ret = rlx_watcher_read_events(watcher);
+		if(ret != RLX_ERR_SUCESS)
+			return ret;
+	}
+}
+
+void rlx_watcher_free(struct rlx_watcher* watcher)
+{
+	if(!watcher)
+		return;
+	if(watcher->fd >= 0)
+		close(watcher->fd);
+	for(size_t i = 0; i < watcher->file_count; ++i) {
+		free(watcher->files[i].name);
+		free(watcher->files[i].prints);
+	}
+	free(watcher->files);
+	free(watcher->directory);
+	free(watcher);
+}
+
+#else
+
+struct rlx_watcher* rlx_watcher_create(const char* directory, int debounce_ms, bool scan_existing,
+                                       rlx_watch_sink sink, void* userdata, const char** error)
+{
+	(void)directory;
+	(void)debounce_ms;
+	(void)scan_existing;
+	(void)sink;
+	(void)userdata;
+	if(error)
+		*error = "Watching directories is not supported on this platform";
+	return NULL;
+}
+
+int rlx_watcher_get_fd(const struct rlx_watcher* watcher)
+{
+	(void)watcher;
+	return -1;
+}
+
+int rlx_watcher_run(struct rlx_watcher* watcher, int timeout_ms)
+{
+	(void)watcher;
+	(void)timeout_ms;
+	return RLX_ERR_NO_ENT;
+}
+
+void rlx_watcher_free(struct rlx_watcher* watcher)
+{
+	(void)watcher;
+}
+
+#endif
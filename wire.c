@@ -0,0 +1,322 @@
+/*
+ * relaxisloader
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * relaxisloader is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * relaxisloader is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "relaxisloader.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * A spectrum on the wire is a single flat buffer, all integers and doubles are little endian and all offsets are
+ * relative to the start of the buffer. It starts with a header of RLX_WIRE_HEADER_SIZE bytes:
+ *
+ * char magic[4] "RLXW", u16 version, u16 header_size, u32 size, u32 flags (bit 0: fitted),
+ * i32 id, i32 project_id, u32 length, u32 metadata_count, u32 param_count, u32 circuit,
+ * u32 datapoints, u32 metadata, u32 params, u32 strings, u32 strings_size, u32 reserved,
+ * f64 freq_lower_limit, f64 freq_upper_limit, i64 date_added, i64 date_fitted
+ *
+ * datapoints, metadata, params and strings are the offsets of the sections that follow, in this order:
+ *
+ * length datapoints of f64 im, f64 re, f64 omega, the same layout as struct rlx_datapoint, 8 byte aligned
+ * metadata_count records of u32 key, u32 str, f64 value, u32 type, u32 reserved
+ * param_count records of i32 p_index, u32 name, u32 flags (bit 0: fixed, bit 1: global), u32 reserved,
+ * f64 value, f64 error, f64 lower_limit, f64 upper_limit
+ * strings_size bytes of NUL terminated strings
+ *
+ * Strings are referenced by their offset into the string section, RLX_WIRE_NULL stands for a NULL string.
+ * As the string section has to end with a NUL byte, checking an offset against strings_size is all that is
+ * needed to know the string is terminated inside the buffer, which keeps validation linear in the amount of
+ * records and independent of the length of the strings and the amount of datapoints. size is rounded up to a
+ * multiple of 8 so that spectra can be sent back to back.
+ *
+ * Readers accept any header_size of at least RLX_WIRE_HEADER_SIZE, so fields can be appended to the header
+ * without changing the version.
+ */
+
+#define RLX_WIRE_VERSION 1
+#define RLX_WIRE_HEADER_SIZE 96
+#define RLX_WIRE_METADATA_SIZE 24
+#define RLX_WIRE_PARAM_SIZE 48
+#define RLX_WIRE_NULL UINT32_MAX
+
+#define RLX_WIRE_FITTED 1
+#define RLX_WIRE_FIXED 1
+#define RLX_WIRE_GLOBAL 2
+
+_Static_assert(sizeof(struct rlx_datapoint) == 3*sizeof(double), "struct rlx_datapoint has to match the wire layout");
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define RLX_WIRE_NATIVE 1
+#else
+#define RLX_WIRE_NATIVE 0
+#endif
+
+static void rlx_wire_put32(unsigned char *buf, uint32_t value)
+{
+	for(int i = 0; i < 4; ++i)
+		buf[i] = value >> 8*i;
+}
+
+static void rlx_wire_put64(unsigned char *buf, uint64_t value)
+{
+	for(int i = 0; i < 8; ++i)
+		buf[i] = value >> 8*i;
+}
+
+static void rlx_wire_put_double(unsigned char *buf, double value)
+{
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	rlx_wire_put64(buf, bits);
+}
+
+static uint32_t rlx_wire_get32(const unsigned char *buf)
+{
+	uint32_t value = 0;
+	for(int i = 0; i < 4; ++i)
+		value |= (uint32_t)buf[i] << 8*i;
+	return value;
+}
+
+static uint64_t rlx_wire_get64(const unsigned char *buf)
+{
+	uint64_t value = 0;
+	for(int i = 0; i < 8; ++i)
+		value |= (uint64_t)buf[i] << 8*i;
+	return value;
+}
+
+static double rlx_wire_get_double(const unsigned char *buf)
+{
+	uint64_t bits = rlx_wire_get64(buf);
+	double value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+static size_t rlx_wire_strsize(const char *str)
+{
+	return str ? strlen(str) + 1 : 0;
+}
+
+/* Copies str into the string section and returns its offset there */
+static uint32_t rlx_wire_put_string(unsigned char *strings, size_t *pos, const char *str)
+{
+	if(!str)
+		return RLX_WIRE_NULL;
+	uint32_t offset = *pos;
+	size_t len = strlen(str) + 1;
+	memcpy(strings + *pos, str, len);
+	*pos += len;
+	return offset;
+}
+
+size_t rlx_wire_serialize(const struct rlx_spectra* spectra, struct rlx_fitparam** params, void* buffer, size_t size)
+{
+	size_t param_count = 0;
+	size_t strings_size = rlx_wire_strsize(spectra->circuit);
+	for(size_t i = 0; i < spectra->metadata_count; ++i)
+		strings_size += rlx_wire_strsize(spectra->metadata[i].key) + rlx_wire_strsize(spectra->metadata[i].str);
+	for(; params && params[param_count]; ++param_count)
+		strings_size += rlx_wire_strsize(params[param_count]->name);
+
+	size_t datapoints = RLX_WIRE_HEADER_SIZE;
+	size_t metadata = datapoints + spectra->length*sizeof(struct rlx_datapoint);
+	size_t params_offset = metadata + spectra->metadata_count*RLX_WIRE_METADATA_SIZE;
+	size_t strings = params_offset + param_count*RLX_WIRE_PARAM_SIZE;
+	size_t required = (strings + strings_size + 7) & ~(size_t)7;
+	if(required >= RLX_WIRE_NULL)
+		return 0;
+	if(!buffer || size < required)
+		return required;
+
+	unsigned char *buf = buffer;
+	memset(buf, 0, RLX_WIRE_HEADER_SIZE);
+	memcpy(buf, "RLXW", 4);
+	buf[4] = RLX_WIRE_VERSION;
+	buf[6] = RLX_WIRE_HEADER_SIZE;
+	rlx_wire_put32(buf + 8, required);
+	rlx_wire_put32(buf + 12, spectra->fitted ? RLX_WIRE_FITTED : 0);
+	rlx_wire_put32(buf + 16, spectra->id);
+	rlx_wire_put32(buf + 20, spectra->project_id);
+	rlx_wire_put32(buf + 24, spectra->length);
+	rlx_wire_put32(buf + 28, spectra->metadata_count);
+	rlx_wire_put32(buf + 32, param_count);
+	rlx_wire_put32(buf + 40, datapoints);
+	rlx_wire_put32(buf + 44, metadata);
+	rlx_wire_put32(buf + 48, params_offset);
+	rlx_wire_put32(buf + 52, strings);
+	rlx_wire_put32(buf + 56, strings_size);
+	rlx_wire_put_double(buf + 64, spectra->freq_lower_limit);
+	rlx_wire_put_double(buf + 72, spectra->freq_upper_limit);
+	rlx_wire_put64(buf + 80, spectra->date_added);
+	rlx_wire_put64(buf + 88, spectra->date_fitted);
+
+	if(RLX_WIRE_NATIVE) {
+		if(spectra->length)
+			memcpy(buf + datapoints, spectra->datapoints, spectra->length*sizeof(struct rlx_datapoint));
+	} else {
+		for(size_t i = 0; i < spectra->length; ++i) {
+			unsigned char *dp = buf + datapoints + i*sizeof(struct rlx_datapoint);
+			rlx_wire_put_double(dp, spectra->datapoints[i].im);
+			rlx_wire_put_double(dp + 8, spectra->datapoints[i].re);
+			rlx_wire_put_double(dp + 16, spectra->datapoints[i].omega);
+		}
+	}
+
+	size_t pos = 0;
+	rlx_wire_put32(buf + 36, rlx_wire_put_string(buf + strings, &pos, spectra->circuit));
+
+	for(size_t i = 0; i < spectra->metadata_count; ++i) {
+		const struct rlx_metadata *entry = &spectra->metadata[i];
+		unsigned char *record = buf + metadata + i*RLX_WIRE_METADATA_SIZE;
+		rlx_wire_put32(record, rlx_wire_put_string(buf + strings, &pos, entry->key));
+		rlx_wire_put32(record + 4, rlx_wire_put_string(buf + strings, &pos, entry->str));
+		rlx_wire_put_double(record + 8, entry->value);
+		rlx_wire_put32(record + 16, entry->type);
+		rlx_wire_put32(record + 20, 0);
+	}
+
+	for(size_t i = 0; i < param_count; ++i) {
+		const struct rlx_fitparam *param = params[i];
+		unsigned char *record = buf + params_offset + i*RLX_WIRE_PARAM_SIZE;
+		rlx_wire_put32(record, param->p_index);
+		rlx_wire_put32(record + 4, rlx_wire_put_string(buf + strings, &pos, param->name));
+		rlx_wire_put32(record + 8, (param->fixed ? RLX_WIRE_FIXED : 0) | (param->global ? RLX_WIRE_GLOBAL : 0));
+		rlx_wire_put32(record + 12, 0);
+		rlx_wire_put_double(record + 16, param->value);
+		rlx_wire_put_double(record + 24, param->error);
+		rlx_wire_put_double(record + 32, param->lower_limit);
+		rlx_wire_put_double(record + 40, param->upper_limit);
+	}
+
+	memset(buf + strings + strings_size, 0, required - strings - strings_size);
+	return required;
+}
+
+/* Checks that count records of record_size bytes starting at offset lie inside the buffer after the header */
+static bool rlx_wire_section_valid(uint32_t offset, uint32_t count, size_t record_size, uint32_t header_size,
+                                   uint32_t size)
+{
+	return offset >= header_size && offset <= size && (uint64_t)count*record_size <= size - offset;
+}
+
+static bool rlx_wire_string_valid(uint32_t offset, uint32_t strings_size)
+{
+	return offset == RLX_WIRE_NULL || offset < strings_size;
+}
+
+static const char* rlx_wire_string(const struct rlx_wire_view* view, uint32_t offset)
+{
+	return offset == RLX_WIRE_NULL ? NULL : view->strings + offset;
+}
+
+int rlx_wire_view(const void* buffer, size_t size, struct rlx_wire_view* view)
+{
+	const unsigned char *buf = buffer;
+
+	// datapoints are handed out in place, which requires the host to share the byte order and alignment of the wire
+	if(!RLX_WIRE_NATIVE || ((uintptr_t)buf & (_Alignof(struct rlx_datapoint) - 1)))
+		return RLX_ERR_WIRE;
+
+	if(size < RLX_WIRE_HEADER_SIZE || memcmp(buf, "RLXW", 4) != 0)
+		return RLX_ERR_WIRE;
+	uint32_t version = buf[4] | buf[5] << 8;
+	uint32_t header_size = buf[6] | buf[7] << 8;
+	uint32_t wire_size = rlx_wire_get32(buf + 8);
+	if(version != RLX_WIRE_VERSION || header_size < RLX_WIRE_HEADER_SIZE || wire_size > size || wire_size < header_size)
+		return RLX_ERR_WIRE;
+
+	uint32_t length = rlx_wire_get32(buf + 24);
+	uint32_t metadata_count = rlx_wire_get32(buf + 28);
+	uint32_t param_count = rlx_wire_get32(buf + 32);
+	uint32_t circuit = rlx_wire_get32(buf + 36);
+	uint32_t datapoints = rlx_wire_get32(buf + 40);
+	uint32_t metadata = rlx_wire_get32(buf + 44);
+	uint32_t params = rlx_wire_get32(buf + 48);
+	uint32_t strings = rlx_wire_get32(buf + 52);
+	uint32_t strings_size = rlx_wire_get32(buf + 56);
+
+	if(datapoints % _Alignof(struct rlx_datapoint) != 0 ||
+	   !rlx_wire_section_valid(datapoints, length, sizeof(struct rlx_datapoint), header_size, wire_size) ||
+	   !rlx_wire_section_valid(metadata, metadata_count, RLX_WIRE_METADATA_SIZE, header_size, wire_size) ||
+	   !rlx_wire_section_valid(params, param_count, RLX_WIRE_PARAM_SIZE, header_size, wire_size) ||
+	   !rlx_wire_section_valid(strings, strings_size, 1, header_size, wire_size) ||
+	   (strings_size > 0 && buf[strings + strings_size - 1] != '\0') ||
+	   !rlx_wire_string_valid(circuit, strings_size))
+		return RLX_ERR_WIRE;
+
+	for(uint32_t i = 0; i < metadata_count; ++i) {
+		const unsigned char *record = buf + metadata + (size_t)i*RLX_WIRE_METADATA_SIZE;
+		uint32_t type = rlx_wire_get32(record + 16);
+		if(!rlx_wire_string_valid(rlx_wire_get32(record), strings_size) ||
+		   !rlx_wire_string_valid(rlx_wire_get32(record + 4), strings_size) ||
+		   (type != RLX_FIELD_TYPE_STR && type != RLX_FIELD_TYPE_DOUBLE))
+			return RLX_ERR_WIRE;
+	}
+
+	for(uint32_t i = 0; i < param_count; ++i) {
+		const unsigned char *record = buf + params + (size_t)i*RLX_WIRE_PARAM_SIZE;
+		if(!rlx_wire_string_valid(rlx_wire_get32(record + 4), strings_size))
+			return RLX_ERR_WIRE;
+	}
+
+	uint32_t flags = rlx_wire_get32(buf + 12);
+	view->id = (int32_t)rlx_wire_get32(buf + 16);
+	view->project_id = (int32_t)rlx_wire_get32(buf + 20);
+	view->fitted = flags & RLX_WIRE_FITTED;
+	view->freq_lower_limit = rlx_wire_get_double(buf + 64);
+	view->freq_upper_limit = rlx_wire_get_double(buf + 72);
+	view->date_added = (int64_t)rlx_wire_get64(buf + 80);
+	view->date_fitted = (int64_t)rlx_wire_get64(buf + 88);
+	view->datapoints = (const struct rlx_datapoint*)(buf + datapoints);
+	view->length = length;
+	view->metadata_count = metadata_count;
+	view->param_count = param_count;
+	view->size = wire_size;
+	view->metadata = buf + metadata;
+	view->params = buf + params;
+	view->strings = (const char*)buf + strings;
+	view->circuit = rlx_wire_string(view, circuit);
+	return RLX_ERR_SUCESS;
+}
+
+void rlx_wire_view_metadata(const struct rlx_wire_view* view, size_t index, struct rlx_metadata* metadata)
+{
+	const unsigned char *record = view->metadata + index*RLX_WIRE_METADATA_SIZE;
+	metadata->key = (char*)rlx_wire_string(view, rlx_wire_get32(record));
+	metadata->str = (char*)rlx_wire_string(view, rlx_wire_get32(record + 4));
+	metadata->value = rlx_wire_get_double(record + 8);
+	metadata->type = rlx_wire_get32(record + 16);
+}
+
+void rlx_wire_view_fitparam(const struct rlx_wire_view* view, size_t index, struct rlx_fitparam* param)
+{
+	const unsigned char *record = view->params + index*RLX_WIRE_PARAM_SIZE;
+	uint32_t flags = rlx_wire_get32(record + 8);
+	param->spectra_id = view->id;
+	param->p_index = (int32_t)rlx_wire_get32(record);
+	param->name = (char*)rlx_wire_string(view, rlx_wire_get32(record + 4));
+	param->value = rlx_wire_get_double(record + 16);
+	param->error = rlx_wire_get_double(record + 24);
+	param->lower_limit = rlx_wire_get_double(record + 32);
+	param->upper_limit = rlx_wire_get_double(record + 40);
+	param->fixed = flags & RLX_WIRE_FIXED;
+	param->global = flags & RLX_WIRE_GLOBAL;
+}
@@ -0,0 +1,533 @@
+/*
+ * relaxisloader
+ * Copyright (C) Carl Philipp Klemm 2023 <carl@uvos.xyz>
+ *
+ * relaxisloader is free software: you can redistribute it and/or modify it
+ * under the terms of the lesser GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * relaxisloader is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the lesser GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "vfs.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RLX_ZSTD_FRAME_MAGIC 0xFD2FB528u
+
+static uint32_t rlx_read_le32(const unsigned char *data)
+{
+	return data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+bool rlx_vfs_is_zstd(const char* path)
+{
+	FILE *fp = fopen(path, "rb");
+	if(!fp)
+		return false;
+	unsigned char magic[4];
+	bool ret = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) && rlx_read_le32(magic) == RLX_ZSTD_FRAME_MAGIC;
+	fclose(fp);
+	return ret;
+}
+
+#ifdef RLX_HAVE_ZSTD
+
+#include <sqlite3.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <zstd.h>
+
+#include "utils.h"
+
+/*
+ * Serves reads of the main database from a file in the zstd seekable format, ie. a series of independent
+ * zstd frames followed by a skippable frame holding the compressed and decompressed size of every frame.
+ * Only the frames containing requested pages are decompressed and kept in a small lru cache. When sqlite reads
+ * the frames in order, as it does for table scans, the following frames are read in one go and decompressed
+ * in parallel. All other files sqlite opens, like temporary files, are passed to the default vfs.
+ */
+
+#define RLX_ZSTD_VFS_NAME "rlx-zstd"
+#define RLX_ZSTD_SKIPPABLE_MAGIC 0x184D2A5Eu
+#define RLX_ZSTD_SEEKABLE_MAGIC 0x8F92EAB1u
+#define RLX_ZSTD_SKIPPABLE_HEADER_SIZE 8
+#define RLX_ZSTD_FOOTER_SIZE 9
+#define RLX_ZSTD_CACHE_FRAMES 16
+
+struct rlx_zstd_slot
+{
+	size_t frame;
+	bool valid;
+	uint64_t last_use;
+	unsigned char *data;
+};
+
+struct rlx_zstd_file
+{
+	sqlite3_file base;
+	sqlite3_file *real;
+
+	size_t frame_count;
+	uint64_t *comp_offset;
+	uint64_t *decomp_offset;
+	size_t max_frame_size;
+
+	struct rlx_zstd_slot slots[RLX_ZSTD_CACHE_FRAMES];
+	uint64_t clock;
+	size_t next_frame;
+
+	int threads;
+	ZSTD_DCtx **dctx;
+	unsigned char *comp_buffer;
+	size_t comp_buffer_size;
+};
+
+struct rlx_zstd_batch
+{
+	struct rlx_zstd_file *file;
+	size_t first;
+	size_t *frames;
+	struct rlx_zstd_slot **slots;
+	atomic_bool failed;
+};
+
+static sqlite3_vfs *base_vfs;
+static sqlite3_vfs zstd_vfs;
+static pthread_once_t zstd_vfs_once = PTHREAD_ONCE_INIT;
+static bool zstd_vfs_registered;
+
+static void rlx_zstd_free_members(struct rlx_zstd_file *zf)
+{
+	for(size_t i = 0; i < RLX_ZSTD_CACHE_FRAMES; ++i)
+		free(zf->slots[i].data);
+	if(zf->dctx) {
+		for(int i = 0; i < zf->threads; ++i)
+			ZSTD_freeDCtx(zf->dctx[i]);
+		free(zf->dctx);
+	}
+	free(zf->comp_offset);
+	free(zf->decomp_offset);
+	free(zf->comp_buffer);
+}
+
+static int rlx_zstd_close(sqlite3_file *file)
+{
+	struct rlx_zstd_file *zf = (struct rlx_zstd_file*)file;
+	int ret = zf->real->pMethods->xClose(zf->real);
+	rlx_zstd_free_members(zf);
+	return ret;
+}
+
+static void rlx_zstd_decompress_worker(size_t index, int thread, void *userdata)
+{
+	struct rlx_zstd_batch *batch = userdata;
+	struct rlx_zstd_file *zf = batch->file;
+	size_t frame = batch->frames[index];
+	size_t size = zf->decomp_offset[frame+1] - zf->decomp_offset[frame];
+	const unsigned char *src = zf->comp_buffer + (zf->comp_offset[frame] - zf->comp_offset[batch->first]);
+	size_t ret = ZSTD_decompressDCtx(zf->dctx[thread], batch->slots[index]->data, size, src,
+	                                 zf->comp_offset[frame+1] - zf->comp_offset[frame]);
+	if(ZSTD_isError(ret) || ret != size)
+		atomic_store(&batch->failed, true);
+}
+
+static struct rlx_zstd_slot *rlx_zstd_lru_slot(struct rlx_zstd_file *zf)
+{
+	struct rlx_zstd_slot *slot = &zf->slots[0];
+	for(size_t i = 1; i < RLX_ZSTD_CACHE_FRAMES; ++i) {
+		if(zf->slots[i].last_use < slot->last_use)
+			slot = &zf->slots[i];
+	}
+	return slot;
+}
+
+static struct rlx_zstd_slot *rlx_zstd_cached(struct rlx_zstd_file *zf, size_t frame)
+{
+	for(size_t i = 0; i < RLX_ZSTD_CACHE_FRAMES; ++i) {
+		if(zf->slots[i].valid && zf->slots[i].frame == frame)
+			return &zf->slots[i];
+	}
+	return NULL;
+}
+
+/* Loads frames [first, first+count) that are not already cached, the compressed data is read with a single read */
+static int rlx_zstd_load(struct rlx_zstd_file *zf, size_t first, size_t count)
+{
+	size_t frames[RLX_ZSTD_CACHE_FRAMES];
+	struct rlx_zstd_slot *slots[RLX_ZSTD_CACHE_FRAMES];
+	size_t loadCount = 0;
+	size_t last = first;
+	for(size_t frame = first; frame < first + count; ++frame) {
+		if(rlx_zstd_cached(zf, frame))
+			continue;
+		frames[loadCount] = frame;
+		slots[loadCount] = rlx_zstd_lru_slot(zf);
+		slots[loadCount]->valid = false;
+		slots[loadCount]->last_use = ++zf->clock;
+		++loadCount;
+		last = frame;
+	}
+	if(loadCount == 0)
+		return SQLITE_OK;
+
+	first = frames[0];
+	uint64_t compSize = zf->comp_offset[last+1] - zf->comp_offset[first];
+	if(compSize > zf->comp_buffer_size) {
+		unsigned char *buffer = realloc(zf->comp_buffer, compSize);
+		if(!buffer)
+			return SQLITE_IOERR_NOMEM;
+		zf->comp_buffer = buffer;
+		zf->comp_buffer_size = compSize;
+	}
+	int ret = zf->real->pMethods->xRead(zf->real, zf->comp_buffer, compSize, zf->comp_offset[first]);
+	if(ret != SQLITE_OK)
+		return SQLITE_IOERR_READ;
+
+	struct rlx_zstd_batch batch = {.file = zf, .first = first, .frames = frames, .slots = slots};
+	atomic_init(&batch.failed, false);
+	if(loadCount == 1)
+		rlx_zstd_decompress_worker(0, 0, &batch);
+	else if(rlx_parallel_for(loadCount, zf->threads, rlx_zstd_decompress_worker, &batch) != 0)
+		return SQLITE_IOERR_NOMEM;
+	if(atomic_load(&batch.failed))
+		return SQLITE_CORRUPT;
+
+	for(size_t i = 0; i < loadCount; ++i) {
+		slots[i]->frame = frames[i];
+		slots[i]->valid = true;
+	}
+	return SQLITE_OK;
+}
+
+static const unsigned char *rlx_zstd_get_frame(struct rlx_zstd_file *zf, size_t frame, int *error)
+{
+	struct rlx_zstd_slot *slot = rlx_zstd_cached(zf, frame);
+	if(!slot) {
+		size_t count = 1;
+		if(frame == zf->next_frame) {
+			count = zf->threads*2;
+			if(count > RLX_ZSTD_CACHE_FRAMES/2)
+				count = RLX_ZSTD_CACHE_FRAMES/2;
+			if(count > zf->frame_count - frame)
+				count = zf->frame_count - frame;
+		}
+		*error = rlx_zstd_load(zf, frame, count);
+		if(*error != SQLITE_OK)
+			return NULL;
+		slot = rlx_zstd_cached(zf, frame);
+	}
+	slot->last_use = ++zf->clock;
+	zf->next_frame = frame + 1;
+	return slot->data;
+}
+
+static size_t rlx_zstd_find_frame(const struct rlx_zstd_file *zf, uint64_t offset)
+{
+	size_t low = 0;
+	size_t high = zf->frame_count;
+	while(high - low > 1) {
+		size_t mid = low + (high - low)/2;
+		if(zf->decomp_offset[mid] <= offset)
+			low = mid;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+static int rlx_zstd_read(sqlite3_file *file, void *buffer, int amount, sqlite3_int64 offset)
+{
+	struct rlx_zstd_file *zf = (struct rlx_zstd_file*)file;
+	unsigned char *out = buffer;
+	const uint64_t total = zf->decomp_offset[zf->frame_count];
+
+	while(amount > 0) {
+		if((uint64_t)offset >= total) {
+			memset(out, 0, amount);
+			return SQLITE_IOERR_SHORT_READ;
+		}
+
+		size_t frame = rlx_zstd_find_frame(zf, offset);
+		int error;
+		const unsigned char *data = rlx_zstd_get_frame(zf, frame, &error);
+		if(!data)
+			return error;
+
+		uint64_t inFrame = offset - zf->decomp_offset[frame];
+		uint64_t available = zf->decomp_offset[frame+1] - offset;
+		size_t chunk = (uint64_t)amount < available ? (size_t)amount : (size_t)available;
+		memcpy(out, data + inFrame, chunk);
+		out += chunk;
+		offset += chunk;
+		amount -= chunk;
+	}
+	return SQLITE_OK;
+}
+
+static int rlx_zstd_write(sqlite3_file *file, const void *buffer, int amount, sqlite3_int64 offset)
+{
+	(void)file;
+	(void)buffer;
+	(void)amount;
+	(void)offset;
+	return SQLITE_READONLY;
+}
+
+static int rlx_zstd_truncate(sqlite3_file *file, sqlite3_int64 size)
+{
+	(void)file;
+	(void)size;
+	return SQLITE_READONLY;
+}
+
+static int rlx_zstd_sync(sqlite3_file *file, int flags)
+{
+	(void)file;
+	(void)flags;
+	return SQLITE_OK;
+}
+
+static int rlx_zstd_file_size(sqlite3_file *file, sqlite3_int64 *size)
+{
+	struct rlx_zstd_file *zf = (struct rlx_zstd_file*)file;
+	*size = zf->decomp_offset[zf->frame_count];
+	return SQLITE_OK;
+}
+
+static int rlx_zstd_lock(sqlite3_file *file, int lock)
+{
+	(void)file;
+	(void)lock;
+	return SQLITE_OK;
+}
+
+static int rlx_zstd_check_reserved_lock(sqlite3_file *file, int *out)
+{
+	(void)file;
+	*out = 0;
+	return SQLITE_OK;
+}
+
+static int rlx_zstd_file_control(sqlite3_file *file, int op, void *arg)
+{
+	(void)file;
+	(void)op;
+	(void)arg;
+	return SQLITE_NOTFOUND;
+}
+
+static int rlx_zstd_sector_size(sqlite3_file *file)
+{
+	(void)file;
+	return 4096;
+}
+
+static int rlx_zstd_device_characteristics(sqlite3_file *file)
+{
+	(void)file;
+	return SQLITE_IOCAP_IMMUTABLE;
+}
+
+static const sqlite3_io_methods zstd_io_methods = {
+	.iVersion = 1,
+	.xClose = rlx_zstd_close,
+	.xRead = rlx_zstd_read,
+	.xWrite = rlx_zstd_write,
+	.xTruncate = rlx_zstd_truncate,
+	.xSync = rlx_zstd_sync,
+	.xFileSize = rlx_zstd_file_size,
+	.xLock = rlx_zstd_lock,
+	.xUnlock = rlx_zstd_lock,
+	.xCheckReservedLock = rlx_zstd_check_reserved_lock,
+	.xFileControl = rlx_zstd_file_control,
+	.xSectorSize = rlx_zstd_sector_size,
+	.xDeviceCharacteristics = rlx_zstd_device_characteristics,
+};
+
+static int rlx_zstd_read_seek_table(struct rlx_zstd_file *zf)
+{
+	sqlite3_int64 fileSize;
+	int ret = zf->real->pMethods->xFileSize(zf->real, &fileSize);
+	if(ret != SQLITE_OK)
+		return ret;
+	if(fileSize < RLX_ZSTD_SKIPPABLE_HEADER_SIZE + RLX_ZSTD_FOOTER_SIZE)
+		return SQLITE_NOTADB;
+
+	unsigned char footer[RLX_ZSTD_FOOTER_SIZE];
+	ret = zf->real->pMethods->xRead(zf->real, footer, sizeof(footer), fileSize - RLX_ZSTD_FOOTER_SIZE);
+	if(ret != SQLITE_OK)
+		return ret;
+	if(rlx_read_le32(footer + 5) != RLX_ZSTD_SEEKABLE_MAGIC || (footer[4] & 0x7C) != 0)
+		return SQLITE_NOTADB;
+
+	zf->frame_count = rlx_read_le32(footer);
+	const size_t entrySize = footer[4] & 0x80 ? 12 : 8;
+	const uint64_t tableSize = zf->frame_count*entrySize;
+	if(zf->frame_count == 0 || tableSize + RLX_ZSTD_SKIPPABLE_HEADER_SIZE + RLX_ZSTD_FOOTER_SIZE > (uint64_t)fileSize)
+		return SQLITE_NOTADB;
+
+	const uint64_t tableStart = fileSize - RLX_ZSTD_FOOTER_SIZE - tableSize - RLX_ZSTD_SKIPPABLE_HEADER_SIZE;
+	unsigned char *table = malloc(tableSize + RLX_ZSTD_SKIPPABLE_HEADER_SIZE);
+	zf->comp_offset = malloc(sizeof(*zf->comp_offset)*(zf->frame_count+1));
+	zf->decomp_offset = malloc(sizeof(*zf->decomp_offset)*(zf->frame_count+1));
+	if(!table || !zf->comp_offset || !zf->decomp_offset) {
+		free(table);
+		return SQLITE_NOMEM;
+	}
+
+	ret = zf->real->pMethods->xRead(zf->real, table, tableSize + RLX_ZSTD_SKIPPABLE_HEADER_SIZE, tableStart);
+	if(ret == SQLITE_OK && (rlx_read_le32(table) != RLX_ZSTD_SKIPPABLE_MAGIC ||
+	   rlx_read_le32(table + 4) != tableSize + RLX_ZSTD_FOOTER_SIZE))
+		ret = SQLITE_NOTADB;
+
+	zf->comp_offset[0] = 0;
+	zf->decomp_offset[0] = 0;
+	for(size_t i = 0; i < zf->frame_count && ret == SQLITE_OK; ++i) {
+		const unsigned char *entry = table + RLX_ZSTD_SKIPPABLE_HEADER_SIZE + i*entrySize;
+		size_t decompSize = rlx_read_le32(entry + 4);
+		zf->comp_offset[i+1] = zf->comp_offset[i] + rlx_read_le32(entry);
+		zf->decomp_offset[i+1] = zf->decomp_offset[i] + decompSize;
+		if(decompSize > zf->max_frame_size)
+			zf->max_frame_size = decompSize;
+	}
+	free(table);
+
+	if(ret == SQLITE_OK && zf->comp_offset[zf->frame_count] > tableStart)
+		ret = SQLITE_NOTADB;
+	return ret;
+}
+
+static int rlx_zstd_open(sqlite3_vfs *vfs, const char *name, sqlite3_file *file, int flags, int *outFlags)
+{
+	(void)vfs;
+	if(!(flags & SQLITE_OPEN_MAIN_DB))
+		return base_vfs->xOpen(base_vfs, name, file, flags, outFlags);
+
+	if(flags & (SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE))
+		return SQLITE_READONLY;
+
+	struct rlx_zstd_file *zf = (struct rlx_zstd_file*)file;
+	memset(zf, 0, sizeof(*zf));
+	zf->real = (sqlite3_file*)(zf + 1);
+	int ret = base_vfs->xOpen(base_vfs, name, zf->real, flags, outFlags);
+	if(ret != SQLITE_OK)
+		return ret;
+
+	ret = rlx_zstd_read_seek_table(zf);
+	if(ret == SQLITE_OK) {
+		zf->threads = rlx_thread_count(0);
+		zf->dctx = calloc(zf->threads, sizeof(*zf->dctx));
+		if(!zf->dctx)
+			ret = SQLITE_NOMEM;
+		for(int i = 0; i < zf->threads && ret == SQLITE_OK; ++i) {
+			zf->dctx[i] = ZSTD_createDCtx();
+			if(!zf->dctx[i])
+				ret = SQLITE_NOMEM;
+		}
+		for(size_t i = 0; i < RLX_ZSTD_CACHE_FRAMES && ret == SQLITE_OK; ++i) {
+			zf->slots[i].data = malloc(zf->max_frame_size);
+			if(!zf->slots[i].data)
+				ret = SQLITE_NOMEM;
+		}
+	}
+
+	if(ret != SQLITE_OK) {
+		zf->real->pMethods->xClose(zf->real);
+		rlx_zstd_free_members(zf);
+		zf->base.pMethods = NULL;
+		return ret;
+	}
+
+	zf->next_frame = SIZE_MAX;
+	zf->base.pMethods = &zstd_io_methods;
+	return SQLITE_OK;
+}
+
+static int rlx_zstd_delete(sqlite3_vfs *vfs, const char *name, int syncDir)
+{
+	(void)vfs;
+	return base_vfs->xDelete(base_vfs, name, syncDir);
+}
+
+static int rlx_zstd_access(sqlite3_vfs *vfs, const char *name, int flags, int *out)
+{
+	(void)vfs;
+	return base_vfs->xAccess(base_vfs, name, flags, out);
+}
+
+static int rlx_zstd_full_pathname(sqlite3_vfs *vfs, const char *name, int size, char *out)
+{
+	(void)vfs;
+	return base_vfs->xFullPathname(base_vfs, name, size, out);
+}
+
+static int rlx_zstd_randomness(sqlite3_vfs *vfs, int size, char *out)
+{
+	(void)vfs;
+	return base_vfs->xRandomness(base_vfs, size, out);
+}
+
+static int rlx_zstd_sleep(sqlite3_vfs *vfs, int microseconds)
+{
+	(void)vfs;
+	return base_vfs->xSleep(base_vfs, microseconds);
+}
+
+static int rlx_zstd_current_time(sqlite3_vfs *vfs, double *out)
+{
+	(void)vfs;
+	return base_vfs->xCurrentTime(base_vfs, out);
+}
+
+static int rlx_zstd_get_last_error(sqlite3_vfs *vfs, int size, char *out)
+{
+	(void)vfs;
+	return base_vfs->xGetLastError ? base_vfs->xGetLastError(base_vfs, size, out) : 0;
+}
+
+static void rlx_zstd_register(void)
+{
+	base_vfs = sqlite3_vfs_find(NULL);
+	if(!base_vfs)
+		return;
+
+	zstd_vfs.iVersion = 1;
+	zstd_vfs.szOsFile = sizeof(struct rlx_zstd_file) + base_vfs->szOsFile;
+	zstd_vfs.mxPathname = base_vfs->mxPathname;
+	zstd_vfs.zName = RLX_ZSTD_VFS_NAME;
+	zstd_vfs.xOpen = rlx_zstd_open;
+	zstd_vfs.xDelete = rlx_zstd_delete;
+	zstd_vfs.xAccess = rlx_zstd_access;
+	zstd_vfs.xFullPathname = rlx_zstd_full_pathname;
+	zstd_vfs.xRandomness = rlx_zstd_randomness;
+	zstd_vfs.xSleep = rlx_zstd_sleep;
+	zstd_vfs.xCurrentTime = rlx_zstd_current_time;
+	zstd_vfs.xGetLastError = rlx_zstd_get_last_error;
+	zstd_vfs_registered = sqlite3_vfs_register(&zstd_vfs, 0) == SQLITE_OK;
+}
+
+const char* rlx_vfs_zstd(void)
+{
+	pthread_once(&zstd_vfs_once, rlx_zstd_register);
+	return zstd_vfs_registered ? RLX_ZSTD_VFS_NAME : NULL;
+}
+
+#else
+
+const char* rlx_vfs_zstd(void)
+{
+	return NULL;
+}
+
+#endif